@@ -21,12 +21,12 @@ static uint64_t ensure_sessions_dir(struct kvbfs_ctx *ctx)
 
     char *val = NULL;
     size_t vlen = 0;
-    if (kv_get(ctx->db, key, keylen, &val, &vlen) == 0 && vlen == sizeof(uint64_t)) {
-        uint64_t ino;
-        memcpy(&ino, val, sizeof(uint64_t));
+    struct kvbfs_dirent de;
+    if (kv_get(ctx->db, key, keylen, &val, &vlen) == 0 &&
+        kvbfs_dirent_decode(val, vlen, &de) == 0) {
         free(val);
-        printf("CFS: found /sessions (ino=%lu)\n", (unsigned long)ino);
-        return ino;
+        printf("CFS: found /sessions (ino=%lu)\n", (unsigned long)de.ino);
+        return de.ino;
     }
     if (val) free(val);
 
@@ -45,8 +45,19 @@ static uint64_t ensure_sessions_dir(struct kvbfs_ctx *ctx)
     uint64_t ino = ic->inode.ino;
     inode_put(ic);
 
-    /* 添加目录项 */
-    if (kv_put(ctx->db, key, keylen, (const char *)&ino, sizeof(uint64_t)) != 0) {
+    /* 添加目录项及其反向索引 */
+    kv_batch_t *batch = kv_batch_new();
+    int ret = -1;
+    if (batch) {
+        de = (struct kvbfs_dirent){ .ino = ino, .type = S_IFDIR };
+        kv_batch_put(batch, key, keylen, (const char *)&de, sizeof(de));
+        path_link_batch(batch, ino, KVBFS_ROOT_INO, name);
+        struct kvbfs_usage cu = { 0, 1, 0 };
+        usage_link_batch(&ctx->usage, batch, ctx->db, KVBFS_ROOT_INO, &cu);
+        ret = kv_batch_commit(ctx->db, batch);
+        kv_batch_free(batch);
+    }
+    if (ret != 0) {
         fprintf(stderr, "CFS: failed to add /sessions dirent\n");
         inode_delete(ino);
         return 0;
@@ -84,11 +95,10 @@ struct kvbfs_ctx *ctx_init(const char *db_path)
     }
 
     /* 初始化锁 */
-    pthread_mutex_init(&ctx->icache_lock, NULL);
     pthread_mutex_init(&ctx->alloc_lock, NULL);
 
     /* inode 缓存初始化为空 */
-    ctx->icache = NULL;
+    inode_cache_init(ctx);
 
     vtree_init(&ctx->vtree);
 
@@ -100,6 +110,32 @@ struct kvbfs_ctx *ctx_init(const char *db_path)
         return NULL;
     }
 
+    /* 旧数据库首次挂载时补建 p: 反向索引 */
+    if (path_init(&ctx->paths, ctx->db) != 0)
+        fprintf(stderr, "Warning: failed to build path index\n");
+    dcache_init(&ctx->dcache);
+    warmup_init(&ctx->warmup);
+
+    /* 首次挂载时统计目录用量 */
+    if (usage_init(&ctx->usage, ctx->db) != 0)
+        fprintf(stderr, "Warning: failed to build usage counters\n");
+    ctx->db_path = strdup(db_path);
+
+    /* 加载文件系统快照，清理未完成的检查点 */
+    if (fssnap_init(&ctx->snaps, ctx->db, db_path) != 0)
+        fprintf(stderr, "Warning: failed to load snapshots\n");
+
+    /* 旧数据库中逐个存储的 xattr 合并为打包记录 */
+    if (xattr_migrate(ctx->db) != 0)
+        fprintf(stderr, "Warning: failed to pack xattrs\n");
+
+    /* 加载未完成的回收任务，工作线程在 FUSE init 时启动 */
+    gc_init(&ctx->gc, ctx->db);
+
+    /* I/O 执行线程与快照线程在 FUSE init 时启动 */
+    iopool_init(&ctx->iopool);
+    snapq_init(&ctx->snapq);
+
     return ctx;
 }
 
@@ -125,9 +161,9 @@ int ctx_init_llm(struct kvbfs_ctx *ctx, const struct llm_config *config)
     while (kv_iter_valid(iter)) {
         size_t vlen;
         const char *val = kv_iter_value(iter, &vlen);
-        if (vlen == sizeof(uint64_t)) {
-            uint64_t child_ino;
-            memcpy(&child_ino, val, sizeof(uint64_t));
+        struct kvbfs_dirent de;
+        if (kvbfs_dirent_decode(val, vlen, &de) == 0) {
+            uint64_t child_ino = de.ino;
 
             struct session_ino_entry *entry = malloc(sizeof(*entry));
             if (entry) {
@@ -181,25 +217,38 @@ void ctx_destroy(struct kvbfs_ctx *ctx)
     }
 #endif
 
+    iopool_destroy(&ctx->iopool);
+    snapq_destroy(&ctx->snapq);
+    warmup_stop(&ctx->warmup);
     vtree_destroy(&ctx->vtree);
+    gc_destroy(&ctx->gc);
+    path_destroy(&ctx->paths);
+    dcache_destroy(&ctx->dcache);
 
-    /* 同步所有脏 inode */
+    /* 停止后台写回，再同步所有脏 inode */
+    inode_flusher_stop();
     inode_sync_all();
 
-    /* 释放 inode 缓存 */
+    /* 释放 inode 缓存；写回已完成，不再计入用量 */
     inode_cache_clear();
+    usage_destroy(&ctx->usage);
 
-    /* 保存超级块 */
+    /* 保存超级块；正常卸载时收回未领取的预留号段 */
+    ctx->super.next_ino = ctx->ino_next;
     super_save(ctx);
 
+    /* 快照的只读检查点先于主库关闭 */
+    fssnap_destroy(&ctx->snaps);
+
     /* 关闭 KV 存储 */
     if (ctx->db) {
         kv_close(ctx->db);
     }
 
     /* 销毁锁 */
-    pthread_mutex_destroy(&ctx->icache_lock);
+    inode_cache_destroy(ctx);
     pthread_mutex_destroy(&ctx->alloc_lock);
 
+    free(ctx->db_path);
     free(ctx);
 }
@@ -0,0 +1,246 @@
+#include "dcache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define DCACHE_KEY_MAX  (sizeof(uint64_t) + 256)
+
+/* Build the binary key; returns 0 when the name is too long to cache */
+static size_t make_key(char *buf, uint64_t parent, const char *name)
+{
+    size_t nlen = strlen(name);
+    if (sizeof(uint64_t) + nlen > DCACHE_KEY_MAX) return 0;
+    memcpy(buf, &parent, sizeof(uint64_t));
+    memcpy(buf + sizeof(uint64_t), name, nlen);
+    return sizeof(uint64_t) + nlen;
+}
+
+/* High hash bits pick the shard; uthash buckets use the low ones */
+static struct dcache_shard *shard_of(struct dcache *dc, const char *key,
+                                     size_t key_len, unsigned *hashv)
+{
+    HASH_VALUE(key, key_len, *hashv);
+    return &dc->shards[(*hashv >> 24) % DCACHE_SHARDS];
+}
+
+static void entry_free(struct dcache_entry *e)
+{
+    free(e->key);
+    free(e);
+}
+
+/* ── Lookup / fill ────────────────────────────────────── */
+
+int dcache_lookup(struct dcache *dc, uint64_t parent, const char *name,
+                  uint64_t *ino, uint64_t *gen)
+{
+    *gen = 0;
+    if (dc->shard_max == 0) return DCACHE_MISS;
+
+    char key[DCACHE_KEY_MAX];
+    size_t key_len = make_key(key, parent, name);
+    if (key_len == 0) return DCACHE_MISS;
+
+    unsigned hashv;
+    struct dcache_shard *s = shard_of(dc, key, key_len, &hashv);
+
+    pthread_mutex_lock(&s->lock);
+    struct dcache_entry *e = NULL;
+    HASH_FIND_BYHASHVALUE(hh, s->map, key, key_len, hashv, e);
+    if (e) {
+        /* Move to the LRU tail */
+        HASH_DELETE(hh, s->map, e);
+        HASH_ADD_KEYPTR_BYHASHVALUE(hh, s->map, e->key, e->key_len, hashv, e);
+        *ino = e->ino;
+    }
+    *gen = s->gen;
+    pthread_mutex_unlock(&s->lock);
+
+    if (!e) {
+        __atomic_add_fetch(&dc->misses, 1, __ATOMIC_RELAXED);
+        return DCACHE_MISS;
+    }
+    if (*ino == 0)
+        __atomic_add_fetch(&dc->negative_hits, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_add_fetch(&dc->hits, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void dcache_insert(struct dcache *dc, uint64_t parent, const char *name,
+                   uint64_t ino, uint64_t gen)
+{
+    if (dc->shard_max == 0) return;
+
+    char key[DCACHE_KEY_MAX];
+    size_t key_len = make_key(key, parent, name);
+    if (key_len == 0) return;
+
+    struct dcache_entry *e = calloc(1, sizeof(*e));
+    if (!e) return;
+    e->key = malloc(key_len);
+    if (!e->key) {
+        free(e);
+        return;
+    }
+    memcpy(e->key, key, key_len);
+    e->key_len = key_len;
+    e->ino = ino;
+
+    unsigned hashv;
+    struct dcache_shard *s = shard_of(dc, key, key_len, &hashv);
+    struct dcache_entry *victim = NULL, *old = NULL;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->gen != gen) {
+        /* The namespace changed since the KV read; drop the result */
+        pthread_mutex_unlock(&s->lock);
+        entry_free(e);
+        return;
+    }
+
+    HASH_FIND_BYHASHVALUE(hh, s->map, key, key_len, hashv, old);
+    if (old) {
+        HASH_DELETE(hh, s->map, old);
+        s->count--;
+    } else if (s->count >= dc->shard_max) {
+        victim = s->map;        /* head = least recently used */
+        HASH_DELETE(hh, s->map, victim);
+        s->count--;
+    }
+    HASH_ADD_KEYPTR_BYHASHVALUE(hh, s->map, e->key, e->key_len, hashv, e);
+    s->count++;
+    pthread_mutex_unlock(&s->lock);
+
+    if (old) entry_free(old);
+    if (victim) {
+        entry_free(victim);
+        __atomic_add_fetch(&dc->evictions, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* ── Warmup ───────────────────────────────────────────── */
+
+void dcache_gens(struct dcache *dc, uint64_t *gens)
+{
+    for (int i = 0; i < DCACHE_SHARDS; i++) {
+        pthread_mutex_lock(&dc->shards[i].lock);
+        gens[i] = dc->shards[i].gen;
+        pthread_mutex_unlock(&dc->shards[i].lock);
+    }
+}
+
+int dcache_preload(struct dcache *dc, uint64_t parent, const char *name,
+                   uint64_t ino, const uint64_t *gens)
+{
+    if (dc->shard_max == 0) return 0;
+
+    char key[DCACHE_KEY_MAX];
+    size_t key_len = make_key(key, parent, name);
+    if (key_len == 0) return 0;
+
+    unsigned hashv;
+    struct dcache_shard *s = shard_of(dc, key, key_len, &hashv);
+    uint64_t gen = gens[s - dc->shards];
+
+    struct dcache_entry *e = calloc(1, sizeof(*e));
+    if (!e) return 0;
+    e->key = malloc(key_len);
+    if (!e->key) {
+        free(e);
+        return 0;
+    }
+    memcpy(e->key, key, key_len);
+    e->key_len = key_len;
+    e->ino = ino;
+
+    int ret = 0;
+    pthread_mutex_lock(&s->lock);
+    struct dcache_entry *old = NULL;
+    if (s->gen == gen && s->count < dc->shard_max) {
+        HASH_FIND_BYHASHVALUE(hh, s->map, key, key_len, hashv, old);
+        if (!old) {
+            HASH_ADD_KEYPTR_BYHASHVALUE(hh, s->map, e->key, e->key_len, hashv, e);
+            s->count++;
+            e = NULL;
+            ret = 1;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    if (e) entry_free(e);
+    return ret;
+}
+
+void dcache_invalidate(struct dcache *dc, uint64_t parent, const char *name)
+{
+    if (dc->shard_max == 0) return;
+
+    char key[DCACHE_KEY_MAX];
+    size_t key_len = make_key(key, parent, name);
+    if (key_len == 0) return;
+
+    unsigned hashv;
+    struct dcache_shard *s = shard_of(dc, key, key_len, &hashv);
+
+    pthread_mutex_lock(&s->lock);
+    struct dcache_entry *e = NULL;
+    HASH_FIND_BYHASHVALUE(hh, s->map, key, key_len, hashv, e);
+    if (e) {
+        HASH_DELETE(hh, s->map, e);
+        s->count--;
+    }
+    s->gen++;
+    pthread_mutex_unlock(&s->lock);
+
+    if (e) entry_free(e);
+}
+
+void dcache_get_stats(struct dcache *dc, struct dcache_stats *st)
+{
+    st->hits          = __atomic_load_n(&dc->hits, __ATOMIC_RELAXED);
+    st->negative_hits = __atomic_load_n(&dc->negative_hits, __ATOMIC_RELAXED);
+    st->misses        = __atomic_load_n(&dc->misses, __ATOMIC_RELAXED);
+    st->evictions     = __atomic_load_n(&dc->evictions, __ATOMIC_RELAXED);
+    st->entries = 0;
+    for (int i = 0; i < DCACHE_SHARDS; i++) {
+        pthread_mutex_lock(&dc->shards[i].lock);
+        st->entries += dc->shards[i].count;
+        pthread_mutex_unlock(&dc->shards[i].lock);
+    }
+}
+
+/* ── Lifecycle ────────────────────────────────────────── */
+
+void dcache_init(struct dcache *dc)
+{
+    memset(dc, 0, sizeof(*dc));
+
+    unsigned long max = DCACHE_DEFAULT_MAX;
+    const char *s = getenv("KVBFS_DCACHE_SIZE");
+    if (s) max = strtoul(s, NULL, 10);
+    dc->shard_max = max ? (max + DCACHE_SHARDS - 1) / DCACHE_SHARDS : 0;
+
+    dc->neg_timeout = DCACHE_NEG_TIMEOUT;
+    s = getenv("KVBFS_NEG_TIMEOUT");
+    if (s) dc->neg_timeout = strtod(s, NULL);
+
+    for (int i = 0; i < DCACHE_SHARDS; i++)
+        pthread_mutex_init(&dc->shards[i].lock, NULL);
+}
+
+void dcache_destroy(struct dcache *dc)
+{
+    for (int i = 0; i < DCACHE_SHARDS; i++) {
+        struct dcache_shard *s = &dc->shards[i];
+        struct dcache_entry *e, *tmp;
+        pthread_mutex_lock(&s->lock);
+        HASH_ITER(hh, s->map, e, tmp) {
+            HASH_DELETE(hh, s->map, e);
+            entry_free(e);
+        }
+        s->count = 0;
+        pthread_mutex_unlock(&s->lock);
+        pthread_mutex_destroy(&s->lock);
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "uthash.h"
+
+/*
+ * Dentry cache: (parent, name) → child inode.
+ *
+ * Holds positive entries and negative ones (ino == 0) so repeated probes for
+ * missing files (.git, __pycache__, config search paths) stay off the KV
+ * store.  The table is split into shards by hash, each with its own lock and
+ * LRU order; uthash keeps insertion order, so a hit re-adds the entry at the
+ * tail and eviction takes from the head.
+ *
+ * Every namespace change calls dcache_invalidate() after its batch commits.
+ * Invalidation bumps the shard generation, and a miss only fills the cache if
+ * the generation it observed is still current, so a lookup racing with a
+ * commit can never re-insert the stale result.
+ */
+
+#define DCACHE_SHARDS           16
+#define DCACHE_DEFAULT_MAX      65536   /* entries across all shards */
+#define DCACHE_NEG_TIMEOUT      1.0     /* seconds the kernel keeps ENOENT */
+
+#define DCACHE_MISS             (-1)
+
+struct dcache_entry {
+    char *key;              /* parent (8 bytes) followed by the name */
+    size_t key_len;
+    uint64_t ino;           /* 0 = negative entry */
+    UT_hash_handle hh;
+};
+
+struct dcache_shard {
+    pthread_mutex_t lock;
+    struct dcache_entry *map;
+    unsigned count;
+    uint64_t gen;
+};
+
+struct dcache_stats {
+    uint64_t hits;
+    uint64_t negative_hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t entries;
+};
+
+struct dcache {
+    struct dcache_shard shards[DCACHE_SHARDS];
+    unsigned shard_max;
+    double neg_timeout;     /* entry_timeout of negative replies */
+
+    uint64_t hits;          /* updated atomically */
+    uint64_t negative_hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+/* Reads KVBFS_DCACHE_SIZE (0 disables the cache) and KVBFS_NEG_TIMEOUT */
+void dcache_init(struct dcache *dc);
+void dcache_destroy(struct dcache *dc);
+
+/*
+ * Returns 0 on a hit with *ino set (0 for a negative entry), DCACHE_MISS
+ * otherwise.  *gen receives the generation to pass to dcache_insert().
+ */
+int  dcache_lookup(struct dcache *dc, uint64_t parent, const char *name,
+                   uint64_t *ino, uint64_t *gen);
+
+/* Cache the result of a KV lookup (ino 0 = name does not exist) */
+void dcache_insert(struct dcache *dc, uint64_t parent, const char *name,
+                   uint64_t ino, uint64_t gen);
+
+void dcache_invalidate(struct dcache *dc, uint64_t parent, const char *name);
+
+/*
+ * Warmup fill.  Snapshot the shard generations with dcache_gens() before
+ * reading the dirents; dcache_preload() then adds a positive entry only if
+ * its shard saw no invalidation since, and never evicts.  Returns 1 when
+ * the entry was added.
+ */
+void dcache_gens(struct dcache *dc, uint64_t *gens);
+int  dcache_preload(struct dcache *dc, uint64_t parent, const char *name,
+                    uint64_t ino, const uint64_t *gens);
+
+void dcache_get_stats(struct dcache *dc, struct dcache_stats *st);
+
+#endif /* DCACHE_H */
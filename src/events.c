@@ -19,6 +19,8 @@ static const char *event_type_str(enum event_type type)
     case EVT_SETXATTR:    return "setxattr";
     case EVT_REMOVEXATTR: return "removexattr";
     case EVT_LINK:        return "link";
+    case EVT_RMTREE:      return "rmtree";
+    case EVT_RESTORE:     return "restore";
     default:              return "unknown";
     }
 }
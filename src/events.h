@@ -23,7 +23,9 @@ enum event_type {
     EVT_SETATTR,
     EVT_SETXATTR,
     EVT_REMOVEXATTR,
-    EVT_LINK
+    EVT_LINK,
+    EVT_RMTREE,
+    EVT_RESTORE
 };
 
 struct events_ctx {
@@ -0,0 +1,259 @@
+#include "fssnap.h"
+#include "kv_store.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static void snap_path(const struct fssnap_ctx *fs, uint64_t seq,
+                      char *buf, size_t len)
+{
+    snprintf(buf, len, "%s/%llu", fs->dir, (unsigned long long)seq);
+}
+
+/* A checkpoint directory holds plain files only */
+static void remove_checkpoint(const char *path)
+{
+    DIR *d = opendir(path);
+    if (d) {
+        struct dirent *ent;
+        while ((ent = readdir(d)) != NULL) {
+            if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+                continue;
+            unlinkat(dirfd(d), ent->d_name, 0);
+        }
+        closedir(d);
+    }
+    rmdir(path);
+}
+
+static struct fssnap *snap_new(struct fssnap_ctx *fs, const char *name,
+                               const struct fssnap_rec *rec)
+{
+    struct fssnap *s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    s->name = strdup(name);
+    if (!s->name) {
+        free(s);
+        return NULL;
+    }
+    s->id = fs->next_id++;
+    s->rec = *rec;
+    HASH_ADD_KEYPTR(hh, fs->by_name, s->name, strlen(s->name), s);
+    HASH_ADD(hh_id, fs->by_id, id, sizeof(s->id), s);
+    return s;
+}
+
+/* Close and remove a snapshot nobody can reach any more */
+static void snap_free(struct fssnap_ctx *fs, struct fssnap *s, bool remove)
+{
+    if (s->db) kv_close(s->db);
+    if (remove) {
+        char path[4096];
+        snap_path(fs, s->rec.seq, path, sizeof(path));
+        remove_checkpoint(path);
+    }
+    free(s->name);
+    free(s);
+}
+
+int fssnap_init(struct fssnap_ctx *fs, void *db, const char *db_path)
+{
+    memset(fs, 0, sizeof(*fs));
+    fs->db = db;
+    fs->next_id = 1;
+    pthread_mutex_init(&fs->lock, NULL);
+    pthread_mutex_init(&fs->create_lock, NULL);
+
+    size_t len = strlen(db_path) + sizeof(".snapshots");
+    fs->dir = malloc(len);
+    if (!fs->dir) return -1;
+    snprintf(fs->dir, len, "%s.snapshots", db_path);
+
+    kv_iterator_t *iter = kv_iter_prefix(db, "ss:", 3);
+    for (; kv_iter_valid(iter); kv_iter_next(iter)) {
+        size_t klen, vlen;
+        const char *k = kv_iter_key(iter, &klen);
+        const char *v = kv_iter_value(iter, &vlen);
+        if (vlen != sizeof(struct fssnap_rec) || klen <= 3 || klen - 3 > 255)
+            continue;
+
+        char name[256];
+        memcpy(name, k + 3, klen - 3);
+        name[klen - 3] = '\0';
+        struct fssnap_rec rec;
+        memcpy(&rec, v, sizeof(rec));
+        if (!snap_new(fs, name, &rec)) break;
+        if (rec.seq >= fs->next_seq) fs->next_seq = rec.seq + 1;
+    }
+    kv_iter_free(iter);
+
+    /* Checkpoints without a record: creation or deletion was cut short */
+    DIR *d = opendir(fs->dir);
+    if (!d) return 0;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        char *end;
+        uint64_t seq = strtoull(ent->d_name, &end, 10);
+        if (ent->d_name[0] < '0' || ent->d_name[0] > '9' || *end != '\0')
+            continue;
+        if (seq >= fs->next_seq) fs->next_seq = seq + 1;
+
+        bool used = false;
+        struct fssnap *s, *tmp;
+        HASH_ITER(hh, fs->by_name, s, tmp) {
+            if (s->rec.seq == seq) used = true;
+        }
+        if (!used) {
+            char path[4096];
+            snap_path(fs, seq, path, sizeof(path));
+            remove_checkpoint(path);
+        }
+    }
+    closedir(d);
+    return 0;
+}
+
+void fssnap_destroy(struct fssnap_ctx *fs)
+{
+    struct fssnap *s, *tmp;
+    HASH_ITER(hh, fs->by_name, s, tmp) {
+        HASH_DELETE(hh, fs->by_name, s);
+        HASH_DELETE(hh_id, fs->by_id, s);
+        snap_free(fs, s, false);
+    }
+    pthread_mutex_destroy(&fs->lock);
+    pthread_mutex_destroy(&fs->create_lock);
+    free(fs->dir);
+    fs->dir = NULL;
+}
+
+int fssnap_create(struct fssnap_ctx *fs, const char *name, uint64_t *id)
+{
+    char key[300];
+    int keylen = kvbfs_key_fssnap(key, sizeof(key), name);
+    if (keylen < 0) return ENAMETOOLONG;
+
+    pthread_mutex_lock(&fs->create_lock);
+
+    struct fssnap *s;
+    pthread_mutex_lock(&fs->lock);
+    HASH_FIND(hh, fs->by_name, name, strlen(name), s);
+    uint64_t seq = s ? 0 : fs->next_seq++;
+    pthread_mutex_unlock(&fs->lock);
+    if (s) {
+        pthread_mutex_unlock(&fs->create_lock);
+        return EEXIST;
+    }
+
+    if (mkdir(fs->dir, 0755) != 0 && errno != EEXIST) {
+        pthread_mutex_unlock(&fs->create_lock);
+        return EIO;
+    }
+
+    char path[4096];
+    snap_path(fs, seq, path, sizeof(path));
+    errno = 0;
+    if (kv_checkpoint(fs->db, path) != 0) {
+        int err = errno == ENOTSUP ? ENOTSUP : EIO;
+        remove_checkpoint(path);
+        pthread_mutex_unlock(&fs->create_lock);
+        return err;
+    }
+
+    struct fssnap_rec rec = { .seq = seq, .created = time(NULL) };
+    if (kv_put(fs->db, key, keylen, (const char *)&rec, sizeof(rec)) != 0) {
+        remove_checkpoint(path);
+        pthread_mutex_unlock(&fs->create_lock);
+        return EIO;
+    }
+
+    pthread_mutex_lock(&fs->lock);
+    s = snap_new(fs, name, &rec);
+    if (s && id) *id = s->id;
+    pthread_mutex_unlock(&fs->lock);
+
+    pthread_mutex_unlock(&fs->create_lock);
+    return s ? 0 : ENOMEM;
+}
+
+int fssnap_delete(struct fssnap_ctx *fs, const char *name)
+{
+    char key[300];
+    int keylen = kvbfs_key_fssnap(key, sizeof(key), name);
+    if (keylen < 0) return ENOENT;
+
+    pthread_mutex_lock(&fs->create_lock);
+
+    struct fssnap *s;
+    pthread_mutex_lock(&fs->lock);
+    HASH_FIND(hh, fs->by_name, name, strlen(name), s);
+    pthread_mutex_unlock(&fs->lock);
+    if (!s) {
+        pthread_mutex_unlock(&fs->create_lock);
+        return ENOENT;
+    }
+
+    if (kv_delete(fs->db, key, keylen) != 0) {
+        pthread_mutex_unlock(&fs->create_lock);
+        return EIO;
+    }
+
+    pthread_mutex_lock(&fs->lock);
+    HASH_DELETE(hh, fs->by_name, s);
+    HASH_DELETE(hh_id, fs->by_id, s);
+    s->dead = true;
+    bool idle = s->refs == 0;
+    pthread_mutex_unlock(&fs->lock);
+
+    if (idle) snap_free(fs, s, true);
+    pthread_mutex_unlock(&fs->create_lock);
+    return 0;
+}
+
+/* lock held: take a reference, opening the checkpoint on first use */
+static struct fssnap *snap_ref(struct fssnap_ctx *fs, struct fssnap *s)
+{
+    if (!s) return NULL;
+    if (!s->db) {
+        char path[4096];
+        snap_path(fs, s->rec.seq, path, sizeof(path));
+        s->db = kv_open_readonly(path);
+        if (!s->db) return NULL;
+    }
+    s->refs++;
+    return s;
+}
+
+struct fssnap *fssnap_find(struct fssnap_ctx *fs, const char *name)
+{
+    struct fssnap *s;
+    pthread_mutex_lock(&fs->lock);
+    HASH_FIND(hh, fs->by_name, name, strlen(name), s);
+    s = snap_ref(fs, s);
+    pthread_mutex_unlock(&fs->lock);
+    return s;
+}
+
+struct fssnap *fssnap_get(struct fssnap_ctx *fs, uint64_t id)
+{
+    struct fssnap *s;
+    pthread_mutex_lock(&fs->lock);
+    HASH_FIND(hh_id, fs->by_id, &id, sizeof(id), s);
+    s = snap_ref(fs, s);
+    pthread_mutex_unlock(&fs->lock);
+    return s;
+}
+
+void fssnap_put(struct fssnap_ctx *fs, struct fssnap *s)
+{
+    if (!s) return;
+    pthread_mutex_lock(&fs->lock);
+    bool last = --s->refs == 0 && s->dead;
+    pthread_mutex_unlock(&fs->lock);
+    if (last) snap_free(fs, s, true);
+}
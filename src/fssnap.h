@@ -0,0 +1,85 @@
+#ifndef FSSNAP_H
+#define FSSNAP_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "uthash.h"
+
+/*
+ * Filesystem-wide point-in-time snapshots, browsed read-only under
+ * /.snapshots/<name>/.
+ *
+ * mkdir /.snapshots/<name> settles queued writes, writes back dirty inodes
+ * and takes a KV checkpoint into <db>.snapshots/<seq>.  RocksDB builds the
+ * checkpoint from hard links to its immutable SST files after flushing the
+ * memtable, so the cost follows the number of files, not the data in them;
+ * later writes go to new files and never touch the snapshot.  The name is
+ * recorded as ss:<name> -> struct fssnap_rec only once the checkpoint
+ * exists, and rmdir removes the record before the files, so a crash leaves
+ * at most an orphan directory, which the next mount deletes.
+ *
+ * A snapshot's checkpoint is opened read-only on first access and stays
+ * open until the snapshot is deleted and its last reader has let go.
+ * Backends without checkpoints (NVMe) fail creation with ENOTSUP.
+ */
+
+#define AGENTFS_SNAPSHOTS_INO   0xFFFFFFFFFFFFFCULL
+#define AGENTFS_SNAPSHOTS_NAME  ".snapshots"
+
+/* Value of ss:<name> */
+struct fssnap_rec {
+    uint64_t seq;           /* checkpoint directory number */
+    int64_t created;        /* creation time (seconds) */
+};
+
+struct fssnap {
+    char *name;
+    uint64_t id;            /* unique for the mount; names the vtree node */
+    struct fssnap_rec rec;
+    void *db;               /* read-only checkpoint, opened on first use */
+    unsigned refs;          /* lock held */
+    bool dead;              /* deleted; files go with the last reference */
+    UT_hash_handle hh;      /* by name */
+    UT_hash_handle hh_id;   /* by id */
+};
+
+struct fssnap_ctx {
+    void *db;               /* live store */
+    char *dir;              /* <db>.snapshots */
+    pthread_mutex_t lock;   /* tables and references */
+    pthread_mutex_t create_lock;    /* serializes create and delete */
+    struct fssnap *by_name;
+    struct fssnap *by_id;
+    uint64_t next_id;
+    uint64_t next_seq;
+};
+
+static inline int kvbfs_key_fssnap(char *buf, size_t buflen, const char *name)
+{
+    int n = snprintf(buf, buflen, "ss:%s", name);
+    if (n < 0 || (size_t)n >= buflen) return -1;
+    return n;
+}
+
+/* Load the snapshot records and remove orphaned checkpoints */
+int  fssnap_init(struct fssnap_ctx *fs, void *db, const char *db_path);
+void fssnap_destroy(struct fssnap_ctx *fs);
+
+/*
+ * Checkpoint the live store as name.  The caller settles pending writes and
+ * dirty inodes first.  Returns 0 or an errno (EEXIST, ENOTSUP, EIO).
+ */
+int fssnap_create(struct fssnap_ctx *fs, const char *name, uint64_t *id);
+
+/* Forget name; its files go once no reader holds it.  0 or ENOENT/EIO */
+int fssnap_delete(struct fssnap_ctx *fs, const char *name);
+
+/* Take a reference by name or id, opening the checkpoint; NULL if gone */
+struct fssnap *fssnap_find(struct fssnap_ctx *fs, const char *name);
+struct fssnap *fssnap_get(struct fssnap_ctx *fs, uint64_t id);
+void fssnap_put(struct fssnap_ctx *fs, struct fssnap *s);
+
+#endif /* FSSNAP_H */
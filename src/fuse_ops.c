@@ -2,6 +2,7 @@
 #include "kv_store.h"
 #include "inode.h"
 #include "version.h"
+#include "vdiff.h"
 
 #include <string.h>
 #include <errno.h>
@@ -10,6 +11,7 @@
 #include "super.h"
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <poll.h>
 #include <sys/xattr.h>
 
@@ -18,8 +20,6 @@
 static int is_session_file(fuse_ino_t ino);
 #endif
 
-static void xattr_delete_all(uint64_t ino);
-
 /* ── Virtual .agentfs control file ───────────────────── */
 #ifdef CFS_MEMORY
 
@@ -59,119 +59,6 @@ static void agentfs_events_stat(struct stat *st)
     st->st_ctim = st->st_atim;
 }
 
-static void versions_root_stat(struct stat *st)
-{
-    memset(st, 0, sizeof(*st));
-    st->st_ino   = AGENTFS_VERSIONS_INO;
-    st->st_mode  = S_IFDIR | 0555;
-    st->st_nlink = 2;
-    st->st_uid   = getuid();
-    st->st_gid   = getgid();
-    clock_gettime(CLOCK_REALTIME, &st->st_atim);
-    st->st_mtim  = st->st_atim;
-    st->st_ctim  = st->st_atim;
-}
-
-static void vnode_stat(struct vtree_node *vn, struct stat *st)
-{
-    memset(st, 0, sizeof(*st));
-    st->st_ino = vn->vino;
-    st->st_uid = getuid();
-    st->st_gid = getgid();
-
-    if (!vn->is_version_file) {
-        st->st_mode  = S_IFDIR | 0555;
-        st->st_nlink = 2;
-        clock_gettime(CLOCK_REALTIME, &st->st_atim);
-        st->st_mtim  = st->st_atim;
-    } else {
-        struct kvbfs_version_meta meta;
-        st->st_mode  = S_IFREG | 0444;
-        st->st_nlink = 1;
-        if (version_get_meta(vn->real_ino, vn->version, &meta) == 0) {
-            st->st_size   = (off_t)meta.size;
-            st->st_blocks = (blkcnt_t)((meta.size + 511) / 512);
-            st->st_mtim   = meta.mtime;
-        }
-        clock_gettime(CLOCK_REALTIME, &st->st_atim);
-    }
-    st->st_ctim = st->st_atim;
-}
-
-/* Resolve inode number to a path by walking dirent entries backwards */
-static int ino_to_path(uint64_t ino, char *buf, size_t buflen)
-{
-    if (ino == KVBFS_ROOT_INO) {
-        if (buflen < 2) return -1;
-        buf[0] = '/';
-        buf[1] = '\0';
-        return 0;
-    }
-
-    /* Build path components by searching parent dirents */
-    char *components[128];
-    int depth = 0;
-    uint64_t cur = ino;
-
-    while (cur != KVBFS_ROOT_INO && depth < 128) {
-        /* Scan all dirent prefixes to find parent -> cur mapping */
-        bool found = false;
-        kv_iterator_t *iter = kv_iter_prefix(g_ctx->db, "d:", 2);
-        while (kv_iter_valid(iter)) {
-            size_t vlen;
-            const char *val = kv_iter_value(iter, &vlen);
-            if (vlen == sizeof(uint64_t)) {
-                uint64_t child;
-                memcpy(&child, val, sizeof(uint64_t));
-                if (child == cur) {
-                    size_t klen;
-                    const char *key = kv_iter_key(iter, &klen);
-                    /* key = "d:<parent>:<name>" */
-                    const char *p = key + 2;  /* skip "d:" */
-                    const char *colon = memchr(p, ':', klen - 2);
-                    if (colon) {
-                        const char *name = colon + 1;
-                        size_t nlen = klen - (name - key);
-                        components[depth] = strndup(name, nlen);
-                        depth++;
-
-                        /* Parse parent ino */
-                        char parent_str[32];
-                        size_t plen = colon - p;
-                        if (plen >= sizeof(parent_str)) plen = sizeof(parent_str) - 1;
-                        memcpy(parent_str, p, plen);
-                        parent_str[plen] = '\0';
-                        cur = strtoull(parent_str, NULL, 10);
-                        found = true;
-                        kv_iter_free(iter);
-                        break;
-                    }
-                }
-            }
-            kv_iter_next(iter);
-        }
-        if (!found) {
-            kv_iter_free(iter);
-            break;
-        }
-    }
-
-    if (depth == 0) {
-        snprintf(buf, buflen, "ino:%lu", (unsigned long)ino);
-        return -1;
-    }
-
-    /* Build path from components (reverse order) */
-    size_t off = 0;
-    for (int i = depth - 1; i >= 0; i--) {
-        int n = snprintf(buf + off, buflen - off, "/%s", components[i]);
-        if (n < 0 || (size_t)n >= buflen - off) break;
-        off += n;
-    }
-    for (int i = 0; i < depth; i++) free(components[i]);
-    return 0;
-}
-
 /* Execute search query and format JSON results */
 static int agentfs_ctl_search(struct agentfs_ctl_fh *fh)
 {
@@ -231,7 +118,7 @@ static int agentfs_ctl_search(struct agentfs_ctl_fh *fh)
 
         /* Resolve ino to path */
         char path[CFS_MEM_PATH_LEN];
-        ino_to_path(r->ino, path, sizeof(path));
+        path_resolve(&g_ctx->paths, g_ctx->db, r->ino, path, sizeof(path));
 
         /* Escape summary for JSON (simple: replace " and \ and control chars) */
         char escaped[CFS_MEM_SUMMARY_LEN * 2];
@@ -284,6 +171,83 @@ static int agentfs_ctl_search(struct agentfs_ctl_fh *fh)
 
 #endif /* CFS_MEMORY */
 
+/* ── .versions virtual tree ──────────────────────────── */
+
+static void versions_root_stat(struct stat *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->st_ino   = AGENTFS_VERSIONS_INO;
+    st->st_mode  = S_IFDIR | 0555;
+    st->st_nlink = 2;
+    st->st_uid   = getuid();
+    st->st_gid   = getgid();
+    clock_gettime(CLOCK_REALTIME, &st->st_atim);
+    st->st_mtim  = st->st_atim;
+    st->st_ctim  = st->st_atim;
+}
+
+static int snap_node_stat(struct vtree_node *vn, struct stat *st);
+
+/* 版本树节点的属性；快照已删除时返回 -1 */
+static int vnode_stat(struct vtree_node *vn, struct stat *st)
+{
+    if (vn->is_version_file == 3)
+        return snap_node_stat(vn, st);
+
+    memset(st, 0, sizeof(*st));
+    st->st_ino = vtree_stat_ino(vn);
+    st->st_uid = getuid();
+    st->st_gid = getgid();
+
+    if (!vn->is_version_file) {
+        st->st_mode  = S_IFDIR | 0555;
+        st->st_nlink = 2;
+        clock_gettime(CLOCK_REALTIME, &st->st_atim);
+        st->st_mtim  = st->st_atim;
+    } else if (vn->is_version_file == 2) {
+        /* 差异在打开时生成，大小未知；以 direct_io 读到 EOF */
+        st->st_mode  = S_IFREG | 0444;
+        st->st_nlink = 1;
+        clock_gettime(CLOCK_REALTIME, &st->st_atim);
+        st->st_mtim  = st->st_atim;
+    } else {
+        struct kvbfs_version_meta meta;
+        st->st_mode  = S_IFREG | 0444;
+        st->st_nlink = 1;
+        if (version_get_meta(vn->real_ino, vn->version, &meta) == 0) {
+            st->st_size   = (off_t)meta.size;
+            st->st_blocks = (blkcnt_t)((meta.size + 511) / 512);
+            st->st_mtim   = meta.mtime;
+        }
+        clock_gettime(CLOCK_REALTIME, &st->st_atim);
+    }
+    st->st_ctim = st->st_atim;
+    return 0;
+}
+
+/*
+ * 解析差异文件名 "<a>..<b>"，b 可为 "live"；版本号从 1 开始。
+ * 成功时返回 0，from、to 为内部版本号（to 为 VTREE_LIVE 表示当前内容）。
+ */
+static int parse_diff_name(const char *name, uint64_t *from, uint64_t *to)
+{
+    char *end;
+    if (*name < '0' || *name > '9') return -1;
+    uint64_t a = strtoull(name, &end, 10);
+    if (a == 0 || strncmp(end, "..", 2) != 0) return -1;
+    const char *rest = end + 2;
+    if (strcmp(rest, "live") == 0) {
+        *to = VTREE_LIVE;
+    } else {
+        if (*rest < '0' || *rest > '9') return -1;
+        uint64_t b = strtoull(rest, &end, 10);
+        if (*end != '\0' || b == 0) return -1;
+        *to = b - 1;
+    }
+    *from = a - 1;
+    return 0;
+}
+
 /* FUSE lowlevel 操作实现 */
 
 static void inode_to_stat(const struct kvbfs_inode *inode, struct stat *st)
@@ -302,9 +266,13 @@ static void inode_to_stat(const struct kvbfs_inode *inode, struct stat *st)
     st->st_gid = getgid();
 }
 
-/* 查找目录项，返回子 inode 号，未找到返回 0 */
+/* 查找目录项，返回子 inode 号，未找到返回 0；结果 (含不存在) 进入 dentry 缓存 */
 static uint64_t dirent_lookup(uint64_t parent, const char *name)
 {
+    uint64_t ino, gen;
+    if (dcache_lookup(&g_ctx->dcache, parent, name, &ino, &gen) == 0)
+        return ino;
+
     char key[KVBFS_KEY_MAX];
     int keylen = kvbfs_key_dirent(key, sizeof(key), parent, name);
     if (keylen < 0) return 0;  /* key overflow */
@@ -312,41 +280,136 @@ static uint64_t dirent_lookup(uint64_t parent, const char *name)
     char *value = NULL;
     size_t value_len = 0;
 
+    struct kvbfs_dirent de;
     int ret = kv_get(g_ctx->db, key, keylen, &value, &value_len);
-    if (ret != 0 || value_len != sizeof(uint64_t)) {
-        if (value) free(value);
-        return 0;
-    }
-
-    uint64_t child_ino;
-    memcpy(&child_ino, value, sizeof(uint64_t));
+    if (ret != 0 || kvbfs_dirent_decode(value, value_len, &de) != 0)
+        de.ino = 0;
     free(value);
-    return child_ino;
+
+    dcache_insert(&g_ctx->dcache, parent, name, de.ino, gen);
+    return de.ino;
 }
 
-/* 添加目录项 */
-static int dirent_add(uint64_t parent, const char *name, uint64_t child)
+/* ── .snapshots virtual tree ─────────────────────────── */
+
+/* /.snapshots 可写: mkdir 建快照，rmdir 删除快照 */
+static void snapshots_root_stat(struct stat *st)
 {
-    char key[KVBFS_KEY_MAX];
-    int keylen = kvbfs_key_dirent(key, sizeof(key), parent, name);
-    if (keylen < 0) return -1;  /* key overflow */
+    memset(st, 0, sizeof(*st));
+    st->st_ino   = AGENTFS_SNAPSHOTS_INO;
+    st->st_mode  = S_IFDIR | 0755;
+    st->st_nlink = 2;
+    st->st_uid   = getuid();
+    st->st_gid   = getgid();
+    clock_gettime(CLOCK_REALTIME, &st->st_atim);
+    st->st_mtim  = st->st_atim;
+    st->st_ctim  = st->st_atim;
+}
 
-    return kv_put(g_ctx->db, key, keylen,
-                  (const char *)&child, sizeof(uint64_t));
+/* 从快照检查点读取 inode */
+static int snap_inode_load(struct fssnap *s, uint64_t ino, struct kvbfs_inode *inode)
+{
+    char key[64];
+    int keylen = kvbfs_key_inode(key, sizeof(key), ino);
+    size_t len;
+    if (kv_get_into(s->db, key, keylen, (char *)inode, sizeof(*inode), &len) != 0 ||
+        len != sizeof(*inode))
+        return -1;
+    return 0;
 }
 
-/* 删除目录项 */
-static int dirent_remove(uint64_t parent, const char *name)
+/* 快照中的目录项，未找到返回 0 (快照不变，不经 dentry 缓存) */
+static uint64_t snap_dirent_lookup(struct fssnap *s, uint64_t parent, const char *name)
 {
     char key[KVBFS_KEY_MAX];
     int keylen = kvbfs_key_dirent(key, sizeof(key), parent, name);
-    if (keylen < 0) return -1;  /* key overflow */
+    if (keylen < 0) return 0;
+
+    char buf[sizeof(struct kvbfs_dirent)];
+    size_t len;
+    struct kvbfs_dirent de;
+    if (kv_get_into(s->db, key, keylen, buf, sizeof(buf), &len) != 0 ||
+        len > sizeof(buf) || kvbfs_dirent_decode(buf, len, &de) != 0)
+        return 0;
+    return de.ino;
+}
 
-    return kv_delete(g_ctx->db, key, keylen);
+/* 快照节点的属性取自检查点中的 inode，去掉写权限 */
+static int snap_stat(struct fssnap *s, uint64_t ino, struct stat *st)
+{
+    struct kvbfs_inode inode;
+    if (snap_inode_load(s, ino, &inode) != 0) return -1;
+    inode_to_stat(&inode, st);
+    struct vtree_node id = {.is_version_file = 3, .real_ino = ino, .snap = s->id};
+    st->st_ino = vtree_stat_ino(&id);
+    st->st_mode &= ~(mode_t)(S_IWUSR | S_IWGRP | S_IWOTH);
+    return 0;
+}
+
+static int snap_node_stat(struct vtree_node *vn, struct stat *st)
+{
+    struct fssnap *s = fssnap_get(&g_ctx->snaps, vn->snap);
+    if (!s) return -1;
+    int ret = snap_stat(s, vn->real_ino, st);
+    fssnap_put(&g_ctx->snaps, s);
+    return ret;
+}
+
+/* 快照根目录在树中以快照 id 命名，删除后重建的同名快照得到新节点 */
+static void snap_root_name(const struct fssnap *s, char *buf, size_t len)
+{
+    snprintf(buf, len, "#%llu", (unsigned long long)s->id);
+}
+
+/* 为 entry 回复分配快照根节点，带一次内核引用 */
+static uint64_t snap_root_vino(const struct fssnap *s)
+{
+    char idname[32];
+    snap_root_name(s, idname, sizeof(idname));
+    return vtree_alloc_snap(&g_ctx->vtree, AGENTFS_SNAPSHOTS_INO, idname,
+                            KVBFS_ROOT_INO, s->id);
+}
+
+/* readdir 的 d_ino：与 getattr 的 st_ino 相同，不为只列出的名字分配节点 */
+static uint64_t vnode_peek(int kind, uint64_t real_ino, uint64_t version,
+                           uint64_t snap)
+{
+    struct vtree_node id = {.is_version_file = kind, .real_ino = real_ino,
+                            .version = version, .snap = snap};
+    return vtree_stat_ino(&id);
+}
+
+/* 虚拟树 (.versions、.snapshots) 只读，其中不能建立或删除项 */
+static int is_virtual_dir(fuse_ino_t ino)
+{
+    return ino == AGENTFS_VERSIONS_INO || ino == AGENTFS_SNAPSHOTS_INO ||
+           vtree_is_vnode(ino);
+}
+
+/* 回复 entry 并记录内核的 lookup 计数，供 forget 与缓存淘汰使用 */
+static void reply_entry(fuse_req_t req, const struct fuse_entry_param *e)
+{
+    if (e->ino != 0)
+        inode_lookup_inc(e->ino);
+    fuse_reply_entry(req, e);
+}
+
+/* 目录项变更提交后调用，使 dentry 缓存中的旧结果失效 */
+static void dirent_changed(uint64_t parent, const char *name)
+{
+    dcache_invalidate(&g_ctx->dcache, parent, name);
 }
 
 static int dirent_is_empty(uint64_t ino)
 {
+    /*
+     * 用量记录中的子项计数只用来快速判定"非空"；计数可能滞后或漂移，
+     * 判定为空之前仍以 d: 前缀探测一个 key 为准
+     */
+    struct kvbfs_usage u;
+    if (usage_get(g_ctx->db, ino, &u) == 0 && u.entries > 0)
+        return 0;
+
     char prefix[64];
     int prefix_len = kvbfs_key_dirent_prefix(prefix, sizeof(prefix), ino);
 
@@ -357,21 +420,159 @@ static int dirent_is_empty(uint64_t ino)
     return empty;
 }
 
-static void delete_file_blocks(uint64_t ino, uint64_t blocks)
+/*
+ * 将目录项添加/删除加入批处理，同时维护 p: 反向索引和目录用量。
+ * cu 为子项计入父目录的用量 (usage_child)。
+ */
+static int dirent_add_batch(kv_batch_t *batch, uint64_t parent,
+                            const char *name, uint64_t child, uint32_t mode,
+                            const struct kvbfs_usage *cu)
 {
-    for (uint64_t i = 0; i < blocks; i++) {
-        char key[64];
-        int keylen = kvbfs_key_block(key, sizeof(key), ino, i);
-        kv_delete(g_ctx->db, key, keylen);
+    char key[KVBFS_KEY_MAX];
+    int keylen = kvbfs_key_dirent(key, sizeof(key), parent, name);
+    if (keylen < 0) return -1;  /* key overflow */
+    if (path_link_batch(batch, child, parent, name) != 0) return -1;
+    usage_link_batch(&g_ctx->usage, batch, g_ctx->db, parent, cu);
+
+    /* 记录文件类型，readdir 无需再读取子 inode */
+    struct kvbfs_dirent de = { .ino = child, .type = mode & S_IFMT };
+    kv_batch_put(batch, key, keylen, (const char *)&de, sizeof(de));
+    return 0;
+}
+
+static int dirent_remove_batch(kv_batch_t *batch, uint64_t parent,
+                               const char *name, uint64_t child,
+                               const struct kvbfs_usage *cu)
+{
+    char key[KVBFS_KEY_MAX];
+    int keylen = kvbfs_key_dirent(key, sizeof(key), parent, name);
+    if (keylen < 0) return -1;  /* key overflow */
+    if (path_unlink_batch(batch, child, parent, name) != 0) return -1;
+    usage_unlink_batch(&g_ctx->usage, batch, g_ctx->db, parent, cu);
+
+    kv_batch_delete(batch, key, keylen);
+    return 0;
+}
+
+/* 添加目录项 (连同反向索引一起提交) */
+static int dirent_add(uint64_t parent, const char *name, uint64_t child,
+                      uint32_t mode, const struct kvbfs_usage *cu)
+{
+    kv_batch_t *batch = kv_batch_new();
+    if (!batch) return -1;
+
+    int ret = -1;
+    usage_charge_begin(&g_ctx->usage);
+    if (dirent_add_batch(batch, parent, name, child, mode, cu) == 0)
+        ret = kv_batch_commit(g_ctx->db, batch);
+    usage_charge_end(&g_ctx->usage);
+    kv_batch_free(batch);
+    dirent_changed(parent, name);
+    return ret;
+}
+
+/*
+ * 删除 inode：inode 键的删除和孤儿记录与目录项变更在同一批次提交，
+ * 数据块/xattr/版本/嵌入由后台 GC 回收。批次提交成功后调用 reclaim_start。
+ */
+static void reclaim_batch(kv_batch_t *batch, uint64_t ino)
+{
+    inode_delete_batch(batch, ino);
+    gc_orphan(batch, ino);
+}
+
+static void reclaim_start(uint64_t ino)
+{
+    inode_mark_deleted(ino);
+    gc_enqueue(&g_ctx->gc, ino);
+}
+
+/*
+ * 把阻塞在 KV 上的请求交给 I/O 线程，FUSE 线程立即返回，由 I/O 线程回复。
+ * 写入和 release 对同一 inode 独占执行，保持提交顺序。
+ * 返回 -1 表示未排队，调用方直接处理。
+ */
+static int io_defer(int op, fuse_req_t req, fuse_ino_t ino, size_t size,
+                    off_t off, const struct fuse_file_info *fi, const char *buf)
+{
+    struct iopool *p = &g_ctx->iopool;
+    if (!iopool_running(p)) return -1;
+
+    /* 写入数据只在回调期间有效，需要复制 */
+    char *data = NULL;
+    if (buf) {
+        data = malloc(size ? size : 1);
+        if (!data) return -1;
+        memcpy(data, buf, size);
+    }
+    struct io_task *t = iopool_task(p);
+    if (!t) {
+        free(data);
+        return -1;
     }
+    t->op = op;
+    t->exclusive = (op == IO_WRITE || op == IO_RELEASE);
+    t->req = req;
+    t->ino = ino;
+    t->size = size;
+    t->off = off;
+    if (fi) t->fi = *fi;
+    t->data = data;
+    iopool_submit(p, t);
+    return 0;
+}
+
+/*
+ * 等 ino（0 = 全部）此前的 release 完成，并立即执行它们排下的快照与索引。
+ * 只在 FUSE 线程中调用。
+ */
+static void version_settle(uint64_t ino)
+{
+    if (iopool_running(&g_ctx->iopool))
+        iopool_wait(&g_ctx->iopool, ino);
+    snapq_wait(&g_ctx->snapq, ino);
 }
 
+/*
+ * 版本树与虚拟文件反映 release 的副作用（快照、索引、事件），
+ * 访问前先等相关的请求完成：版本节点只等它对应的真实 inode，
+ * 查询与事件文件等调用前已提交的请求。只在 FUSE 线程中调用。
+ */
+static void io_settle(fuse_ino_t ino)
+{
+    bool io = iopool_running(&g_ctx->iopool);
+    if (ino == AGENTFS_VERSIONS_INO) {
+        if (io) iopool_wait(&g_ctx->iopool, KVBFS_ROOT_INO);
+    } else if (vtree_is_vnode(ino)) {
+        /* 快照节点读的是检查点，不受排队请求影响 */
+        struct vtree_node vn_buf, *vn = vtree_get(&g_ctx->vtree, ino, &vn_buf);
+        if (vn && vn->is_version_file != 3) version_settle(vn->real_ino);
+    }
+#ifdef CFS_MEMORY
+    else if (ino == AGENTFS_CTL_INO) {
+        version_settle(0);      /* 搜索结果包含刚关闭的文件 */
+    } else if (ino == AGENTFS_EVENTS_INO) {
+        if (io) iopool_wait(&g_ctx->iopool, 0);
+    }
+#endif
+}
+
+static void io_run(struct io_task *t);
+static void snap_run(uint64_t ino);
+
 static void kvbfs_init(void *userdata, struct fuse_conn_info *conn)
 {
     (void)userdata;
     (void)conn;
 
-    /* 上下文已在 main.c 中初始化 */
+    /* 上下文已在 main.c 中初始化，这里只启动后台回收与写回线程 */
+    gc_start(&g_ctx->gc);
+    inode_flusher_start();
+    iopool_start(&g_ctx->iopool, io_run);
+    snapq_start(&g_ctx->snapq, snap_run);
+
+    /* 缓存预热：同步模式在此完成后才开始处理请求 */
+    warmup_start(&g_ctx->warmup);
     printf("KVBFS initialized\n");
 }
 
@@ -381,9 +582,22 @@ static void kvbfs_destroy(void *userdata)
 
     printf("KVBFS shutting down...\n");
 
-    /* 同步所有脏 inode */
+    /* 先完成已排队的 I/O 请求，再执行其中 release 排下的快照 */
+    iopool_stop(&g_ctx->iopool);
+    snapq_stop(&g_ctx->snapq);
+
+    /* 停止后台回收，未完成的工作在下次挂载时继续 */
+    warmup_stop(&g_ctx->warmup);
+    gc_stop(&g_ctx->gc);
+
+    /* 停止周期写回，同步所有脏 inode */
+    inode_flusher_stop();
     inode_sync_all();
 
+    /* 记录缓存中的 inode，下次挂载时优先预热 */
+    if (warmup_save_hotset(g_ctx->db) != 0)
+        fprintf(stderr, "Warning: failed to save hot set\n");
+
     /* 清理缓存 */
     inode_cache_clear();
 
@@ -392,6 +606,8 @@ static void kvbfs_destroy(void *userdata)
 
 static void kvbfs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
+    io_settle(parent);
+
 #ifdef CFS_MEMORY
     /* Virtual .agentfs control file in root */
     if (parent == KVBFS_ROOT_INO && strcmp(name, AGENTFS_CTL_NAME) == 0) {
@@ -429,13 +645,62 @@ static void kvbfs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
         return;
     }
 
+    /* Virtual .snapshots root and the snapshots in it */
+    if (parent == KVBFS_ROOT_INO && strcmp(name, AGENTFS_SNAPSHOTS_NAME) == 0) {
+        struct fuse_entry_param e;
+        memset(&e, 0, sizeof(e));
+        e.ino = AGENTFS_SNAPSHOTS_INO;
+        snapshots_root_stat(&e.attr);
+        fuse_reply_entry(req, &e);
+        return;
+    }
+    if (parent == AGENTFS_SNAPSHOTS_INO) {
+        struct fssnap *s = fssnap_find(&g_ctx->snaps, name);
+        if (!s) { fuse_reply_err(req, ENOENT); return; }
+        struct fuse_entry_param e;
+        memset(&e, 0, sizeof(e));
+        e.ino = snap_root_vino(s);
+        int ret = e.ino ? snap_stat(s, KVBFS_ROOT_INO, &e.attr) : -1;
+        fssnap_put(&g_ctx->snaps, s);
+        if (ret != 0) {
+            if (e.ino) vtree_forget(&g_ctx->vtree, e.ino, 1);
+            fuse_reply_err(req, e.ino ? EIO : ENOMEM);
+            return;
+        }
+        fuse_reply_entry(req, &e);
+        return;
+    }
+
+    /* Child lookup within a snapshot: the checkpoint holds the whole tree */
+    if (vtree_is_vnode(parent)) {
+        struct vtree_node pn_buf, *pn = vtree_get(&g_ctx->vtree, parent, &pn_buf);
+        if (pn && pn->is_version_file == 3) {
+            struct fssnap *s = fssnap_get(&g_ctx->snaps, pn->snap);
+            if (!s) { fuse_reply_err(req, ENOENT); return; }
+            struct fuse_entry_param e;
+            memset(&e, 0, sizeof(e));
+            uint64_t child = snap_dirent_lookup(s, pn->real_ino, name);
+            int err = ENOENT;
+            if (child) {
+                e.ino = vtree_alloc_snap(&g_ctx->vtree, parent, name, child, pn->snap);
+                err = !e.ino ? ENOMEM :
+                      snap_stat(s, child, &e.attr) != 0 ? ENOENT : 0;
+                if (err && e.ino) vtree_forget(&g_ctx->vtree, e.ino, 1);
+            }
+            fssnap_put(&g_ctx->snaps, s);
+            if (err) { fuse_reply_err(req, err); return; }
+            fuse_reply_entry(req, &e);
+            return;
+        }
+    }
+
     /* Child lookup within .versions virtual tree */
     if (parent == AGENTFS_VERSIONS_INO || vtree_is_vnode(parent)) {
         uint64_t parent_real_ino;
         if (parent == AGENTFS_VERSIONS_INO) {
             parent_real_ino = KVBFS_ROOT_INO;
         } else {
-            struct vtree_node *pn = vtree_get(&g_ctx->vtree, parent);
+            struct vtree_node pn_buf, *pn = vtree_get(&g_ctx->vtree, parent, &pn_buf);
             if (!pn) { fuse_reply_err(req, ENOENT); return; }
             parent_real_ino = pn->real_ino;
         }
@@ -453,8 +718,22 @@ static void kvbfs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
             if (child_real_ino == 0) { fuse_reply_err(req, ENOENT); return; }
             vino = vtree_alloc_dir(&g_ctx->vtree, parent, name, child_real_ino);
             if (!vino) { fuse_reply_err(req, ENOMEM); return; }
-            struct vtree_node *cn = vtree_get(&g_ctx->vtree, vino);
-            vnode_stat(cn, &st);
+            struct vtree_node cn;
+            vnode_stat(vtree_get(&g_ctx->vtree, vino, &cn), &st);
+        } else if (strstr(name, "..")) {
+            uint64_t from, to;
+            struct kvbfs_version_meta vmeta;
+            if (parse_diff_name(name, &from, &to) != 0 ||
+                version_get_meta(parent_real_ino, from, &vmeta) != 0 ||
+                (to != VTREE_LIVE &&
+                 version_get_meta(parent_real_ino, to, &vmeta) != 0)) {
+                fuse_reply_err(req, ENOENT); return;
+            }
+            vino = vtree_alloc_diff(&g_ctx->vtree, parent, name,
+                                    parent_real_ino, from, to);
+            if (!vino) { fuse_reply_err(req, ENOMEM); return; }
+            struct vtree_node cn;
+            vnode_stat(vtree_get(&g_ctx->vtree, vino, &cn), &st);
         } else {
             char *endptr;
             uint64_t uver = strtoull(name, &endptr, 10);
@@ -468,8 +747,8 @@ static void kvbfs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
             vino = vtree_alloc_vfile(&g_ctx->vtree, parent, name,
                                      parent_real_ino, ver);
             if (!vino) { fuse_reply_err(req, ENOMEM); return; }
-            struct vtree_node *cn = vtree_get(&g_ctx->vtree, vino);
-            vnode_stat(cn, &st);
+            struct vtree_node cn;
+            vnode_stat(vtree_get(&g_ctx->vtree, vino, &cn), &st);
         }
 
         struct fuse_entry_param e;
@@ -482,20 +761,25 @@ static void kvbfs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
         return;
     }
 
+    struct fuse_entry_param e;
+    memset(&e, 0, sizeof(e));
+
     uint64_t child_ino = dirent_lookup(parent, name);
     if (child_ino == 0) {
-        fuse_reply_err(req, ENOENT);
+        /* 负目录项：ino 为 0 的回复让内核在超时内缓存 ENOENT */
+        e.entry_timeout = g_ctx->dcache.neg_timeout;
+        fuse_reply_entry(req, &e);
         return;
     }
 
     struct kvbfs_inode_cache *ic = inode_get(child_ino);
     if (!ic) {
+        /* 目录已被摘除、子 inode 已回收：缓存项过期 */
+        dirent_changed(parent, name);
         fuse_reply_err(req, ENOENT);
         return;
     }
 
-    struct fuse_entry_param e;
-    memset(&e, 0, sizeof(e));
     e.ino = child_ino;
     e.attr_timeout = 1.0;
     e.entry_timeout = 1.0;
@@ -506,7 +790,29 @@ static void kvbfs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 
     inode_put(ic);
 
-    fuse_reply_entry(req, &e);
+    reply_entry(req, &e);
+}
+
+/* 内核丢弃 inode 引用：更新 lookup 计数，无引用的缓存项优先淘汰 */
+static void kvbfs_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup)
+{
+    if (vtree_is_vnode(ino))
+        vtree_forget(&g_ctx->vtree, ino, nlookup);     /* 虚拟节点在此释放 */
+    else
+        inode_forget(ino, nlookup);
+    fuse_reply_none(req);
+}
+
+static void kvbfs_forget_multi(fuse_req_t req, size_t count,
+                               struct fuse_forget_data *forgets)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (vtree_is_vnode(forgets[i].ino))
+            vtree_forget(&g_ctx->vtree, forgets[i].ino, forgets[i].nlookup);
+        else
+            inode_forget(forgets[i].ino, forgets[i].nlookup);
+    }
+    fuse_reply_none(req);
 }
 
 static void kvbfs_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
@@ -526,21 +832,27 @@ static void kvbfs_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
         fuse_reply_attr(req, &st, 0);
         return;
     }
+#endif
+
     if (ino == AGENTFS_VERSIONS_INO) {
         struct stat st;
         versions_root_stat(&st);
         fuse_reply_attr(req, &st, 0);
         return;
     }
+    if (ino == AGENTFS_SNAPSHOTS_INO) {
+        struct stat st;
+        snapshots_root_stat(&st);
+        fuse_reply_attr(req, &st, 0);
+        return;
+    }
     if (vtree_is_vnode(ino)) {
-        struct vtree_node *vn = vtree_get(&g_ctx->vtree, ino);
-        if (!vn) { fuse_reply_err(req, ENOENT); return; }
+        struct vtree_node vn_buf, *vn = vtree_get(&g_ctx->vtree, ino, &vn_buf);
         struct stat st;
-        vnode_stat(vn, &st);
+        if (!vn || vnode_stat(vn, &st) != 0) { fuse_reply_err(req, ENOENT); return; }
         fuse_reply_attr(req, &st, 0);
         return;
     }
-#endif
 
     struct kvbfs_inode_cache *ic = inode_get(ino);
     if (!ic) {
@@ -577,21 +889,27 @@ static void kvbfs_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
         fuse_reply_attr(req, &st, 0);
         return;
     }
+#endif
+
     if (ino == AGENTFS_VERSIONS_INO) {
         struct stat st;
         versions_root_stat(&st);
         fuse_reply_attr(req, &st, 0);
         return;
     }
+    if (ino == AGENTFS_SNAPSHOTS_INO) {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
     if (vtree_is_vnode(ino)) {
-        struct vtree_node *vn = vtree_get(&g_ctx->vtree, ino);
+        struct vtree_node vn_buf, *vn = vtree_get(&g_ctx->vtree, ino, &vn_buf);
         if (!vn) { fuse_reply_err(req, ENOENT); return; }
+        if (vn->is_version_file == 3) { fuse_reply_err(req, EROFS); return; }
         struct stat st;
         vnode_stat(vn, &st);
         fuse_reply_attr(req, &st, 0);
         return;
     }
-#endif
 
     struct kvbfs_inode_cache *ic = inode_get(ino);
     if (!ic) {
@@ -599,6 +917,10 @@ static void kvbfs_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
         return;
     }
 
+    /* 截断排在此前排队的写入与 release (写回、快照) 之后 */
+    if (to_set & FUSE_SET_ATTR_SIZE)
+        iopool_wait(&g_ctx->iopool, ino);
+
     pthread_rwlock_wrlock(&ic->lock);
 
     if (to_set & FUSE_SET_ATTR_MODE) {
@@ -608,18 +930,12 @@ static void kvbfs_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
     if (to_set & FUSE_SET_ATTR_SIZE) {
         uint64_t old_size = ic->inode.size;
         uint64_t new_size = attr->st_size;
+        uint64_t old_blocks = ic->inode.blocks;
 
         if (new_size < old_size) {
-            /* 截断：删除多余的块 */
-            uint64_t old_blocks = (old_size + KVBFS_BLOCK_SIZE - 1) / KVBFS_BLOCK_SIZE;
+            /* 截断：多余的块交给后台 GC 回收 */
             uint64_t new_blocks = (new_size + KVBFS_BLOCK_SIZE - 1) / KVBFS_BLOCK_SIZE;
 
-            for (uint64_t i = new_blocks; i < old_blocks; i++) {
-                char key[64];
-                int keylen = kvbfs_key_block(key, sizeof(key), ino, i);
-                kv_delete(g_ctx->db, key, keylen);
-            }
-
             /* 零填充最后一个保留块的尾部，避免暴露旧数据 */
             size_t tail_off = new_size % KVBFS_BLOCK_SIZE;
             if (tail_off > 0 && new_blocks > 0) {
@@ -638,6 +954,16 @@ static void kvbfs_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
                     free(block_data);
                 }
             }
+
+            gc_truncate(&g_ctx->gc, ino, old_size, new_size);
+            /* 尾块被零填充；其余只是大小变化 */
+            version_mark_dirty(NULL, ic, tail_off > 0 ? new_blocks - 1 : new_blocks,
+                               new_blocks);
+        } else if (new_size > old_size) {
+            gc_claim(&g_ctx->gc, ino, old_size, new_size);
+            /* 扩展出的空洞可能遮住旧版本在这些位置的数据 */
+            version_mark_dirty(NULL, ic, old_blocks,
+                               (new_size + KVBFS_BLOCK_SIZE - 1) / KVBFS_BLOCK_SIZE);
         }
 
         ic->inode.size = new_size;
@@ -666,9 +992,12 @@ static void kvbfs_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
     struct stat st;
     inode_to_stat(&ic->inode, &st);
 
+    /* 大小与权限变化立即写回；只改时间戳 (touch/utimens) 时延迟写回 */
+    bool sync_now = (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_SIZE)) != 0;
+    if (!sync_now) inode_mark_dirty(ic);
     pthread_rwlock_unlock(&ic->lock);
 
-    inode_sync(ic);
+    if (sync_now) inode_sync(ic);
     inode_put(ic);
 
 #ifdef CFS_MEMORY
@@ -677,115 +1006,487 @@ static void kvbfs_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
     fuse_reply_attr(req, &st, 1.0);
 }
 
+/* ── readdir / readdirplus ───────────────────────────── */
+
+#define DIR_CHUNK   64      /* 每批读取的目录项数 */
+
+/*
+ * 目录偏移量 (cookie)：
+ *   1/2 为 "." 与 ".."，3..6 为根目录下的虚拟项，
+ *   真实目录项用名字哈希 (>= DIR_OFF_MIN)，版本文件用 版本号 + DIR_OFF_MIN。
+ * 续读时由 cookie 找回名字并直接 seek 到其后，不再从头数过 off 项；
+ * 并发插入或删除不会让 telldir/seekdir 的位置错位：名字已被删除时
+ * seek 停在按键序排在它之后的第一项。
+ */
+#define DIR_OFF_DOT         1
+#define DIR_OFF_DOTDOT      2
+#define DIR_OFF_CTL         3
+#define DIR_OFF_EVENTS      4
+#define DIR_OFF_VERSIONS    5
+#define DIR_OFF_SNAPSHOTS   6
+#define DIR_OFF_MIN         16
+#define DIR_MARKS_MAX       65536   /* 打开句柄记住的 cookie 数上限 */
+
+/* 打开目录的游标状态：记录本句柄回复过的每项的 cookie 与名字 */
+struct dir_handle {
+    pthread_mutex_t lock;
+    struct dir_mark {
+        off_t cookie;
+        size_t name_off;        /* names 中的偏移 */
+    } *marks;
+    size_t nmarks;
+    size_t marks_cap;
+    char *names;                /* 以 '\0' 分隔的名字 */
+    size_t names_len;
+    size_t names_cap;
+};
+
+static off_t dir_cookie(const char *name, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;       /* FNV-1a */
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+    h &= INT64_MAX;
+    if (h < DIR_OFF_MIN) h += DIR_OFF_MIN;
+    return (off_t)h;
+}
+
+static void dir_handle_mark(struct dir_handle *dh, off_t cookie, const char *name)
+{
+    if (!dh) return;
+
+    size_t len = strlen(name) + 1;
+    if (dh->nmarks == dh->marks_cap) {
+        size_t cap = dh->marks_cap ? dh->marks_cap * 2 : 64;
+        struct dir_mark *m = realloc(dh->marks, cap * sizeof(*m));
+        if (!m) return;
+        dh->marks = m;
+        dh->marks_cap = cap;
+    }
+    if (dh->names_len + len > dh->names_cap) {
+        size_t cap = dh->names_cap ? dh->names_cap * 2 : 4096;
+        while (cap < dh->names_len + len) cap *= 2;
+        char *n = realloc(dh->names, cap);
+        if (!n) return;
+        dh->names = n;
+        dh->names_cap = cap;
+    }
+    memcpy(dh->names + dh->names_len, name, len);
+    dh->marks[dh->nmarks].cookie = cookie;
+    dh->marks[dh->nmarks].name_off = dh->names_len;
+    dh->nmarks++;
+    dh->names_len += len;
+}
+
+/*
+ * 由 cookie 找回续读位置的名字。先从新到旧查本句柄回复过的项 (常见路径
+ * 命中最近一次回复；该项之后被删除也能找回名字)，否则 (没有打开句柄、
+ * 或记录已超出上限被清空) 线性扫描比较哈希。都找不到时无法确定位置。
+ */
+static int dir_resume_name(void *db, struct dir_handle *dh, const char *prefix,
+                           int plen, off_t cookie, char *name, size_t namelen)
+{
+    if (dh) {
+        for (size_t i = dh->nmarks; i-- > 0; ) {
+            if (dh->marks[i].cookie != cookie) continue;
+            snprintf(name, namelen, "%s", dh->names + dh->marks[i].name_off);
+            return 0;
+        }
+    }
+
+    int ret = -1;
+    kv_iterator_t *iter = kv_iter_prefix(db, prefix, plen);
+    for (; kv_iter_valid(iter); kv_iter_next(iter)) {
+        size_t klen;
+        const char *k = kv_iter_key(iter, &klen);
+        if (dir_cookie(k + plen, klen - plen) != cookie) continue;
+        size_t nlen = klen - plen;
+        if (nlen >= namelen) nlen = namelen - 1;
+        memcpy(name, k + plen, nlen);
+        name[nlen] = '\0';
+        ret = 0;
+        break;
+    }
+    kv_iter_free(iter);
+    return ret;
+}
+
+/*
+ * 打开 db (主库或快照检查点) 中 prefix 下的迭代器，
+ * 定位到 after 之后的第一项 (after 为 NULL 时从头开始)
+ */
+static kv_iterator_t *dir_iter_after(void *db, const char *prefix, int plen,
+                                     const char *after)
+{
+    kv_iterator_t *iter = kv_iter_prefix(db, prefix, plen);
+    if (!iter || !after) return iter;
+
+    char key[KVBFS_KEY_MAX];
+    int keylen = snprintf(key, sizeof(key), "%.*s%s", plen, prefix, after);
+    if (keylen < 0 || (size_t)keylen >= sizeof(key)) return iter;
+
+    kv_iter_seek(iter, key, keylen);
+    if (kv_iter_valid(iter)) {
+        size_t klen;
+        const char *k = kv_iter_key(iter, &klen);
+        if (klen == (size_t)keylen && memcmp(k, key, klen) == 0)
+            kv_iter_next(iter);
+    }
+    return iter;
+}
+
+/*
+ * 按 off 定位一个目录项迭代器。off 既不是本句柄回复过的 cookie、
+ * 对应的项也已不存在时无法确定位置，*err 置 EINVAL 并返回 NULL
+ * (不当作目录结束)。从头开始或记录超出上限时清空记录。
+ */
+static kv_iterator_t *dir_iter_at(void *db, struct dir_handle *dh,
+                                  const char *prefix, int plen, off_t off,
+                                  int *err)
+{
+    kv_iterator_t *iter;
+    *err = 0;
+    if (off < DIR_OFF_MIN) {
+        iter = dir_iter_after(db, prefix, plen, NULL);
+    } else {
+        char name[256];
+        if (dir_resume_name(db, dh, prefix, plen, off, name, sizeof(name)) != 0) {
+            *err = EINVAL;
+            return NULL;
+        }
+        iter = dir_iter_after(db, prefix, plen, name);
+    }
+    if (!iter) *err = EIO;
+
+    if (dh && (off < DIR_OFF_MIN || dh->nmarks >= DIR_MARKS_MAX)) {
+        dh->nmarks = 0;
+        dh->names_len = 0;
+    }
+    return iter;
+}
+
 static void kvbfs_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-    if (ino == AGENTFS_VERSIONS_INO || vtree_is_vnode(ino)) {
-        fuse_reply_open(req, fi);
-        return;
+    if (!is_virtual_dir(ino)) {
+        struct kvbfs_inode_cache *ic = inode_get(ino);
+        if (!ic) {
+            fuse_reply_err(req, ENOENT);
+            return;
+        }
+
+        pthread_rwlock_rdlock(&ic->lock);
+        int is_dir = S_ISDIR(ic->inode.mode);
+        pthread_rwlock_unlock(&ic->lock);
+
+        inode_put(ic);
+
+        if (!is_dir) {
+            fuse_reply_err(req, ENOTDIR);
+            return;
+        }
     }
 
-    struct kvbfs_inode_cache *ic = inode_get(ino);
-    if (!ic) {
-        fuse_reply_err(req, ENOENT);
+    struct dir_handle *dh = calloc(1, sizeof(*dh));
+    if (!dh) {
+        fuse_reply_err(req, ENOMEM);
         return;
     }
+    pthread_mutex_init(&dh->lock, NULL);
+    fi->fh = (uint64_t)(uintptr_t)dh;
 
-    pthread_rwlock_rdlock(&ic->lock);
-    int is_dir = S_ISDIR(ic->inode.mode);
-    pthread_rwlock_unlock(&ic->lock);
+    if (fuse_reply_open(req, fi) != 0) {
+        pthread_mutex_destroy(&dh->lock);
+        free(dh);
+    }
+}
 
-    inode_put(ic);
+static void kvbfs_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    (void)ino;
+    struct dir_handle *dh = (struct dir_handle *)(uintptr_t)fi->fh;
+    if (dh) {
+        pthread_mutex_destroy(&dh->lock);
+        free(dh->marks);
+        free(dh->names);
+        free(dh);
+    }
+    fuse_reply_err(req, 0);
+}
 
-    if (!is_dir) {
-        fuse_reply_err(req, ENOTDIR);
-        return;
+/* readdir 与 readdirplus 共用的回复缓冲 */
+struct dir_buf {
+    fuse_req_t req;
+    char *buf;
+    size_t size;
+    size_t used;
+    int plus;
+};
+
+/*
+ * 向回复缓冲添加一项，缓冲区已满返回 -1。
+ * readdirplus 下 e 为 NULL 的项只带类型 (ino = 0)，内核会单独 lookup。
+ */
+static int dir_buf_add(struct dir_buf *d, const char *name,
+                       const struct stat *st, const struct fuse_entry_param *e,
+                       off_t next_off)
+{
+    size_t rem = d->size - d->used;
+    size_t es;
+
+    if (d->plus) {
+        struct fuse_entry_param pe;
+        if (e) {
+            pe = *e;
+        } else {
+            memset(&pe, 0, sizeof(pe));
+            pe.attr = *st;
+        }
+        es = fuse_add_direntry_plus(d->req, d->buf + d->used, rem, name,
+                                    &pe, next_off);
+    } else {
+        es = fuse_add_direntry(d->req, d->buf + d->used, rem, name,
+                               e ? &e->attr : st, next_off);
     }
 
-    fuse_reply_open(req, fi);
+    if (es > rem) return -1;
+    d->used += es;
+    return 0;
 }
 
-static void kvbfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
-                          off_t off, struct fuse_file_info *fi)
+struct dir_item {
+    char name[256];
+    struct kvbfs_dirent de;
+    off_t next_off;
+};
+
+/*
+ * 读取一批子 inode：先查 inode 缓存，其余用一次 kv_multi_get。
+ * need_all 为 0 时只读取类型未知 (旧格式) 的项。
+ */
+static void dir_load_inodes(const struct dir_item *items, size_t n,
+                            int need_all, struct kvbfs_inode *out, int *valid)
 {
-    (void)fi;
+    char kbuf[DIR_CHUNK][32];
+    const char *keys[DIR_CHUNK];
+    size_t klens[DIR_CHUNK];
+    size_t idx[DIR_CHUNK];
+    char *vals[DIR_CHUNK];
+    size_t vlens[DIR_CHUNK];
+    size_t m = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        valid[i] = 0;
+        if (!need_all && items[i].de.type != 0) continue;
+        if (inode_peek(items[i].de.ino, &out[i]) == 0) {
+            valid[i] = 1;
+            continue;
+        }
+        klens[m] = kvbfs_key_inode(kbuf[m], sizeof(kbuf[m]), items[i].de.ino);
+        keys[m] = kbuf[m];
+        idx[m] = i;
+        m++;
+    }
+    if (m == 0) return;
+
+    kv_multi_get(g_ctx->db, m, keys, klens, vals, vlens);
+    for (size_t j = 0; j < m; j++) {
+        if (vals[j] && vlens[j] == sizeof(struct kvbfs_inode)) {
+            memcpy(&out[idx[j]], vals[j], sizeof(struct kvbfs_inode));
+            valid[idx[j]] = 1;
+        }
+        free(vals[j]);
+    }
+}
+
+/* 取出迭代器当前目录项的名字 (跳过 "d:<parent>:" 前缀) */
+static void dir_iter_name(kv_iterator_t *iter, int plen, char *name, size_t namelen)
+{
+    size_t klen;
+    const char *k = kv_iter_key(iter, &klen);
+    size_t nlen = klen - plen;
+    if (nlen >= namelen) nlen = namelen - 1;
+    memcpy(name, k + plen, nlen);
+    name[nlen] = '\0';
+}
+
+/* 把 real_dir 的子项列成只读的虚拟目录 (.versions 树) */
+static int dir_list_vdirs(struct dir_buf *d, struct dir_handle *dh,
+                          uint64_t real_dir, off_t off)
+{
+    char prefix[64];
+    int plen = kvbfs_key_dirent_prefix(prefix, sizeof(prefix), real_dir);
+    int err;
+    kv_iterator_t *iter = dir_iter_at(g_ctx->db, dh, prefix, plen, off, &err);
+    if (!iter) return err;
+
+    for (; kv_iter_valid(iter); kv_iter_next(iter)) {
+        size_t vlen;
+        const char *val = kv_iter_value(iter, &vlen);
+        struct kvbfs_dirent de;
+        if (kvbfs_dirent_decode(val, vlen, &de) != 0) continue;
+
+        char nbuf[256];
+        dir_iter_name(iter, plen, nbuf, sizeof(nbuf));
+        off_t cookie = dir_cookie(nbuf, strlen(nbuf));
+
+        struct stat st = {.st_ino = vnode_peek(0, de.ino, 0, 0),
+                          .st_mode = S_IFDIR | 0555};
+        if (dir_buf_add(d, nbuf, &st, NULL, cookie) != 0) break;
+        dir_handle_mark(dh, cookie, nbuf);
+    }
+    kv_iter_free(iter);
+    return 0;
+}
+
+/* 列出 /.snapshots: 名字取自 ss: 记录，按名字排序 */
+static int dir_list_snapshots(struct dir_buf *d, struct dir_handle *dh, off_t off)
+{
+    int err;
+    kv_iterator_t *iter = dir_iter_at(g_ctx->db, dh, "ss:", 3, off, &err);
+    if (!iter) return err;
+
+    for (; kv_iter_valid(iter); kv_iter_next(iter)) {
+        char nbuf[256];
+        dir_iter_name(iter, 3, nbuf, sizeof(nbuf));
+        off_t cookie = dir_cookie(nbuf, strlen(nbuf));
+
+        struct fssnap *s = fssnap_find(&g_ctx->snaps, nbuf);
+        if (!s) continue;
+        uint64_t id = s->id;
+        fssnap_put(&g_ctx->snaps, s);
+
+        struct stat st = {.st_ino = vnode_peek(3, KVBFS_ROOT_INO, 0, id),
+                          .st_mode = S_IFDIR | 0555};
+        if (dir_buf_add(d, nbuf, &st, NULL, cookie) != 0) break;
+        dir_handle_mark(dh, cookie, nbuf);
+    }
+    kv_iter_free(iter);
+    return 0;
+}
+
+/* 列出快照中的目录 real_dir；类型取自检查点中的目录项 */
+static int dir_list_snap(struct dir_buf *d, struct dir_handle *dh,
+                         struct vtree_node *vn, struct fssnap *s, off_t off)
+{
+    char prefix[64];
+    int plen = kvbfs_key_dirent_prefix(prefix, sizeof(prefix), vn->real_ino);
+    int err;
+    kv_iterator_t *iter = dir_iter_at(s->db, dh, prefix, plen, off, &err);
+    if (!iter) return err;
+
+    for (; kv_iter_valid(iter); kv_iter_next(iter)) {
+        size_t vlen;
+        const char *val = kv_iter_value(iter, &vlen);
+        struct kvbfs_dirent de;
+        if (kvbfs_dirent_decode(val, vlen, &de) != 0) continue;
+
+        char nbuf[256];
+        dir_iter_name(iter, plen, nbuf, sizeof(nbuf));
+        off_t cookie = dir_cookie(nbuf, strlen(nbuf));
+
+        struct kvbfs_inode ci;
+        if (de.type == 0 && snap_inode_load(s, de.ino, &ci) == 0)
+            de.type = ci.mode & S_IFMT;
+
+        struct stat st = {.st_ino = vnode_peek(3, de.ino, 0, vn->snap),
+                          .st_mode = de.type};
+        if (dir_buf_add(d, nbuf, &st, NULL, cookie) != 0) break;
+        dir_handle_mark(dh, cookie, nbuf);
+    }
+    kv_iter_free(iter);
+    return 0;
+}
+
+static void dir_list(fuse_req_t req, fuse_ino_t ino, size_t size,
+                     off_t off, int plus, struct dir_handle *dh)
+{
+    /* 批处理数组与回复缓冲区共用线程的请求缓冲区 */
+    size_t items_len = DIR_CHUNK * sizeof(struct dir_item);
+    size_t scratch = items_len + DIR_CHUNK * sizeof(struct kvbfs_inode);
+    char *base = reqbuf_get(scratch + size);
+    if (!base) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    struct dir_item *items = (struct dir_item *)base;
+    struct kvbfs_inode *inodes = (struct kvbfs_inode *)(base + items_len);
+    char *buf = base + scratch;
+    struct dir_buf d = { .req = req, .buf = buf, .size = size, .plus = plus };
+    int err = 0;
 
     /* .versions root: list real root entries as virtual dirs */
     if (ino == AGENTFS_VERSIONS_INO) {
-        char *buf = malloc(size);
-        if (!buf) { fuse_reply_err(req, ENOMEM); return; }
-        size_t buf_used = 0;
-        off_t entry_idx = 0;
-
-        if (off <= 0) {
+        if (off < DIR_OFF_DOT) {
             struct stat st; versions_root_stat(&st);
-            size_t es = fuse_add_direntry(req, buf + buf_used, size - buf_used,
-                                          ".", &st, ++entry_idx);
-            if (es <= size - buf_used) buf_used += es;
+            if (dir_buf_add(&d, ".", &st, NULL, DIR_OFF_DOT) != 0) goto done;
         }
-        if (off <= 1) {
+        if (off < DIR_OFF_DOTDOT) {
             struct stat st = {.st_ino = KVBFS_ROOT_INO, .st_mode = S_IFDIR};
-            size_t es = fuse_add_direntry(req, buf + buf_used, size - buf_used,
-                                          "..", &st, ++entry_idx);
-            if (es <= size - buf_used) buf_used += es;
-        }
-
-        char prefix[64];
-        int prefix_len = kvbfs_key_dirent_prefix(prefix, sizeof(prefix), KVBFS_ROOT_INO);
-        kv_iterator_t *iter = kv_iter_prefix(g_ctx->db, prefix, prefix_len);
-        while (kv_iter_valid(iter)) {
-            entry_idx++;
-            if (entry_idx <= off) { kv_iter_next(iter); continue; }
-
-            size_t klen;
-            const char *k = kv_iter_key(iter, &klen);
-            const char *name = k + prefix_len;
-            size_t nlen = klen - prefix_len;
-            size_t vlen;
-            const char *val = kv_iter_value(iter, &vlen);
-            uint64_t child_real_ino = 0;
-            if (vlen == sizeof(uint64_t)) memcpy(&child_real_ino, val, sizeof(uint64_t));
-
-            char nbuf[256];
-            if (nlen >= sizeof(nbuf)) nlen = sizeof(nbuf) - 1;
-            memcpy(nbuf, name, nlen); nbuf[nlen] = '\0';
-
-            uint64_t vino = vtree_alloc_dir(&g_ctx->vtree, AGENTFS_VERSIONS_INO,
-                                            nbuf, child_real_ino);
-            struct stat st = {.st_ino = vino, .st_mode = S_IFDIR | 0555};
-            size_t es = fuse_add_direntry(req, buf + buf_used, size - buf_used,
-                                          nbuf, &st, entry_idx + 1);
-            if (es > size - buf_used) { kv_iter_free(iter); goto vr_done; }
-            buf_used += es;
-            kv_iter_next(iter);
+            if (dir_buf_add(&d, "..", &st, NULL, DIR_OFF_DOTDOT) != 0) goto done;
         }
-        kv_iter_free(iter);
-    vr_done:
-        fuse_reply_buf(req, buf, buf_used);
-        free(buf);
-        return;
+        err = dir_list_vdirs(&d, dh, KVBFS_ROOT_INO, off);
+        goto done;
+    }
+
+    if (ino == AGENTFS_SNAPSHOTS_INO) {
+        if (off < DIR_OFF_DOT) {
+            struct stat st; snapshots_root_stat(&st);
+            if (dir_buf_add(&d, ".", &st, NULL, DIR_OFF_DOT) != 0) goto done;
+        }
+        if (off < DIR_OFF_DOTDOT) {
+            struct stat st = {.st_ino = KVBFS_ROOT_INO, .st_mode = S_IFDIR};
+            if (dir_buf_add(&d, "..", &st, NULL, DIR_OFF_DOTDOT) != 0) goto done;
+        }
+        err = dir_list_snapshots(&d, dh, off);
+        goto done;
     }
 
     /* Virtual tree node readdir */
     if (vtree_is_vnode(ino)) {
-        struct vtree_node *vn = vtree_get(&g_ctx->vtree, ino);
-        if (!vn || vn->is_version_file) { fuse_reply_err(req, ENOTDIR); return; }
-
-        char *buf = malloc(size);
-        if (!buf) { fuse_reply_err(req, ENOMEM); return; }
-        size_t buf_used = 0;
-        off_t entry_idx = 0;
+        struct vtree_node vn_buf, *vn = vtree_get(&g_ctx->vtree, ino, &vn_buf);
+        if (vn && vn->is_version_file == 3) {
+            struct fssnap *s = fssnap_get(&g_ctx->snaps, vn->snap);
+            struct stat st;
+            if (!s || snap_stat(s, vn->real_ino, &st) != 0) {
+                fssnap_put(&g_ctx->snaps, s);
+                fuse_reply_err(req, ENOENT);
+                return;
+            }
+            if (!S_ISDIR(st.st_mode)) {
+                fssnap_put(&g_ctx->snaps, s);
+                fuse_reply_err(req, ENOTDIR);
+                return;
+            }
+            if (off < DIR_OFF_DOT &&
+                dir_buf_add(&d, ".", &st, NULL, DIR_OFF_DOT) != 0) {
+                fssnap_put(&g_ctx->snaps, s);
+                goto done;
+            }
+            if (off < DIR_OFF_DOTDOT) {
+                struct stat pst = {.st_ino = ino, .st_mode = S_IFDIR};
+                if (dir_buf_add(&d, "..", &pst, NULL, DIR_OFF_DOTDOT) != 0) {
+                    fssnap_put(&g_ctx->snaps, s);
+                    goto done;
+                }
+            }
+            err = dir_list_snap(&d, dh, vn, s, off);
+            fssnap_put(&g_ctx->snaps, s);
+            goto done;
+        }
+        if (!vn || vn->is_version_file) {
+            fuse_reply_err(req, ENOTDIR);
+            return;
+        }
 
-        if (off <= 0) {
+        if (off < DIR_OFF_DOT) {
             struct stat st; vnode_stat(vn, &st);
-            size_t es = fuse_add_direntry(req, buf + buf_used, size - buf_used,
-                                          ".", &st, ++entry_idx);
-            if (es <= size - buf_used) buf_used += es;
+            if (dir_buf_add(&d, ".", &st, NULL, DIR_OFF_DOT) != 0) goto done;
         }
-        if (off <= 1) {
+        if (off < DIR_OFF_DOTDOT) {
             struct stat st = {.st_ino = ino, .st_mode = S_IFDIR};
-            size_t es = fuse_add_direntry(req, buf + buf_used, size - buf_used,
-                                          "..", &st, ++entry_idx);
-            if (es <= size - buf_used) buf_used += es;
+            if (dir_buf_add(&d, "..", &st, NULL, DIR_OFF_DOTDOT) != 0) goto done;
         }
 
         struct kvbfs_inode ri;
@@ -793,73 +1494,33 @@ static void kvbfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
         if (inode_load(vn->real_ino, &ri) == 0) is_dir = S_ISDIR(ri.mode);
 
         if (is_dir) {
-            char prefix[64];
-            int plen = kvbfs_key_dirent_prefix(prefix, sizeof(prefix), vn->real_ino);
-            kv_iterator_t *iter = kv_iter_prefix(g_ctx->db, prefix, plen);
-            while (kv_iter_valid(iter)) {
-                entry_idx++;
-                if (entry_idx <= off) { kv_iter_next(iter); continue; }
-                size_t klen;
-                const char *k = kv_iter_key(iter, &klen);
-                const char *name = k + plen;
-                size_t nlen = klen - plen;
-                size_t vlen;
-                const char *val = kv_iter_value(iter, &vlen);
-                uint64_t child_real = 0;
-                if (vlen == sizeof(uint64_t)) memcpy(&child_real, val, sizeof(uint64_t));
-
-                char nbuf[256];
-                if (nlen >= sizeof(nbuf)) nlen = sizeof(nbuf) - 1;
-                memcpy(nbuf, name, nlen); nbuf[nlen] = '\0';
-
-                uint64_t cvino = vtree_alloc_dir(&g_ctx->vtree, ino, nbuf, child_real);
-                struct stat st = {.st_ino = cvino, .st_mode = S_IFDIR | 0555};
-                size_t es = fuse_add_direntry(req, buf + buf_used, size - buf_used,
-                                              nbuf, &st, entry_idx + 1);
-                if (es > size - buf_used) { kv_iter_free(iter); goto vn_done; }
-                buf_used += es;
-                kv_iter_next(iter);
-            }
-            kv_iter_free(iter);
+            err = dir_list_vdirs(&d, dh, vn->real_ino, off);
         } else {
-            /* real_ino is a file: enumerate version numbers */
-            char prefix[64];
-            int plen = kvbfs_key_version_meta_prefix(prefix, sizeof(prefix), vn->real_ino);
-            kv_iterator_t *iter = kv_iter_prefix(g_ctx->db, prefix, plen);
-            while (kv_iter_valid(iter)) {
-                entry_idx++;
-                if (entry_idx <= off) { kv_iter_next(iter); continue; }
-
-                size_t klen;
-                const char *k = kv_iter_key(iter, &klen);
-                const char *ver_str = k + plen;
-                size_t ver_len = klen - plen;
-
-                char nbuf[32];
-                if (ver_len >= sizeof(nbuf)) ver_len = sizeof(nbuf) - 1;
-                memcpy(nbuf, ver_str, ver_len); nbuf[ver_len] = '\0';
-                uint64_t ver = strtoull(nbuf, NULL, 10);
+            /* real_ino is a file: enumerate version numbers, cookie = ver + DIR_OFF_MIN */
+            struct version_index vi;
+            if (version_index_load(vn->real_ino, &vi) != 0) {
+                fuse_reply_err(req, EIO);
+                return;
+            }
+            for (size_t i = 0; i < vi.n; i++) {
+                uint64_t ver = vi.e[i].ver;
+                if (off >= DIR_OFF_MIN && ver <= (uint64_t)(off - DIR_OFF_MIN))
+                    continue;
 
                 /* Expose 1-indexed names to the user (internal storage is 0-indexed) */
                 char display_name[32];
                 snprintf(display_name, sizeof(display_name), "%llu",
                          (unsigned long long)(ver + 1));
 
-                uint64_t cvino = vtree_alloc_vfile(&g_ctx->vtree, ino, display_name,
-                                                   vn->real_ino, ver);
-                struct stat st = {.st_ino = cvino, .st_mode = S_IFREG | 0444};
-                size_t es = fuse_add_direntry(req, buf + buf_used, size - buf_used,
-                                              display_name, &st, entry_idx + 1);
-                if (es > size - buf_used) { kv_iter_free(iter); goto vn_done; }
-                buf_used += es;
-                kv_iter_next(iter);
+                struct stat st = {.st_ino = vnode_peek(1, vn->real_ino, ver, 0),
+                                  .st_mode = S_IFREG | 0444};
+                if (dir_buf_add(&d, display_name, &st, NULL,
+                                (off_t)ver + DIR_OFF_MIN) != 0)
+                    break;
             }
-            kv_iter_free(iter);
+            version_index_free(&vi);
         }
-    vn_done:
-        fuse_reply_buf(req, buf, buf_used);
-        free(buf);
-        return;
+        goto done;
     }
 
     struct kvbfs_inode_cache *ic = inode_get(ino);
@@ -869,124 +1530,173 @@ static void kvbfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
     }
     inode_put(ic);
 
-    char *buf = malloc(size);
-    if (!buf) {
-        fuse_reply_err(req, ENOMEM);
-        return;
-    }
-
-    size_t buf_used = 0;
-    off_t entry_idx = 0;
-
     /* . and .. entries */
-    if (off <= 0) {
+    if (off < DIR_OFF_DOT) {
         struct stat st = {.st_ino = ino, .st_mode = S_IFDIR};
-        size_t entsize = fuse_add_direntry(req, buf + buf_used, size - buf_used,
-                                           ".", &st, ++entry_idx);
-        if (entsize > size - buf_used) goto done;
-        buf_used += entsize;
+        if (dir_buf_add(&d, ".", &st, NULL, DIR_OFF_DOT) != 0) goto done;
     }
-
-    if (off <= 1) {
+    if (off < DIR_OFF_DOTDOT) {
         struct stat st = {.st_ino = ino, .st_mode = S_IFDIR};  /* parent, simplified */
-        size_t entsize = fuse_add_direntry(req, buf + buf_used, size - buf_used,
-                                           "..", &st, ++entry_idx);
-        if (entsize > size - buf_used) goto done;
-        buf_used += entsize;
+        if (dir_buf_add(&d, "..", &st, NULL, DIR_OFF_DOTDOT) != 0) goto done;
+    }
+
+    /* Virtual entries of the root come before the real ones (fixed offsets) */
+    if (ino == KVBFS_ROOT_INO) {
+#ifdef CFS_MEMORY
+        if (off < DIR_OFF_CTL) {
+            struct stat ctl_st;
+            agentfs_ctl_stat(&ctl_st);
+            if (dir_buf_add(&d, AGENTFS_CTL_NAME, &ctl_st, NULL, DIR_OFF_CTL) != 0)
+                goto done;
+        }
+        if (off < DIR_OFF_EVENTS) {
+            struct stat evt_st;
+            agentfs_events_stat(&evt_st);
+            if (dir_buf_add(&d, AGENTFS_EVENTS_NAME, &evt_st, NULL, DIR_OFF_EVENTS) != 0)
+                goto done;
+        }
+#endif
+        if (off < DIR_OFF_VERSIONS) {
+            struct stat ver_st;
+            versions_root_stat(&ver_st);
+            if (dir_buf_add(&d, AGENTFS_VERSIONS_NAME, &ver_st, NULL, DIR_OFF_VERSIONS) != 0)
+                goto done;
+        }
+        if (off < DIR_OFF_SNAPSHOTS) {
+            struct stat snap_st;
+            snapshots_root_stat(&snap_st);
+            if (dir_buf_add(&d, AGENTFS_SNAPSHOTS_NAME, &snap_st, NULL,
+                            DIR_OFF_SNAPSHOTS) != 0)
+                goto done;
+        }
     }
 
-    /* 遍历目录项 */
+    /* 遍历目录项：类型取自目录项，readdirplus 按批读取子 inode */
     char prefix[64];
     int prefix_len = kvbfs_key_dirent_prefix(prefix, sizeof(prefix), ino);
 
-    kv_iterator_t *iter = kv_iter_prefix(g_ctx->db, prefix, prefix_len);
-    while (kv_iter_valid(iter)) {
-        entry_idx++;
-
-        if (entry_idx <= off) {
+    int valid[DIR_CHUNK];
+
+    kv_iterator_t *iter = dir_iter_at(g_ctx->db, dh, prefix, prefix_len, off, &err);
+    int full = 0;
+    while (!full && kv_iter_valid(iter)) {
+        size_t n = 0;
+        while (n < DIR_CHUNK && kv_iter_valid(iter)) {
+            size_t val_len;
+            const char *val = kv_iter_value(iter, &val_len);
+
+            struct dir_item *it = &items[n];
+            if (kvbfs_dirent_decode(val, val_len, &it->de) == 0) {
+                dir_iter_name(iter, prefix_len, it->name, sizeof(it->name));
+                it->next_off = dir_cookie(it->name, strlen(it->name));
+                n++;
+            }
             kv_iter_next(iter);
-            continue;
         }
 
-        size_t key_len;
-        const char *key = kv_iter_key(iter, &key_len);
+        dir_load_inodes(items, n, plus, inodes, valid);
 
-        /* 提取文件名：跳过 "d:<parent>:" 前缀 */
-        const char *name = key + prefix_len;
-        size_t name_len = key_len - prefix_len;
+        for (size_t i = 0; i < n; i++) {
+            struct fuse_entry_param e;
+            memset(&e, 0, sizeof(e));
+            if (valid[i]) {
+                inode_to_stat(&inodes[i], &e.attr);
+                e.ino = items[i].de.ino;
+                e.attr_timeout = 1.0;
+                e.entry_timeout = 1.0;
+            } else {
+                e.attr.st_ino = items[i].de.ino;
+                e.attr.st_mode = items[i].de.type;
+            }
 
-        /* 获取子 inode 号 */
-        size_t val_len;
-        const char *val = kv_iter_value(iter, &val_len);
-        uint64_t child_ino;
-        memcpy(&child_ino, val, sizeof(uint64_t));
-
-        /* 获取子 inode 属性 */
-        struct kvbfs_inode child_inode;
-        struct stat st = {0};
-        if (inode_load(child_ino, &child_inode) == 0) {
-            st.st_ino = child_ino;
-            st.st_mode = child_inode.mode;
-        }
-
-        /* 需要 null-terminated name */
-        char name_buf[256];
-        if (name_len >= sizeof(name_buf)) name_len = sizeof(name_buf) - 1;
-        memcpy(name_buf, name, name_len);
-        name_buf[name_len] = '\0';
-
-        size_t entsize = fuse_add_direntry(req, buf + buf_used, size - buf_used,
-                                           name_buf, &st, entry_idx + 1);
-        if (entsize > size - buf_used) {
-            kv_iter_free(iter);
-            goto done;
+            int r = valid[i] ? dir_buf_add(&d, items[i].name, NULL, &e, items[i].next_off)
+                             : dir_buf_add(&d, items[i].name, &e.attr, NULL, items[i].next_off);
+            if (r != 0) {
+                full = 1;
+                break;
+            }
+            if (plus && valid[i])
+                inode_lookup_inc(e.ino);
+            dir_handle_mark(dh, items[i].next_off, items[i].name);
         }
-        buf_used += entsize;
-
-        kv_iter_next(iter);
     }
     kv_iter_free(iter);
 
-#ifdef CFS_MEMORY
-    /* Append virtual .agentfs and .events entries when listing root */
-    if (ino == KVBFS_ROOT_INO) {
-        entry_idx++;
-        if (entry_idx > off) {
-            struct stat ctl_st;
-            agentfs_ctl_stat(&ctl_st);
-            size_t entsize = fuse_add_direntry(req, buf + buf_used, size - buf_used,
-                                               AGENTFS_CTL_NAME, &ctl_st, entry_idx + 1);
-            if (entsize <= size - buf_used)
-                buf_used += entsize;
-        }
-        entry_idx++;
-        if (entry_idx > off) {
-            struct stat evt_st;
-            agentfs_events_stat(&evt_st);
-            size_t entsize = fuse_add_direntry(req, buf + buf_used, size - buf_used,
-                                               AGENTFS_EVENTS_NAME, &evt_st, entry_idx + 1);
-            if (entsize <= size - buf_used)
-                buf_used += entsize;
-        }
-        entry_idx++;
-        if (entry_idx > off) {
-            struct stat ver_st;
-            versions_root_stat(&ver_st);
-            size_t entsize = fuse_add_direntry(req, buf + buf_used, size - buf_used,
-                                               AGENTFS_VERSIONS_NAME, &ver_st, entry_idx + 1);
-            if (entsize <= size - buf_used)
-                buf_used += entsize;
-        }
+done:
+    if (err != 0 && d.used == 0)
+        fuse_reply_err(req, err);
+    else
+        fuse_reply_buf(req, buf, d.used);
+}
+
+static void dir_read(fuse_req_t req, fuse_ino_t ino, size_t size,
+                     off_t off, int plus, const struct fuse_file_info *fi)
+{
+    struct dir_handle *dh = fi ? (struct dir_handle *)(uintptr_t)fi->fh : NULL;
+    if (dh) pthread_mutex_lock(&dh->lock);
+    dir_list(req, ino, size, off, plus, dh);
+    if (dh) pthread_mutex_unlock(&dh->lock);
+}
+
+static void kvbfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+                          off_t off, struct fuse_file_info *fi)
+{
+    io_settle(ino);
+    if (io_defer(IO_READDIR, req, ino, size, off, fi, NULL) == 0) return;
+    dir_read(req, ino, size, off, 0, fi);
+}
+
+/* 目录项与属性一次返回，省去 ls -l / find 的逐项 lookup */
+static void kvbfs_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size,
+                              off_t off, struct fuse_file_info *fi)
+{
+    io_settle(ino);
+    if (io_defer(IO_READDIRPLUS, req, ino, size, off, fi, NULL) == 0) return;
+    dir_read(req, ino, size, off, 1, fi);
+}
+
+/*
+ * mkdir /.snapshots/<name>: 先完成排队的写入并写回脏 inode，
+ * 检查点即包含此前所有已返回的写操作
+ */
+static void snapshot_create(fuse_req_t req, const char *name)
+{
+    if (iopool_running(&g_ctx->iopool))
+        iopool_wait(&g_ctx->iopool, 0);
+    inode_sync_all();
+
+    uint64_t id;
+    int err = fssnap_create(&g_ctx->snaps, name, &id);
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
     }
-#endif
 
-done:
-    fuse_reply_buf(req, buf, buf_used);
-    free(buf);
+    struct fssnap *s = fssnap_get(&g_ctx->snaps, id);
+    struct fuse_entry_param e;
+    memset(&e, 0, sizeof(e));
+    e.ino = s ? snap_root_vino(s) : 0;
+    if (!e.ino || snap_stat(s, KVBFS_ROOT_INO, &e.attr) != 0) {
+        if (e.ino) vtree_forget(&g_ctx->vtree, e.ino, 1);
+        fssnap_put(&g_ctx->snaps, s);
+        fuse_reply_err(req, EIO);
+        return;
+    }
+    fssnap_put(&g_ctx->snaps, s);
+    fuse_reply_entry(req, &e);
 }
 
 static void kvbfs_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
 {
+    if (parent == AGENTFS_SNAPSHOTS_INO) {
+        snapshot_create(req, name);
+        return;
+    }
+    if (is_virtual_dir(parent)) {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+
     /* 检查父目录存在且是目录 */
     struct kvbfs_inode_cache *pic = inode_get(parent);
     if (!pic) {
@@ -1026,7 +1736,8 @@ static void kvbfs_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mod
     inode_sync(ic);
 
     /* 添加目录项 */
-    if (dirent_add(parent, name, ic->inode.ino) != 0) {
+    struct kvbfs_usage cu = { 0, 1, 0 };
+    if (dirent_add(parent, name, ic->inode.ino, ic->inode.mode, &cu) != 0) {
         inode_delete(ic->inode.ino);
         inode_put(ic);
         inode_put(pic);
@@ -1054,27 +1765,29 @@ static void kvbfs_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mod
 
     inode_put(ic);
 
-    fuse_reply_entry(req, &e);
+    reply_entry(req, &e);
 
 #ifdef CFS_MEMORY
     events_emit(&g_ctx->events, EVT_MKDIR, e.ino, name);
 #endif
 }
 
-static void kvbfs_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+/*
+ * 从父目录摘除子目录：目录项、inode 和父目录 nlink 在同一批次提交。
+ * recursive 为真时不检查是否为空，子树由后台 GC 逐层回收。
+ * 成功返回 0，否则返回 errno。
+ */
+static int dir_detach(uint64_t parent, const char *name, int recursive,
+                      uint64_t *out_ino)
 {
     /* 查找目标目录 */
     uint64_t child_ino = dirent_lookup(parent, name);
-    if (child_ino == 0) {
-        fuse_reply_err(req, ENOENT);
-        return;
-    }
+    if (child_ino == 0)
+        return ENOENT;
 
     struct kvbfs_inode_cache *ic = inode_get(child_ino);
-    if (!ic) {
-        fuse_reply_err(req, ENOENT);
-        return;
-    }
+    if (!ic)
+        return ENOENT;
 
     pthread_rwlock_rdlock(&ic->lock);
     int is_dir = S_ISDIR(ic->inode.mode);
@@ -1082,42 +1795,89 @@ static void kvbfs_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
 
     if (!is_dir) {
         inode_put(ic);
-        fuse_reply_err(req, ENOTDIR);
-        return;
+        return ENOTDIR;
     }
 
     /* 检查目录是否为空 */
-    if (!dirent_is_empty(child_ino)) {
+    if (!recursive && !dirent_is_empty(child_ino)) {
         inode_put(ic);
-        fuse_reply_err(req, ENOTEMPTY);
-        return;
+        return ENOTEMPTY;
     }
 
-    /* 删除目录项 */
-    if (dirent_remove(parent, name) != 0) {
+    kv_batch_t *batch = kv_batch_new();
+    if (!batch) {
         inode_put(ic);
-        fuse_reply_err(req, EIO);
-        return;
+        return EIO;
     }
 
-    /* 减少父目录 nlink */
+    /* 减少父目录 nlink (inode 锁在用量树锁之外获取) */
     struct kvbfs_inode_cache *pic = inode_get(parent);
     if (pic) {
         pthread_rwlock_wrlock(&pic->lock);
         if (pic->inode.nlink > 0) pic->inode.nlink--;
+        inode_save_batch(batch, &pic->inode);
         pthread_rwlock_unlock(&pic->lock);
-        inode_sync(pic);
-        inode_put(pic);
     }
 
-    /* 删除 inode */
+    /*
+     * 整个子树的用量从祖先目录中扣除；递归删除时子树内可能仍有计入，
+     * 独占用量树锁直到提交，读到的子树总量才不会遗漏。
+     */
+    if (recursive)
+        usage_move_begin(&g_ctx->usage);
+    else
+        usage_charge_begin(&g_ctx->usage);
+    struct kvbfs_usage cu;
+    usage_child(g_ctx->db, child_ino, S_IFDIR, 0, &cu);
+
+    int ret = -1;
+    if (dirent_remove_batch(batch, parent, name, child_ino, &cu) == 0) {
+        reclaim_batch(batch, child_ino);
+        ret = kv_batch_commit(g_ctx->db, batch);
+    }
+    usage_charge_end(&g_ctx->usage);
+    kv_batch_free(batch);
+    dirent_changed(parent, name);
+    if (ret != 0) {
+        if (pic) {
+            pthread_rwlock_wrlock(&pic->lock);
+            pic->inode.nlink++;
+            pthread_rwlock_unlock(&pic->lock);
+            inode_put(pic);
+        }
+        inode_put(ic);
+        return EIO;
+    }
+    inode_put(pic);
+
+    /* 删除 inode；子树内已缓存的路径全部失效 */
     inode_put(ic);
-    xattr_delete_all(child_ino);
-    version_delete_all(child_ino);
-#ifdef CFS_MEMORY
-    mem_delete_embeddings(g_ctx->db, child_ino);
-#endif
-    inode_delete(child_ino);
+    reclaim_start(child_ino);
+    path_invalidate(&g_ctx->paths);
+    usage_forget(&g_ctx->usage, child_ino);
+
+    *out_ino = child_ino;
+    return 0;
+}
+
+static void kvbfs_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    /* rmdir /.snapshots/<name> 删除快照，仍在读取的文件读完后再释放 */
+    if (parent == AGENTFS_SNAPSHOTS_INO) {
+        fuse_reply_err(req, fssnap_delete(&g_ctx->snaps, name));
+        return;
+    }
+    if (is_virtual_dir(parent)) {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+
+    uint64_t child_ino;
+    int err = dir_detach(parent, name, 0, &child_ino);
+    if (err != 0) {
+        fuse_reply_err(req, err);
+        return;
+    }
 
 #ifdef CFS_MEMORY
     events_emit(&g_ctx->events, EVT_RMDIR, child_ino, name);
@@ -1128,6 +1888,11 @@ static void kvbfs_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
 static void kvbfs_create(fuse_req_t req, fuse_ino_t parent, const char *name,
                          mode_t mode, struct fuse_file_info *fi)
 {
+    if (is_virtual_dir(parent)) {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+
     /* 检查父目录 */
     struct kvbfs_inode_cache *pic = inode_get(parent);
     if (!pic) {
@@ -1159,7 +1924,8 @@ static void kvbfs_create(fuse_req_t req, fuse_ino_t parent, const char *name,
     }
 
     /* 添加目录项 */
-    if (dirent_add(parent, name, ic->inode.ino) != 0) {
+    struct kvbfs_usage cu = { 0, 1, 0 };
+    if (dirent_add(parent, name, ic->inode.ino, ic->inode.mode, &cu) != 0) {
         inode_delete(ic->inode.ino);
         inode_put(ic);
         fuse_reply_err(req, EIO);
@@ -1202,6 +1968,7 @@ static void kvbfs_create(fuse_req_t req, fuse_ino_t parent, const char *name,
 
     inode_put(ic);
 
+    inode_lookup_inc(e.ino);
     fuse_reply_create(req, &e, fi);
 
 #ifdef CFS_MEMORY
@@ -1211,6 +1978,11 @@ static void kvbfs_create(fuse_req_t req, fuse_ino_t parent, const char *name,
 
 static void kvbfs_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
+    if (is_virtual_dir(parent)) {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+
     /* 查找文件 */
     uint64_t child_ino = dirent_lookup(parent, name);
     if (child_ino == 0) {
@@ -1226,7 +1998,6 @@ static void kvbfs_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
 
     pthread_rwlock_rdlock(&ic->lock);
     int is_dir = S_ISDIR(ic->inode.mode);
-    uint64_t blocks = ic->inode.blocks;
     pthread_rwlock_unlock(&ic->lock);
 
     if (is_dir) {
@@ -1235,30 +2006,49 @@ static void kvbfs_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
         return;
     }
 
-    /* 删除目录项 */
-    if (dirent_remove(parent, name) != 0) {
+    /*
+     * 删除目录项，减少 nlink，为 0 则删除；同批提交。
+     * 写锁保持到提交，期间 inode_sync 不会按旧链接计入大小变化。
+     */
+    kv_batch_t *batch = kv_batch_new();
+    pthread_rwlock_wrlock(&ic->lock);
+    struct kvbfs_usage cu;
+    usage_child(g_ctx->db, child_ino, ic->inode.mode, ic->synced_size, &cu);
+    usage_charge_begin(&g_ctx->usage);
+    if (!batch || dirent_remove_batch(batch, parent, name, child_ino, &cu) != 0) {
+        usage_charge_end(&g_ctx->usage);
+        pthread_rwlock_unlock(&ic->lock);
+        kv_batch_free(batch);
         inode_put(ic);
         fuse_reply_err(req, EIO);
         return;
     }
 
-    /* 减少 nlink，如果为 0 则删除 */
-    pthread_rwlock_wrlock(&ic->lock);
     if (ic->inode.nlink > 0) ic->inode.nlink--;
     int should_delete = (ic->inode.nlink == 0);
+    if (should_delete)
+        reclaim_batch(batch, child_ino);
+    else
+        inode_save_nlink_batch(batch, ic);
+
+    int ret = kv_batch_commit(g_ctx->db, batch);
+    usage_charge_end(&g_ctx->usage);
+    if (ret != 0)
+        ic->inode.nlink++;
     pthread_rwlock_unlock(&ic->lock);
+    kv_batch_free(batch);
+    dirent_changed(parent, name);
+    if (ret != 0) {
+        inode_put(ic);
+        fuse_reply_err(req, EIO);
+        return;
+    }
 
     inode_put(ic);
+    path_forget(&g_ctx->paths, child_ino);
 
-    if (should_delete) {
-        delete_file_blocks(child_ino, blocks);
-        xattr_delete_all(child_ino);
-        version_delete_all(child_ino);
-#ifdef CFS_MEMORY
-        mem_delete_embeddings(g_ctx->db, child_ino);
-#endif
-        inode_delete(child_ino);
-    }
+    if (should_delete)
+        reclaim_start(child_ino);
 
 #ifdef CFS_LOCAL_LLM
     /* Remove from session hash set if parent is /sessions */
@@ -1281,8 +2071,51 @@ static void kvbfs_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
     fuse_reply_err(req, 0);
 }
 
+/*
+ * 打开快照中的文件：句柄持有快照引用，删除快照不影响已打开的文件。
+ * 内容不会再变，页缓存跨打开保留。
+ */
+static void snap_open(fuse_req_t req, struct vtree_node *vn, struct fuse_file_info *fi)
+{
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+
+    struct fssnap *s = fssnap_get(&g_ctx->snaps, vn->snap);
+    struct kvbfs_inode inode;
+    if (!s || snap_inode_load(s, vn->real_ino, &inode) != 0) {
+        fssnap_put(&g_ctx->snaps, s);
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if (!S_ISREG(inode.mode)) {
+        fssnap_put(&g_ctx->snaps, s);
+        fuse_reply_err(req, S_ISDIR(inode.mode) ? EISDIR : EINVAL);
+        return;
+    }
+
+    struct version_fh *vfh = calloc(1, sizeof(*vfh));
+    if (!vfh) {
+        fssnap_put(&g_ctx->snaps, s);
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    vfh->real_ino = vn->real_ino;
+    vfh->snap = s;
+    vfh->size = inode.size;
+    fi->fh = (uint64_t)(uintptr_t)vfh;
+    fi->keep_cache = 1;
+    if (fuse_reply_open(req, fi) != 0) {
+        fssnap_put(&g_ctx->snaps, s);
+        free(vfh);
+    }
+}
+
 static void kvbfs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
+    io_settle(ino);
+
 #ifdef CFS_MEMORY
     if (ino == AGENTFS_CTL_INO) {
         struct agentfs_ctl_fh *ctl = calloc(1, sizeof(struct agentfs_ctl_fh));
@@ -1315,13 +2148,23 @@ static void kvbfs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi
         fuse_reply_open(req, fi);
         return;
     }
+#endif
+
     if (ino == AGENTFS_VERSIONS_INO) {
         fuse_reply_err(req, EISDIR);
         return;
     }
+    if (ino == AGENTFS_SNAPSHOTS_INO) {
+        fuse_reply_err(req, EISDIR);
+        return;
+    }
     if (vtree_is_vnode(ino)) {
-        struct vtree_node *vn = vtree_get(&g_ctx->vtree, ino);
+        struct vtree_node vn_buf, *vn = vtree_get(&g_ctx->vtree, ino, &vn_buf);
         if (!vn) { fuse_reply_err(req, ENOENT); return; }
+        if (vn->is_version_file == 3) {
+            snap_open(req, vn, fi);
+            return;
+        }
         if (!vn->is_version_file) { fuse_reply_err(req, EISDIR); return; }
         if ((fi->flags & O_ACCMODE) != O_RDONLY) {
             fuse_reply_err(req, EACCES);
@@ -1331,12 +2174,33 @@ static void kvbfs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi
         if (!vfh) { fuse_reply_err(req, ENOMEM); return; }
         vfh->real_ino = vn->real_ino;
         vfh->version  = vn->version;
-        fi->fh        = (uint64_t)(uintptr_t)vfh;
-        fi->direct_io = 1;
+        if (vn->is_version_file == 2) {
+            /* 差异在打开时生成一次；live 直接读当前块，不建版本 */
+            uint64_t to = vn->version2;
+            char from_label[24], to_label[24];
+            snprintf(from_label, sizeof(from_label), "%llu",
+                     (unsigned long long)vn->version + 1);
+            if (to == VTREE_LIVE) {
+                to = VDIFF_LIVE;
+                snprintf(to_label, sizeof(to_label), "live");
+            } else {
+                snprintf(to_label, sizeof(to_label), "%llu",
+                         (unsigned long long)to + 1);
+            }
+            if (vdiff_render(vn->real_ino, vn->version, to, from_label, to_label,
+                             &vfh->diff, &vfh->diff_len) != 0) {
+                free(vfh);
+                fuse_reply_err(req, EIO);
+                return;
+            }
+        }
+        fi->fh = (uint64_t)(uintptr_t)vfh;
+        /* 版本内容不变，可留在页缓存；差异文件大小未知，仍直接读 */
+        if (vfh->diff) fi->direct_io = 1;
+        else fi->keep_cache = 1;
         fuse_reply_open(req, fi);
         return;
     }
-#endif
 
     struct kvbfs_inode_cache *ic = inode_get(ino);
     if (!ic) {
@@ -1356,11 +2220,10 @@ static void kvbfs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi
 
     /* 处理 O_TRUNC：截断文件为 0 */
     if (fi->flags & O_TRUNC) {
+        iopool_wait(&g_ctx->iopool, ino);
         pthread_rwlock_wrlock(&ic->lock);
-        uint64_t old_blocks = ic->inode.blocks;
-        if (old_blocks > 0) {
-            delete_file_blocks(ino, old_blocks);
-        }
+        gc_truncate(&g_ctx->gc, ino, ic->inode.size, 0);
+        version_mark_dirty(NULL, ic, 0, 0);     /* 只是大小变化 */
         ic->inode.size = 0;
         ic->inode.blocks = 0;
         struct timespec now;
@@ -1384,6 +2247,8 @@ static void kvbfs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi
     fuse_reply_open(req, fi);
 }
 
+static void release_file(fuse_req_t req, struct kvbfs_fh *fh);
+
 static void kvbfs_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
 #ifdef CFS_MEMORY
@@ -1403,13 +2268,18 @@ static void kvbfs_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
         fuse_reply_err(req, 0);
         return;
     }
+#endif
+
     if (vtree_is_vnode(ino)) {
         struct version_fh *vfh = (struct version_fh *)(uintptr_t)fi->fh;
+        if (vfh) {
+            free(vfh->diff);
+            fssnap_put(&g_ctx->snaps, vfh->snap);
+        }
         free(vfh);
         fuse_reply_err(req, 0);
         return;
     }
-#endif
 
     struct kvbfs_fh *fh = (struct kvbfs_fh *)(uintptr_t)fi->fh;
 
@@ -1417,14 +2287,27 @@ static void kvbfs_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
     /* 如果文件在 /sessions 目录下且可写打开，尝试触发推理 */
     if (fi->flags != O_RDONLY && is_session_file(ino))
         llm_submit(&g_ctx->llm, ino);
-#else
-    (void)ino;
 #endif
 
+    /* 写回、快照与索引在 I/O 线程中完成 */
+    if (fh && fh->written &&
+        io_defer(IO_RELEASE, req, ino, 0, 0, fi, NULL) == 0)
+        return;
+    release_file(req, fh);
+}
+
+static void release_file(fuse_req_t req, struct kvbfs_fh *fh)
+{
     if (fh && fh->written) {
-        version_snapshot(fh->ino);
+        /* 关闭时写回延迟的 inode 属性 */
+        struct kvbfs_inode_cache *ic = inode_get(fh->ino);
+        if (ic) {
+            inode_sync(ic);
+            inode_put(ic);
+        }
+        /* 快照与索引在后台合并执行，close() 不再等待 */
+        snapq_submit(&g_ctx->snapq, fh->ino);
 #ifdef CFS_MEMORY
-        mem_index_file(&g_ctx->mem, g_ctx->db, fh->ino);
         events_emit(&g_ctx->events, EVT_WRITE, fh->ino, NULL);
 #endif
     }
@@ -1433,9 +2316,64 @@ static void kvbfs_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
     fuse_reply_err(req, 0);
 }
 
+/* 快照线程：为文件建版本，并按该版本的内容重建索引 */
+static void snap_run(uint64_t ino)
+{
+    uint64_t ver;
+    if (version_capture(ino, &ver) != 0 || ver == UINT64_MAX)
+        return;
+    gc_thin(&g_ctx->gc, ino);               /* 新版本可能超出保留策略 */
+#ifdef CFS_MEMORY
+    mem_index_file(&g_ctx->mem, g_ctx->db, ino, ver);
+#endif
+}
+
+static void read_file(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off);
+
+/* 读取 ino 的 [off, off + size) 到 buf，不存在的块填充零 */
+static void read_blocks(void *db, uint64_t ino, char *buf, size_t size, off_t off)
+{
+    size_t bytes_read = 0;
+    uint64_t block_idx = off / KVBFS_BLOCK_SIZE;
+    size_t block_off = off % KVBFS_BLOCK_SIZE;
+    char partial[KVBFS_BLOCK_SIZE];
+
+    while (bytes_read < size) {
+        char key[64];
+        int keylen = kvbfs_key_block(key, sizeof(key), ino, block_idx);
+
+        size_t to_copy = KVBFS_BLOCK_SIZE - block_off;
+        if (to_copy > size - bytes_read) to_copy = size - bytes_read;
+
+        /* 整块直接读入输出缓冲区，首尾的部分块经栈上缓冲区中转 */
+        int whole = (to_copy == KVBFS_BLOCK_SIZE);
+        char *dst = whole ? buf + bytes_read : partial;
+        size_t block_len = 0;
+        if (kv_get_into(db, key, keylen, dst, KVBFS_BLOCK_SIZE,
+                        &block_len) != 0)
+            block_len = 0;  /* 块不存在，填充零 */
+        if (block_len > KVBFS_BLOCK_SIZE) block_len = KVBFS_BLOCK_SIZE;
+
+        if (whole) {
+            memset(dst + block_len, 0, KVBFS_BLOCK_SIZE - block_len);
+        } else {
+            size_t have = block_len > block_off ? block_len - block_off : 0;
+            if (have > to_copy) have = to_copy;
+            memcpy(buf + bytes_read, partial + block_off, have);
+            memset(buf + bytes_read + have, 0, to_copy - have);
+        }
+        bytes_read += to_copy;
+
+        block_idx++;
+        block_off = 0;  /* 后续块从头开始 */
+    }
+}
+
 static void kvbfs_read(fuse_req_t req, fuse_ino_t ino, size_t size,
                        off_t off, struct fuse_file_info *fi)
 {
+    io_settle(ino);
+
 #ifdef CFS_MEMORY
     if (ino == AGENTFS_CTL_INO) {
         struct agentfs_ctl_fh *ctl = (struct agentfs_ctl_fh *)(uintptr_t)fi->fh;
@@ -1486,7 +2424,7 @@ static void kvbfs_read(fuse_req_t req, fuse_ino_t ino, size_t size,
         if (size > avail) size = avail;
 
         /* Copy from ring buffer (may wrap around) */
-        char *tmp = malloc(size);
+        char *tmp = reqbuf_get(size);
         if (!tmp) {
             pthread_mutex_unlock(&ectx->lock);
             fuse_reply_err(req, ENOMEM);
@@ -1499,42 +2437,66 @@ static void kvbfs_read(fuse_req_t req, fuse_ino_t ino, size_t size,
         pthread_mutex_unlock(&ectx->lock);
 
         fuse_reply_buf(req, tmp, size);
-        free(tmp);
         return;
     }
+#endif
+
     if (vtree_is_vnode(ino)) {
         struct version_fh *vfh = (struct version_fh *)(uintptr_t)fi->fh;
         if (!vfh) { fuse_reply_err(req, EIO); return; }
 
-        uint64_t start_block = (uint64_t)off / KVBFS_BLOCK_SIZE;
-        uint64_t end_block   = ((uint64_t)off + size - 1) / KVBFS_BLOCK_SIZE;
+        if (vfh->snap) {
+            if ((uint64_t)off >= vfh->size) {
+                fuse_reply_buf(req, NULL, 0);
+                return;
+            }
+            if ((uint64_t)off + size > vfh->size) size = vfh->size - off;
+            char *outbuf = reqbuf_get(size);
+            if (!outbuf) { fuse_reply_err(req, ENOMEM); return; }
+            read_blocks(vfh->snap->db, vfh->real_ino, outbuf, size, off);
+            fuse_reply_buf(req, outbuf, size);
+            return;
+        }
 
-        char *outbuf = calloc(1, size);
-        if (!outbuf) { fuse_reply_err(req, ENOMEM); return; }
-        size_t copied = 0;
+        if (vfh->diff) {
+            if ((uint64_t)off >= vfh->diff_len) {
+                fuse_reply_buf(req, NULL, 0);
+                return;
+            }
+            if ((uint64_t)off + size > vfh->diff_len) size = vfh->diff_len - off;
+            fuse_reply_buf(req, vfh->diff + off, size);
+            return;
+        }
 
-        for (uint64_t blk = start_block; blk <= end_block && copied < size; blk++) {
-            char *data = NULL;
-            size_t dlen = 0;
-            if (version_read_block(vfh->real_ino, vfh->version, blk,
-                                   &data, &dlen) != 0)
-                break;
-            size_t blk_off = (blk == start_block) ? ((uint64_t)off % KVBFS_BLOCK_SIZE) : 0;
-            size_t avail   = dlen > blk_off ? dlen - blk_off : 0;
-            size_t tocopy  = avail < (size - copied) ? avail : (size - copied);
-            memcpy(outbuf + copied, data + blk_off, tocopy);
-            copied += tocopy;
-            free(data);
+        /* 版本之间共享未改动的块，空洞按零返回 */
+        struct kvbfs_version_meta meta;
+        if (version_get_meta(vfh->real_ino, vfh->version, &meta) != 0) {
+            fuse_reply_err(req, ENOENT);
+            return;
         }
+        if ((uint64_t)off >= meta.size) {
+            fuse_reply_buf(req, NULL, 0);
+            return;
+        }
+        if ((uint64_t)off + size > meta.size) size = meta.size - off;
 
-        fuse_reply_buf(req, outbuf, copied);
-        free(outbuf);
+        char *outbuf = reqbuf_get(size);
+        if (!outbuf) { fuse_reply_err(req, ENOMEM); return; }
+        if (version_read_range(vfh->real_ino, vfh->version, &meta,
+                               outbuf, size, off) != 0) {
+            fuse_reply_err(req, EIO);
+            return;
+        }
+        fuse_reply_buf(req, outbuf, size);
         return;
     }
-#endif
 
-    (void)fi;
+    if (io_defer(IO_READ, req, ino, size, off, fi, NULL) == 0) return;
+    read_file(req, ino, size, off);
+}
 
+static void read_file(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off)
+{
     struct kvbfs_inode_cache *ic = inode_get(ino);
     if (!ic) {
         fuse_reply_err(req, ENOENT);
@@ -1558,47 +2520,20 @@ static void kvbfs_read(fuse_req_t req, fuse_ino_t ino, size_t size,
         size = file_size - off;
     }
 
-    char *buf = malloc(size);
+    /* 线程复用的请求缓冲区，不必每次读分配 */
+    char *buf = reqbuf_get(size);
     if (!buf) {
         fuse_reply_err(req, ENOMEM);
         return;
     }
 
-    size_t bytes_read = 0;
-    uint64_t block_idx = off / KVBFS_BLOCK_SIZE;
-    size_t block_off = off % KVBFS_BLOCK_SIZE;
-
-    while (bytes_read < size) {
-        char key[64];
-        int keylen = kvbfs_key_block(key, sizeof(key), ino, block_idx);
-
-        char *block_data = NULL;
-        size_t block_len = 0;
-
-        int ret = kv_get(g_ctx->db, key, keylen, &block_data, &block_len);
-        if (ret != 0 || block_len <= block_off) {
-            /* 块不存在或偏移超出块数据，填充零 */
-            if (block_data) free(block_data);
-            size_t to_copy = KVBFS_BLOCK_SIZE - block_off;
-            if (to_copy > size - bytes_read) to_copy = size - bytes_read;
-            memset(buf + bytes_read, 0, to_copy);
-            bytes_read += to_copy;
-        } else {
-            size_t to_copy = block_len - block_off;
-            if (to_copy > size - bytes_read) to_copy = size - bytes_read;
-            memcpy(buf + bytes_read, block_data + block_off, to_copy);
-            bytes_read += to_copy;
-            free(block_data);
-        }
-
-        block_idx++;
-        block_off = 0;  /* 后续块从头开始 */
-    }
-
-    fuse_reply_buf(req, buf, bytes_read);
-    free(buf);
+    read_blocks(g_ctx->db, ino, buf, size, off);
+    fuse_reply_buf(req, buf, size);
 }
 
+static void write_file(fuse_req_t req, fuse_ino_t ino, const char *buf,
+                       size_t size, off_t off);
+
 static void kvbfs_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
                         size_t size, off_t off, struct fuse_file_info *fi)
 {
@@ -1637,12 +2572,39 @@ static void kvbfs_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
     struct kvbfs_fh *fh = (struct kvbfs_fh *)(uintptr_t)fi->fh;
     if (fh) fh->written = true;
 
+    if (io_defer(IO_WRITE, req, ino, size, off, NULL, buf) == 0) return;
+    write_file(req, ino, buf, size, off);
+}
+
+static void write_file(fuse_req_t req, fuse_ino_t ino, const char *buf,
+                       size_t size, off_t off)
+{
     struct kvbfs_inode_cache *ic = inode_get(ino);
     if (!ic) {
         fuse_reply_err(req, ENOENT);
         return;
     }
 
+    /*
+     * 同一文件的写入在 inode 写锁下串行：数据块（及必要时的 ow: 记录）
+     * 在一个批次中提交，inode 只标记为脏，由写回线程或 release/fsync 持久化。
+     */
+    pthread_rwlock_wrlock(&ic->lock);
+    uint64_t end = off + size;
+
+    /* 文件增长时先丢弃待回收范围内的旧块，避免旧数据重新可见 */
+    if (end > ic->inode.size)
+        gc_claim(&g_ctx->gc, ino, ic->inode.size, end);
+
+    kv_batch_t *batch = kv_batch_new();
+    if (!batch) {
+        pthread_rwlock_unlock(&ic->lock);
+        inode_put(ic);
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    bool intent = inode_writeback_batch(batch, ic, end);
+
     size_t bytes_written = 0;
     uint64_t block_idx = off / KVBFS_BLOCK_SIZE;
     size_t block_off = off % KVBFS_BLOCK_SIZE;
@@ -1651,40 +2613,52 @@ static void kvbfs_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
         char key[64];
         int keylen = kvbfs_key_block(key, sizeof(key), ino, block_idx);
 
-        /* 读取现有块（如果存在）或创建新块 */
+        size_t to_write = KVBFS_BLOCK_SIZE - block_off;
+        if (to_write > size - bytes_written) to_write = size - bytes_written;
+
+        /* 读取现有块（如果存在）或创建新块；整块覆盖时无需读取 */
         char block[KVBFS_BLOCK_SIZE];
         memset(block, 0, KVBFS_BLOCK_SIZE);
 
         char *existing = NULL;
         size_t existing_len = 0;
-        if (kv_get(g_ctx->db, key, keylen, &existing, &existing_len) == 0) {
+        if (to_write < KVBFS_BLOCK_SIZE &&
+            kv_get(g_ctx->db, key, keylen, &existing, &existing_len) == 0) {
             size_t copy_len = existing_len < KVBFS_BLOCK_SIZE ? existing_len : KVBFS_BLOCK_SIZE;
             memcpy(block, existing, copy_len);
             free(existing);
         }
 
         /* 写入数据到块 */
-        size_t to_write = KVBFS_BLOCK_SIZE - block_off;
-        if (to_write > size - bytes_written) to_write = size - bytes_written;
-
         memcpy(block + block_off, buf + bytes_written, to_write);
 
         /* 保存完整块，保持统一块大小 */
-        if (kv_put(g_ctx->db, key, keylen, block, KVBFS_BLOCK_SIZE) != 0) {
-            inode_put(ic);
-            fuse_reply_err(req, EIO);
-            return;
-        }
+        kv_batch_put(batch, key, keylen, block, KVBFS_BLOCK_SIZE);
 
         bytes_written += to_write;
         block_idx++;
         block_off = 0;
     }
 
+    /* 记录改动的块供下次快照；越过 EOF 写入时中间的空洞也算改动 */
+    uint64_t first_blk = off / KVBFS_BLOCK_SIZE;
+    if (first_blk > ic->inode.blocks) first_blk = ic->inode.blocks;
+    version_mark_dirty(batch, ic, first_blk,
+                       (end + KVBFS_BLOCK_SIZE - 1) / KVBFS_BLOCK_SIZE);
+
+    if (kv_batch_commit(g_ctx->db, batch) != 0) {
+        if (intent) ic->wb_intent = false;
+        pthread_rwlock_unlock(&ic->lock);
+        kv_batch_free(batch);
+        inode_put(ic);
+        fuse_reply_err(req, EIO);
+        return;
+    }
+    kv_batch_free(batch);
+
     /* 更新文件大小 */
-    pthread_rwlock_wrlock(&ic->lock);
-    if ((uint64_t)(off + size) > ic->inode.size) {
-        ic->inode.size = off + size;
+    if (end > ic->inode.size) {
+        ic->inode.size = end;
     }
     ic->inode.blocks = (ic->inode.size + KVBFS_BLOCK_SIZE - 1) / KVBFS_BLOCK_SIZE;
 
@@ -1692,19 +2666,44 @@ static void kvbfs_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
     clock_gettime(CLOCK_REALTIME, &now);
     ic->inode.mtime = now;
     ic->inode.ctime = now;
+    inode_mark_dirty(ic);
     pthread_rwlock_unlock(&ic->lock);
-
-    inode_sync(ic);
     inode_put(ic);
 
     fuse_reply_write(req, bytes_written);
 }
 
+/* I/O 线程执行排队的请求 */
+static void io_run(struct io_task *t)
+{
+    switch (t->op) {
+    case IO_READ:
+        read_file(t->req, t->ino, t->size, t->off);
+        break;
+    case IO_WRITE:
+        write_file(t->req, t->ino, t->data, t->size, t->off);
+        break;
+    case IO_READDIR:
+    case IO_READDIRPLUS:
+        dir_read(t->req, t->ino, t->size, t->off,
+                 t->op == IO_READDIRPLUS, &t->fi);
+        break;
+    case IO_RELEASE:
+        release_file(t->req, (struct kvbfs_fh *)(uintptr_t)t->fi.fh);
+        break;
+    }
+}
+
 static void kvbfs_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
                          fuse_ino_t newparent, const char *newname, unsigned int flags)
 {
     (void)flags;  /* 暂不支持 RENAME_EXCHANGE 等 */
 
+    if (is_virtual_dir(parent) || is_virtual_dir(newparent)) {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+
     /* 查找源文件 */
     uint64_t src_ino = dirent_lookup(parent, name);
     if (src_ino == 0) {
@@ -1714,68 +2713,145 @@ static void kvbfs_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
 
     /* 检查目标是否已存在 */
     uint64_t dst_ino = dirent_lookup(newparent, newname);
+    if (dst_ino == src_ino) {
+        /* 同一 inode 的两个名字：POSIX 规定什么都不做 */
+        fuse_reply_err(req, 0);
+        return;
+    }
+
+    /* 目录项变更与被替换目标的删除在同一批次提交 */
+    kv_batch_t *batch = kv_batch_new();
+    if (!batch) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    struct kvbfs_inode_cache *dst_ic = NULL;
+    struct kvbfs_inode_cache *np_ic = NULL;
+    int dst_reclaim = 0;
+    int dst_unlinked = 0;   /* dst_ic->inode.nlink 已减少，写锁保持到提交 */
+    struct kvbfs_usage dst_cu = { 0, 1, 0 };
+
     if (dst_ino != 0) {
         /* 目标存在，需要先删除 */
-        struct kvbfs_inode_cache *dst_ic = inode_get(dst_ino);
+        dst_ic = inode_get(dst_ino);
         if (dst_ic) {
             pthread_rwlock_rdlock(&dst_ic->lock);
             int is_dir = S_ISDIR(dst_ic->inode.mode);
-            uint64_t blocks = dst_ic->inode.blocks;
             pthread_rwlock_unlock(&dst_ic->lock);
-            inode_put(dst_ic);
 
             if (is_dir) {
                 if (!dirent_is_empty(dst_ino)) {
+                    inode_put(dst_ic);
+                    kv_batch_free(batch);
                     fuse_reply_err(req, ENOTEMPTY);
                     return;
                 }
-            }
 
-            dirent_remove(newparent, newname);
-            if (!is_dir) {
-                delete_file_blocks(dst_ino, blocks);
-            } else {
                 /* 被替换的目标是目录，减少 newparent 的 nlink */
-                struct kvbfs_inode_cache *np_ic = inode_get(newparent);
+                dst_reclaim = 1;
+                np_ic = inode_get(newparent);
                 if (np_ic) {
                     pthread_rwlock_wrlock(&np_ic->lock);
                     if (np_ic->inode.nlink > 0) np_ic->inode.nlink--;
+                    inode_save_batch(batch, &np_ic->inode);
                     pthread_rwlock_unlock(&np_ic->lock);
-                    inode_sync(np_ic);
-                    inode_put(np_ic);
                 }
+            } else {
+                /* 普通文件可能还有其他硬链接 */
+                pthread_rwlock_wrlock(&dst_ic->lock);
+                if (dst_ic->inode.nlink > 0) dst_ic->inode.nlink--;
+                dst_unlinked = 1;
+                dst_reclaim = (dst_ic->inode.nlink == 0);
+                if (!dst_reclaim)
+                    inode_save_nlink_batch(batch, dst_ic);
+                dst_cu.bytes = (int64_t)dst_ic->synced_size;
             }
-            xattr_delete_all(dst_ino);
-            version_delete_all(dst_ino);
-#ifdef CFS_MEMORY
-            mem_delete_embeddings(g_ctx->db, dst_ino);
-#endif
-            inode_delete(dst_ino);
+
+            if (dst_reclaim)
+                reclaim_batch(batch, dst_ino);
         }
     }
 
-    /* 获取源 inode 信息 */
+    /* 获取源 inode 信息；普通文件的读锁保持到提交，与 inode_sync 互斥 */
     struct kvbfs_inode_cache *src_ic = inode_get(src_ino);
     int src_is_dir = 0;
+    uint32_t src_mode = 0;
+    struct kvbfs_usage src_cu = { 0, 1, 0 };
     if (src_ic) {
         pthread_rwlock_rdlock(&src_ic->lock);
-        src_is_dir = S_ISDIR(src_ic->inode.mode);
-        pthread_rwlock_unlock(&src_ic->lock);
+        src_mode = src_ic->inode.mode;
+        src_is_dir = S_ISDIR(src_mode);
+    }
+
+    /*
+     * 用量树锁在所有 inode 锁之后获取。目录移动会改变其下所有计入的
+     * 祖先链，独占到提交并丢弃父目录缓存之后，其他计入重新遍历。
+     */
+    int tree_move = src_is_dir && parent != newparent;
+    if (tree_move)
+        usage_move_begin(&g_ctx->usage);
+    else
+        usage_charge_begin(&g_ctx->usage);
+
+    if (dst_ino != 0) {
+        path_unlink_batch(batch, dst_ino, newparent, newname);
+        usage_unlink_batch(&g_ctx->usage, batch, g_ctx->db, newparent, &dst_cu);
+    }
+    if (src_ic) {
+        usage_child(g_ctx->db, src_ino, src_mode, src_ic->synced_size, &src_cu);
+        if (src_is_dir)
+            pthread_rwlock_unlock(&src_ic->lock);
+    }
+
+    /* 删除旧目录项，添加新目录项 */
+    int ret = -1;
+    if (dirent_remove_batch(batch, parent, name, src_ino, &src_cu) == 0 &&
+        dirent_add_batch(batch, newparent, newname, src_ino, src_mode, &src_cu) == 0)
+        ret = kv_batch_commit(g_ctx->db, batch);
+    kv_batch_free(batch);
+    if (ret == 0 && src_is_dir)
+        usage_forget(&g_ctx->usage, src_ino);
+    usage_charge_end(&g_ctx->usage);
+
+    if (src_ic) {
+        if (!src_is_dir)
+            pthread_rwlock_unlock(&src_ic->lock);
         inode_put(src_ic);
     }
+    if (dst_unlinked) {
+        if (ret != 0) dst_ic->inode.nlink++;    /* 回滚 */
+        pthread_rwlock_unlock(&dst_ic->lock);
+    }
+    dirent_changed(parent, name);
+    dirent_changed(newparent, newname);
 
-    /* 删除旧目录项 */
-    if (dirent_remove(parent, name) != 0) {
+    if (ret != 0) {
+        /* 回滚内存中的 nlink 修改 */
+        if (np_ic) {
+            pthread_rwlock_wrlock(&np_ic->lock);
+            np_ic->inode.nlink++;
+            pthread_rwlock_unlock(&np_ic->lock);
+        }
+        inode_put(np_ic);
+        inode_put(dst_ic);
         fuse_reply_err(req, EIO);
         return;
     }
 
-    /* 添加新目录项 */
-    if (dirent_add(newparent, newname, src_ino) != 0) {
-        /* 尝试恢复 */
-        dirent_add(parent, name, src_ino);
-        fuse_reply_err(req, EIO);
-        return;
+    inode_put(np_ic);
+    inode_put(dst_ic);
+    if (dst_reclaim)
+        reclaim_start(dst_ino);
+
+    /* 目录改名会改变所有后代的路径 */
+    if (src_is_dir)
+        path_invalidate(&g_ctx->paths);
+    else
+        path_forget(&g_ctx->paths, src_ino);
+    if (dst_ino != 0) {
+        path_forget(&g_ctx->paths, dst_ino);
+        usage_forget(&g_ctx->usage, dst_ino);
     }
 
 #ifdef CFS_LOCAL_LLM
@@ -1851,9 +2927,49 @@ static void kvbfs_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
     fuse_reply_err(req, ret == 0 ? 0 : EIO);
 }
 
+/*
+ * 已用空间和 inode 数取自根目录的用量记录，O(1)；
+ * 可用空间取自数据库所在的文件系统，无法获取时 (NVMe 后端) 报告 1 TiB。
+ */
+static void kvbfs_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+    (void)ino;
+
+    struct kvbfs_usage u;
+    usage_get(g_ctx->db, KVBFS_ROOT_INO, &u);
+    uint64_t used = ((uint64_t)(u.bytes > 0 ? u.bytes : 0) + KVBFS_BLOCK_SIZE - 1) /
+                    KVBFS_BLOCK_SIZE;
+    uint64_t files = (uint64_t)(u.inodes > 0 ? u.inodes : 0) + 1;   /* 含根目录 */
+
+    struct statvfs host;
+    uint64_t avail;
+    if (g_ctx->db_path && statvfs(g_ctx->db_path, &host) == 0)
+        avail = (uint64_t)host.f_bavail * host.f_frsize / KVBFS_BLOCK_SIZE;
+    else
+        avail = (1ULL << 40) / KVBFS_BLOCK_SIZE;
+
+    struct statvfs st;
+    memset(&st, 0, sizeof(st));
+    st.f_bsize = KVBFS_BLOCK_SIZE;
+    st.f_frsize = KVBFS_BLOCK_SIZE;
+    st.f_blocks = used + avail;
+    st.f_bfree = avail;
+    st.f_bavail = avail;
+    st.f_files = files + avail;
+    st.f_ffree = avail;
+    st.f_favail = avail;
+    st.f_namemax = 255;
+    fuse_reply_statfs(req, &st);
+}
+
 static void kvbfs_symlink(fuse_req_t req, const char *link, fuse_ino_t parent,
                           const char *name)
 {
+    if (is_virtual_dir(parent)) {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+
     /* 检查父目录 */
     struct kvbfs_inode_cache *pic = inode_get(parent);
     if (!pic) {
@@ -1905,7 +3021,8 @@ static void kvbfs_symlink(fuse_req_t req, const char *link, fuse_ino_t parent,
     inode_sync(ic);
 
     /* 添加目录项 */
-    if (dirent_add(parent, name, ino) != 0) {
+    struct kvbfs_usage cu = { 0, 1, (int64_t)link_len };
+    if (dirent_add(parent, name, ino, S_IFLNK, &cu) != 0) {
         char bkey[64];
         int bkeylen = kvbfs_key_block(bkey, sizeof(bkey), ino, 0);
         kv_delete(g_ctx->db, bkey, bkeylen);
@@ -1928,11 +3045,52 @@ static void kvbfs_symlink(fuse_req_t req, const char *link, fuse_ino_t parent,
 
     inode_put(ic);
 
-    fuse_reply_entry(req, &e);
+    reply_entry(req, &e);
+}
+
+/* 快照中的符号链接：目标同样在检查点的 block 0 */
+static void snap_readlink(fuse_req_t req, struct vtree_node *vn)
+{
+    struct fssnap *s = fssnap_get(&g_ctx->snaps, vn->snap);
+    struct kvbfs_inode inode;
+    if (!s || snap_inode_load(s, vn->real_ino, &inode) != 0) {
+        fssnap_put(&g_ctx->snaps, s);
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if (!S_ISLNK(inode.mode)) {
+        fssnap_put(&g_ctx->snaps, s);
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    char key[64];
+    int keylen = kvbfs_key_block(key, sizeof(key), vn->real_ino, 0);
+    char buf[KVBFS_BLOCK_SIZE + 1];
+    size_t len;
+    int ret = kv_get_into(s->db, key, keylen, buf, KVBFS_BLOCK_SIZE, &len);
+    fssnap_put(&g_ctx->snaps, s);
+    if (ret != 0) {
+        fuse_reply_err(req, EIO);
+        return;
+    }
+    if (len > KVBFS_BLOCK_SIZE) len = KVBFS_BLOCK_SIZE;
+    buf[len] = '\0';
+    fuse_reply_readlink(req, buf);
 }
 
 static void kvbfs_readlink(fuse_req_t req, fuse_ino_t ino)
 {
+    if (vtree_is_vnode(ino)) {
+        struct vtree_node vn_buf, *vn = vtree_get(&g_ctx->vtree, ino, &vn_buf);
+        if (!vn || vn->is_version_file != 3) {
+            fuse_reply_err(req, vn ? EINVAL : ENOENT);
+            return;
+        }
+        snap_readlink(req, vn);
+        return;
+    }
+
     struct kvbfs_inode_cache *ic = inode_get(ino);
     if (!ic) {
         fuse_reply_err(req, ENOENT);
@@ -1979,6 +3137,11 @@ static void kvbfs_readlink(fuse_req_t req, fuse_ino_t ino)
 static void kvbfs_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent,
                        const char *newname)
 {
+    if (is_virtual_dir(newparent)) {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+
     /* 获取源 inode */
     struct kvbfs_inode_cache *ic = inode_get(ino);
     if (!ic) {
@@ -2022,8 +3185,13 @@ static void kvbfs_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent,
         return;
     }
 
-    /* 添加目录项 */
-    if (dirent_add(newparent, newname, ino) != 0) {
+    /* 添加目录项；读锁保持到提交，计入的大小与 inode_sync 一致 */
+    pthread_rwlock_rdlock(&ic->lock);
+    struct kvbfs_usage cu;
+    usage_child(g_ctx->db, ino, ic->inode.mode, ic->synced_size, &cu);
+    int ret = dirent_add(newparent, newname, ino, ic->inode.mode, &cu);
+    pthread_rwlock_unlock(&ic->lock);
+    if (ret != 0) {
         inode_put(ic);
         fuse_reply_err(req, EIO);
         return;
@@ -2048,7 +3216,7 @@ static void kvbfs_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent,
     inode_sync(ic);
     inode_put(ic);
 
-    fuse_reply_entry(req, &e);
+    reply_entry(req, &e);
 
 #ifdef CFS_MEMORY
     events_emit(&g_ctx->events, EVT_LINK, ino, newname);
@@ -2127,13 +3295,116 @@ static void kvbfs_ioctl_op(fuse_req_t req, fuse_ino_t ino, unsigned int cmd,
     (void)arg;
     (void)fi;
 
-#if defined(CFS_LOCAL_LLM) || defined(CFS_MEMORY)
     if (flags & FUSE_IOCTL_COMPAT) {
         fuse_reply_err(req, ENOSYS);
         return;
     }
 
     switch (cmd) {
+    case CFS_IOC_RMTREE: {
+        if (in_bufsz < sizeof(struct cfs_rmtree)) {
+            struct iovec in_iov = { .iov_base = NULL,
+                                    .iov_len = sizeof(struct cfs_rmtree) };
+            fuse_reply_ioctl_retry(req, &in_iov, 1, NULL, 0);
+            return;
+        }
+
+        struct cfs_rmtree rt;
+        memcpy(&rt, in_buf, sizeof(rt));
+        rt.name[sizeof(rt.name) - 1] = '\0';
+
+        if (rt.name[0] == '\0' || strchr(rt.name, '/') ||
+            strcmp(rt.name, ".") == 0 || strcmp(rt.name, "..") == 0) {
+            fuse_reply_err(req, EINVAL);
+            return;
+        }
+#ifdef CFS_LOCAL_LLM
+        if (ino == KVBFS_ROOT_INO && g_ctx->sessions_ino != 0 &&
+            dirent_lookup(ino, rt.name) == g_ctx->sessions_ino) {
+            fuse_reply_err(req, EBUSY);
+            return;
+        }
+#endif
+
+        /* 摘除子树后立即返回，子孙节点由 GC 在后台回收 */
+        uint64_t child_ino;
+        int err = dir_detach(ino, rt.name, 1, &child_ino);
+        if (err != 0) {
+            fuse_reply_err(req, err);
+            return;
+        }
+#ifdef CFS_MEMORY
+        events_emit(&g_ctx->events, EVT_RMTREE, child_ino, rt.name);
+#endif
+        fuse_reply_ioctl(req, 0, NULL, 0);
+
+        /* 内核可能仍缓存着该目录项 */
+        if (g_ctx->se)
+            fuse_lowlevel_notify_inval_entry(g_ctx->se, ino, rt.name,
+                                             strlen(rt.name));
+        return;
+    }
+    case CFS_IOC_VERSION_WAIT: {
+        struct kvbfs_inode_cache *ic = inode_get(ino);
+        if (!ic) {
+            fuse_reply_err(req, ENOENT);
+            return;
+        }
+        bool dir = S_ISDIR(ic->inode.mode);
+        inode_put(ic);
+
+        version_settle(dir ? 0 : ino);
+        fuse_reply_ioctl(req, 0, NULL, 0);
+        return;
+    }
+    case CFS_IOC_VERSION_RESTORE: {
+        if (in_bufsz < sizeof(struct cfs_restore) ||
+            out_bufsz < sizeof(struct cfs_restore)) {
+            struct iovec in_iov = { .iov_base = NULL,
+                                    .iov_len = sizeof(struct cfs_restore) };
+            struct iovec out_iov = { .iov_base = NULL,
+                                     .iov_len = sizeof(struct cfs_restore) };
+            fuse_reply_ioctl_retry(req, &in_iov, 1, &out_iov, 1);
+            return;
+        }
+
+        struct cfs_restore rs;
+        memcpy(&rs, in_buf, sizeof(rs));
+        if (vtree_is_vnode(ino) || ino == AGENTFS_VERSIONS_INO ||
+            rs.version == 0) {
+            fuse_reply_err(req, EINVAL);
+            return;
+        }
+        struct kvbfs_inode_cache *ic = inode_get(ino);
+        if (!ic) {
+            fuse_reply_err(req, ENOENT);
+            return;
+        }
+        bool reg = S_ISREG(ic->inode.mode);
+        inode_put(ic);
+        if (!reg) {
+            fuse_reply_err(req, EISDIR);
+            return;
+        }
+
+        /* 排队的写入与快照先完成，恢复前的内容成为一个版本 */
+        version_settle(ino);
+        int err = version_restore(ino, rs.version - 1, &rs.blocks);
+        if (err != 0) {
+            fuse_reply_err(req, err);
+            return;
+        }
+        snapq_submit(&g_ctx->snapq, ino);       /* 恢复后的内容成为新版本 */
+#ifdef CFS_MEMORY
+        events_emit(&g_ctx->events, EVT_RESTORE, ino, NULL);
+#endif
+        fuse_reply_ioctl(req, 0, &rs, sizeof(rs));
+
+        /* 内核缓存的页与属性已过期 */
+        if (g_ctx->se)
+            fuse_lowlevel_notify_inval_inode(g_ctx->se, ino, 0, 0);
+        return;
+    }
 #ifdef CFS_LOCAL_LLM
     case CFS_IOC_STATUS: {
         if (out_bufsz < sizeof(struct cfs_status)) {
@@ -2155,6 +3426,7 @@ static void kvbfs_ioctl_op(fuse_req_t req, fuse_ino_t ino, unsigned int cmd,
 #endif /* CFS_LOCAL_LLM */
 #ifdef CFS_MEMORY
     case CFS_IOC_MEM_SEARCH: {
+        version_settle(0);                      /* 等此前排队的索引 */
         if (in_bufsz < sizeof(struct cfs_mem_query)) {
             struct iovec in_iov = { .iov_base = NULL,
                                     .iov_len = sizeof(struct cfs_mem_query) };
@@ -2181,6 +3453,9 @@ static void kvbfs_ioctl_op(fuse_req_t req, fuse_ino_t ino, unsigned int cmd,
             fuse_reply_err(req, EIO);
             return;
         }
+        for (int i = 0; i < query.n_results; i++)
+            path_resolve(&g_ctx->paths, g_ctx->db, query.results[i].ino,
+                         query.results[i].path, sizeof(query.results[i].path));
 
         fuse_reply_ioctl(req, 0, &query, sizeof(query));
         return;
@@ -2189,14 +3464,7 @@ static void kvbfs_ioctl_op(fuse_req_t req, fuse_ino_t ino, unsigned int cmd,
     default:
         break;
     }
-#else
-    (void)ino;
-    (void)cmd;
-    (void)flags;
-    (void)in_buf;
-    (void)in_bufsz;
     (void)out_bufsz;
-#endif
 
     fuse_reply_err(req, ENOTTY);
 }
@@ -2217,35 +3485,24 @@ static void kvbfs_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
         return;
     }
 
-    char key[KVBFS_KEY_MAX];
-    int keylen = kvbfs_key_xattr(key, sizeof(key), ino, name);
-    if (keylen < 0) {
-        fuse_reply_err(req, ERANGE);
-        return;
-    }
-
-    if (flags & XATTR_CREATE) {
-        /* Must not already exist */
-        char *existing = NULL;
-        size_t elen = 0;
-        if (kv_get(g_ctx->db, key, keylen, &existing, &elen) == 0) {
-            free(existing);
-            fuse_reply_err(req, EEXIST);
+    /* 保留策略在写入时校验，后台 GC 只会读到合法值 */
+    if (strcmp(name, VERSION_RETENTION_XATTR) == 0) {
+        struct version_policy pol = g_ctx->gc.retention;
+        if (version_policy_parse(value, size, &pol) != 0) {
+            fuse_reply_err(req, EINVAL);
             return;
         }
-    } else if (flags & XATTR_REPLACE) {
-        /* Must already exist */
-        char *existing = NULL;
-        size_t elen = 0;
-        if (kv_get(g_ctx->db, key, keylen, &existing, &elen) != 0) {
-            fuse_reply_err(req, ENODATA);
-            return;
-        }
-        free(existing);
     }
 
-    if (kv_put(g_ctx->db, key, keylen, value, size) != 0) {
-        fuse_reply_err(req, EIO);
+    struct kvbfs_inode_cache *ic = inode_get(ino);
+    if (!ic) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    int err = xattr_set(ic, name, value, size, flags);
+    inode_put(ic);
+    if (err) {
+        fuse_reply_err(req, err);
         return;
     }
 
@@ -2278,6 +3535,7 @@ static void kvbfs_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
 #endif
     /* Virtual xattr: agentfs.version → current version number as string */
     if (strcmp(name, "agentfs.version") == 0) {
+        version_settle(ino);                    /* 等排队中的快照 */
         uint64_t ver = version_get_current(ino);
         char buf[24];
         int n = snprintf(buf, sizeof(buf), "%lu", (unsigned long)ver);
@@ -2285,74 +3543,174 @@ static void kvbfs_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
         return;
     }
 
+    /* Virtual xattr: agentfs.stats → cache counters as JSON */
+    if (strcmp(name, "agentfs.stats") == 0) {
+        struct dcache_stats ds;
+        dcache_get_stats(&g_ctx->dcache, &ds);
+        uint64_t lookups = ds.hits + ds.negative_hits + ds.misses;
+        uint64_t ic_entries, ic_evictions, ic_writes;
+        inode_cache_stats(&ic_entries, &ic_evictions, &ic_writes);
+        uint64_t sl_live, sl_free, sl_chunks;
+        inode_cache_slab_stats(&sl_live, &sl_free, &sl_chunks);
+        struct iopool_stats io;
+        iopool_get_stats(&g_ctx->iopool, &io);
+        struct snapq_stats sq;
+        snapq_get_stats(&g_ctx->snapq, &sq);
+        struct warmup_ctx *wc = &g_ctx->warmup;
+        static const char *const wstate[] = { "off", "running", "done" };
+        int ws = __atomic_load_n(&wc->state, __ATOMIC_ACQUIRE);
+        struct gc_ctx *gc = &g_ctx->gc;
+        uint64_t dd_stored = __atomic_load_n(&gc->dedup.stored, __ATOMIC_RELAXED);
+        uint64_t dd_refd = __atomic_load_n(&gc->dedup.referenced, __ATOMIC_RELAXED);
+        char buf[1664];
+        int n = snprintf(buf, sizeof(buf),
+            "{\"dcache\":{\"entries\":%lu,\"hits\":%lu,\"negative_hits\":%lu,"
+            "\"misses\":%lu,\"evictions\":%lu,\"hit_rate\":%.3f},"
+            "\"icache\":{\"entries\":%lu,\"evictions\":%lu,\"limit\":%lu,"
+            "\"inode_writes\":%lu},"
+            "\"warmup\":{\"state\":\"%s\",\"inodes\":%lu,\"dentries\":%lu,"
+            "\"hot\":%lu,\"ms\":%.1f},"
+            "\"alloc\":{\"icache_live\":%lu,\"icache_free\":%lu,"
+            "\"icache_chunks\":%lu,\"reqbuf_bytes\":%lu},"
+            "\"io\":{\"threads\":%lu,\"queued\":%lu,\"peak\":%lu,"
+            "\"completed\":%lu,\"deferred\":%lu},"
+            "\"snapshots\":{\"delay_ms\":%lu,\"pending\":%lu,\"submitted\":%lu,"
+            "\"coalesced\":%lu,\"completed\":%lu},"
+            "\"retention\":{\"thinned\":%lu,\"reclaimed_bytes\":%lu},"
+            "\"vtree\":{\"nodes\":%lu,\"forgotten\":%lu},"
+            "\"dedup\":{\"blobs\":%lu,\"stored_bytes\":%lu,"
+            "\"referenced_bytes\":%lu,\"ratio\":%.3f,\"corrupt\":%lu,"
+            "\"swept\":%lu,\"passes\":%lu}}",
+            (unsigned long)ds.entries, (unsigned long)ds.hits,
+            (unsigned long)ds.negative_hits, (unsigned long)ds.misses,
+            (unsigned long)ds.evictions,
+            lookups ? (double)(ds.hits + ds.negative_hits) / lookups : 0.0,
+            (unsigned long)ic_entries, (unsigned long)ic_evictions,
+            (unsigned long)(g_ctx->icache_shard_max * KVBFS_ICACHE_SHARDS),
+            (unsigned long)ic_writes, wstate[ws],
+            (unsigned long)__atomic_load_n(&wc->inodes, __ATOMIC_RELAXED),
+            (unsigned long)__atomic_load_n(&wc->dentries, __ATOMIC_RELAXED),
+            (unsigned long)wc->hot,
+            ws == WARMUP_DONE ? wc->elapsed_us / 1000.0 : 0.0,
+            (unsigned long)sl_live, (unsigned long)sl_free,
+            (unsigned long)sl_chunks, (unsigned long)reqbuf_bytes(),
+            (unsigned long)io.threads, (unsigned long)io.queued,
+            (unsigned long)io.peak, (unsigned long)io.completed,
+            (unsigned long)io.deferred,
+            (unsigned long)sq.delay_ms, (unsigned long)sq.pending,
+            (unsigned long)sq.submitted, (unsigned long)sq.coalesced,
+            (unsigned long)sq.completed,
+            (unsigned long)__atomic_load_n(&g_ctx->gc.versions_thinned,
+                                           __ATOMIC_RELAXED),
+            (unsigned long)__atomic_load_n(&g_ctx->gc.version_bytes,
+                                           __ATOMIC_RELAXED),
+            (unsigned long)__atomic_load_n(&g_ctx->vtree.live, __ATOMIC_RELAXED),
+            (unsigned long)__atomic_load_n(&g_ctx->vtree.forgotten,
+                                           __ATOMIC_RELAXED),
+            (unsigned long)__atomic_load_n(&gc->dedup.blobs, __ATOMIC_RELAXED),
+            (unsigned long)dd_stored, (unsigned long)dd_refd,
+            dd_stored ? (double)dd_refd / dd_stored : 1.0,
+            (unsigned long)__atomic_load_n(&gc->dedup.corrupt, __ATOMIC_RELAXED),
+            (unsigned long)__atomic_load_n(&gc->dedup.swept, __ATOMIC_RELAXED),
+            (unsigned long)__atomic_load_n(&gc->dedup_passes, __ATOMIC_ACQUIRE));
+        reply_virtual_xattr(req, size, buf, n);
+        return;
+    }
+
+    /* Virtual xattr: agentfs.du → usage counters below a directory as JSON */
+    if (strcmp(name, "agentfs.du") == 0) {
+        struct kvbfs_inode_cache *ic = inode_get(ino);
+        if (!ic) { fuse_reply_err(req, ENOENT); return; }
+        pthread_rwlock_rdlock(&ic->lock);
+        uint32_t mode = ic->inode.mode;
+        uint64_t fsize = ic->inode.size;
+        pthread_rwlock_unlock(&ic->lock);
+        inode_put(ic);
+
+        /* A file counts itself, at its current size */
+        struct kvbfs_usage u = { 0, 1, (int64_t)fsize };
+        if (S_ISDIR(mode))
+            usage_get(g_ctx->db, ino, &u);
+
+        char buf[128];
+        int n = snprintf(buf, sizeof(buf),
+            "{\"entries\":%ld,\"inodes\":%ld,\"bytes\":%ld}",
+            (long)u.entries, (long)u.inodes, (long)u.bytes);
+        reply_virtual_xattr(req, size, buf, n);
+        return;
+    }
+
     /* Virtual xattr: agentfs.versions → JSON array of version metadata */
     if (strcmp(name, "agentfs.versions") == 0) {
-        uint64_t ver = version_get_current(ino);
-        if (ver == 0) {
-            reply_virtual_xattr(req, size, "[]", 2);
+        version_settle(ino);
+
+        /* One read of the version index, in version order */
+        struct version_index vi;
+        if (version_index_load(ino, &vi) != 0) {
+            fuse_reply_err(req, EIO);
             return;
         }
 
         /* Build JSON array */
         size_t cap = 256;
         char *json = malloc(cap);
-        if (!json) { fuse_reply_err(req, ENOMEM); return; }
+        if (!json) { version_index_free(&vi); fuse_reply_err(req, ENOMEM); return; }
         size_t off = 0;
         json[off++] = '[';
 
-        uint64_t start = 0;
-        if (ver > KVBFS_MAX_VERSIONS) start = ver - KVBFS_MAX_VERSIONS;
-
-        for (uint64_t v = start; v < ver; v++) {
-            struct kvbfs_version_meta meta;
-            if (version_get_meta(ino, v, &meta) != 0) continue;
+        for (size_t i = 0; i < vi.n; i++) {
+            const struct kvbfs_version_meta *meta = &vi.e[i].meta;
 
-            char entry[128];
+            char entry[160];
             int elen = snprintf(entry, sizeof(entry),
-                "%s{\"ver\":%lu,\"size\":%lu,\"mtime\":%lu}",
+                "%s{\"ver\":%lu,\"size\":%lu,\"mtime\":%lu,"
+                "\"created\":%ld,\"changed\":%lu}",
                 (off > 1) ? "," : "",
-                (unsigned long)v,
-                (unsigned long)meta.size,
-                (unsigned long)meta.mtime.tv_sec);
+                (unsigned long)vi.e[i].ver,
+                (unsigned long)meta->size,
+                (unsigned long)meta->mtime.tv_sec,
+                (long)(meta->created ? meta->created : meta->mtime.tv_sec),
+                (unsigned long)(meta->format == VERSION_FORMAT_COPY ?
+                                meta->blocks : meta->changed));
 
             while (off + elen + 2 > cap) {
                 cap *= 2;
                 char *tmp = realloc(json, cap);
-                if (!tmp) { free(json); fuse_reply_err(req, ENOMEM); return; }
+                if (!tmp) {
+                    free(json);
+                    version_index_free(&vi);
+                    fuse_reply_err(req, ENOMEM);
+                    return;
+                }
                 json = tmp;
             }
             memcpy(json + off, entry, elen);
             off += elen;
         }
         json[off++] = ']';
+        version_index_free(&vi);
 
         reply_virtual_xattr(req, size, json, off);
         free(json);
         return;
     }
 
-    /* Regular user xattr from KV store */
-    char key[KVBFS_KEY_MAX];
-    int keylen = kvbfs_key_xattr(key, sizeof(key), ino, name);
-    if (keylen < 0) {
-        fuse_reply_err(req, ERANGE);
+    /* Regular user xattr from the cached per-inode set */
+    struct kvbfs_inode_cache *ic = inode_get(ino);
+    if (!ic) {
+        fuse_reply_err(req, ENODATA);
         return;
     }
-
     char *value = NULL;
     size_t vlen = 0;
-    if (kv_get(g_ctx->db, key, keylen, &value, &vlen) != 0) {
-        fuse_reply_err(req, ENODATA);
+    int err = xattr_get(ic, name, &value, &vlen);
+    inode_put(ic);
+    if (err) {
+        fuse_reply_err(req, err);
         return;
     }
 
-    if (size == 0) {
-        fuse_reply_xattr(req, vlen);
-    } else if (size < vlen) {
-        fuse_reply_err(req, ERANGE);
-    } else {
-        fuse_reply_buf(req, value, vlen);
-    }
+    reply_virtual_xattr(req, size, value, vlen);
     free(value);
 }
 
@@ -2365,52 +3723,17 @@ static void kvbfs_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
         return;
     }
 #endif
-    char prefix[64];
-    int prefix_len = kvbfs_key_xattr_prefix(prefix, sizeof(prefix), ino);
-
-    /* First pass: collect all xattr names and total size */
+    char *names = NULL;
     size_t total = 0;
-    size_t count = 0;
-    size_t cap = 16;
-    char **names = malloc(cap * sizeof(char *));
-    size_t *name_lens = malloc(cap * sizeof(size_t));
-    if (!names || !name_lens) {
-        free(names);
-        free(name_lens);
-        fuse_reply_err(req, ENOMEM);
-        return;
-    }
-
-    kv_iterator_t *iter = kv_iter_prefix(g_ctx->db, prefix, prefix_len);
-    while (kv_iter_valid(iter)) {
-        size_t klen;
-        const char *raw_key = kv_iter_key(iter, &klen);
-
-        /* Extract attr name: skip "x:<ino>:" prefix */
-        const char *attr_name = raw_key + prefix_len;
-        size_t attr_len = klen - prefix_len;
-
-        if (count >= cap) {
-            cap *= 2;
-            names = realloc(names, cap * sizeof(char *));
-            name_lens = realloc(name_lens, cap * sizeof(size_t));
-            if (!names || !name_lens) {
-                kv_iter_free(iter);
-                free(names);
-                free(name_lens);
-                fuse_reply_err(req, ENOMEM);
-                return;
-            }
+    struct kvbfs_inode_cache *ic = inode_get(ino);
+    if (ic) {
+        int err = xattr_list(ic, &names, &total);
+        inode_put(ic);
+        if (err) {
+            fuse_reply_err(req, err);
+            return;
         }
-
-        names[count] = strndup(attr_name, attr_len);
-        name_lens[count] = attr_len;
-        total += attr_len + 1;  /* name + null terminator */
-        count++;
-
-        kv_iter_next(iter);
     }
-    kv_iter_free(iter);
 
     if (size == 0) {
         /* Return total size needed */
@@ -2418,28 +3741,9 @@ static void kvbfs_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
     } else if (size < total) {
         fuse_reply_err(req, ERANGE);
     } else {
-        /* Build null-separated name list */
-        char *buf = malloc(total);
-        if (!buf) {
-            for (size_t i = 0; i < count; i++) free(names[i]);
-            free(names);
-            free(name_lens);
-            fuse_reply_err(req, ENOMEM);
-            return;
-        }
-        size_t off = 0;
-        for (size_t i = 0; i < count; i++) {
-            memcpy(buf + off, names[i], name_lens[i]);
-            off += name_lens[i];
-            buf[off++] = '\0';
-        }
-        fuse_reply_buf(req, buf, total);
-        free(buf);
+        fuse_reply_buf(req, names, total);
     }
-
-    for (size_t i = 0; i < count; i++) free(names[i]);
     free(names);
-    free(name_lens);
 }
 
 static void kvbfs_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name)
@@ -2454,24 +3758,15 @@ static void kvbfs_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name)
         return;
     }
 
-    char key[KVBFS_KEY_MAX];
-    int keylen = kvbfs_key_xattr(key, sizeof(key), ino, name);
-    if (keylen < 0) {
-        fuse_reply_err(req, ERANGE);
-        return;
-    }
-
-    /* Check existence first */
-    char *value = NULL;
-    size_t vlen = 0;
-    if (kv_get(g_ctx->db, key, keylen, &value, &vlen) != 0) {
+    struct kvbfs_inode_cache *ic = inode_get(ino);
+    if (!ic) {
         fuse_reply_err(req, ENODATA);
         return;
     }
-    free(value);
-
-    if (kv_delete(g_ctx->db, key, keylen) != 0) {
-        fuse_reply_err(req, EIO);
+    int err = xattr_remove(ic, name);
+    inode_put(ic);
+    if (err) {
+        fuse_reply_err(req, err);
         return;
     }
 
@@ -2481,31 +3776,18 @@ static void kvbfs_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name)
     fuse_reply_err(req, 0);
 }
 
-/* Helper: delete all xattrs for an inode */
-static void xattr_delete_all(uint64_t ino)
-{
-    char prefix[64];
-    int prefix_len = kvbfs_key_xattr_prefix(prefix, sizeof(prefix), ino);
-
-    kv_iterator_t *iter = kv_iter_prefix(g_ctx->db, prefix, prefix_len);
-    while (kv_iter_valid(iter)) {
-        size_t klen;
-        const char *key = kv_iter_key(iter, &klen);
-        kv_delete(g_ctx->db, key, klen);
-        kv_iter_next(iter);
-    }
-    kv_iter_free(iter);
-}
-
-/* FUSE 操作表 */
 struct fuse_lowlevel_ops kvbfs_ll_ops = {
     .init       = kvbfs_init,
     .destroy    = kvbfs_destroy,
     .lookup     = kvbfs_lookup,
+    .forget     = kvbfs_forget,
+    .forget_multi = kvbfs_forget_multi,
     .getattr    = kvbfs_getattr,
     .setattr    = kvbfs_setattr,
     .readdir    = kvbfs_readdir,
+    .readdirplus = kvbfs_readdirplus,
     .opendir    = kvbfs_opendir,
+    .releasedir = kvbfs_releasedir,
     .mkdir      = kvbfs_mkdir,
     .rmdir      = kvbfs_rmdir,
     .create     = kvbfs_create,
@@ -2516,6 +3798,7 @@ struct fuse_lowlevel_ops kvbfs_ll_ops = {
     .write      = kvbfs_write,
     .rename     = kvbfs_rename,
     .fsync      = kvbfs_fsync,
+    .statfs     = kvbfs_statfs,
     .symlink    = kvbfs_symlink,
     .readlink   = kvbfs_readlink,
     .link       = kvbfs_link,
@@ -0,0 +1,903 @@
+#include "gc.h"
+#include "kvbfs.h"
+#include "inode.h"
+#include "version.h"
+#ifdef CFS_MEMORY
+#include "mem.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define GC_SCAN_KEYS  (GC_BATCH_KEYS * 4)   /* keys inspected per lock hold */
+
+static uint64_t size_to_blocks(uint64_t size)
+{
+    return (size + KVBFS_BLOCK_SIZE - 1) / KVBFS_BLOCK_SIZE;
+}
+
+static int gc_stopping(struct gc_ctx *gc)
+{
+    return __atomic_load_n(&gc->shutdown, __ATOMIC_ACQUIRE);
+}
+
+/* Account n deletions and sleep long enough to stay under the rate limit */
+static void gc_throttle(struct gc_ctx *gc, size_t n)
+{
+    if (n == 0) return;
+    __atomic_add_fetch(&gc->reclaimed, n, __ATOMIC_RELAXED);
+    if (gc->rate == 0) return;
+
+    uint64_t ns = (uint64_t)n * 1000000000ULL / gc->rate;
+    struct timespec ts = {
+        .tv_sec  = (time_t)(ns / 1000000000ULL),
+        .tv_nsec = (long)(ns % 1000000000ULL),
+    };
+    nanosleep(&ts, NULL);
+}
+
+/* Parse the block index out of a "b:<ino>:<blk>" key */
+static int block_key_index(const char *key, size_t klen, size_t prefix_len,
+                           uint64_t *blk)
+{
+    char num[24];
+    size_t n = klen - prefix_len;
+    if (klen <= prefix_len || n >= sizeof(num)) return -1;
+    memcpy(num, key + prefix_len, n);
+    num[n] = '\0';
+
+    char *end;
+    *blk = strtoull(num, &end, 10);
+    return *end == '\0' ? 0 : -1;
+}
+
+/* ── Task queue ───────────────────────────────────────── */
+
+static void gc_push(struct gc_ctx *gc, uint64_t ino, int kind)
+{
+    struct gc_task *task = malloc(sizeof(*task));
+    if (!task) return;     /* record stays persisted; retried next mount */
+    task->ino = ino;
+    task->kind = kind;
+    task->next = NULL;
+
+    pthread_mutex_lock(&gc->lock);
+    if (gc->tail)
+        gc->tail->next = task;
+    else
+        gc->head = task;
+    gc->tail = task;
+    pthread_cond_signal(&gc->cond);
+    pthread_mutex_unlock(&gc->lock);
+}
+
+void gc_orphan(kv_batch_t *batch, uint64_t ino)
+{
+    char key[64];
+    int keylen = kvbfs_key_orphan(key, sizeof(key), ino);
+    kv_batch_put(batch, key, keylen, (const char *)&ino, sizeof(uint64_t));
+}
+
+void gc_enqueue(struct gc_ctx *gc, uint64_t ino)
+{
+    gc_push(gc, ino, GC_INODE);
+}
+
+void gc_thin(struct gc_ctx *gc, uint64_t ino)
+{
+    if (!gc->running) return;   /* the next sweep covers it */
+    gc_push(gc, ino, GC_THIN);
+}
+
+/* ── Reclamation ──────────────────────────────────────── */
+
+/* Forget a pending truncate; the inode itself is being reclaimed */
+static void gc_trunc_drop(struct gc_ctx *gc, uint64_t ino)
+{
+    char key[64];
+    int keylen = kvbfs_key_orphan_trunc(key, sizeof(key), ino);
+
+    pthread_mutex_lock(&gc->lock);
+    struct gc_trunc *t = NULL;
+    HASH_FIND(hh, gc->truncs, &ino, sizeof(uint64_t), t);
+    if (t) {
+        HASH_DEL(gc->truncs, t);
+        __atomic_sub_fetch(&gc->n_truncs, 1, __ATOMIC_RELEASE);
+        free(t);
+    }
+    kv_delete(gc->db, key, keylen);
+    pthread_mutex_unlock(&gc->lock);
+}
+
+/*
+ * Detach every child of an orphaned directory.  Each dirent is deleted in
+ * the same batch as its child's orphan record (or nlink drop for files
+ * with other links), so a crash never loses or double-counts a child.
+ * Subdirectories become orphans themselves and are walked in turn.
+ */
+static int gc_reclaim_children(struct gc_ctx *gc, uint64_t dir)
+{
+    char prefix[64];
+    int plen = kvbfs_key_dirent_prefix(prefix, sizeof(prefix), dir);
+
+    kv_iterator_t *iter = kv_iter_prefix(gc->db, prefix, plen);
+    if (!iter) return -1;
+
+    int ret = 0;
+    while (ret == 0 && kv_iter_valid(iter)) {
+        kv_batch_t *batch = kv_batch_new();
+        if (!batch) {
+            ret = -1;
+            break;
+        }
+
+        /* Children that only lose a link, for rollback on failure */
+        struct kvbfs_inode_cache *linked[GC_BATCH_KEYS];
+        uint64_t orphans[GC_BATCH_KEYS];
+        size_t n_linked = 0, n_orphans = 0, n = 0;
+
+        while (n < GC_BATCH_KEYS && kv_iter_valid(iter)) {
+            size_t klen, vlen;
+            const char *k = kv_iter_key(iter, &klen);
+            const char *v = kv_iter_value(iter, &vlen);
+            kv_batch_delete(batch, k, klen);
+            n++;
+
+            struct kvbfs_dirent de;
+            uint64_t child = 0;
+            if (kvbfs_dirent_decode(v, vlen, &de) == 0)
+                child = de.ino;
+
+            /* Matching reverse-index record */
+            char name[KVBFS_KEY_MAX];
+            size_t nlen = klen - plen;
+            if (child && nlen < sizeof(name)) {
+                memcpy(name, k + plen, nlen);
+                name[nlen] = '\0';
+                path_unlink_batch(batch, child, dir, name);
+            }
+            kv_iter_next(iter);
+
+            struct kvbfs_inode_cache *ic = child ? inode_get(child) : NULL;
+            if (!ic) continue;      /* already gone */
+
+            pthread_rwlock_wrlock(&ic->lock);
+            if (!S_ISDIR(ic->inode.mode) && ic->inode.nlink > 1) {
+                /* Still linked from outside the subtree */
+                ic->inode.nlink--;
+                inode_save_nlink_batch(batch, ic);
+                pthread_rwlock_unlock(&ic->lock);
+                linked[n_linked++] = ic;
+            } else {
+                pthread_rwlock_unlock(&ic->lock);
+                inode_put(ic);
+                inode_delete_batch(batch, child);
+                gc_orphan(batch, child);
+                orphans[n_orphans++] = child;
+            }
+        }
+
+        int err = kv_batch_commit(gc->db, batch);
+        kv_batch_free(batch);
+
+        for (size_t i = 0; i < n_linked; i++) {
+            if (err != 0) {
+                pthread_rwlock_wrlock(&linked[i]->lock);
+                linked[i]->inode.nlink++;
+                pthread_rwlock_unlock(&linked[i]->lock);
+            }
+            inode_put(linked[i]);
+        }
+        if (err != 0) {
+            ret = -1;       /* directory orphan stays; retried next mount */
+            break;
+        }
+        for (size_t i = 0; i < n_orphans; i++) {
+            inode_mark_deleted(orphans[i]);
+            gc_push(gc, orphans[i], GC_INODE);
+        }
+
+        gc_throttle(gc, n);
+        if (gc_stopping(gc)) ret = -1;
+    }
+
+    kv_iter_free(iter);
+    return ret;
+}
+
+/*
+ * Delete every key under prefix, GC_BATCH_KEYS keys per range delete, and
+ * charge each chunk to the rate limit.  With refs set the keys are version
+ * records and each reference gives its count back in the same batch.
+ * Returns -1 on error or shutdown; the orphan record resumes the rest.
+ */
+static int gc_delete_prefix(struct gc_ctx *gc, const char *prefix,
+                            size_t prefix_len, int refs)
+{
+    kv_iterator_t *iter = kv_iter_prefix(gc->db, prefix, prefix_len);
+    if (!iter) return -1;
+
+    int ret = 0;
+    while (ret == 0 && kv_iter_valid(iter)) {
+        kv_batch_t *batch = kv_batch_new();
+        if (!batch) {
+            ret = -1;
+            break;
+        }
+
+        char first[KVBFS_KEY_MAX];
+        size_t first_len = 0, n = 0;
+        while (n < GC_BATCH_KEYS && kv_iter_valid(iter)) {
+            size_t klen, vlen;
+            const char *k = kv_iter_key(iter, &klen);
+            const char *v = kv_iter_value(iter, &vlen);
+            if (n == 0) {
+                first_len = klen < sizeof(first) ? klen : sizeof(first);
+                memcpy(first, k, first_len);
+            }
+            if (refs && k[klen - 1] == '#' && vlen == VCAS_HASH_SIZE)
+                vcas_unref(batch, (const uint8_t *)v);
+            n++;
+            kv_iter_next(iter);
+        }
+
+        /* [first key, next key), or up to the end of the prefix */
+        char end[KVBFS_KEY_MAX];
+        size_t end_len;
+        if (kv_iter_valid(iter)) {
+            const char *k = kv_iter_key(iter, &end_len);
+            if (end_len > sizeof(end)) end_len = sizeof(end);
+            memcpy(end, k, end_len);
+        } else {
+            end_len = prefix_len;
+            memcpy(end, prefix, prefix_len);
+            end[prefix_len - 1]++;
+        }
+        kv_batch_delete_range(batch, first, first_len, end, end_len);
+
+        if (kv_batch_commit(gc->db, batch) != 0) ret = -1;
+        kv_batch_free(batch);
+        gc_throttle(gc, n);
+        if (gc_stopping(gc)) ret = -1;
+    }
+
+    kv_iter_free(iter);
+    return ret;
+}
+
+static void gc_reclaim_inode(struct gc_ctx *gc, uint64_t ino)
+{
+    /* A detached directory tree: orphan its children first */
+    if (gc_reclaim_children(gc, ino) != 0) return;
+
+    /* Bulk keys in bounded chunks, then the per-inode records in one batch */
+    char prefix[64];
+    int plen;
+
+    plen = kvbfs_key_block_prefix(prefix, sizeof(prefix), ino);
+    if (gc_delete_prefix(gc, prefix, plen, 0) != 0) return;
+    plen = kvbfs_key_xattr_prefix(prefix, sizeof(prefix), ino);
+    if (gc_delete_prefix(gc, prefix, plen, 0) != 0) return;
+    plen = kvbfs_key_parent_prefix(prefix, sizeof(prefix), ino);
+    if (gc_delete_prefix(gc, prefix, plen, 0) != 0) return;
+    plen = snprintf(prefix, sizeof(prefix), "vb:%lu:", (unsigned long)ino);
+    if (gc_delete_prefix(gc, prefix, plen, 0) != 0) return;
+    plen = snprintf(prefix, sizeof(prefix), "vx:%lu:", (unsigned long)ino);
+    if (gc_delete_prefix(gc, prefix, plen, 1) != 0) return;
+    plen = kvbfs_key_version_meta_prefix(prefix, sizeof(prefix), ino);
+    if (gc_delete_prefix(gc, prefix, plen, 0) != 0) return;
+
+    kv_batch_t *batch = kv_batch_new();
+    if (!batch) return;
+    plen = kvbfs_key_xattr_packed(prefix, sizeof(prefix), ino);
+    kv_batch_delete(batch, prefix, plen);
+    plen = kvbfs_key_orphan_wb(prefix, sizeof(prefix), ino);
+    kv_batch_delete(batch, prefix, plen);
+    plen = kvbfs_key_usage(prefix, sizeof(prefix), ino);
+    kv_batch_delete(batch, prefix, plen);
+    version_delete_all_batch(batch, ino);   /* only index and marker remain */
+
+    int ret = kv_batch_commit(gc->db, batch);
+    kv_batch_free(batch);
+    if (ret != 0) return;   /* retried at next mount */
+    gc_throttle(gc, 5);     /* xa:, ow:, u:, vc:, vd: */
+
+#ifdef CFS_MEMORY
+    mem_delete_embeddings(gc->db, ino);
+#endif
+
+    gc_trunc_drop(gc, ino);
+
+    char key[64];
+    int keylen = kvbfs_key_orphan(key, sizeof(key), ino);
+    kv_delete(gc->db, key, keylen);
+}
+
+static void gc_reclaim_trunc(struct gc_ctx *gc, uint64_t ino)
+{
+    struct kvbfs_inode_cache *ic = inode_get(ino);
+    if (!ic) {
+        /* Unlinked meanwhile: the orphan record covers the blocks */
+        gc_trunc_drop(gc, ino);
+        return;
+    }
+
+    char prefix[64];
+    int plen = kvbfs_key_block_prefix(prefix, sizeof(prefix), ino);
+
+    for (;;) {
+        pthread_mutex_lock(&gc->lock);
+        struct gc_trunc *t = NULL;
+        HASH_FIND(hh, gc->truncs, &ino, sizeof(uint64_t), t);
+        uint64_t gen = t ? t->gen : 0;
+        pthread_mutex_unlock(&gc->lock);
+        if (!t) break;
+
+        kv_iterator_t *iter = kv_iter_prefix(gc->db, prefix, plen);
+        if (!iter) break;
+
+        while (kv_iter_valid(iter)) {
+            kv_batch_t *batch = kv_batch_new();
+            if (!batch) {
+                kv_iter_free(iter);
+                inode_put(ic);
+                return;
+            }
+
+            /* Writers extend the file under the inode write lock */
+            pthread_rwlock_wrlock(&ic->lock);
+            uint64_t eof_blocks = size_to_blocks(ic->inode.size);
+
+            pthread_mutex_lock(&gc->lock);
+            HASH_FIND(hh, gc->truncs, &ino, sizeof(uint64_t), t);
+            uint64_t start = t ? t->start : 0;
+            uint64_t end = t ? t->end : 0;
+            pthread_mutex_unlock(&gc->lock);
+
+            size_t n = 0, scanned = 0;
+            while (scanned < GC_SCAN_KEYS && kv_iter_valid(iter)) {
+                size_t klen;
+                const char *k = kv_iter_key(iter, &klen);
+                uint64_t blk;
+                if (block_key_index(k, klen, plen, &blk) == 0 &&
+                    blk >= start && blk < end && blk >= eof_blocks) {
+                    kv_batch_delete(batch, k, klen);
+                    n++;
+                }
+                scanned++;
+                kv_iter_next(iter);
+                if (n == GC_BATCH_KEYS) break;
+            }
+            if (n > 0)
+                kv_batch_commit(gc->db, batch);
+            pthread_rwlock_unlock(&ic->lock);
+            kv_batch_free(batch);
+
+            gc_throttle(gc, n);
+            if (gc_stopping(gc)) {
+                /* Record stays persisted; resumed at next mount */
+                kv_iter_free(iter);
+                inode_put(ic);
+                return;
+            }
+        }
+        kv_iter_free(iter);
+
+        /* Done unless the range grew while we were scanning */
+        char key[64];
+        int keylen = kvbfs_key_orphan_trunc(key, sizeof(key), ino);
+        int again = 0;
+
+        pthread_mutex_lock(&gc->lock);
+        HASH_FIND(hh, gc->truncs, &ino, sizeof(uint64_t), t);
+        if (t && t->gen == gen) {
+            HASH_DEL(gc->truncs, t);
+            __atomic_sub_fetch(&gc->n_truncs, 1, __ATOMIC_RELEASE);
+            free(t);
+            kv_delete(gc->db, key, keylen);
+        } else if (t) {
+            again = 1;
+        }
+        pthread_mutex_unlock(&gc->lock);
+
+        if (!again) break;
+    }
+
+    inode_put(ic);
+}
+
+/* ── Truncate bookkeeping ─────────────────────────────── */
+
+static void gc_trunc_persist(struct gc_ctx *gc, struct gc_trunc *t)
+{
+    char key[64];
+    int keylen = kvbfs_key_orphan_trunc(key, sizeof(key), t->ino);
+    struct gc_trunc_rec rec = { .start = t->start, .end = t->end };
+    kv_put(gc->db, key, keylen, (const char *)&rec, sizeof(rec));
+}
+
+int gc_truncate(struct gc_ctx *gc, uint64_t ino,
+                uint64_t old_size, uint64_t new_size)
+{
+    uint64_t start = size_to_blocks(new_size);
+    uint64_t end = size_to_blocks(old_size);
+    if (end <= start) return 0;
+
+    pthread_mutex_lock(&gc->lock);
+    struct gc_trunc *t = NULL;
+    HASH_FIND(hh, gc->truncs, &ino, sizeof(uint64_t), t);
+    if (!t) {
+        t = calloc(1, sizeof(*t));
+        if (!t) {
+            pthread_mutex_unlock(&gc->lock);
+            return -1;
+        }
+        t->ino = ino;
+        t->start = start;
+        t->end = end;
+        HASH_ADD(hh, gc->truncs, ino, sizeof(uint64_t), t);
+        __atomic_add_fetch(&gc->n_truncs, 1, __ATOMIC_RELEASE);
+    } else {
+        if (start < t->start) t->start = start;
+        if (end > t->end) t->end = end;
+    }
+    t->gen++;
+    gc_trunc_persist(gc, t);
+    pthread_mutex_unlock(&gc->lock);
+
+    gc_push(gc, ino, GC_TRUNC);
+    return 0;
+}
+
+/* Delete blocks [lo, hi) of ino now; scans the prefix for sparse ranges */
+static void gc_delete_blocks_now(struct gc_ctx *gc, uint64_t ino,
+                                 uint64_t lo, uint64_t hi)
+{
+    kv_batch_t *batch = kv_batch_new();
+    if (!batch) return;
+
+    char key[64];
+    int keylen;
+
+    if (hi - lo <= GC_SCAN_KEYS) {
+        for (uint64_t b = lo; b < hi; b++) {
+            keylen = kvbfs_key_block(key, sizeof(key), ino, b);
+            kv_batch_delete(batch, key, keylen);
+        }
+    } else {
+        int plen = kvbfs_key_block_prefix(key, sizeof(key), ino);
+        kv_iterator_t *iter = kv_iter_prefix(gc->db, key, plen);
+        while (kv_iter_valid(iter)) {
+            size_t klen;
+            const char *k = kv_iter_key(iter, &klen);
+            uint64_t blk;
+            if (block_key_index(k, klen, plen, &blk) == 0 && blk >= lo && blk < hi)
+                kv_batch_delete(batch, k, klen);
+            kv_iter_next(iter);
+        }
+        kv_iter_free(iter);
+    }
+
+    kv_batch_commit(gc->db, batch);
+    kv_batch_free(batch);
+}
+
+void gc_claim(struct gc_ctx *gc, uint64_t ino,
+              uint64_t old_size, uint64_t new_size)
+{
+    if (__atomic_load_n(&gc->n_truncs, __ATOMIC_ACQUIRE) == 0) return;
+
+    uint64_t from = size_to_blocks(old_size);
+    uint64_t to = size_to_blocks(new_size);
+    if (to <= from) return;
+
+    pthread_mutex_lock(&gc->lock);
+    struct gc_trunc *t = NULL;
+    HASH_FIND(hh, gc->truncs, &ino, sizeof(uint64_t), t);
+    if (!t || to <= t->start || from >= t->end) {
+        pthread_mutex_unlock(&gc->lock);
+        return;
+    }
+
+    uint64_t lo = from > t->start ? from : t->start;
+    uint64_t hi = to < t->end ? to : t->end;
+    pthread_mutex_unlock(&gc->lock);
+
+    /*
+     * Delete without gc->lock: the scan can be long.  The caller's inode
+     * write lock keeps gc_truncate and the worker off this inode meanwhile;
+     * the record is only narrowed once the blocks are gone.
+     */
+    gc_delete_blocks_now(gc, ino, lo, hi);
+
+    pthread_mutex_lock(&gc->lock);
+    t = NULL;
+    HASH_FIND(hh, gc->truncs, &ino, sizeof(uint64_t), t);
+    if (!t) {
+        pthread_mutex_unlock(&gc->lock);
+        return;
+    }
+
+    /* Growth always starts at EOF, so the claimed part is a prefix */
+    if (lo <= t->start && hi > t->start)
+        t->start = hi;
+
+    if (t->start >= t->end) {
+        char key[64];
+        int keylen = kvbfs_key_orphan_trunc(key, sizeof(key), ino);
+        kv_delete(gc->db, key, keylen);
+        HASH_DEL(gc->truncs, t);
+        __atomic_sub_fetch(&gc->n_truncs, 1, __ATOMIC_RELEASE);
+        free(t);
+    } else {
+        gc_trunc_persist(gc, t);
+    }
+    pthread_mutex_unlock(&gc->lock);
+}
+
+/* ── Version thinning ─────────────────────────────────── */
+
+static void gc_thin_inode(struct gc_ctx *gc, uint64_t ino)
+{
+    struct version_policy pol;
+    version_policy_resolve(ino, &pol);
+
+    uint64_t *drop;
+    size_t n;
+    if (version_thin_plan(ino, &pol, time(NULL), &drop, &n) != 0) return;
+
+    for (size_t i = 0; i < n && !gc_stopping(gc); i++) {
+        size_t keys = 0;
+        uint64_t bytes = version_delete(ino, drop[i], &keys);
+        if (keys == 0) continue;
+        __atomic_add_fetch(&gc->versions_thinned, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&gc->version_bytes, bytes, __ATOMIC_RELAXED);
+        gc_throttle(gc, keys);
+    }
+    free(drop);
+}
+
+/*
+ * One step of the retention sweep: thin the next GC_SWEEP_FILES versioned
+ * files after cursor ("vc:<ino>" key).  Returns 1 while files remain.
+ */
+static int gc_sweep_step(struct gc_ctx *gc, char *cursor, size_t *cursor_len)
+{
+    uint64_t inos[GC_SWEEP_FILES];
+    size_t n = 0;
+
+    kv_iterator_t *iter = kv_iter_prefix(gc->db, "vc:", 3);
+    if (!iter) return 0;
+    if (*cursor_len > 0) {
+        kv_iter_seek(iter, cursor, *cursor_len);
+        size_t klen;
+        const char *key;
+        if (kv_iter_valid(iter) && (key = kv_iter_key(iter, &klen)) &&
+            klen == *cursor_len && memcmp(key, cursor, klen) == 0)
+            kv_iter_next(iter);
+    }
+    while (n < GC_SWEEP_FILES && kv_iter_valid(iter)) {
+        size_t klen;
+        const char *key = kv_iter_key(iter, &klen);
+        uint64_t ino;
+        if (block_key_index(key, klen, 3, &ino) == 0 && klen < 32) {
+            inos[n++] = ino;
+            memcpy(cursor, key, klen);
+            *cursor_len = klen;
+        }
+        kv_iter_next(iter);
+    }
+    int more = kv_iter_valid(iter);
+    kv_iter_free(iter);
+
+    for (size_t i = 0; i < n && !gc_stopping(gc); i++)
+        gc_thin_inode(gc, inos[i]);
+    return more;
+}
+
+/* ── Store verifier ───────────────────────────────────── */
+
+/* Publish a finished verifier pass for agentfs.stats */
+static void gc_verify_done(struct gc_ctx *gc, const struct vcas_pass *pass)
+{
+    __atomic_store_n(&gc->dedup.blobs, pass->blobs, __ATOMIC_RELAXED);
+    __atomic_store_n(&gc->dedup.stored, pass->stored, __ATOMIC_RELAXED);
+    __atomic_store_n(&gc->dedup.referenced, pass->referenced, __ATOMIC_RELAXED);
+    __atomic_store_n(&gc->dedup.corrupt, pass->corrupt, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&gc->dedup_passes, 1, __ATOMIC_RELEASE);
+    if (pass->corrupt > 0)
+        fprintf(stderr, "GC: %lu version block(s) failed verification\n",
+                (unsigned long)pass->corrupt);
+}
+
+/* ── Worker thread ────────────────────────────────────── */
+
+static uint64_t now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec;
+}
+
+static void *gc_worker(void *arg)
+{
+    struct gc_ctx *gc = (struct gc_ctx *)arg;
+    uint64_t next_sweep = now_s() + gc->thin_interval;
+    int sweeping = 0;
+    char cursor[32];
+    size_t cursor_len = 0;
+
+    /* The first verifier pass runs at mount, to report the ratio early */
+    uint64_t next_verify = now_s();
+    int verifying = 0;
+    char vcursor[80];
+    size_t vcursor_len = 0;
+    struct vcas_pass pass;
+
+    while (1) {
+        pthread_mutex_lock(&gc->lock);
+
+        /* Queued tasks go first; the sweeps advance when the queue is idle */
+        while (!gc->head && !gc->shutdown && !sweeping && !verifying) {
+            uint64_t now = now_s();
+            if (gc->thin_interval != 0 && now >= next_sweep) {
+                sweeping = 1;
+                cursor_len = 0;
+                break;
+            }
+            if (gc->verify_interval != 0 && now >= next_verify) {
+                verifying = 1;
+                vcursor_len = 0;
+                memset(&pass, 0, sizeof(pass));
+                break;
+            }
+
+            uint64_t wake = UINT64_MAX;
+            if (gc->thin_interval != 0) wake = next_sweep;
+            if (gc->verify_interval != 0 && next_verify < wake) wake = next_verify;
+            if (wake == UINT64_MAX) {
+                pthread_cond_wait(&gc->cond, &gc->lock);
+                continue;
+            }
+            struct timespec ts = { .tv_sec = (time_t)wake };
+            pthread_cond_timedwait(&gc->cond, &gc->lock, &ts);
+        }
+
+        /* Pending work is persisted, no need to drain on shutdown */
+        if (gc->shutdown) {
+            pthread_mutex_unlock(&gc->lock);
+            break;
+        }
+
+        struct gc_task *task = gc->head;
+        if (task) {
+            gc->head = task->next;
+            if (!gc->head) gc->tail = NULL;
+        }
+
+        pthread_mutex_unlock(&gc->lock);
+
+        if (!task && sweeping) {
+            if (!gc_sweep_step(gc, cursor, &cursor_len)) {
+                sweeping = 0;
+                next_sweep = now_s() + gc->thin_interval;
+            }
+            continue;
+        }
+        if (!task) {
+            size_t keys = 0;
+            int more = vcas_verify_step(vcursor, &vcursor_len, &pass, &keys);
+            __atomic_add_fetch(&gc->dedup.swept, pass.swept, __ATOMIC_RELAXED);
+            pass.swept = 0;
+            gc_throttle(gc, keys);
+            if (!more) {
+                gc_verify_done(gc, &pass);
+                verifying = 0;
+                next_verify = now_s() + gc->verify_interval;
+            }
+            continue;
+        }
+
+        if (task->kind == GC_INODE)
+            gc_reclaim_inode(gc, task->ino);
+        else if (task->kind == GC_TRUNC)
+            gc_reclaim_trunc(gc, task->ino);
+        else
+            gc_thin_inode(gc, task->ino);
+        free(task);
+    }
+
+    return NULL;
+}
+
+/* ── Lifecycle ────────────────────────────────────────── */
+
+/*
+ * A write-back record "ow:<ino>" means the file grew past the size stored in
+ * its inode and the inode was not flushed before a crash.  Blocks beyond the
+ * stored EOF hold data the size never acknowledged: zero the tail of the last
+ * kept block now and turn the rest into a truncate record, so the usual
+ * truncate path reclaims them and a later extension never exposes them.
+ */
+static void gc_recover_writeback(void *db, const char *okey, size_t oklen,
+                                 uint64_t ino)
+{
+    kv_batch_t *batch = kv_batch_new();
+    if (!batch) return;
+
+    char key[64];
+    int keylen = kvbfs_key_inode(key, sizeof(key), ino);
+    char *val = NULL;
+    size_t vlen = 0;
+    struct kvbfs_inode inode;
+    int live = kv_get(db, key, keylen, &val, &vlen) == 0 &&
+               vlen == sizeof(inode);
+    if (live) memcpy(&inode, val, sizeof(inode));
+    free(val);
+
+    /* Unlinked inodes are covered by their orphan record */
+    if (live) {
+        uint64_t keep = size_to_blocks(inode.size);
+        size_t tail = inode.size % KVBFS_BLOCK_SIZE;
+        if (tail != 0) {
+            keylen = kvbfs_key_block(key, sizeof(key), ino, keep - 1);
+            val = NULL;
+            if (kv_get(db, key, keylen, &val, &vlen) == 0 && vlen > tail) {
+                memset(val + tail, 0, vlen - tail);
+                kv_batch_put(batch, key, keylen, val, vlen);
+            }
+            free(val);
+        }
+
+        struct gc_trunc_rec rec = { .start = keep, .end = UINT64_MAX };
+        keylen = kvbfs_key_orphan_trunc(key, sizeof(key), ino);
+        val = NULL;
+        if (kv_get(db, key, keylen, &val, &vlen) == 0 && vlen == sizeof(rec)) {
+            struct gc_trunc_rec old;
+            memcpy(&old, val, sizeof(old));
+            if (old.start < rec.start) rec.start = old.start;
+        }
+        free(val);
+        kv_batch_put(batch, key, keylen, (const char *)&rec, sizeof(rec));
+    }
+
+    kv_batch_delete(batch, okey, oklen);
+    kv_batch_commit(db, batch);
+    kv_batch_free(batch);
+}
+
+int gc_init(struct gc_ctx *gc, void *db)
+{
+    memset(gc, 0, sizeof(*gc));
+    gc->db = db;
+    gc->rate = GC_DEFAULT_RATE;
+    gc->thin_interval = GC_THIN_DEFAULT_S;
+    gc->verify_interval = VCAS_VERIFY_DEFAULT_S;
+    pthread_mutex_init(&gc->lock, NULL);
+
+    /* The retention sweep sleeps on a monotonic deadline */
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&gc->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    const char *s = getenv("KVBFS_GC_RATE");
+    if (s) gc->rate = strtoull(s, NULL, 10);
+    s = getenv("KVBFS_VERSION_THIN_S");
+    if (s) gc->thin_interval = strtoull(s, NULL, 10);
+    s = getenv("KVBFS_DEDUP_VERIFY_S");
+    if (s) gc->verify_interval = strtoull(s, NULL, 10);
+    version_policy_default(&gc->retention);
+
+    /* Blocks written past an unflushed EOF become truncate records */
+    unsigned n_writeback = 0;
+    kv_iterator_t *iter = kv_iter_prefix(db, "ow:", 3);
+    while (kv_iter_valid(iter)) {
+        size_t klen;
+        const char *key = kv_iter_key(iter, &klen);
+        uint64_t ino;
+        if (block_key_index(key, klen, 3, &ino) == 0) {
+            gc_recover_writeback(db, key, klen, ino);
+            n_writeback++;
+        }
+        kv_iter_next(iter);
+    }
+    kv_iter_free(iter);
+    if (n_writeback > 0)
+        printf("GC: recovered %u unflushed write-back(s)\n", n_writeback);
+
+    /* Re-queue reclamation interrupted by a crash or unmount */
+    unsigned n_orphans = 0;
+    iter = kv_iter_prefix(db, "o:", 2);
+    while (kv_iter_valid(iter)) {
+        size_t vlen;
+        const char *val = kv_iter_value(iter, &vlen);
+        if (vlen == sizeof(uint64_t)) {
+            uint64_t ino;
+            memcpy(&ino, val, sizeof(uint64_t));
+            gc_push(gc, ino, GC_INODE);
+            n_orphans++;
+        }
+        kv_iter_next(iter);
+    }
+    kv_iter_free(iter);
+
+    iter = kv_iter_prefix(db, "ot:", 3);
+    while (kv_iter_valid(iter)) {
+        size_t klen, vlen;
+        const char *key = kv_iter_key(iter, &klen);
+        const char *val = kv_iter_value(iter, &vlen);
+        uint64_t ino;
+        struct gc_trunc *t;
+        if (vlen == sizeof(struct gc_trunc_rec) &&
+            block_key_index(key, klen, 3, &ino) == 0 &&
+            (t = calloc(1, sizeof(*t))) != NULL) {
+            struct gc_trunc_rec rec;
+            memcpy(&rec, val, sizeof(rec));
+            t->ino = ino;
+            t->start = rec.start;
+            t->end = rec.end;
+            HASH_ADD(hh, gc->truncs, ino, sizeof(uint64_t), t);
+            gc->n_truncs++;
+            gc_push(gc, ino, GC_TRUNC);
+        }
+        kv_iter_next(iter);
+    }
+    kv_iter_free(iter);
+
+    if (n_orphans > 0 || gc->n_truncs > 0)
+        printf("GC: resuming %u orphan inode(s), %u truncation(s)\n",
+               n_orphans, gc->n_truncs);
+    return 0;
+}
+
+int gc_start(struct gc_ctx *gc)
+{
+    if (gc->running) return 0;
+    gc->shutdown = 0;
+    if (pthread_create(&gc->thread, NULL, gc_worker, gc) != 0) {
+        fprintf(stderr, "GC: failed to create worker thread\n");
+        return -1;
+    }
+    gc->running = 1;
+    return 0;
+}
+
+void gc_stop(struct gc_ctx *gc)
+{
+    if (!gc->running) return;
+
+    pthread_mutex_lock(&gc->lock);
+    __atomic_store_n(&gc->shutdown, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&gc->cond);
+    pthread_mutex_unlock(&gc->lock);
+
+    pthread_join(gc->thread, NULL);
+    gc->running = 0;
+}
+
+void gc_destroy(struct gc_ctx *gc)
+{
+    gc_stop(gc);
+
+    struct gc_task *task = gc->head;
+    while (task) {
+        struct gc_task *next = task->next;
+        free(task);
+        task = next;
+    }
+    gc->head = gc->tail = NULL;
+
+    struct gc_trunc *t, *tmp;
+    HASH_ITER(hh, gc->truncs, t, tmp) {
+        HASH_DEL(gc->truncs, t);
+        free(t);
+    }
+    gc->n_truncs = 0;
+
+    pthread_mutex_destroy(&gc->lock);
+    pthread_cond_destroy(&gc->cond);
+}
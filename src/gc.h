@@ -0,0 +1,130 @@
+#ifndef GC_H
+#define GC_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "uthash.h"
+#include "kv_store.h"
+#include "vcas.h"
+
+/*
+ * Background reclamation.
+ *
+ * unlink/rmdir/rename only detach the inode: the dirent removal, the inode
+ * key deletion and an orphan record "o:<ino>" go into one batch, and the GC
+ * worker later deletes blocks, xattrs, versions and embeddings at a bounded
+ * rate.  A detached directory is reclaimed one level at a time: each child's
+ * dirent is dropped together with its own orphan record, so recursive
+ * deletes (CFS_IOC_RMTREE) return as soon as the subtree root is detached.
+ * Per-inode data is removed with range deletes of GC_BATCH_KEYS keys each,
+ * charged to the rate limit by the keys they cover.  Truncation records
+ * the dropped block range as "ot:<ino>" instead of deleting the blocks
+ * inline.  Both record types survive a crash and are re-queued at mount.
+ * A leftover write-back record "ow:<ino>" (see inode_writeback_batch) is
+ * converted into a truncate record for everything past the stored EOF.
+ *
+ * The worker also thins file versions (see version.h): after each snapshot
+ * for that file, and for every versioned file once per KVBFS_VERSION_THIN_S
+ * seconds, a chunk of files at a time between other tasks.  Deletions are
+ * charged to the same rate limit as reclamation.
+ *
+ * In the same idle time it verifies the version block store (see vcas.h)
+ * once at mount and then every KVBFS_DEDUP_VERIFY_S seconds, sweeping
+ * blobs nobody references and publishing the totals of the last full pass.
+ */
+
+#define GC_DEFAULT_RATE   20000     /* key deletions per second */
+#define GC_BATCH_KEYS     256       /* deletions per batch commit */
+#define GC_THIN_DEFAULT_S 600       /* retention sweep interval */
+#define GC_SWEEP_FILES    64        /* files thinned per sweep step */
+
+enum gc_kind {
+    GC_INODE = 1,       /* reclaim everything owned by an unlinked inode */
+    GC_TRUNC = 2,       /* reclaim blocks beyond EOF after a truncate */
+    GC_THIN  = 3,       /* apply the version retention policy */
+};
+
+struct gc_task {
+    uint64_t ino;
+    int kind;
+    struct gc_task *next;
+};
+
+/* Pending truncate range: blocks [start, end) are logically gone */
+struct gc_trunc {
+    uint64_t ino;
+    uint64_t start;
+    uint64_t end;
+    uint64_t gen;       /* bumped when the range grows */
+    UT_hash_handle hh;
+};
+
+/* Persisted value of "ot:<ino>" */
+struct gc_trunc_rec {
+    uint64_t start;
+    uint64_t end;
+};
+
+/* Version retention, see version.h */
+struct version_policy {
+    uint64_t keep_all;      /* seconds */
+    uint64_t hourly;        /* seconds */
+    uint64_t daily;         /* seconds, 0 = forever */
+    uint64_t max_count;     /* 0 = no cap */
+    uint64_t max_bytes;     /* 0 = no cap */
+};
+
+struct gc_ctx {
+    void *db;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct gc_task *head, *tail;
+    struct gc_trunc *truncs;        /* hash by ino, protected by lock */
+    uint32_t n_truncs;              /* read without lock as a fast path */
+    int shutdown;
+    int running;
+
+    uint64_t rate;                  /* deletions per second, 0 = unlimited */
+    uint64_t reclaimed;             /* keys deleted since mount */
+
+    struct version_policy retention;    /* mount default */
+    uint64_t thin_interval;         /* sweep period in seconds, 0 = off */
+    uint64_t versions_thinned;
+    uint64_t version_bytes;         /* block bytes freed by thinning */
+
+    uint64_t verify_interval;       /* store verifier period in seconds, 0 = off */
+    struct vcas_pass dedup;         /* last full pass; swept counts since mount */
+    uint64_t dedup_passes;
+};
+
+/* Load pending orphan/truncate records; does not start the worker */
+int  gc_init(struct gc_ctx *gc, void *db);
+int  gc_start(struct gc_ctx *gc);
+/* Stop the worker; unfinished work stays persisted for the next mount */
+void gc_stop(struct gc_ctx *gc);
+void gc_destroy(struct gc_ctx *gc);
+
+/* Add the orphan record for ino to batch; call gc_enqueue after commit */
+void gc_orphan(kv_batch_t *batch, uint64_t ino);
+void gc_enqueue(struct gc_ctx *gc, uint64_t ino);
+/* Apply the retention policy to ino soon */
+void gc_thin(struct gc_ctx *gc, uint64_t ino);
+
+/*
+ * Record that the file shrank from old_size to new_size.  Caller holds the
+ * inode write lock and has already zeroed the tail of the last kept block.
+ */
+int  gc_truncate(struct gc_ctx *gc, uint64_t ino,
+                 uint64_t old_size, uint64_t new_size);
+
+/*
+ * The file is about to grow from old_size to new_size: synchronously drop any
+ * pending-truncate blocks in that range so stale data never reappears.
+ * Caller holds the inode write lock.
+ */
+void gc_claim(struct gc_ctx *gc, uint64_t ino,
+              uint64_t old_size, uint64_t new_size);
+
+#endif /* GC_H */
@@ -8,13 +8,50 @@
 #include <time.h>
 #include <sys/stat.h>
 
+/*
+ * inode 号分配：存储中的 super.next_ino 是已预留范围的上界，每 KVBFS_INO_CHUNK
+ * 个号才写一次超级块；线程再从全局范围中一次领取 KVBFS_INO_BATCH 个号。
+ * 崩溃后从上界继续分配，未用完的号直接跳过。
+ */
+static __thread struct {
+    uint64_t epoch;
+    uint64_t next;
+    uint64_t end;
+} ino_cache;
+
+static uint64_t ino_epoch_seq;
+
+void inode_alloc_init(struct kvbfs_ctx *ctx)
+{
+    ctx->ino_next = ctx->super.next_ino;
+    /* 之前挂载遗留的线程号段随 epoch 失效 */
+    ctx->ino_epoch = __atomic_add_fetch(&ino_epoch_seq, 1, __ATOMIC_RELAXED);
+}
+
 uint64_t inode_alloc(void)
 {
-    pthread_mutex_lock(&g_ctx->alloc_lock);
-    uint64_t ino = g_ctx->super.next_ino++;
-    pthread_mutex_unlock(&g_ctx->alloc_lock);
-    super_save(g_ctx);  /* I/O outside lock; crash wastes at most one ino */
-    return ino;
+    if (ino_cache.epoch != g_ctx->ino_epoch || ino_cache.next == ino_cache.end) {
+        pthread_mutex_lock(&g_ctx->alloc_lock);
+        uint64_t start = g_ctx->ino_next;
+        uint64_t end = start + KVBFS_INO_BATCH;
+        if (end > g_ctx->super.next_ino) {
+            /* 先持久化新的上界再交出号码 */
+            uint64_t old_limit = g_ctx->super.next_ino;
+            g_ctx->super.next_ino = end + KVBFS_INO_CHUNK;
+            if (super_save(g_ctx) != 0) {
+                g_ctx->super.next_ino = old_limit;
+                pthread_mutex_unlock(&g_ctx->alloc_lock);
+                return 0;
+            }
+        }
+        g_ctx->ino_next = end;
+        pthread_mutex_unlock(&g_ctx->alloc_lock);
+
+        ino_cache.epoch = g_ctx->ino_epoch;
+        ino_cache.next = start;
+        ino_cache.end = end;
+    }
+    return ino_cache.next++;
 }
 
 int inode_load(uint64_t ino, struct kvbfs_inode *inode)
@@ -41,145 +78,404 @@ int inode_save(const struct kvbfs_inode *inode)
     char key[64];
     int keylen = kvbfs_key_inode(key, sizeof(key), inode->ino);
 
+    __atomic_add_fetch(&g_ctx->inode_writes, 1, __ATOMIC_RELAXED);
     return kv_put(g_ctx->db, key, keylen,
                   (const char *)inode, sizeof(struct kvbfs_inode));
 }
 
-struct kvbfs_inode_cache *inode_get(uint64_t ino)
+#define ICACHE_LOAD_RETRIES 2     /* 锁外加载的重试次数，之后在分片锁内加载 */
+
+/* inode 号连续分配，取模即可均匀分布到各分片 */
+static inline struct icache_shard *icache_shard(uint64_t ino)
 {
-    struct kvbfs_inode_cache *ic = NULL;
+    return &g_ctx->icache[ino % KVBFS_ICACHE_SHARDS];
+}
 
-    /* 先查缓存 */
-    pthread_mutex_lock(&g_ctx->icache_lock);
-    HASH_FIND(hh, g_ctx->icache, &ino, sizeof(uint64_t), ic);
-    if (ic) {
-        if (ic->deleted) {
-            pthread_mutex_unlock(&g_ctx->icache_lock);
-            return NULL;  /* deleted inode, treat as absent */
+/* ── LRU：引用计数为 0 的缓存项按最近使用顺序挂在分片链表上 ── */
+
+static void lru_remove(struct icache_shard *sh, struct kvbfs_inode_cache *ic)
+{
+    if (ic->lru_prev) ic->lru_prev->lru_next = ic->lru_next;
+    else sh->lru_head = ic->lru_next;
+    if (ic->lru_next) ic->lru_next->lru_prev = ic->lru_prev;
+    else sh->lru_tail = ic->lru_prev;
+    ic->lru_prev = ic->lru_next = NULL;
+}
+
+static void lru_push_tail(struct icache_shard *sh, struct kvbfs_inode_cache *ic)
+{
+    ic->lru_next = NULL;
+    ic->lru_prev = sh->lru_tail;
+    if (sh->lru_tail) sh->lru_tail->lru_next = ic;
+    else sh->lru_head = ic;
+    sh->lru_tail = ic;
+}
+
+static void lru_push_head(struct icache_shard *sh, struct kvbfs_inode_cache *ic)
+{
+    ic->lru_prev = NULL;
+    ic->lru_next = sh->lru_head;
+    if (sh->lru_head) sh->lru_head->lru_prev = ic;
+    else sh->lru_tail = ic;
+    sh->lru_head = ic;
+}
+
+/* 增加引用；从 0 变为 1 时移出 LRU。调用方持有分片锁 */
+static void icache_ref_locked(struct icache_shard *sh, struct kvbfs_inode_cache *ic)
+{
+    if (ic->refcount++ == 0 && !ic->deleted)
+        lru_remove(sh, ic);
+}
+
+static void icache_unlink_locked(struct icache_shard *sh, struct kvbfs_inode_cache *ic)
+{
+    HASH_DEL(sh->map, ic);
+    sh->count--;
+    sh->gen++;      /* 预热读到的旧值不能再填入 */
+}
+
+/* 缓存项从分片的 slab 分配和归还，调用方持有分片锁 */
+static struct kvbfs_inode_cache *icache_entry_new_locked(struct icache_shard *sh)
+{
+    struct kvbfs_inode_cache *ic = slab_zalloc(&sh->slab);
+    if (ic) pthread_rwlock_init(&ic->lock, NULL);
+    return ic;
+}
+
+static void icache_entry_free_locked(struct icache_shard *sh,
+                                     struct kvbfs_inode_cache *ic)
+{
+    pthread_rwlock_destroy(&ic->lock);
+    xattr_set_free(ic->xattrs);
+    free(ic->vdirty);       /* 丢弃后由 vd: 标记触发全量比较 */
+    slab_free(&sh->slab, ic);
+}
+
+/* 超出预算时从 LRU 头部淘汰干净、无引用的缓存项 */
+static void icache_evict_locked(struct icache_shard *sh)
+{
+    struct kvbfs_inode_cache *ic = sh->lru_head;
+
+    while (ic && sh->count > g_ctx->icache_shard_max) {
+        struct kvbfs_inode_cache *next = ic->lru_next;
+        if (!ic->dirty) {
+            lru_remove(sh, ic);
+            icache_unlink_locked(sh, ic);
+            icache_entry_free_locked(sh, ic);
+            sh->evictions++;
         }
-        ic->refcount++;
-        pthread_mutex_unlock(&g_ctx->icache_lock);
-        return ic;
+        ic = next;
     }
-    pthread_mutex_unlock(&g_ctx->icache_lock);
+}
 
-    /* 缓存未命中，从存储加载 */
-    struct kvbfs_inode inode;
-    if (inode_load(ino, &inode) != 0) {
-        return NULL;
+void inode_cache_init(struct kvbfs_ctx *ctx)
+{
+    for (int i = 0; i < KVBFS_ICACHE_SHARDS; i++) {
+        memset(&ctx->icache[i], 0, sizeof(ctx->icache[i]));
+        pthread_mutex_init(&ctx->icache[i].lock, NULL);
+        slab_init(&ctx->icache[i].slab, sizeof(struct kvbfs_inode_cache));
     }
 
-    /* 创建缓存项 */
-    ic = calloc(1, sizeof(struct kvbfs_inode_cache));
-    if (!ic) return NULL;
+    /* 内存预算换算为每个分片的缓存项上限 */
+    unsigned long mb = KVBFS_ICACHE_DEFAULT_MB;
+    const char *s = getenv("KVBFS_ICACHE_MB");
+    if (s) mb = strtoul(s, NULL, 10);
+    size_t total = (size_t)mb * 1024 * 1024 / sizeof(struct kvbfs_inode_cache);
+    ctx->icache_shard_max = total / KVBFS_ICACHE_SHARDS;
+    if (ctx->icache_shard_max == 0) ctx->icache_shard_max = 1;
+
+    struct icache_flusher *fl = &ctx->flusher;
+    memset(fl, 0, sizeof(*fl));
+    pthread_mutex_init(&fl->lock, NULL);
+    pthread_cond_init(&fl->cond, NULL);
+    fl->interval_ms = KVBFS_WRITEBACK_MS;
+    s = getenv("KVBFS_WRITEBACK_MS");
+    if (s) fl->interval_ms = strtoul(s, NULL, 10);
+}
 
-    ic->inode = inode;
-    ic->refcount = 1;
-    ic->dirty = false;
-    pthread_rwlock_init(&ic->lock, NULL);
+void inode_cache_destroy(struct kvbfs_ctx *ctx)
+{
+    pthread_mutex_destroy(&ctx->flusher.lock);
+    pthread_cond_destroy(&ctx->flusher.cond);
 
-    /* 加入缓存 */
-    pthread_mutex_lock(&g_ctx->icache_lock);
-    /* 双重检查：可能其他线程已加载或已删除 */
+    for (int i = 0; i < KVBFS_ICACHE_SHARDS; i++) {
+        pthread_mutex_destroy(&ctx->icache[i].lock);
+        slab_destroy(&ctx->icache[i].slab);
+    }
+}
+
+void inode_cache_stats(uint64_t *entries, uint64_t *evictions, uint64_t *writes)
+{
+    *entries = 0;
+    *evictions = 0;
+    *writes = __atomic_load_n(&g_ctx->inode_writes, __ATOMIC_RELAXED);
+    for (int i = 0; i < KVBFS_ICACHE_SHARDS; i++) {
+        struct icache_shard *sh = &g_ctx->icache[i];
+        pthread_mutex_lock(&sh->lock);
+        *entries += sh->count;
+        *evictions += sh->evictions;
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
+
+void inode_cache_slab_stats(uint64_t *live, uint64_t *idle, uint64_t *chunks)
+{
+    *live = *idle = *chunks = 0;
+    for (int i = 0; i < KVBFS_ICACHE_SHARDS; i++) {
+        struct icache_shard *sh = &g_ctx->icache[i];
+        pthread_mutex_lock(&sh->lock);
+        *live += sh->slab.n_live;
+        *idle += sh->slab.n_free;
+        *chunks += sh->slab.n_chunks;
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
+
+struct kvbfs_inode_cache *inode_get(uint64_t ino)
+{
+    struct kvbfs_inode_cache *ic = NULL;
+    struct icache_shard *sh = icache_shard(ino);
+    struct kvbfs_inode inode;
+
+    /*
+     * 未命中时在分片锁外读取存储；期间若有缓存项移出或 inode 被删除
+     * (gen 变化)，读到的值可能已过期，重试。多次重试仍失败则在锁内读取，
+     * 保证在频繁淘汰时也能前进。
+     */
+    for (int attempt = 0; ; attempt++) {
+        bool locked_load = attempt >= ICACHE_LOAD_RETRIES;
+
+        pthread_mutex_lock(&sh->lock);
+        HASH_FIND(hh, sh->map, &ino, sizeof(uint64_t), ic);
+        if (ic) {
+            if (ic->deleted) {
+                pthread_mutex_unlock(&sh->lock);
+                return NULL;  /* deleted inode, treat as absent */
+            }
+            icache_ref_locked(sh, ic);
+            pthread_mutex_unlock(&sh->lock);
+            return ic;
+        }
+        uint64_t gen = sh->gen;
+
+        if (locked_load) {
+            if (inode_load(ino, &inode) != 0) {
+                pthread_mutex_unlock(&sh->lock);
+                return NULL;
+            }
+            break;
+        }
+        pthread_mutex_unlock(&sh->lock);
+
+        /* 缓存未命中，从存储加载 */
+        if (inode_load(ino, &inode) != 0) {
+            return NULL;
+        }
+
+        pthread_mutex_lock(&sh->lock);
+        if (sh->gen == gen) break;
+        pthread_mutex_unlock(&sh->lock);
+    }
+
+    /* 双重检查：其他线程可能已加载同一 inode */
     struct kvbfs_inode_cache *existing = NULL;
-    HASH_FIND(hh, g_ctx->icache, &ino, sizeof(uint64_t), existing);
+    HASH_FIND(hh, sh->map, &ino, sizeof(uint64_t), existing);
     if (existing) {
         if (existing->deleted) {
-            pthread_mutex_unlock(&g_ctx->icache_lock);
-            pthread_rwlock_destroy(&ic->lock);
-            free(ic);
+            pthread_mutex_unlock(&sh->lock);
             return NULL;
         }
-        existing->refcount++;
-        pthread_mutex_unlock(&g_ctx->icache_lock);
-        pthread_rwlock_destroy(&ic->lock);
-        free(ic);
+        icache_ref_locked(sh, existing);
+        pthread_mutex_unlock(&sh->lock);
         return existing;
     }
-    HASH_ADD(hh, g_ctx->icache, inode.ino, sizeof(uint64_t), ic);
-    pthread_mutex_unlock(&g_ctx->icache_lock);
 
+    ic = icache_entry_new_locked(sh);
+    if (!ic) {
+        pthread_mutex_unlock(&sh->lock);
+        return NULL;
+    }
+    ic->inode = inode;
+    ic->refcount = 1;
+    ic->dirty = false;
+    ic->synced_size = inode.size;
+    HASH_ADD(hh, sh->map, inode.ino, sizeof(uint64_t), ic);
+    sh->count++;
+    icache_evict_locked(sh);
+    pthread_mutex_unlock(&sh->lock);
     return ic;
 }
 
+int inode_peek(uint64_t ino, struct kvbfs_inode *inode)
+{
+    struct kvbfs_inode_cache *ic = NULL;
+    struct icache_shard *sh = icache_shard(ino);
+
+    pthread_mutex_lock(&sh->lock);
+    HASH_FIND(hh, sh->map, &ino, sizeof(uint64_t), ic);
+    if (!ic || ic->deleted) {
+        pthread_mutex_unlock(&sh->lock);
+        return -1;
+    }
+    icache_ref_locked(sh, ic);
+    pthread_mutex_unlock(&sh->lock);
+
+    /* 不在持有分片锁时获取 inode 锁 */
+    pthread_rwlock_rdlock(&ic->lock);
+    *inode = ic->inode;
+    pthread_rwlock_unlock(&ic->lock);
+
+    inode_put(ic);
+    return 0;
+}
+
 void inode_put(struct kvbfs_inode_cache *ic)
 {
     if (!ic) return;
 
-    pthread_mutex_lock(&g_ctx->icache_lock);
+    struct icache_shard *sh = icache_shard(ic->inode.ino);
+
+    pthread_mutex_lock(&sh->lock);
     if (ic->refcount > 0) {
         ic->refcount--;
     }
-    if (ic->refcount == 0 && ic->deleted) {
-        HASH_DEL(g_ctx->icache, ic);
-        pthread_mutex_unlock(&g_ctx->icache_lock);
-        pthread_rwlock_destroy(&ic->lock);
-        free(ic);
-        return;
+    if (ic->refcount == 0) {
+        if (ic->deleted) {
+            icache_unlink_locked(sh, ic);
+            icache_entry_free_locked(sh, ic);
+        } else {
+            lru_push_tail(sh, ic);
+            icache_evict_locked(sh);
+        }
+    }
+    pthread_mutex_unlock(&sh->lock);
+}
+
+void inode_lookup_inc(uint64_t ino)
+{
+    struct icache_shard *sh = icache_shard(ino);
+    struct kvbfs_inode_cache *ic = NULL;
+
+    pthread_mutex_lock(&sh->lock);
+    HASH_FIND(hh, sh->map, &ino, sizeof(uint64_t), ic);
+    if (ic) ic->nlookup++;
+    pthread_mutex_unlock(&sh->lock);
+}
+
+void inode_forget(uint64_t ino, uint64_t nlookup)
+{
+    struct icache_shard *sh = icache_shard(ino);
+    struct kvbfs_inode_cache *ic = NULL;
+
+    pthread_mutex_lock(&sh->lock);
+    HASH_FIND(hh, sh->map, &ino, sizeof(uint64_t), ic);
+    if (ic) {
+        /* 缓存项可能在内核引用期间被淘汰后重新加载，计数只作提示 */
+        ic->nlookup = ic->nlookup > nlookup ? ic->nlookup - nlookup : 0;
+
+        /* 内核已不再引用：移到 LRU 头部，最先被淘汰 */
+        if (ic->nlookup == 0 && ic->refcount == 0 && !ic->deleted) {
+            lru_remove(sh, ic);
+            lru_push_head(sh, ic);
+            icache_evict_locked(sh);
+        }
     }
-    pthread_mutex_unlock(&g_ctx->icache_lock);
+    pthread_mutex_unlock(&sh->lock);
 }
 
 struct kvbfs_inode_cache *inode_create(uint32_t mode)
 {
     uint64_t ino = inode_alloc();
-
-    struct kvbfs_inode_cache *ic = calloc(1, sizeof(struct kvbfs_inode_cache));
-    if (!ic) return NULL;
+    if (ino == 0) return NULL;
 
     struct timespec now;
     clock_gettime(CLOCK_REALTIME, &now);
 
-    ic->inode.ino = ino;
-    ic->inode.mode = mode;
-    ic->inode.nlink = 1;
-    ic->inode.size = 0;
-    ic->inode.blocks = 0;
-    ic->inode.atime = now;
-    ic->inode.mtime = now;
-    ic->inode.ctime = now;
-
-    ic->refcount = 1;
-    ic->dirty = true;
-    pthread_rwlock_init(&ic->lock, NULL);
+    struct kvbfs_inode inode;
+    memset(&inode, 0, sizeof(inode));
+    inode.ino = ino;
+    inode.mode = mode;
+    inode.nlink = 1;
+    inode.size = 0;
+    inode.blocks = 0;
+    inode.atime = now;
+    inode.mtime = now;
+    inode.ctime = now;
 
     /* 立即保存到存储 */
-    if (inode_save(&ic->inode) != 0) {
-        pthread_rwlock_destroy(&ic->lock);
-        free(ic);
+    if (inode_save(&inode) != 0) {
         return NULL;
     }
-    ic->dirty = false;
 
     /* 加入缓存 */
-    pthread_mutex_lock(&g_ctx->icache_lock);
-    HASH_ADD(hh, g_ctx->icache, inode.ino, sizeof(uint64_t), ic);
-    pthread_mutex_unlock(&g_ctx->icache_lock);
-
+    struct icache_shard *sh = icache_shard(ino);
+    pthread_mutex_lock(&sh->lock);
+    struct kvbfs_inode_cache *ic = icache_entry_new_locked(sh);
+    if (!ic) {
+        pthread_mutex_unlock(&sh->lock);
+        return NULL;
+    }
+    ic->inode = inode;
+    ic->refcount = 1;
+    ic->dirty = false;
+    HASH_ADD(hh, sh->map, inode.ino, sizeof(uint64_t), ic);
+    sh->count++;
+    icache_evict_locked(sh);
+    pthread_mutex_unlock(&sh->lock);
     return ic;
 }
 
-int inode_delete(uint64_t ino)
+void inode_save_batch(kv_batch_t *batch, const struct kvbfs_inode *inode)
+{
+    char key[64];
+    int keylen = kvbfs_key_inode(key, sizeof(key), inode->ino);
+
+    kv_batch_put(batch, key, keylen,
+                 (const char *)inode, sizeof(struct kvbfs_inode));
+}
+
+void inode_save_nlink_batch(kv_batch_t *batch,
+                            const struct kvbfs_inode_cache *ic)
+{
+    struct kvbfs_inode inode = ic->inode;
+    inode.size = ic->synced_size;   /* 新大小由 inode_sync 连同用量写回 */
+    inode_save_batch(batch, &inode);
+}
+
+void inode_delete_batch(kv_batch_t *batch, uint64_t ino)
 {
     char key[64];
     int keylen = kvbfs_key_inode(key, sizeof(key), ino);
 
+    kv_batch_delete(batch, key, keylen);
+}
+
+void inode_mark_deleted(uint64_t ino)
+{
     /* Mark deleted; free immediately only if refcount == 0 */
-    pthread_mutex_lock(&g_ctx->icache_lock);
+    struct icache_shard *sh = icache_shard(ino);
+    pthread_mutex_lock(&sh->lock);
+    sh->gen++;      /* 未缓存的 inode 也不能被预热重新填入 */
     struct kvbfs_inode_cache *ic = NULL;
-    HASH_FIND(hh, g_ctx->icache, &ino, sizeof(uint64_t), ic);
+    HASH_FIND(hh, sh->map, &ino, sizeof(uint64_t), ic);
     if (ic) {
         ic->deleted = true;
         if (ic->refcount == 0) {
-            HASH_DEL(g_ctx->icache, ic);
-            pthread_mutex_unlock(&g_ctx->icache_lock);
-            pthread_rwlock_destroy(&ic->lock);
-            free(ic);
-            return kv_delete(g_ctx->db, key, keylen);
+            lru_remove(sh, ic);
+            icache_unlink_locked(sh, ic);
+            icache_entry_free_locked(sh, ic);
         }
         /* refcount > 0: keep in hash marked deleted; inode_put will clean up */
     }
-    pthread_mutex_unlock(&g_ctx->icache_lock);
+    pthread_mutex_unlock(&sh->lock);
+}
+
+int inode_delete(uint64_t ino)
+{
+    char key[64];
+    int keylen = kvbfs_key_inode(key, sizeof(key), ino);
+
+    inode_mark_deleted(ino);
 
     /* 从存储删除 */
     return kv_delete(g_ctx->db, key, keylen);
@@ -192,17 +488,68 @@ void inode_mark_dirty(struct kvbfs_inode_cache *ic)
     }
 }
 
+bool inode_writeback_batch(kv_batch_t *batch, struct kvbfs_inode_cache *ic,
+                           uint64_t end)
+{
+    if (end <= ic->synced_size || ic->wb_intent) return false;
+
+    char key[64];
+    int keylen = kvbfs_key_orphan_wb(key, sizeof(key), ic->inode.ino);
+    kv_batch_put(batch, key, keylen, NULL, 0);
+    ic->wb_intent = true;
+    return true;
+}
+
 int inode_sync(struct kvbfs_inode_cache *ic)
 {
-    if (!ic || !ic->dirty) return 0;
+    if (!ic) return 0;
+
+    /*
+     * 写锁与写入者互斥：写回的大小覆盖所有已提交的数据块，
+     * 因此可以在同一批次中删除 ow: 记录。
+     */
+    pthread_rwlock_wrlock(&ic->lock);
+    if (ic->deleted) {
+        /* 已删除的 inode 不能再写回，否则会重新出现 */
+        pthread_rwlock_unlock(&ic->lock);
+        return 0;
+    }
 
-    pthread_rwlock_rdlock(&ic->lock);
-    int ret = inode_save(&ic->inode);
-    pthread_rwlock_unlock(&ic->lock);
+    /* 文件大小的变化计入各个父目录的用量，与新大小同批提交 */
+    int64_t delta = S_ISDIR(ic->inode.mode) ? 0 :
+                    (int64_t)ic->inode.size - (int64_t)ic->synced_size;
+
+    int ret;
+    if (ic->wb_intent || delta != 0) {
+        kv_batch_t *batch = kv_batch_new();
+        ret = -1;
+        if (batch) {
+            inode_save_batch(batch, &ic->inode);
+            if (ic->wb_intent) {
+                char key[64];
+                int keylen = kvbfs_key_orphan_wb(key, sizeof(key), ic->inode.ino);
+                kv_batch_delete(batch, key, keylen);
+            }
+            if (delta != 0) usage_charge_begin(&g_ctx->usage);
+            usage_resize_batch(&g_ctx->usage, batch, g_ctx->db,
+                               ic->inode.ino, delta);
+            __atomic_add_fetch(&g_ctx->inode_writes, 1, __ATOMIC_RELAXED);
+            ret = kv_batch_commit(g_ctx->db, batch);
+            if (delta != 0) usage_charge_end(&g_ctx->usage);
+            kv_batch_free(batch);
+        }
+    } else {
+        ret = inode_save(&ic->inode);
+    }
 
     if (ret == 0) {
         ic->dirty = false;
+        ic->wb_intent = false;
+        ic->synced_size = ic->inode.size;
+    } else {
+        ic->dirty = true;   /* 保留在缓存中，inode_sync_all 重试 */
     }
+    pthread_rwlock_unlock(&ic->lock);
     return ret;
 }
 
@@ -216,29 +563,30 @@ int inode_sync_all(void)
     struct kvbfs_inode_cache **dirty_list = malloc(capacity * sizeof(*dirty_list));
     if (!dirty_list) return -1;
 
-    pthread_mutex_lock(&g_ctx->icache_lock);
-    struct kvbfs_inode_cache *ic, *tmp;
-    HASH_ITER(hh, g_ctx->icache, ic, tmp) {
-        if (ic->dirty && !ic->deleted) {
-            ic->refcount++;
+    for (int i = 0; i < KVBFS_ICACHE_SHARDS; i++) {
+        struct icache_shard *sh = &g_ctx->icache[i];
+        pthread_mutex_lock(&sh->lock);
+        struct kvbfs_inode_cache *ic, *tmp;
+        HASH_ITER(hh, sh->map, ic, tmp) {
+            if (!ic->dirty || ic->deleted) continue;
             if (count >= capacity) {
                 capacity *= 2;
                 struct kvbfs_inode_cache **new_list = realloc(dirty_list, capacity * sizeof(*dirty_list));
                 if (!new_list) {
-                    /* 回退已增加的引用计数 */
-                    for (size_t i = 0; i < count; i++) {
-                        dirty_list[i]->refcount--;
-                    }
-                    pthread_mutex_unlock(&g_ctx->icache_lock);
+                    pthread_mutex_unlock(&sh->lock);
+                    /* 释放已增加的引用计数 */
+                    for (size_t j = 0; j < count; j++)
+                        inode_put(dirty_list[j]);
                     free(dirty_list);
                     return -1;
                 }
                 dirty_list = new_list;
             }
+            icache_ref_locked(sh, ic);
             dirty_list[count++] = ic;
         }
+        pthread_mutex_unlock(&sh->lock);
     }
-    pthread_mutex_unlock(&g_ctx->icache_lock);
 
     /* 在无锁状态下逐个同步 */
     for (size_t i = 0; i < count; i++) {
@@ -254,16 +602,147 @@ int inode_sync_all(void)
 
 void inode_cache_clear(void)
 {
-    pthread_mutex_lock(&g_ctx->icache_lock);
-    struct kvbfs_inode_cache *ic, *tmp;
-    HASH_ITER(hh, g_ctx->icache, ic, tmp) {
-        if (ic->refcount > 0) {
-            fprintf(stderr, "warning: inode %lu still has refcount %lu at cache clear\n",
-                    (unsigned long)ic->inode.ino, (unsigned long)ic->refcount);
+    for (int i = 0; i < KVBFS_ICACHE_SHARDS; i++) {
+        struct icache_shard *sh = &g_ctx->icache[i];
+        pthread_mutex_lock(&sh->lock);
+        struct kvbfs_inode_cache *ic, *tmp;
+        HASH_ITER(hh, sh->map, ic, tmp) {
+            if (ic->refcount > 0) {
+                fprintf(stderr, "warning: inode %lu still has refcount %lu at cache clear\n",
+                        (unsigned long)ic->inode.ino, (unsigned long)ic->refcount);
+            }
+            HASH_DEL(sh->map, ic);
+            icache_entry_free_locked(sh, ic);
+        }
+        sh->count = 0;
+        sh->gen++;
+        sh->lru_head = sh->lru_tail = NULL;
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
+
+/* ── 预热 ─────────────────────────────────────────────── */
+
+void inode_cache_gens(uint64_t *gens)
+{
+    for (int i = 0; i < KVBFS_ICACHE_SHARDS; i++) {
+        struct icache_shard *sh = &g_ctx->icache[i];
+        pthread_mutex_lock(&sh->lock);
+        gens[i] = sh->gen;
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
+
+int inode_preload(const struct kvbfs_inode *inode, const uint64_t *gens)
+{
+    struct icache_shard *sh = icache_shard(inode->ino);
+    uint64_t gen = gens[inode->ino % KVBFS_ICACHE_SHARDS];
+
+    /* 读取之后有缓存项被移出时值可能已过期；预热不淘汰已有缓存项 */
+    pthread_mutex_lock(&sh->lock);
+    int ret = 0;
+    struct kvbfs_inode_cache *existing = NULL;
+    if (sh->gen == gen && sh->count < g_ctx->icache_shard_max) {
+        HASH_FIND(hh, sh->map, &inode->ino, sizeof(uint64_t), existing);
+        if (!existing) {
+            struct kvbfs_inode_cache *ic = icache_entry_new_locked(sh);
+            if (!ic) {
+                ret = -1;
+            } else {
+                ic->inode = *inode;
+                ic->synced_size = inode->size;
+                /* 放在 LRU 头部：预热项先于真正用过的项被淘汰 */
+                HASH_ADD(hh, sh->map, inode.ino, sizeof(uint64_t), ic);
+                sh->count++;
+                lru_push_head(sh, ic);
+                ret = 1;
+            }
+        }
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return ret;
+}
+
+size_t inode_hot_list(uint64_t *inos, size_t max)
+{
+    size_t n = 0;
+    size_t quota = max / KVBFS_ICACHE_SHARDS;
+    if (quota == 0) quota = 1;
+
+    for (int i = 0; i < KVBFS_ICACHE_SHARDS && n < max; i++) {
+        struct icache_shard *sh = &g_ctx->icache[i];
+        size_t taken = 0;
+        pthread_mutex_lock(&sh->lock);
+
+        /* 仍被引用的项最热，其余按 LRU 从尾部取 */
+        struct kvbfs_inode_cache *ic, *tmp;
+        HASH_ITER(hh, sh->map, ic, tmp) {
+            if (taken == quota || n == max) break;
+            if (ic->refcount > 0 && !ic->deleted) {
+                inos[n++] = ic->inode.ino;
+                taken++;
+            }
+        }
+        for (ic = sh->lru_tail; ic && taken < quota && n < max; ic = ic->lru_prev) {
+            inos[n++] = ic->inode.ino;
+            taken++;
+        }
+        pthread_mutex_unlock(&sh->lock);
+    }
+    return n;
+}
+
+/* ── 后台写回 ─────────────────────────────────────────── */
+
+static void *flusher_main(void *arg)
+{
+    struct icache_flusher *fl = arg;
+
+    pthread_mutex_lock(&fl->lock);
+    while (!fl->shutdown) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += fl->interval_ms / 1000;
+        ts.tv_nsec += (long)(fl->interval_ms % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
         }
-        HASH_DEL(g_ctx->icache, ic);
-        pthread_rwlock_destroy(&ic->lock);
-        free(ic);
+        pthread_cond_timedwait(&fl->cond, &fl->lock, &ts);
+        if (fl->shutdown) break;
+
+        pthread_mutex_unlock(&fl->lock);
+        inode_sync_all();
+        pthread_mutex_lock(&fl->lock);
     }
-    pthread_mutex_unlock(&g_ctx->icache_lock);
+    pthread_mutex_unlock(&fl->lock);
+    return NULL;
+}
+
+int inode_flusher_start(void)
+{
+    struct icache_flusher *fl = &g_ctx->flusher;
+    if (fl->running || fl->interval_ms == 0) return 0;
+
+    fl->shutdown = 0;
+    if (pthread_create(&fl->thread, NULL, flusher_main, fl) != 0) {
+        fprintf(stderr, "failed to create inode flusher thread\n");
+        return -1;
+    }
+    fl->running = 1;
+    return 0;
+}
+
+void inode_flusher_stop(void)
+{
+    struct icache_flusher *fl = &g_ctx->flusher;
+    if (!fl->running) return;
+
+    pthread_mutex_lock(&fl->lock);
+    fl->shutdown = 1;
+    pthread_cond_signal(&fl->cond);
+    pthread_mutex_unlock(&fl->lock);
+
+    pthread_join(fl->thread, NULL);
+    fl->running = 0;
 }
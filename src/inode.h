@@ -2,10 +2,24 @@
 #define INODE_H
 
 #include "kvbfs.h"
+#include "kv_store.h"
 
 /* inode 管理接口 */
 
-/* 分配新 inode 号 */
+/* 初始化/销毁 inode 缓存分片 */
+void inode_cache_init(struct kvbfs_ctx *ctx);
+void inode_cache_destroy(struct kvbfs_ctx *ctx);
+
+/* 缓存项数、累计淘汰次数与 inode 写入次数 */
+void inode_cache_stats(uint64_t *entries, uint64_t *evictions, uint64_t *writes);
+
+/* 缓存项 slab 的在用项、空闲项与块数（各分片合计） */
+void inode_cache_slab_stats(uint64_t *live, uint64_t *idle, uint64_t *chunks);
+
+/* 从已加载的超级块初始化 inode 号分配 */
+void inode_alloc_init(struct kvbfs_ctx *ctx);
+
+/* 分配新 inode 号；失败返回 0 */
 uint64_t inode_alloc(void);
 
 /* 从 KV 存储加载 inode（不使用缓存） */
@@ -17,25 +31,66 @@ int inode_save(const struct kvbfs_inode *inode);
 /* 从缓存或存储获取 inode，增加引用计数 */
 struct kvbfs_inode_cache *inode_get(uint64_t ino);
 
-/* 释放 inode 引用 */
+/* 仅查缓存：命中时复制 inode 并返回 0，不加载存储 */
+int inode_peek(uint64_t ino, struct kvbfs_inode *inode);
+
+/* 释放 inode 引用；引用归零的项进入 LRU，超出预算时淘汰 */
 void inode_put(struct kvbfs_inode_cache *ic);
 
+/* 内核 lookup 计数：回复 entry 时增加，FUSE forget 时减少 */
+void inode_lookup_inc(uint64_t ino);
+void inode_forget(uint64_t ino, uint64_t nlookup);
+
 /* 创建新 inode */
 struct kvbfs_inode_cache *inode_create(uint32_t mode);
 
 /* 删除 inode（从存储中删除） */
 int inode_delete(uint64_t ino);
 
-/* 将 inode 标记为脏 */
+/* 将 inode 写入/删除操作加入批处理 */
+void inode_save_batch(kv_batch_t *batch, const struct kvbfs_inode *inode);
+void inode_delete_batch(kv_batch_t *batch, uint64_t ino);
+
+/* 仅链接数变化时保存文件 inode：大小保持为已计入用量的值。调用方持有写锁 */
+void inode_save_nlink_batch(kv_batch_t *batch,
+                            const struct kvbfs_inode_cache *ic);
+
+/* 仅在缓存中标记删除（存储中的删除由调用方通过批处理完成） */
+void inode_mark_deleted(uint64_t ino);
+
+/* 将 inode 标记为脏，由后台线程或 release/fsync 写回 */
 void inode_mark_dirty(struct kvbfs_inode_cache *ic);
 
-/* 将脏 inode 写回存储 */
+/*
+ * 文件将增长到 end 且超出存储中的大小时，向数据块所在批次加入 ow: 记录，
+ * 崩溃后挂载时据此回收 EOF 之后的块。调用方持有 inode 写锁；
+ * 返回是否加入了记录（提交失败时调用方清除 wb_intent）。
+ */
+bool inode_writeback_batch(kv_batch_t *batch, struct kvbfs_inode_cache *ic,
+                           uint64_t end);
+
+/* 将 inode 写回存储，删除其 ow: 记录，并把大小变化计入目录用量 */
 int inode_sync(struct kvbfs_inode_cache *ic);
 
 /* 同步所有脏 inode */
 int inode_sync_all(void);
 
+/* 启动/停止周期写回线程（KVBFS_WRITEBACK_MS） */
+int  inode_flusher_start(void);
+void inode_flusher_stop(void);
+
 /* 释放所有缓存的 inode */
 void inode_cache_clear(void);
 
+/*
+ * 预热：先用 inode_cache_gens 记录各分片的代数再读取存储，
+ * inode_preload 只在代数未变时填入无引用的缓存项，不淘汰已有项。
+ * 返回 1 表示已填入；已缓存、分片已满或值可能过期时返回 0。
+ */
+void inode_cache_gens(uint64_t *gens);
+int  inode_preload(const struct kvbfs_inode *inode, const uint64_t *gens);
+
+/* 收集最近使用的 inode 号（各分片均分 max），用于保存热点集合 */
+size_t inode_hot_list(uint64_t *inos, size_t max);
+
 #endif /* INODE_H */
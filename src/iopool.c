@@ -0,0 +1,261 @@
+#include "iopool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void iopool_init(struct iopool *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->threads = IOPOOL_THREADS_DEFAULT;
+    p->per_inode = IOPOOL_INODE_INFLIGHT;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    pthread_cond_init(&p->idle, NULL);
+    slab_init(&p->task_slab, sizeof(struct io_task));
+    slab_init(&p->inode_slab, sizeof(struct io_inode));
+
+    const char *s = getenv("KVBFS_IO_THREADS");
+    if (s) p->threads = strtoul(s, NULL, 10);
+    if (p->threads > IOPOOL_THREADS_MAX) p->threads = IOPOOL_THREADS_MAX;
+    s = getenv("KVBFS_IO_INODE_INFLIGHT");
+    if (s) p->per_inode = strtoul(s, NULL, 10);
+    if (p->per_inode == 0) p->per_inode = 1;
+}
+
+/* ── Scheduling (lock held) ───────────────────────────── */
+
+static int can_start(const struct iopool *p, const struct io_inode *ii,
+                     const struct io_task *t)
+{
+    if (ii->exclusive) return 0;
+    if (t->exclusive) return ii->running == 0;
+    return ii->running < p->per_inode;
+}
+
+static void start_task(struct iopool *p, struct io_inode *ii, struct io_task *t)
+{
+    ii->running++;
+    if (t->exclusive) ii->exclusive = 1;
+
+    t->next = NULL;
+    if (p->ready_tail) p->ready_tail->next = t;
+    else p->ready_head = t;
+    p->ready_tail = t;
+    pthread_cond_signal(&p->cond);
+}
+
+/* Start waiting tasks of ii, in order, as far as the limits allow */
+static void promote(struct iopool *p, struct io_inode *ii)
+{
+    while (ii->head && can_start(p, ii, ii->head)) {
+        struct io_task *t = ii->head;
+        ii->head = t->next;
+        if (!ii->head) ii->tail = NULL;
+        start_task(p, ii, t);
+    }
+}
+
+/* Tasks on the outstanding list are the ones iopool_wait(p, 0) waits for */
+static void outstanding_add(struct iopool *p, struct io_task *t)
+{
+    t->seq = ++p->seq;
+    t->older = p->newest;
+    t->newer = NULL;
+    if (p->newest) p->newest->newer = t;
+    else p->oldest = t;
+    p->newest = t;
+}
+
+static void outstanding_remove(struct iopool *p, struct io_task *t)
+{
+    if (t->older) t->older->newer = t->newer;
+    else p->oldest = t->newer;
+    if (t->newer) t->newer->older = t->older;
+    else p->newest = t->older;
+}
+
+static void task_free_locked(struct iopool *p, struct io_task *t)
+{
+    free(t->data);
+    slab_free(&p->task_slab, t);
+}
+
+/* ── Workers ──────────────────────────────────────────── */
+
+static void *iopool_worker(void *arg)
+{
+    struct iopool *p = arg;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->ready_head) {
+            if (p->stop && p->queued == 0) {
+                pthread_mutex_unlock(&p->lock);
+                return NULL;
+            }
+            pthread_cond_wait(&p->cond, &p->lock);
+        }
+        struct io_task *t = p->ready_head;
+        p->ready_head = t->next;
+        if (!p->ready_head) p->ready_tail = NULL;
+        pthread_mutex_unlock(&p->lock);
+
+        p->run(t);
+
+        pthread_mutex_lock(&p->lock);
+        struct io_inode *ii = NULL;
+        uint64_t ino = t->ino;
+        HASH_FIND(hh, p->inodes, &ino, sizeof(uint64_t), ii);
+        int wake = p->oldest == t;
+        outstanding_remove(p, t);
+        if (ii) {
+            ii->running--;
+            if (t->exclusive) ii->exclusive = 0;
+            promote(p, ii);
+            if (ii->running == 0 && !ii->head) {
+                HASH_DEL(p->inodes, ii);
+                slab_free(&p->inode_slab, ii);
+                wake = 1;
+            }
+        }
+        if (wake)
+            pthread_cond_broadcast(&p->idle);
+        task_free_locked(p, t);
+        p->queued--;
+        p->completed++;
+        if (p->stop && p->queued == 0)
+            pthread_cond_broadcast(&p->cond);
+    }
+}
+
+int iopool_start(struct iopool *p, void (*run)(struct io_task *t))
+{
+    p->run = run;
+    if (p->started || p->threads == 0) return 0;
+
+    p->workers = calloc(p->threads, sizeof(pthread_t));
+    if (!p->workers) return -1;
+    p->stop = 0;
+    for (unsigned i = 0; i < p->threads; i++) {
+        if (pthread_create(&p->workers[i], NULL, iopool_worker, p) != 0) {
+            fprintf(stderr, "iopool: failed to create worker thread\n");
+            break;
+        }
+        p->started++;
+    }
+    return p->started > 0 ? 0 : -1;
+}
+
+void iopool_stop(struct iopool *p)
+{
+    if (!p->started) return;
+
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+
+    for (unsigned i = 0; i < p->started; i++)
+        pthread_join(p->workers[i], NULL);
+    free(p->workers);
+    p->workers = NULL;
+    p->started = 0;
+}
+
+void iopool_destroy(struct iopool *p)
+{
+    iopool_stop(p);
+    HASH_CLEAR(hh, p->inodes);
+    slab_destroy(&p->task_slab);
+    slab_destroy(&p->inode_slab);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->cond);
+    pthread_cond_destroy(&p->idle);
+}
+
+/* ── Submission ───────────────────────────────────────── */
+
+struct io_task *iopool_task(struct iopool *p)
+{
+    pthread_mutex_lock(&p->lock);
+    struct io_task *t = slab_zalloc(&p->task_slab);
+    pthread_mutex_unlock(&p->lock);
+    return t;
+}
+
+void iopool_submit(struct iopool *p, struct io_task *t)
+{
+    pthread_mutex_lock(&p->lock);
+    if (!p->started) {
+        pthread_mutex_unlock(&p->lock);
+        p->run(t);
+        pthread_mutex_lock(&p->lock);
+        task_free_locked(p, t);
+        pthread_mutex_unlock(&p->lock);
+        return;
+    }
+
+    p->submitted++;
+    if (++p->queued > p->peak) p->peak = p->queued;
+
+    struct io_inode *ii = NULL;
+    uint64_t ino = t->ino;
+    HASH_FIND(hh, p->inodes, &ino, sizeof(uint64_t), ii);
+    if (!ii) {
+        ii = slab_zalloc(&p->inode_slab);
+        if (!ii) {
+            /* No ordering state: run inline rather than out of order */
+            p->queued--;
+            pthread_mutex_unlock(&p->lock);
+            p->run(t);
+            pthread_mutex_lock(&p->lock);
+            task_free_locked(p, t);
+            pthread_mutex_unlock(&p->lock);
+            return;
+        }
+        ii->ino = ino;
+        HASH_ADD(hh, p->inodes, ino, sizeof(uint64_t), ii);
+    }
+    outstanding_add(p, t);
+
+    if (!ii->head && can_start(p, ii, t)) {
+        start_task(p, ii, t);
+    } else {
+        t->next = NULL;
+        if (ii->tail) ii->tail->next = t;
+        else ii->head = t;
+        ii->tail = t;
+        p->deferred++;
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+void iopool_wait(struct iopool *p, uint64_t ino)
+{
+    pthread_mutex_lock(&p->lock);
+    uint64_t mark = p->seq;     /* ino 0: tasks submitted up to now */
+    for (;;) {
+        if (ino != 0) {
+            struct io_inode *ii = NULL;
+            HASH_FIND(hh, p->inodes, &ino, sizeof(uint64_t), ii);
+            if (!ii) break;
+        } else if (!p->oldest || p->oldest->seq > mark) {
+            break;
+        }
+        pthread_cond_wait(&p->idle, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+void iopool_get_stats(struct iopool *p, struct iopool_stats *st)
+{
+    pthread_mutex_lock(&p->lock);
+    st->threads = p->started;
+    st->queued = p->queued;
+    st->peak = p->peak;
+    st->submitted = p->submitted;
+    st->completed = p->completed;
+    st->deferred = p->deferred;
+    pthread_mutex_unlock(&p->lock);
+}
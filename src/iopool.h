@@ -0,0 +1,125 @@
+#ifndef IOPOOL_H
+#define IOPOOL_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <fuse_lowlevel.h>
+#include "uthash.h"
+#include "slab.h"
+
+/*
+ * KV I/O executor.
+ *
+ * read, write, readdir and the side effects of release block on KV calls
+ * (for NVMe-KV, on network round trips).  Their handlers only queue a task
+ * and return, so a few FUSE threads keep many KV operations in flight.  A
+ * worker runs the task and replies through the stored fuse_req_t.
+ *
+ * Tasks of one inode start in submission order.  Shared tasks (reads,
+ * readdir) run up to KVBFS_IO_INODE_INFLIGHT at a time; exclusive tasks
+ * (writes, release) wait for everything queued before them and hold back
+ * everything queued after, so a read sees the writes submitted before it.
+ * With KVBFS_IO_THREADS=0, or once the pool is stopped, tasks run inline on
+ * the submitting thread.
+ *
+ * Replies go out before deferred side effects (a release's snapshot) are
+ * visible elsewhere, so readers of those effects call iopool_wait first.
+ */
+
+#define IOPOOL_THREADS_DEFAULT  8
+#define IOPOOL_THREADS_MAX      64
+#define IOPOOL_INODE_INFLIGHT   4       /* shared tasks per inode */
+
+enum io_op {
+    IO_READ = 1,
+    IO_WRITE,
+    IO_READDIR,
+    IO_READDIRPLUS,
+    IO_RELEASE,
+};
+
+struct io_task {
+    int op;
+    int exclusive;
+    fuse_req_t req;
+    fuse_ino_t ino;
+    size_t size;
+    off_t off;
+    struct fuse_file_info fi;       /* copy: the caller's is gone on return */
+    char *data;                     /* write payload, owned by the task */
+    struct io_task *next;
+    uint64_t seq;                   /* submission order */
+    struct io_task *older, *newer;  /* outstanding list, oldest first */
+};
+
+/* Per-inode ordering state; exists while the inode has queued tasks */
+struct io_inode {
+    uint64_t ino;
+    unsigned running;
+    int exclusive;                  /* an exclusive task is running */
+    struct io_task *head, *tail;    /* waiting behind running tasks */
+    UT_hash_handle hh;
+};
+
+struct iopool {
+    unsigned threads;
+    unsigned per_inode;
+    void (*run)(struct io_task *t);
+
+    pthread_t *workers;
+    unsigned started;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_cond_t idle;            /* an inode or the whole pool drained */
+    struct io_task *ready_head, *ready_tail;
+    struct io_inode *inodes;        /* hash by ino, protected by lock */
+    struct io_task *oldest, *newest;    /* submitted, not yet finished */
+    uint64_t seq;
+    struct slab task_slab;          /* io_task and io_inode storage */
+    struct slab inode_slab;
+    int stop;
+
+    uint64_t queued;                /* submitted, not yet finished */
+    uint64_t peak;
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t deferred;              /* had to wait for the same inode */
+};
+
+struct iopool_stats {
+    uint64_t threads;
+    uint64_t queued;
+    uint64_t peak;
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t deferred;
+};
+
+/* Reads KVBFS_IO_THREADS and KVBFS_IO_INODE_INFLIGHT */
+void iopool_init(struct iopool *p);
+/* Start the workers; run executes (and replies to) one task */
+int  iopool_start(struct iopool *p, void (*run)(struct io_task *t));
+/* Finish every queued task, then join the workers */
+void iopool_stop(struct iopool *p);
+void iopool_destroy(struct iopool *p);
+
+static inline int iopool_running(const struct iopool *p)
+{
+    return p->started > 0;
+}
+
+/* Task with zeroed fields, or NULL; hand it to iopool_submit */
+struct io_task *iopool_task(struct iopool *p);
+/* Queue t, or run it inline when the pool is not running; takes ownership */
+void iopool_submit(struct iopool *p, struct io_task *t);
+
+/*
+ * Wait until ino has no queued or running tasks; with ino 0, until every task
+ * submitted before the call has finished (later ones are not waited for).
+ * Not from a worker.
+ */
+void iopool_wait(struct iopool *p, uint64_t ino);
+
+void iopool_get_stats(struct iopool *p, struct iopool_stats *st);
+
+#endif /* IOPOOL_H */
@@ -17,20 +17,40 @@ struct nvme_kv_conn {
     uint16_t  port;
     uint32_t  next_cmd_id;
     pthread_mutex_t send_lock;  /* 串行化请求/响应 */
+    pthread_mutex_t merge_lock; /* 串行化客户端模拟的计数器合并 */
 };
 
-/* 迭代器: 客户端缓存全部 List 结果 */
+/* 迭代器: 客户端缓存全部 List 结果，条目直接指向响应数据 */
 struct kv_iterator {
     struct iter_entry {
-        char   *key;
-        size_t  key_len;
-        char   *value;
-        size_t  value_len;
+        const char *key;
+        size_t      key_len;
+        const char *value;
+        size_t      value_len;
     } *entries;
     size_t count;
     size_t pos;
+    char  *data;                /* List 响应 */
+};
+
+/* 写批处理: 客户端缓存操作，提交时按顺序逐条发送 */
+struct kv_batch {
+    struct batch_op {
+        uint8_t opcode;         /* NVME_KV_OP_STORE / DELETE / BATCH_OP_RANGE / MERGE */
+        char   *key;            /* RANGE: 起始键 */
+        size_t  key_len;
+        char   *value;          /* RANGE: 结束键 (不含) */
+        size_t  value_len;
+    } *ops;
+    size_t count;
+    size_t capacity;
+    int    failed;              /* 缓存操作时内存不足 */
 };
 
+/* 客户端模拟的范围删除与计数器合并 (设备协议无对应命令) */
+#define BATCH_OP_RANGE  0xFF
+#define BATCH_OP_MERGE  0xFE
+
 /* ---- 网络辅助函数 ---- */
 
 static int recv_exact(int fd, void *buf, size_t n)
@@ -162,6 +182,7 @@ void *kv_open(const char *path)
     }
 
     pthread_mutex_init(&conn->send_lock, NULL);
+    pthread_mutex_init(&conn->merge_lock, NULL);
 
     /* TCP 连接 */
     conn->sockfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -202,9 +223,25 @@ void kv_close(void *db)
         return;
     close(conn->sockfd);
     pthread_mutex_destroy(&conn->send_lock);
+    pthread_mutex_destroy(&conn->merge_lock);
     free(conn);
 }
 
+/* 远端设备没有检查点，文件系统快照不可用 */
+void *kv_open_readonly(const char *path)
+{
+    (void)path;
+    return NULL;
+}
+
+int kv_checkpoint(void *db, const char *dir)
+{
+    (void)db;
+    (void)dir;
+    errno = ENOTSUP;
+    return -1;
+}
+
 int kv_get(void *db, const char *key, size_t key_len,
            char **value, size_t *value_len)
 {
@@ -223,6 +260,35 @@ int kv_get(void *db, const char *key, size_t key_len,
     return 0;
 }
 
+/* 响应数据由 nvme_kv_transact 分配，这里只是复制到调用方缓冲区 */
+int kv_get_into(void *db, const char *key, size_t key_len,
+                char *buf, size_t buflen, size_t *value_len)
+{
+    char *value = NULL;
+    if (kv_get(db, key, key_len, &value, value_len) != 0) {
+        free(value);
+        return -1;
+    }
+    memcpy(buf, value, *value_len < buflen ? *value_len : buflen);
+    free(value);
+    return 0;
+}
+
+/* 协议没有批量读取命令，逐个 RETRIEVE */
+int kv_multi_get(void *db, size_t n, const char *const *keys,
+                 const size_t *key_lens, char **values, size_t *value_lens)
+{
+    for (size_t i = 0; i < n; i++) {
+        values[i] = NULL;
+        value_lens[i] = 0;
+        if (kv_get(db, keys[i], key_lens[i], &values[i], &value_lens[i]) != 0) {
+            free(values[i]);
+            values[i] = NULL;
+        }
+    }
+    return 0;
+}
+
 int kv_put(void *db, const char *key, size_t key_len,
            const char *value, size_t value_len)
 {
@@ -258,6 +324,220 @@ int kv_delete(void *db, const char *key, size_t key_len)
     return 0;
 }
 
+/* 计数器合并: 读取现有值，逐项相加后写回 */
+int kv_merge(void *db, const char *key, size_t key_len,
+             const char *value, size_t value_len)
+{
+    struct nvme_kv_conn *conn = (struct nvme_kv_conn *)db;
+    size_t n = value_len / sizeof(int64_t);
+    if (n == 0)
+        return 0;
+
+    pthread_mutex_lock(&conn->merge_lock);
+
+    char *old = NULL;
+    size_t old_len = 0;
+    if (kv_get(db, key, key_len, &old, &old_len) != 0)
+        old_len = 0;
+
+    size_t len = n * sizeof(int64_t);
+    if (old_len / sizeof(int64_t) > n)
+        len = old_len - old_len % sizeof(int64_t);
+
+    int rc = -1;
+    char *buf = calloc(1, len);
+    if (buf) {
+        if (old_len >= sizeof(int64_t))
+            memcpy(buf, old, old_len - old_len % sizeof(int64_t));
+        for (size_t i = 0; i < n; i++) {
+            int64_t a, b;
+            memcpy(&a, buf + i * sizeof(int64_t), sizeof(a));
+            memcpy(&b, value + i * sizeof(int64_t), sizeof(b));
+            a += b;
+            memcpy(buf + i * sizeof(int64_t), &a, sizeof(a));
+        }
+        rc = kv_put(db, key, key_len, buf, len);
+        free(buf);
+    }
+    free(old);
+
+    pthread_mutex_unlock(&conn->merge_lock);
+    return rc;
+}
+
+kv_batch_t *kv_batch_new(void)
+{
+    return calloc(1, sizeof(kv_batch_t));
+}
+
+static void batch_add(kv_batch_t *batch, uint8_t opcode,
+                      const char *key, size_t key_len,
+                      const char *value, size_t value_len)
+{
+    if (!batch || batch->failed)
+        return;
+
+    if (batch->count == batch->capacity) {
+        size_t cap = batch->capacity ? batch->capacity * 2 : 16;
+        struct batch_op *ops = realloc(batch->ops, cap * sizeof(*ops));
+        if (!ops) {
+            batch->failed = 1;
+            return;
+        }
+        batch->ops = ops;
+        batch->capacity = cap;
+    }
+
+    struct batch_op *op = &batch->ops[batch->count];
+    op->opcode = opcode;
+    op->key = malloc(key_len);
+    op->value = value_len > 0 ? malloc(value_len) : NULL;
+    if (!op->key || (value_len > 0 && !op->value)) {
+        free(op->key);
+        free(op->value);
+        batch->failed = 1;
+        return;
+    }
+    memcpy(op->key, key, key_len);
+    op->key_len = key_len;
+    if (value_len > 0)
+        memcpy(op->value, value, value_len);
+    op->value_len = value_len;
+    batch->count++;
+}
+
+void kv_batch_put(kv_batch_t *batch, const char *key, size_t key_len,
+                  const char *value, size_t value_len)
+{
+    batch_add(batch, NVME_KV_OP_STORE, key, key_len, value, value_len);
+}
+
+void kv_batch_delete(kv_batch_t *batch, const char *key, size_t key_len)
+{
+    batch_add(batch, NVME_KV_OP_DELETE, key, key_len, NULL, 0);
+}
+
+void kv_batch_merge(kv_batch_t *batch, const char *key, size_t key_len,
+                    const char *value, size_t value_len)
+{
+    batch_add(batch, BATCH_OP_MERGE, key, key_len, value, value_len);
+}
+
+void kv_batch_delete_range(kv_batch_t *batch, const char *begin, size_t begin_len,
+                           const char *end, size_t end_len)
+{
+    batch_add(batch, BATCH_OP_RANGE, begin, begin_len, end, end_len);
+}
+
+static int key_cmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    if (c != 0) return c;
+    return alen < blen ? -1 : (alen > blen ? 1 : 0);
+}
+
+static int iter_entry_cmp(const void *a, const void *b)
+{
+    const struct iter_entry *x = a, *y = b;
+    if (!x->key || !y->key)
+        return (x->key != NULL) - (y->key != NULL);
+    return key_cmp(x->key, x->key_len, y->key, y->key_len);
+}
+
+/* end 是否为 begin 末字节加一 (kv_batch_delete_prefix 的形式) */
+static int range_is_prefix(const char *begin, size_t begin_len,
+                           const char *end, size_t end_len)
+{
+    return begin_len > 0 && begin_len == end_len &&
+           memcmp(begin, end, begin_len - 1) == 0 &&
+           (unsigned char)end[end_len - 1] ==
+           (unsigned char)begin[begin_len - 1] + 1;
+}
+
+/*
+ * 范围删除。前缀形式直接 List begin 前缀, 不会列出共享更短前缀的其他键
+ * (如 "b:12:" 不列出 "b:120:...");
+ * 其他范围 List 公共前缀, 定位到 begin 后删到 end 为止。
+ */
+static int nvme_delete_range(void *db, const char *begin, size_t begin_len,
+                             const char *end, size_t end_len)
+{
+    int prefix = range_is_prefix(begin, begin_len, end, end_len);
+    size_t common = begin_len;
+    if (!prefix) {
+        common = 0;
+        while (common < begin_len && common < end_len && begin[common] == end[common])
+            common++;
+    }
+
+    kv_iterator_t *iter = kv_iter_prefix(db, begin, common);
+    if (!iter)
+        return -1;
+
+    int rc = 0;
+    kv_iter_seek(iter, begin, begin_len);
+    for (; kv_iter_valid(iter); kv_iter_next(iter)) {
+        size_t klen;
+        const char *k = kv_iter_key(iter, &klen);
+        if (!prefix && key_cmp(k, klen, end, end_len) >= 0)
+            break;
+        if (kv_delete(db, k, klen) != 0)
+            rc = -1;
+    }
+    kv_iter_free(iter);
+    return rc;
+}
+
+int kv_batch_commit(void *db, kv_batch_t *batch)
+{
+    if (!batch || batch->failed)
+        return -1;
+
+    struct nvme_kv_conn *conn = (struct nvme_kv_conn *)db;
+
+    /* 设备协议没有事务命令: 按顺序执行，遇错即停 */
+    for (size_t i = 0; i < batch->count; i++) {
+        struct batch_op *op = &batch->ops[i];
+        struct nvme_kv_resp_hdr resp;
+
+        if (op->opcode == BATCH_OP_RANGE) {
+            if (nvme_delete_range(db, op->key, op->key_len,
+                                  op->value, op->value_len) != 0)
+                return -1;
+            continue;
+        }
+        if (op->opcode == BATCH_OP_MERGE) {
+            if (kv_merge(db, op->key, op->key_len, op->value, op->value_len) != 0)
+                return -1;
+            continue;
+        }
+
+        if (nvme_kv_transact(conn, op->opcode, 0,
+                             op->key, op->key_len, op->value, op->value_len,
+                             &resp, NULL, NULL) != 0)
+            return -1;
+
+        /* 与 RocksDB 一致: 删除不存在的键不算错误 */
+        if (resp.status != NVME_KV_SC_SUCCESS &&
+            !(op->opcode == NVME_KV_OP_DELETE &&
+              resp.status == NVME_KV_SC_NOT_FOUND))
+            return -1;
+    }
+    return 0;
+}
+
+void kv_batch_free(kv_batch_t *batch)
+{
+    if (!batch)
+        return;
+    for (size_t i = 0; i < batch->count; i++) {
+        free(batch->ops[i].key);
+        free(batch->ops[i].value);
+    }
+    free(batch->ops);
+    free(batch);
+}
+
 kv_iterator_t *kv_iter_prefix(void *db, const char *prefix, size_t prefix_len)
 {
     struct nvme_kv_conn *conn = (struct nvme_kv_conn *)db;
@@ -315,34 +595,48 @@ kv_iterator_t *kv_iter_prefix(void *db, const char *prefix, size_t prefix_len)
     }
     iter->count = count;
 
-    /* 第二遍: 复制数据 */
+    /* 第二遍: 记录各条目在响应中的位置，不逐条复制 */
     off = 0;
     for (size_t i = 0; i < count; i++) {
         uint16_t kl;
         memcpy(&kl, data + off, sizeof(kl));
         off += sizeof(kl);
-
-        iter->entries[i].key = malloc(kl);
-        if (iter->entries[i].key)
-            memcpy(iter->entries[i].key, data + off, kl);
+        iter->entries[i].key = data + off;
         iter->entries[i].key_len = kl;
         off += kl;
 
         uint32_t vl;
         memcpy(&vl, data + off, sizeof(vl));
         off += sizeof(vl);
-
-        iter->entries[i].value = malloc(vl);
-        if (iter->entries[i].value)
-            memcpy(iter->entries[i].value, data + off, vl);
+        iter->entries[i].value = data + off;
         iter->entries[i].value_len = vl;
         off += vl;
     }
+    iter->data = data;
 
-    free(data);
+    /* 设备不保证 List 的顺序，排序后与 RocksDB 迭代器语义一致 */
+    qsort(iter->entries, iter->count, sizeof(iter->entries[0]), iter_entry_cmp);
     return iter;
 }
 
+void kv_iter_seek(kv_iterator_t *iter, const char *key, size_t key_len)
+{
+    if (!iter)
+        return;
+
+    /* 二分查找第一个 >= key 的条目 */
+    size_t lo = 0, hi = iter->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (key_cmp(iter->entries[mid].key, iter->entries[mid].key_len,
+                    key, key_len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    iter->pos = lo;
+}
+
 int kv_iter_valid(kv_iterator_t *iter)
 {
     if (!iter)
@@ -378,10 +672,7 @@ void kv_iter_free(kv_iterator_t *iter)
 {
     if (!iter)
         return;
-    for (size_t i = 0; i < iter->count; i++) {
-        free(iter->entries[i].key);
-        free(iter->entries[i].value);
-    }
     free(iter->entries);
+    free(iter->data);
     free(iter);
 }
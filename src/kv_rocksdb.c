@@ -2,6 +2,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <rocksdb/c.h>
 
 struct kv_iterator {
@@ -10,9 +11,108 @@ struct kv_iterator {
     size_t prefix_len;
 };
 
-void *kv_open(const char *path)
+/* ── 计数器 merge operator：int64_t 数组逐项相加 ── */
+
+static void counter_add(char *acc, size_t acc_len, const char *v, size_t v_len)
+{
+    for (size_t off = 0; off + sizeof(int64_t) <= v_len && off < acc_len;
+         off += sizeof(int64_t)) {
+        int64_t a, b;
+        memcpy(&a, acc + off, sizeof(a));
+        memcpy(&b, v + off, sizeof(b));
+        a += b;
+        memcpy(acc + off, &a, sizeof(a));
+    }
+}
+
+static char *counter_merge(const char *existing, size_t existing_len,
+                           const char *const *operands, const size_t *operand_lens,
+                           int num_operands, unsigned char *success, size_t *new_len)
+{
+    size_t len = existing ? existing_len : 0;
+    for (int i = 0; i < num_operands; i++)
+        if (operand_lens[i] > len) len = operand_lens[i];
+    len -= len % sizeof(int64_t);
+
+    char *out = calloc(1, len ? len : 1);
+    if (!out) {
+        *success = 0;
+        return NULL;
+    }
+    if (existing) counter_add(out, len, existing, existing_len);
+    for (int i = 0; i < num_operands; i++)
+        counter_add(out, len, operands[i], operand_lens[i]);
+
+    *success = 1;
+    *new_len = len;
+    return out;
+}
+
+static char *counter_full_merge(void *state, const char *key, size_t key_len,
+                                const char *existing, size_t existing_len,
+                                const char *const *operands, const size_t *operand_lens,
+                                int num_operands, unsigned char *success, size_t *new_len)
+{
+    (void)state; (void)key; (void)key_len;
+    return counter_merge(existing, existing_len, operands, operand_lens,
+                         num_operands, success, new_len);
+}
+
+static char *counter_partial_merge(void *state, const char *key, size_t key_len,
+                                   const char *const *operands, const size_t *operand_lens,
+                                   int num_operands, unsigned char *success, size_t *new_len)
+{
+    (void)state; (void)key; (void)key_len;
+    return counter_merge(NULL, 0, operands, operand_lens,
+                         num_operands, success, new_len);
+}
+
+static void counter_delete_value(void *state, const char *value, size_t value_len)
+{
+    (void)state; (void)value_len;
+    free((char *)value);
+}
+
+static void counter_destroy(void *state)
+{
+    (void)state;
+}
+
+static const char *counter_name(void *state)
+{
+    (void)state;
+    return "kvbfs.counter_add";
+}
+
+/*
+ * 读写选项对所有调用相同，只创建一次，避免每次读写都分配
+ */
+static rocksdb_readoptions_t *read_opts;
+static rocksdb_writeoptions_t *write_opts;
+static pthread_once_t opts_once = PTHREAD_ONCE_INIT;
+
+static void opts_init(void)
+{
+    read_opts = rocksdb_readoptions_create();
+    write_opts = rocksdb_writeoptions_create();
+}
+
+/* 打开选项: options 持有 merge operator，数据库打开后由数据库引用 */
+static rocksdb_options_t *db_options(void)
 {
+    pthread_once(&opts_once, opts_init);
+
     rocksdb_options_t *options = rocksdb_options_create();
+    rocksdb_mergeoperator_t *merge = rocksdb_mergeoperator_create(
+        NULL, counter_destroy, counter_full_merge, counter_partial_merge,
+        counter_delete_value, counter_name);
+    rocksdb_options_set_merge_operator(options, merge);
+    return options;
+}
+
+void *kv_open(const char *path)
+{
+    rocksdb_options_t *options = db_options();
     rocksdb_options_set_create_if_missing(options, 1);
 
     char *err = NULL;
@@ -26,6 +126,42 @@ void *kv_open(const char *path)
     return db;
 }
 
+void *kv_open_readonly(const char *path)
+{
+    /* 计数器键可能带有未合并的 merge 操作数，只读打开同样需要 merge operator */
+    rocksdb_options_t *options = db_options();
+
+    char *err = NULL;
+    rocksdb_t *db = rocksdb_open_for_read_only(options, path, 0, &err);
+    rocksdb_options_destroy(options);
+
+    if (err) {
+        free(err);
+        return NULL;
+    }
+    return db;
+}
+
+int kv_checkpoint(void *db, const char *dir)
+{
+    char *err = NULL;
+    rocksdb_checkpoint_t *cp = rocksdb_checkpoint_object_create((rocksdb_t *)db, &err);
+    if (err) {
+        free(err);
+        return -1;
+    }
+
+    /* log_size_for_flush 为 0: 先刷写 memtable，检查点只含 SST 的硬链接 */
+    rocksdb_checkpoint_create(cp, dir, 0, &err);
+    rocksdb_checkpoint_object_destroy(cp);
+
+    if (err) {
+        free(err);
+        return -1;
+    }
+    return 0;
+}
+
 void kv_close(void *db)
 {
     if (db) {
@@ -36,11 +172,9 @@ void kv_close(void *db)
 int kv_get(void *db, const char *key, size_t key_len,
            char **value, size_t *value_len)
 {
-    rocksdb_readoptions_t *opts = rocksdb_readoptions_create();
     char *err = NULL;
 
-    *value = rocksdb_get((rocksdb_t *)db, opts, key, key_len, value_len, &err);
-    rocksdb_readoptions_destroy(opts);
+    *value = rocksdb_get((rocksdb_t *)db, read_opts, key, key_len, value_len, &err);
 
     if (err) {
         free(err);
@@ -52,14 +186,75 @@ int kv_get(void *db, const char *key, size_t key_len,
     return 0;
 }
 
+int kv_get_into(void *db, const char *key, size_t key_len,
+                char *buf, size_t buflen, size_t *value_len)
+{
+    char *err = NULL;
+
+    /* pinned 读取直接引用块缓存中的数据，复制一次即可 */
+    rocksdb_pinnableslice_t *slice = rocksdb_get_pinned(
+        (rocksdb_t *)db, read_opts, key, key_len, &err);
+    if (err) {
+        free(err);
+        rocksdb_pinnableslice_destroy(slice);
+        return -1;
+    }
+    if (!slice) {
+        return -1;  /* key not found */
+    }
+
+    size_t vlen;
+    const char *v = rocksdb_pinnableslice_value(slice, &vlen);
+    memcpy(buf, v, vlen < buflen ? vlen : buflen);
+    *value_len = vlen;
+    rocksdb_pinnableslice_destroy(slice);
+    return 0;
+}
+
+int kv_multi_get(void *db, size_t n, const char *const *keys,
+                 const size_t *key_lens, char **values, size_t *value_lens)
+{
+    if (n == 0) return 0;
+
+    char **errs = calloc(n, sizeof(char *));
+    if (!errs) return -1;
+
+    rocksdb_multi_get((rocksdb_t *)db, read_opts, n, keys, key_lens,
+                      values, value_lens, errs);
+
+    int ret = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (errs[i]) {
+            free(errs[i]);
+            free(values[i]);
+            values[i] = NULL;
+            ret = -1;
+        }
+    }
+    free(errs);
+    return ret;
+}
+
 int kv_put(void *db, const char *key, size_t key_len,
            const char *value, size_t value_len)
 {
-    rocksdb_writeoptions_t *opts = rocksdb_writeoptions_create();
     char *err = NULL;
 
-    rocksdb_put((rocksdb_t *)db, opts, key, key_len, value, value_len, &err);
-    rocksdb_writeoptions_destroy(opts);
+    rocksdb_put((rocksdb_t *)db, write_opts, key, key_len, value, value_len, &err);
+
+    if (err) {
+        free(err);
+        return -1;
+    }
+    return 0;
+}
+
+int kv_merge(void *db, const char *key, size_t key_len,
+             const char *value, size_t value_len)
+{
+    char *err = NULL;
+
+    rocksdb_merge((rocksdb_t *)db, write_opts, key, key_len, value, value_len, &err);
 
     if (err) {
         free(err);
@@ -70,11 +265,54 @@ int kv_put(void *db, const char *key, size_t key_len,
 
 int kv_delete(void *db, const char *key, size_t key_len)
 {
-    rocksdb_writeoptions_t *opts = rocksdb_writeoptions_create();
     char *err = NULL;
 
-    rocksdb_delete((rocksdb_t *)db, opts, key, key_len, &err);
-    rocksdb_writeoptions_destroy(opts);
+    rocksdb_delete((rocksdb_t *)db, write_opts, key, key_len, &err);
+
+    if (err) {
+        free(err);
+        return -1;
+    }
+    return 0;
+}
+
+/* kv_batch_t 直接映射为 rocksdb_writebatch_t */
+kv_batch_t *kv_batch_new(void)
+{
+    return (kv_batch_t *)rocksdb_writebatch_create();
+}
+
+void kv_batch_put(kv_batch_t *batch, const char *key, size_t key_len,
+                  const char *value, size_t value_len)
+{
+    rocksdb_writebatch_put((rocksdb_writebatch_t *)batch,
+                           key, key_len, value, value_len);
+}
+
+void kv_batch_delete(kv_batch_t *batch, const char *key, size_t key_len)
+{
+    rocksdb_writebatch_delete((rocksdb_writebatch_t *)batch, key, key_len);
+}
+
+void kv_batch_merge(kv_batch_t *batch, const char *key, size_t key_len,
+                    const char *value, size_t value_len)
+{
+    rocksdb_writebatch_merge((rocksdb_writebatch_t *)batch,
+                             key, key_len, value, value_len);
+}
+
+void kv_batch_delete_range(kv_batch_t *batch, const char *begin, size_t begin_len,
+                           const char *end, size_t end_len)
+{
+    rocksdb_writebatch_delete_range((rocksdb_writebatch_t *)batch,
+                                    begin, begin_len, end, end_len);
+}
+
+int kv_batch_commit(void *db, kv_batch_t *batch)
+{
+    char *err = NULL;
+
+    rocksdb_write((rocksdb_t *)db, write_opts, (rocksdb_writebatch_t *)batch, &err);
 
     if (err) {
         free(err);
@@ -83,6 +321,13 @@ int kv_delete(void *db, const char *key, size_t key_len)
     return 0;
 }
 
+void kv_batch_free(kv_batch_t *batch)
+{
+    if (batch) {
+        rocksdb_writebatch_destroy((rocksdb_writebatch_t *)batch);
+    }
+}
+
 kv_iterator_t *kv_iter_prefix(void *db, const char *prefix, size_t prefix_len)
 {
     kv_iterator_t *iter = malloc(sizeof(kv_iterator_t));
@@ -96,17 +341,20 @@ kv_iterator_t *kv_iter_prefix(void *db, const char *prefix, size_t prefix_len)
     memcpy(iter->prefix, prefix, prefix_len);
     iter->prefix_len = prefix_len;
 
-    rocksdb_readoptions_t *opts = rocksdb_readoptions_create();
-    iter->iter = rocksdb_create_iterator((rocksdb_t *)db, opts);
-    rocksdb_readoptions_destroy(opts);
+    iter->iter = rocksdb_create_iterator((rocksdb_t *)db, read_opts);
 
     rocksdb_iter_seek(iter->iter, prefix, prefix_len);
     return iter;
 }
 
+void kv_iter_seek(kv_iterator_t *iter, const char *key, size_t key_len)
+{
+    rocksdb_iter_seek(iter->iter, key, key_len);
+}
+
 int kv_iter_valid(kv_iterator_t *iter)
 {
-    if (!rocksdb_iter_valid(iter->iter)) {
+    if (!iter || !rocksdb_iter_valid(iter->iter)) {
         return 0;
     }
 
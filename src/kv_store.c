@@ -1,7 +1,20 @@
 #include "kv_store.h"
 
+#include <string.h>
+
 /*
  * KV 存储抽象层
  * 当前实现使用 RocksDB (kv_rocksdb.c)
  * 未来可替换为 NVMe KV 接口
  */
+
+void kv_batch_delete_prefix(kv_batch_t *batch, const char *prefix, size_t prefix_len)
+{
+    /* prefix 的上界: 末字节加一 (key 前缀均为可打印字符, 不会溢出) */
+    char end[256];
+    if (prefix_len == 0 || prefix_len > sizeof(end)) return;
+    memcpy(end, prefix, prefix_len);
+    end[prefix_len - 1]++;
+
+    kv_batch_delete_range(batch, prefix, prefix_len, end, prefix_len);
+}
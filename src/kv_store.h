@@ -9,13 +9,36 @@
 /* 打开 KV 存储，返回句柄 */
 void *kv_open(const char *path);
 
+/* 以只读方式打开 KV 存储 (如检查点目录)，失败返回 NULL */
+void *kv_open_readonly(const char *path);
+
 /* 关闭 KV 存储 */
 void kv_close(void *db);
 
+/*
+ * 在 dir (必须不存在) 建立数据库的一致检查点，可用 kv_open_readonly 打开
+ * RocksDB 后端硬链接 SST 文件，代价与数据量无关; 不支持的后端返回 -1，errno 为 ENOTSUP
+ */
+int kv_checkpoint(void *db, const char *dir);
+
 /* 读取值，返回值需要 free */
 int kv_get(void *db, const char *key, size_t key_len,
            char **value, size_t *value_len);
 
+/*
+ * 读取值到调用方的缓冲区，不分配内存: 复制前 buflen 字节，
+ * *value_len 为完整长度。键不存在返回 -1
+ */
+int kv_get_into(void *db, const char *key, size_t key_len,
+                char *buf, size_t buflen, size_t *value_len);
+
+/*
+ * 批量读取 n 个键: values[i] 需要 free, 键不存在时为 NULL
+ * 返回 0 表示请求已执行 (键不存在不算错误)
+ */
+int kv_multi_get(void *db, size_t n, const char *const *keys,
+                 const size_t *key_lens, char **values, size_t *value_lens);
+
 /* 写入值 */
 int kv_put(void *db, const char *key, size_t key_len,
            const char *value, size_t value_len);
@@ -23,10 +46,40 @@ int kv_put(void *db, const char *key, size_t key_len,
 /* 删除键 */
 int kv_delete(void *db, const char *key, size_t key_len);
 
+/*
+ * 计数器合并: value 为 int64_t 数组，与现有值逐项相加 (键不存在视为全 0)
+ * RocksDB 后端使用 merge operator，无需读取; NVMe 后端在客户端读-改-写
+ */
+int kv_merge(void *db, const char *key, size_t key_len,
+             const char *value, size_t value_len);
+
+/*
+ * 写批处理: 一组 put/delete 一次提交
+ * RocksDB 后端原子提交; NVMe 后端按顺序逐条执行 (非原子)
+ */
+typedef struct kv_batch kv_batch_t;
+
+kv_batch_t *kv_batch_new(void);
+void kv_batch_put(kv_batch_t *batch, const char *key, size_t key_len,
+                  const char *value, size_t value_len);
+void kv_batch_delete(kv_batch_t *batch, const char *key, size_t key_len);
+/* 计数器合并 (语义同 kv_merge) */
+void kv_batch_merge(kv_batch_t *batch, const char *key, size_t key_len,
+                    const char *value, size_t value_len);
+/* 删除 [begin, end) 范围内的所有键 */
+void kv_batch_delete_range(kv_batch_t *batch, const char *begin, size_t begin_len,
+                           const char *end, size_t end_len);
+/* 删除以 prefix 开头的所有键 (基于 kv_batch_delete_range) */
+void kv_batch_delete_prefix(kv_batch_t *batch, const char *prefix, size_t prefix_len);
+int kv_batch_commit(void *db, kv_batch_t *batch);
+void kv_batch_free(kv_batch_t *batch);
+
 /* 前缀迭代器 */
 typedef struct kv_iterator kv_iterator_t;
 
 kv_iterator_t *kv_iter_prefix(void *db, const char *prefix, size_t prefix_len);
+/* 将迭代器定位到第一个 >= key 的键 (仍受前缀约束) */
+void kv_iter_seek(kv_iterator_t *iter, const char *key, size_t key_len);
 int kv_iter_valid(kv_iterator_t *iter);
 void kv_iter_next(kv_iterator_t *iter);
 const char *kv_iter_key(kv_iterator_t *iter, size_t *len);
@@ -8,10 +8,22 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
+#include <sys/stat.h>
 
 #include "uthash.h"
 #include "vfs_versions.h"
+#include "gc.h"
+#include "path.h"
+#include "dcache.h"
+#include "usage.h"
+#include "xattr.h"
+#include "warmup.h"
+#include "slab.h"
+#include "iopool.h"
+#include "snapq.h"
+#include "fssnap.h"
 
 #ifdef CFS_LOCAL_LLM
 #include "llm.h"
@@ -28,12 +40,17 @@
 #define KVBFS_VERSION       1
 #define KVBFS_ROOT_INO      1
 #define KVBFS_KEY_MAX       512
+#define KVBFS_ICACHE_SHARDS 64          /* inode 缓存分片数 */
+#define KVBFS_ICACHE_DEFAULT_MB 64      /* inode 缓存内存预算 */
+#define KVBFS_WRITEBACK_MS  5000        /* 脏 inode 写回周期 */
+#define KVBFS_INO_CHUNK     4096        /* 每次持久化预留的 inode 号数 */
+#define KVBFS_INO_BATCH     64          /* 每个线程一次领取的 inode 号数 */
 
 /* 超级块 */
 struct kvbfs_super {
     uint32_t magic;
     uint32_t version;
-    uint64_t next_ino;
+    uint64_t next_ino;      /* 已预留 inode 号的上界 */
 };
 
 /* inode 结构 (持久化到 KV) */
@@ -48,16 +65,51 @@ struct kvbfs_inode {
     struct timespec ctime;
 };
 
+/* 目录项的值 (持久化到 KV)；旧版本只存 8 字节的 ino */
+struct kvbfs_dirent {
+    uint64_t ino;
+    uint32_t type;          /* 子 inode 的 S_IFMT 位，旧格式为 0 */
+    uint32_t reserved;
+};
+
 /* 内存中的 inode 缓存项 */
 struct kvbfs_inode_cache {
     struct kvbfs_inode inode;
     pthread_rwlock_t lock;
     uint64_t refcount;
-    bool dirty;
+    uint64_t nlookup;       /* 内核持有的 lookup 计数 */
+    bool dirty;             /* 内存中的属性尚未写回 */
     bool deleted;           /* marked for deferred deletion */
+    bool wb_intent;         /* 已写入 ow: 记录，EOF 之后可能有未确认的块 */
+    uint64_t synced_size;   /* 存储中 inode 的文件大小 */
+    struct xattr_set *xattrs;   /* 已缓存的 xattr，NULL = 没有 xattr */
+    bool xattrs_cached;
+    struct version_dirty *vdirty;   /* 上次快照以来改动的块，NULL = 未跟踪 */
+    struct kvbfs_inode_cache *lru_prev, *lru_next;  /* 仅 refcount == 0 时在 LRU 中 */
     UT_hash_handle hh;
 };
 
+/* inode 缓存分片：按 ino 取模，各分片独立加锁 */
+struct icache_shard {
+    pthread_mutex_t lock;
+    struct kvbfs_inode_cache *map;
+    struct kvbfs_inode_cache *lru_head, *lru_tail;  /* 头部最先淘汰 */
+    size_t count;
+    uint64_t evictions;
+    uint64_t gen;           /* 有缓存项移出或 inode 被删除时递增 */
+    struct slab slab;       /* 缓存项分配 */
+};
+
+/* 脏 inode 后台写回线程 */
+struct icache_flusher {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned interval_ms;   /* 0 = 仅在 release/fsync/卸载时写回 */
+    int shutdown;
+    int running;
+};
+
 /* Session inode hash set entry (for O(1) is_session_file) */
 struct session_ino_entry {
     uint64_t ino;
@@ -67,11 +119,25 @@ struct session_ino_entry {
 /* 文件系统全局上下文 */
 struct kvbfs_ctx {
     void *db;                           /* KV 存储句柄 */
-    struct kvbfs_inode_cache *icache;   /* inode 缓存哈希表 */
-    pthread_mutex_t icache_lock;        /* 缓存表锁 */
+    struct icache_shard icache[KVBFS_ICACHE_SHARDS]; /* inode 缓存 */
+    size_t icache_shard_max;            /* 每个分片的缓存项上限 */
+    struct icache_flusher flusher;      /* 脏 inode 写回 */
+    uint64_t inode_writes;              /* inode 写入次数（原子更新） */
     pthread_mutex_t alloc_lock;         /* inode 分配锁 */
+    uint64_t ino_next;                  /* 下一个未领取的 inode 号 */
+    uint64_t ino_epoch;                 /* 区分各次挂载的线程缓存 */
     struct kvbfs_super super;           /* 超级块 */
     struct vtree_ctx vtree;             /* Version virtual directory tree */
+    struct gc_ctx gc;                   /* Background reclamation */
+    struct path_cache paths;            /* inode → 路径缓存 */
+    struct dcache dcache;               /* (parent, name) → ino 缓存 */
+    struct usage_ctx usage;             /* 目录用量计数 */
+    struct warmup_ctx warmup;           /* 挂载时缓存预热 */
+    struct iopool iopool;               /* KV I/O 执行线程 */
+    struct snapq snapq;                 /* 延迟的版本快照与索引 */
+    struct fssnap_ctx snaps;            /* 文件系统快照 (/.snapshots) */
+    char *db_path;                      /* statfs 查询可用空间 */
+    struct fuse_session *se;            /* 用于内核缓存失效通知 */
 
 #ifdef CFS_LOCAL_LLM
     struct llm_ctx llm;                 /* LLM 推理子系统 */
@@ -92,6 +158,8 @@ extern struct kvbfs_ctx *g_ctx;
 /* KV key 常量 */
 #define KVBFS_KEY_SUPER     "sb"
 #define KVBFS_KEY_NEXT_INO  "next_ino"
+#define KVBFS_KEY_HOTSET    "hot"       /* 正常卸载时缓存中的 inode 号 */
+#define KVBFS_KEY_PATH_DONE "pdone"     /* p: 反向索引回填完成标记 */
 
 /* KV key 格式化辅助函数 */
 static inline int kvbfs_key_inode(char *buf, size_t buflen, uint64_t ino)
@@ -111,6 +179,11 @@ static inline int kvbfs_key_block(char *buf, size_t buflen, uint64_t ino, uint64
     return snprintf(buf, buflen, "b:%lu:%lu", (unsigned long)ino, (unsigned long)block);
 }
 
+static inline int kvbfs_key_block_prefix(char *buf, size_t buflen, uint64_t ino)
+{
+    return snprintf(buf, buflen, "b:%lu:", (unsigned long)ino);
+}
+
 static inline int kvbfs_key_dirent_prefix(char *buf, size_t buflen, uint64_t parent)
 {
     return snprintf(buf, buflen, "d:%lu:", (unsigned long)parent);
@@ -129,6 +202,66 @@ static inline int kvbfs_key_xattr_prefix(char *buf, size_t buflen, uint64_t ino)
     return snprintf(buf, buflen, "x:%lu:", (unsigned long)ino);
 }
 
+/* 打包的 xattr 记录：一个 inode 的全部 xattr */
+static inline int kvbfs_key_xattr_packed(char *buf, size_t buflen, uint64_t ino)
+{
+    return snprintf(buf, buflen, "xa:%lu", (unsigned long)ino);
+}
+
+/* 解析目录项的值，兼容旧的 8 字节格式 */
+static inline int kvbfs_dirent_decode(const char *val, size_t len,
+                                      struct kvbfs_dirent *de)
+{
+    memset(de, 0, sizeof(*de));
+    if (len == sizeof(*de)) {
+        memcpy(de, val, sizeof(*de));
+        return 0;
+    }
+    if (len == sizeof(uint64_t)) {
+        memcpy(&de->ino, val, sizeof(uint64_t));
+        return 0;
+    }
+    return -1;
+}
+
+/* Reverse dirent index: one record per link of ino */
+static inline int kvbfs_key_parent(char *buf, size_t buflen, uint64_t ino,
+                                   uint64_t parent, const char *name)
+{
+    int n = snprintf(buf, buflen, "p:%lu:%lu:%s",
+                     (unsigned long)ino, (unsigned long)parent, name);
+    if (n < 0 || (size_t)n >= buflen) return -1;
+    return n;
+}
+
+static inline int kvbfs_key_parent_prefix(char *buf, size_t buflen, uint64_t ino)
+{
+    return snprintf(buf, buflen, "p:%lu:", (unsigned long)ino);
+}
+
+/* Pending GC work: unlinked inode / truncated block range */
+static inline int kvbfs_key_orphan(char *buf, size_t buflen, uint64_t ino)
+{
+    return snprintf(buf, buflen, "o:%lu", (unsigned long)ino);
+}
+
+static inline int kvbfs_key_orphan_trunc(char *buf, size_t buflen, uint64_t ino)
+{
+    return snprintf(buf, buflen, "ot:%lu", (unsigned long)ino);
+}
+
+/* Write-back intent: blocks past the stored size may be unacknowledged */
+static inline int kvbfs_key_orphan_wb(char *buf, size_t buflen, uint64_t ino)
+{
+    return snprintf(buf, buflen, "ow:%lu", (unsigned long)ino);
+}
+
+/* Directory usage counters: int64_t {entries, inodes, bytes} */
+static inline int kvbfs_key_usage(char *buf, size_t buflen, uint64_t ino)
+{
+    return snprintf(buf, buflen, "u:%lu", (unsigned long)ino);
+}
+
 /* Per-open file handle for tracking write state */
 struct kvbfs_fh {
     uint64_t ino;
@@ -136,10 +269,26 @@ struct kvbfs_fh {
 };
 
 /* ioctl interface (shared magic for all subsystems) */
-#if defined(CFS_LOCAL_LLM) || defined(CFS_MEMORY)
 #include <sys/ioctl.h>
 #define CFS_IOC_MAGIC   'C'
-#endif
+
+/* Recursive delete of a child directory; issued on the parent directory */
+struct cfs_rmtree {
+    char name[256];
+};
+
+#define CFS_IOC_RMTREE  _IOW(CFS_IOC_MAGIC, 3, struct cfs_rmtree)
+
+/* 等待排队的版本快照与索引完成：对文件只等该文件，对目录等此前排队的全部 */
+#define CFS_IOC_VERSION_WAIT  _IO(CFS_IOC_MAGIC, 4)
+
+/* 将文件恢复为某个版本（编号同 .versions/<file>/<n>），只改写不同的块 */
+struct cfs_restore {
+    uint64_t version;       /* 入参 */
+    uint64_t blocks;        /* 出参：改写的块数 */
+};
+
+#define CFS_IOC_VERSION_RESTORE  _IOWR(CFS_IOC_MAGIC, 5, struct cfs_restore)
 
 #ifdef CFS_LOCAL_LLM
 struct cfs_status {
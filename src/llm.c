@@ -4,6 +4,7 @@
 #include "llm.h"
 #include "kv_store.h"
 #include "inode.h"
+#include "version.h"
 #ifdef CFS_MEMORY
 #include "mem.h"
 #endif
@@ -69,9 +70,18 @@ static int file_append(uint64_t ino, const char *data, size_t data_len)
     struct kvbfs_inode_cache *ic = inode_get(ino);
     if (!ic) return -1;
 
-    pthread_rwlock_rdlock(&ic->lock);
+    /* 文件增长前丢弃待回收范围内的旧块；数据块与 ow: 记录一并提交 */
+    pthread_rwlock_wrlock(&ic->lock);
     uint64_t off = ic->inode.size;
-    pthread_rwlock_unlock(&ic->lock);
+    gc_claim(&g_ctx->gc, ino, off, off + data_len);
+
+    kv_batch_t *batch = kv_batch_new();
+    if (!batch) {
+        pthread_rwlock_unlock(&ic->lock);
+        inode_put(ic);
+        return -1;
+    }
+    bool intent = inode_writeback_batch(batch, ic, off + data_len);
 
     /* 逐块写入 */
     size_t written = 0;
@@ -98,27 +108,36 @@ static int file_append(uint64_t ino, const char *data, size_t data_len)
         if (to_write > data_len - written) to_write = data_len - written;
         memcpy(block + block_off, data + written, to_write);
 
-        if (kv_put(g_ctx->db, key, keylen, block, KVBFS_BLOCK_SIZE) != 0) {
-            inode_put(ic);
-            return -1;
-        }
+        kv_batch_put(batch, key, keylen, block, KVBFS_BLOCK_SIZE);
 
         written += to_write;
         block_idx++;
         block_off = 0;
     }
 
-    /* 更新 inode */
-    pthread_rwlock_wrlock(&ic->lock);
+    /* 追加的块计入下次版本快照 */
+    version_mark_dirty(batch, ic, off / KVBFS_BLOCK_SIZE,
+                       (off + data_len + KVBFS_BLOCK_SIZE - 1) / KVBFS_BLOCK_SIZE);
+
+    int ret = kv_batch_commit(g_ctx->db, batch);
+    kv_batch_free(batch);
+    if (ret != 0) {
+        if (intent) ic->wb_intent = false;
+        pthread_rwlock_unlock(&ic->lock);
+        inode_put(ic);
+        return -1;
+    }
+
+    /* 更新 inode，延迟写回 */
     ic->inode.size = off + data_len;
     ic->inode.blocks = (ic->inode.size + KVBFS_BLOCK_SIZE - 1) / KVBFS_BLOCK_SIZE;
     struct timespec now;
     clock_gettime(CLOCK_REALTIME, &now);
     ic->inode.mtime = now;
     ic->inode.ctime = now;
+    inode_mark_dirty(ic);
     pthread_rwlock_unlock(&ic->lock);
 
-    inode_sync(ic);
     inode_put(ic);
     return 0;
 }
@@ -320,25 +339,16 @@ void llm_gen_destroy(struct llm_ctx *llm)
 
 /* ── 文件覆写辅助 ─────────────────────────────────────── */
 
-/* Overwrite inode file contents, deleting old blocks first */
+/* Overwrite inode file contents, truncating old blocks first */
 static int file_overwrite(uint64_t ino, const char *data, size_t data_len)
 {
     struct kvbfs_inode_cache *ic = inode_get(ino);
     if (!ic) return -1;
 
-    /* Delete all existing blocks */
-    pthread_rwlock_rdlock(&ic->lock);
-    uint64_t old_blocks = ic->inode.blocks;
-    pthread_rwlock_unlock(&ic->lock);
-
-    for (uint64_t i = 0; i < old_blocks; i++) {
-        char key[64];
-        int keylen = kvbfs_key_block(key, sizeof(key), ino, i);
-        kv_delete(g_ctx->db, key, keylen);
-    }
-
-    /* Reset inode size */
+    /* Reset inode size; old blocks are reclaimed in the background */
     pthread_rwlock_wrlock(&ic->lock);
+    gc_truncate(&g_ctx->gc, ino, ic->inode.size, 0);
+    version_mark_dirty(NULL, ic, 0, 0);
     ic->inode.size = 0;
     ic->inode.blocks = 0;
     pthread_rwlock_unlock(&ic->lock);
@@ -137,6 +137,7 @@ int main(int argc, char *argv[])
         fprintf(stderr, "Failed to create FUSE session\n");
         goto out2;
     }
+    g_ctx->se = se;
 
     /* 设置信号处理 */
     if (fuse_set_signal_handlers(se) != 0) {
@@ -163,6 +164,7 @@ int main(int argc, char *argv[])
     }
 
     /* 卸载 */
+    g_ctx->se = NULL;
     fuse_session_unmount(se);
 
 out4:
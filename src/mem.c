@@ -4,6 +4,7 @@
 #include "kvbfs.h"
 #include "kv_store.h"
 #include "inode.h"
+#include "version.h"
 
 #include <llama.h>
 #include <stdlib.h>
@@ -292,34 +293,30 @@ static int mem_is_text(const char *data, size_t len)
     return 1;
 }
 
-int mem_index_file(struct mem_ctx *mem, void *db, uint64_t ino)
+int mem_index_file(struct mem_ctx *mem, void *db, uint64_t ino, uint64_t ver)
 {
     if (!mem || !mem->running || !db) return -1;
 
+    struct kvbfs_inode_cache *ic = inode_get(ino);
+    if (!ic) return -1;
+
     /* Check for agentfs.noindex xattr — if set, skip indexing */
     {
-        char xkey[KVBFS_KEY_MAX];
-        int xkeylen = kvbfs_key_xattr(xkey, sizeof(xkey), ino, "agentfs.noindex");
-        if (xkeylen > 0) {
-            char *xval = NULL;
-            size_t xvlen = 0;
-            if (kv_get(db, xkey, xkeylen, &xval, &xvlen) == 0) {
-                free(xval);
-                return 0;  /* noindex flag set, skip */
-            }
+        char *xval = NULL;
+        size_t xvlen = 0;
+        if (xattr_get(ic, "agentfs.noindex", &xval, &xvlen) == 0) {
+            free(xval);
+            inode_put(ic);
+            return 0;  /* noindex flag set, skip */
         }
     }
 
-    /* Read inode to get file size and block count */
-    struct kvbfs_inode_cache *ic = inode_get(ino);
-    if (!ic) return -1;
-
-    pthread_rwlock_rdlock(&ic->lock);
-    uint64_t file_size = ic->inode.size;
-    uint64_t file_blocks = ic->inode.blocks;
-    pthread_rwlock_unlock(&ic->lock);
     inode_put(ic);
 
+    /* The version is immutable, unlike the live blocks */
+    struct kvbfs_version_meta meta;
+    if (version_get_meta(ino, ver, &meta) != 0) return -1;
+    uint64_t file_size = meta.size;
     if (file_size == 0) return 0;
 
     /* Assemble full file content from blocks */
@@ -327,21 +324,21 @@ int mem_index_file(struct mem_ctx *mem, void *db, uint64_t ino)
     if (!content) return -1;
 
     size_t offset = 0;
-    for (uint64_t b = 0; b < file_blocks && offset < file_size; b++) {
-        char bkey[64];
-        int bkeylen = kvbfs_key_block(bkey, sizeof(bkey), ino, b);
-
+    for (uint64_t b = 0; b < meta.blocks && offset < file_size; b++) {
         char *block_data = NULL;
         size_t block_len = 0;
-        if (kv_get(db, bkey, bkeylen, &block_data, &block_len) != 0)
-            break;
-
-        size_t copy_len = block_len;
-        if (offset + copy_len > file_size)
-            copy_len = file_size - offset;
-
-        memcpy(content + offset, block_data, copy_len);
-        free(block_data);
+        size_t copy_len = file_size - offset;
+        if (copy_len > KVBFS_BLOCK_SIZE) copy_len = KVBFS_BLOCK_SIZE;
+
+        if (version_read_block(ino, ver, b, &block_data, &block_len) != 0) {
+            memset(content + offset, 0, copy_len);     /* hole */
+        } else {
+            if (block_len < copy_len)
+                memset(content + offset + block_len, 0, copy_len - block_len);
+            memcpy(content + offset, block_data,
+                   block_len < copy_len ? block_len : copy_len);
+            free(block_data);
+        }
         offset += copy_len;
     }
     content[offset] = '\0';
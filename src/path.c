@@ -0,0 +1,317 @@
+#include "path.h"
+#include "kvbfs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PATH_BACKFILL_BATCH  1024
+
+/* Parse "<parent>:<name>" following the "p:<ino>:" / "d:" prefix */
+static int split_parent_name(const char *s, size_t len, uint64_t *parent,
+                             const char **name, size_t *name_len)
+{
+    const char *colon = memchr(s, ':', len);
+    if (!colon || colon == s) return -1;
+
+    char num[24];
+    size_t n = colon - s;
+    if (n >= sizeof(num)) return -1;
+    memcpy(num, s, n);
+    num[n] = '\0';
+
+    char *end;
+    *parent = strtoull(num, &end, 10);
+    if (*end != '\0') return -1;
+
+    *name = colon + 1;
+    *name_len = len - n - 1;
+    return 0;
+}
+
+/* ── Reverse index records ────────────────────────────── */
+
+int path_link_batch(kv_batch_t *batch, uint64_t ino,
+                    uint64_t parent, const char *name)
+{
+    char key[KVBFS_KEY_MAX];
+    int keylen = kvbfs_key_parent(key, sizeof(key), ino, parent, name);
+    if (keylen < 0) return -1;
+    kv_batch_put(batch, key, keylen, NULL, 0);
+    return 0;
+}
+
+int path_unlink_batch(kv_batch_t *batch, uint64_t ino,
+                      uint64_t parent, const char *name)
+{
+    char key[KVBFS_KEY_MAX];
+    int keylen = kvbfs_key_parent(key, sizeof(key), ino, parent, name);
+    if (keylen < 0) return -1;
+    kv_batch_delete(batch, key, keylen);
+    return 0;
+}
+
+/* Find one (parent, name) link of ino; name is malloc'd */
+static int path_parent_of(void *db, uint64_t ino, uint64_t *parent, char **name)
+{
+    char prefix[64];
+    int plen = kvbfs_key_parent_prefix(prefix, sizeof(prefix), ino);
+
+    kv_iterator_t *iter = kv_iter_prefix(db, prefix, plen);
+    int ret = -1;
+    if (kv_iter_valid(iter)) {
+        size_t klen;
+        const char *key = kv_iter_key(iter, &klen);
+        const char *n;
+        size_t nlen;
+        if (split_parent_name(key + plen, klen - plen, parent, &n, &nlen) == 0) {
+            *name = strndup(n, nlen);
+            ret = *name ? 0 : -1;
+        }
+    }
+    kv_iter_free(iter);
+    return ret;
+}
+
+int path_parent(void *db, uint64_t ino, uint64_t *parent)
+{
+    if (ino == KVBFS_ROOT_INO) return -1;
+
+    char *name;
+    if (path_parent_of(db, ino, parent, &name) != 0) return -1;
+    free(name);
+    return 0;
+}
+
+/* ── Cache ────────────────────────────────────────────── */
+
+/* Copy the cached path of ino into buf; caller holds pc->lock */
+static int cache_get_locked(struct path_cache *pc, uint64_t ino,
+                            char *buf, size_t buflen)
+{
+    struct path_entry *e = NULL;
+    HASH_FIND(hh, pc->map, &ino, sizeof(uint64_t), e);
+    if (!e || e->gen != pc->gen) return -1;
+
+    size_t len = strlen(e->path);
+    if (len >= buflen) return -1;
+    memcpy(buf, e->path, len + 1);
+    return 0;
+}
+
+static int cache_get(struct path_cache *pc, uint64_t ino, char *buf, size_t buflen)
+{
+    pthread_mutex_lock(&pc->lock);
+    int ret = cache_get_locked(pc, ino, buf, buflen);
+    pthread_mutex_unlock(&pc->lock);
+    return ret;
+}
+
+static void cache_clear_locked(struct path_cache *pc)
+{
+    struct path_entry *e, *tmp;
+    HASH_ITER(hh, pc->map, e, tmp) {
+        HASH_DEL(pc->map, e);
+        free(e->path);
+        free(e);
+    }
+    pc->count = 0;
+}
+
+static void cache_put(struct path_cache *pc, uint64_t ino, uint64_t gen,
+                      const char *path, size_t len)
+{
+    char *copy = strndup(path, len);
+    if (!copy) return;
+
+    pthread_mutex_lock(&pc->lock);
+    struct path_entry *e = NULL;
+    HASH_FIND(hh, pc->map, &ino, sizeof(uint64_t), e);
+    if (!e) {
+        if (pc->count >= PATH_CACHE_MAX)
+            cache_clear_locked(pc);
+        e = calloc(1, sizeof(*e));
+        if (!e) {
+            pthread_mutex_unlock(&pc->lock);
+            free(copy);
+            return;
+        }
+        e->ino = ino;
+        HASH_ADD(hh, pc->map, ino, sizeof(uint64_t), e);
+        pc->count++;
+    } else {
+        free(e->path);
+    }
+    e->path = copy;
+    e->gen = gen;   /* a stale gen makes the entry a miss */
+    pthread_mutex_unlock(&pc->lock);
+}
+
+void path_forget(struct path_cache *pc, uint64_t ino)
+{
+    pthread_mutex_lock(&pc->lock);
+    struct path_entry *e = NULL;
+    HASH_FIND(hh, pc->map, &ino, sizeof(uint64_t), e);
+    if (e) {
+        HASH_DEL(pc->map, e);
+        pc->count--;
+        free(e->path);
+        free(e);
+    }
+    pthread_mutex_unlock(&pc->lock);
+}
+
+void path_invalidate(struct path_cache *pc)
+{
+    pthread_mutex_lock(&pc->lock);
+    pc->gen++;
+    pthread_mutex_unlock(&pc->lock);
+}
+
+/* ── Resolution ───────────────────────────────────────── */
+
+int path_resolve(struct path_cache *pc, void *db, uint64_t ino,
+                 char *buf, size_t buflen)
+{
+    if (ino == KVBFS_ROOT_INO) {
+        if (buflen < 2) return -1;
+        buf[0] = '/';
+        buf[1] = '\0';
+        return 0;
+    }
+
+    pthread_mutex_lock(&pc->lock);
+    uint64_t gen = pc->gen;
+    int hit = cache_get_locked(pc, ino, buf, buflen);
+    pthread_mutex_unlock(&pc->lock);
+    if (hit == 0) return 0;
+
+    /* Walk up until the root or a cached ancestor */
+    char *names[PATH_MAX_DEPTH];
+    uint64_t inos[PATH_MAX_DEPTH];
+    int depth = 0;
+    uint64_t cur = ino;
+    size_t off = 0;
+    int ok = 0;
+
+    while (depth < PATH_MAX_DEPTH) {
+        if (cur == KVBFS_ROOT_INO) {
+            ok = 1;
+            break;
+        }
+        if (depth > 0 && cache_get(pc, cur, buf, buflen) == 0) {
+            off = strlen(buf);
+            ok = 1;
+            break;
+        }
+
+        uint64_t parent;
+        if (path_parent_of(db, cur, &parent, &names[depth]) != 0)
+            break;
+        inos[depth++] = cur;
+        cur = parent;
+    }
+
+    if (!ok || depth == 0) {
+        for (int i = 0; i < depth; i++) free(names[i]);
+        snprintf(buf, buflen, "ino:%lu", (unsigned long)ino);
+        return -1;
+    }
+
+    /* Append components root-first, caching the parent directory too */
+    for (int i = depth - 1; i >= 0; i--) {
+        int n = snprintf(buf + off, buflen - off, "/%s", names[i]);
+        if (n < 0 || (size_t)n >= buflen - off) break;   /* truncated */
+        off += n;
+        if (i <= 1)
+            cache_put(pc, inos[i], gen, buf, off);
+    }
+
+    for (int i = 0; i < depth; i++) free(names[i]);
+    return 0;
+}
+
+/* ── Lifecycle ────────────────────────────────────────── */
+
+/*
+ * Build "p:" records from existing "d:" entries.  The marker goes in the
+ * last batch: a backfill cut short by a crash is redone at the next mount
+ * (the records are idempotent) instead of leaving a partial index.
+ */
+static int path_backfill(void *db)
+{
+    char probe;
+    size_t plen;
+    if (kv_get_into(db, KVBFS_KEY_PATH_DONE, strlen(KVBFS_KEY_PATH_DONE),
+                    &probe, 0, &plen) == 0)
+        return 0;
+
+    kv_batch_t *batch = kv_batch_new();
+    if (!batch) return -1;
+
+    unsigned n = 0, total = 0;
+    int ret = 0;
+    kv_iterator_t *iter = kv_iter_prefix(db, "d:", 2);
+    while (kv_iter_valid(iter)) {
+        size_t klen, vlen;
+        const char *key = kv_iter_key(iter, &klen);
+        const char *val = kv_iter_value(iter, &vlen);
+        struct kvbfs_dirent de;
+        uint64_t parent;
+        const char *name;
+        size_t nlen;
+
+        if (kvbfs_dirent_decode(val, vlen, &de) == 0 &&
+            split_parent_name(key + 2, klen - 2, &parent, &name, &nlen) == 0) {
+            uint64_t child = de.ino;
+            char pkey[KVBFS_KEY_MAX];
+            int pkeylen = snprintf(pkey, sizeof(pkey), "p:%lu:%lu:%.*s",
+                                   (unsigned long)child, (unsigned long)parent,
+                                   (int)nlen, name);
+            if (pkeylen > 0 && (size_t)pkeylen < sizeof(pkey)) {
+                kv_batch_put(batch, pkey, pkeylen, NULL, 0);
+                n++;
+                total++;
+            }
+        }
+        kv_iter_next(iter);
+
+        if (n == PATH_BACKFILL_BATCH) {
+            ret = kv_batch_commit(db, batch);
+            kv_batch_free(batch);
+            batch = kv_batch_new();
+            n = 0;
+            if (!batch) ret = -1;
+            if (ret != 0) break;
+        }
+    }
+    kv_iter_free(iter);
+
+    if (batch) {
+        if (ret == 0) {
+            kv_batch_put(batch, KVBFS_KEY_PATH_DONE,
+                         strlen(KVBFS_KEY_PATH_DONE), NULL, 0);
+            ret = kv_batch_commit(db, batch);
+        }
+        kv_batch_free(batch);
+    }
+
+    if (total > 0)
+        printf("Path index: backfilled %u entries\n", total);
+    return ret;
+}
+
+int path_init(struct path_cache *pc, void *db)
+{
+    memset(pc, 0, sizeof(*pc));
+    pthread_mutex_init(&pc->lock, NULL);
+    return path_backfill(db);
+}
+
+void path_destroy(struct path_cache *pc)
+{
+    pthread_mutex_lock(&pc->lock);
+    cache_clear_locked(pc);
+    pthread_mutex_unlock(&pc->lock);
+    pthread_mutex_destroy(&pc->lock);
+}
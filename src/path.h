@@ -0,0 +1,63 @@
+#ifndef PATH_H
+#define PATH_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "uthash.h"
+#include "kv_store.h"
+
+/*
+ * Inode → path resolution.
+ *
+ * Every dirent "d:<parent>:<name>" has a reverse record
+ * "p:<ino>:<parent>:<name>" written in the same batch, so walking from an
+ * inode up to the root costs one prefix seek per level.  Hard-linked files
+ * have one record per link; the first one wins.
+ *
+ * Resolved paths are cached.  Removing or renaming a single file forgets its
+ * entry; renaming or removing a directory bumps the generation, which
+ * invalidates every cached path at once.
+ */
+
+#define PATH_CACHE_MAX      4096
+#define PATH_MAX_DEPTH      128
+
+struct path_entry {
+    uint64_t ino;
+    uint64_t gen;
+    char *path;
+    UT_hash_handle hh;
+};
+
+struct path_cache {
+    pthread_mutex_t lock;
+    struct path_entry *map;
+    unsigned count;
+    uint64_t gen;
+};
+
+/* Backfills "p:" records for databases created before the reverse index */
+int  path_init(struct path_cache *pc, void *db);
+void path_destroy(struct path_cache *pc);
+
+/* Add/remove the reverse record of dirent parent/name → ino */
+int  path_link_batch(kv_batch_t *batch, uint64_t ino,
+                     uint64_t parent, const char *name);
+int  path_unlink_batch(kv_batch_t *batch, uint64_t ino,
+                       uint64_t parent, const char *name);
+
+/*
+ * Write the absolute path of ino into buf.  Returns 0 on success; on failure
+ * buf holds "ino:<n>" and -1 is returned.
+ */
+int  path_resolve(struct path_cache *pc, void *db, uint64_t ino,
+                  char *buf, size_t buflen);
+
+/* Parent directory of ino's first link; -1 for the root or a detached inode */
+int  path_parent(void *db, uint64_t ino, uint64_t *parent);
+
+void path_forget(struct path_cache *pc, uint64_t ino);
+void path_invalidate(struct path_cache *pc);
+
+#endif /* PATH_H */
@@ -0,0 +1,126 @@
+#include "slab.h"
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Chunk header, padded so the objects after it stay aligned */
+struct slab_chunk {
+    alignas(max_align_t) struct slab_chunk *next;
+};
+
+/* ── Slabs ────────────────────────────────────────────── */
+
+void slab_init(struct slab *s, size_t obj_size)
+{
+    memset(s, 0, sizeof(*s));
+    size_t align = alignof(max_align_t);
+    if (obj_size < sizeof(void *)) obj_size = sizeof(void *);
+    s->obj_size = (obj_size + align - 1) & ~(align - 1);
+}
+
+void slab_destroy(struct slab *s)
+{
+    struct slab_chunk *c = s->chunks;
+    while (c) {
+        struct slab_chunk *next = c->next;
+        free(c);
+        c = next;
+    }
+    s->chunks = NULL;
+    s->free = NULL;
+    s->n_chunks = s->n_free = s->n_live = 0;
+}
+
+static int slab_grow(struct slab *s)
+{
+    struct slab_chunk *c = malloc(sizeof(*c) + SLAB_CHUNK_OBJS * s->obj_size);
+    if (!c) return -1;
+    c->next = s->chunks;
+    s->chunks = c;
+    s->n_chunks++;
+
+    /* Thread the new objects onto the free list, first object on top */
+    char *base = (char *)(c + 1);
+    for (int i = SLAB_CHUNK_OBJS - 1; i >= 0; i--) {
+        void *obj = base + (size_t)i * s->obj_size;
+        *(void **)obj = s->free;
+        s->free = obj;
+    }
+    s->n_free += SLAB_CHUNK_OBJS;
+    return 0;
+}
+
+void *slab_zalloc(struct slab *s)
+{
+    if (!s->free && slab_grow(s) != 0) return NULL;
+
+    void *obj = s->free;
+    s->free = *(void **)obj;
+    s->n_free--;
+    s->n_live++;
+    memset(obj, 0, s->obj_size);
+    return obj;
+}
+
+void slab_free(struct slab *s, void *obj)
+{
+    if (!obj) return;
+    *(void **)obj = s->free;
+    s->free = obj;
+    s->n_free++;
+    s->n_live--;
+}
+
+/* ── Per-thread request buffers ───────────────────────── */
+
+struct reqbuf {
+    char *buf;
+    size_t cap;
+};
+
+static pthread_key_t reqbuf_key;
+static pthread_once_t reqbuf_once = PTHREAD_ONCE_INIT;
+static uint64_t reqbuf_total;
+
+static void reqbuf_release(void *arg)
+{
+    struct reqbuf *rb = arg;
+    __atomic_sub_fetch(&reqbuf_total, rb->cap, __ATOMIC_RELAXED);
+    free(rb->buf);
+    free(rb);
+}
+
+static void reqbuf_key_init(void)
+{
+    pthread_key_create(&reqbuf_key, reqbuf_release);
+}
+
+void *reqbuf_get(size_t size)
+{
+    pthread_once(&reqbuf_once, reqbuf_key_init);
+
+    struct reqbuf *rb = pthread_getspecific(reqbuf_key);
+    if (!rb) {
+        rb = calloc(1, sizeof(*rb));
+        if (!rb) return NULL;
+        pthread_setspecific(reqbuf_key, rb);
+    }
+    if (size <= rb->cap) return rb->buf;
+
+    size_t cap = rb->cap ? rb->cap : REQBUF_INITIAL;
+    while (cap < size) cap *= 2;
+    char *buf = malloc(cap);    /* old contents are not kept */
+    if (!buf) return NULL;
+    free(rb->buf);
+    __atomic_add_fetch(&reqbuf_total, cap - rb->cap, __ATOMIC_RELAXED);
+    rb->buf = buf;
+    rb->cap = cap;
+    return buf;
+}
+
+uint64_t reqbuf_bytes(void)
+{
+    return __atomic_load_n(&reqbuf_total, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,45 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Allocation helpers for hot paths.
+ *
+ * A slab hands out fixed-size objects carved from chunks of SLAB_CHUNK_OBJS
+ * and keeps freed objects on a free list, so caches that churn entries stop
+ * paying a malloc/free pair per entry.  Slabs have no lock of their own: the
+ * owner calls them under the lock that already guards the objects (an inode
+ * cache shard, a vtree shard).  Chunks are only released by slab_destroy.
+ *
+ * reqbuf_get returns a per-thread buffer that grows to the largest request
+ * the thread has served (max_read for reads) and is reused by read, readdir
+ * and event reads.  The buffer is valid until the thread's next call.
+ */
+
+#define SLAB_CHUNK_OBJS     64
+#define REQBUF_INITIAL      (128 * 1024)
+
+struct slab {
+    size_t obj_size;
+    void *free;             /* free objects, linked through their first word */
+    void *chunks;           /* chunks, linked the same way */
+    uint64_t n_chunks;
+    uint64_t n_free;
+    uint64_t n_live;
+};
+
+void  slab_init(struct slab *s, size_t obj_size);
+void  slab_destroy(struct slab *s);
+
+/* Zeroed object, or NULL */
+void *slab_zalloc(struct slab *s);
+void  slab_free(struct slab *s, void *obj);
+
+void *reqbuf_get(size_t size);
+
+/* Bytes held by request buffers across threads */
+uint64_t reqbuf_bytes(void);
+
+#endif /* SLAB_H */
@@ -0,0 +1,240 @@
+#include "snapq.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void snapq_init(struct snapq *q)
+{
+    memset(q, 0, sizeof(*q));
+    q->delay_ms = SNAPQ_DELAY_DEFAULT_MS;
+    pthread_mutex_init(&q->lock, NULL);
+
+    /* Due times are monotonic; a clock step must not stall or rush jobs */
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&q->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&q->done, NULL);
+
+    const char *s = getenv("KVBFS_VERSION_DELAY_MS");
+    if (s) q->delay_ms = strtoul(s, NULL, 10);
+}
+
+/* ── Due-ordered job list (lock held) ─────────────────── */
+
+static void job_unlink(struct snapq *q, struct snapq_job *j)
+{
+    if (j->prev) j->prev->next = j->next;
+    else q->head = j->next;
+    if (j->next) j->next->prev = j->prev;
+    else q->tail = j->prev;
+    j->prev = j->next = NULL;
+}
+
+/* New due times are mostly the latest, so search from the tail */
+static void job_insert(struct snapq *q, struct snapq_job *j)
+{
+    struct snapq_job *after = q->tail;
+    while (after && after->due_ms > j->due_ms)
+        after = after->prev;
+
+    j->prev = after;
+    j->next = after ? after->next : q->head;
+    if (j->next) j->next->prev = j;
+    else q->tail = j;
+    if (after) after->next = j;
+    else q->head = j;
+}
+
+static void job_flush(struct snapq *q, struct snapq_job *j)
+{
+    if (j->flush) return;
+    j->flush = 1;
+    job_unlink(q, j);
+    j->due_ms = 0;
+    job_insert(q, j);
+    pthread_cond_signal(&q->cond);
+}
+
+/* ── Worker ───────────────────────────────────────────── */
+
+static void *snapq_worker(void *arg)
+{
+    struct snapq *q = arg;
+
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        struct snapq_job *j = q->head;
+        if (!j) {
+            if (q->stop) break;
+            pthread_cond_wait(&q->cond, &q->lock);
+            continue;
+        }
+        if (!q->stop && !j->flush && j->due_ms > now_ms()) {
+            struct timespec ts = {
+                .tv_sec = j->due_ms / 1000,
+                .tv_nsec = (long)(j->due_ms % 1000) * 1000000,
+            };
+            pthread_cond_timedwait(&q->cond, &q->lock, &ts);
+            continue;
+        }
+
+        job_unlink(q, j);
+        HASH_DEL(q->jobs, j);
+        q->pending--;
+        q->busy_ino = j->ino;
+        q->busy_seq = j->seq;
+        pthread_mutex_unlock(&q->lock);
+
+        q->run(j->ino);
+        free(j);
+
+        pthread_mutex_lock(&q->lock);
+        q->busy_ino = 0;
+        q->completed++;
+        pthread_cond_broadcast(&q->done);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+int snapq_start(struct snapq *q, void (*run)(uint64_t ino))
+{
+    q->run = run;
+    if (q->started) return 0;
+
+    q->stop = 0;
+    if (pthread_create(&q->thread, NULL, snapq_worker, q) != 0) {
+        fprintf(stderr, "snapq: failed to create worker thread\n");
+        return -1;      /* jobs run inline */
+    }
+    q->started = 1;
+    return 0;
+}
+
+void snapq_stop(struct snapq *q)
+{
+    if (!q->started) return;
+
+    pthread_mutex_lock(&q->lock);
+    q->stop = 1;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+
+    pthread_join(q->thread, NULL);
+    q->started = 0;
+}
+
+void snapq_destroy(struct snapq *q)
+{
+    snapq_stop(q);
+
+    struct snapq_job *j, *tmp;
+    HASH_ITER(hh, q->jobs, j, tmp) {
+        HASH_DEL(q->jobs, j);
+        free(j);
+    }
+    q->head = q->tail = NULL;
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->cond);
+    pthread_cond_destroy(&q->done);
+}
+
+/* ── Submission and waiting ───────────────────────────── */
+
+void snapq_submit(struct snapq *q, uint64_t ino)
+{
+    pthread_mutex_lock(&q->lock);
+    if (!q->started) {
+        pthread_mutex_unlock(&q->lock);
+        if (q->run) q->run(ino);
+        return;
+    }
+    q->submitted++;
+
+    uint64_t now = now_ms();
+    struct snapq_job *j = NULL;
+    HASH_FIND(hh, q->jobs, &ino, sizeof(uint64_t), j);
+    if (j) {
+        /* Fold into the queued job and restart its delay, up to the cap */
+        q->coalesced++;
+        if (!j->flush) {
+            uint64_t due = now + q->delay_ms;
+            uint64_t cap = j->first_ms + (uint64_t)q->delay_ms * SNAPQ_MAX_HOLD;
+            if (due > cap) due = cap;
+            if (due != j->due_ms) {
+                job_unlink(q, j);
+                j->due_ms = due;
+                job_insert(q, j);
+            }
+        }
+        pthread_mutex_unlock(&q->lock);
+        return;
+    }
+
+    j = calloc(1, sizeof(*j));
+    if (!j) {
+        pthread_mutex_unlock(&q->lock);
+        q->run(ino);
+        return;
+    }
+    j->ino = ino;
+    j->seq = ++q->seq;
+    j->first_ms = now;
+    j->due_ms = now + q->delay_ms;
+    HASH_ADD(hh, q->jobs, ino, sizeof(uint64_t), j);
+    job_insert(q, j);
+    q->pending++;
+    if (q->head == j)
+        pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void snapq_wait(struct snapq *q, uint64_t ino)
+{
+    pthread_mutex_lock(&q->lock);
+    uint64_t mark = q->seq;     /* jobs submitted up to now */
+    for (;;) {
+        int busy = q->busy_ino != 0 && q->busy_seq <= mark &&
+                   (ino == 0 || q->busy_ino == ino);
+        if (ino != 0) {
+            struct snapq_job *j = NULL;
+            HASH_FIND(hh, q->jobs, &ino, sizeof(uint64_t), j);
+            if (j && j->seq <= mark) {
+                job_flush(q, j);
+                busy = 1;
+            }
+        } else {
+            struct snapq_job *j, *tmp;
+            HASH_ITER(hh, q->jobs, j, tmp) {
+                if (j->seq > mark) continue;
+                job_flush(q, j);
+                busy = 1;
+            }
+        }
+        if (!busy) break;
+        pthread_cond_wait(&q->done, &q->lock);
+    }
+    pthread_mutex_unlock(&q->lock);
+}
+
+void snapq_get_stats(struct snapq *q, struct snapq_stats *st)
+{
+    pthread_mutex_lock(&q->lock);
+    st->delay_ms = q->delay_ms;
+    st->pending = q->pending;
+    st->submitted = q->submitted;
+    st->coalesced = q->coalesced;
+    st->completed = q->completed;
+    pthread_mutex_unlock(&q->lock);
+}
@@ -0,0 +1,89 @@
+#ifndef SNAPQ_H
+#define SNAPQ_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "uthash.h"
+
+/*
+ * Deferred version snapshots.
+ *
+ * release() of a written file used to take the version snapshot and re-index
+ * the file before replying, so close() in the agent paid for both.  Release
+ * now only queues the inode here and a worker runs the job later.
+ *
+ * Jobs are coalesced per inode: a job runs KVBFS_VERSION_DELAY_MS after the
+ * last close that queued it, but no later than SNAPQ_MAX_HOLD delays after
+ * the first, so an edit loop that rewrites a file many times produces one
+ * snapshot and one re-index.  The job captures whatever the file holds when
+ * it runs; version_snapshot takes the blocks under the inode write lock and
+ * indexing reads that immutable version, so both see the same content.
+ *
+ * Readers of version state (agentfs.version, agentfs.versions, .versions/)
+ * and CFS_IOC_VERSION_WAIT call snapq_wait, which runs the pending job at
+ * once instead of waiting out the delay.  Unmount runs every pending job.
+ */
+
+#define SNAPQ_DELAY_DEFAULT_MS  1000
+#define SNAPQ_MAX_HOLD          10      /* cap on postponing, in delays */
+
+struct snapq_job {
+    uint64_t ino;
+    uint64_t seq;               /* submission order of the first close */
+    uint64_t first_ms;
+    uint64_t due_ms;
+    int flush;                  /* a waiter wants it now */
+    struct snapq_job *prev, *next;  /* ordered by due_ms */
+    UT_hash_handle hh;
+};
+
+struct snapq {
+    unsigned delay_ms;
+    void (*run)(uint64_t ino);
+
+    pthread_t thread;
+    int started;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* worker: new or earlier job, stop */
+    pthread_cond_t done;        /* waiters: a job finished */
+    struct snapq_job *jobs;     /* hash by ino, protected by lock */
+    struct snapq_job *head, *tail;
+    uint64_t seq;
+    uint64_t busy_ino;          /* job being run, 0 = none */
+    uint64_t busy_seq;
+
+    uint64_t pending;           /* jobs queued, not yet started */
+    uint64_t submitted;
+    uint64_t coalesced;         /* closes folded into a queued job */
+    uint64_t completed;
+};
+
+struct snapq_stats {
+    uint64_t delay_ms;
+    uint64_t pending;
+    uint64_t submitted;
+    uint64_t coalesced;
+    uint64_t completed;
+};
+
+/* Reads KVBFS_VERSION_DELAY_MS */
+void snapq_init(struct snapq *q);
+/* Start the worker; run takes the snapshot and re-indexes one inode */
+int  snapq_start(struct snapq *q, void (*run)(uint64_t ino));
+/* Run every pending job, then join the worker */
+void snapq_stop(struct snapq *q);
+void snapq_destroy(struct snapq *q);
+
+/* Queue ino, or run its job inline when the worker is not running */
+void snapq_submit(struct snapq *q, uint64_t ino);
+
+/*
+ * Run the pending job of ino now and wait for it; with ino 0, every job
+ * submitted before the call.  Not from the worker.
+ */
+void snapq_wait(struct snapq *q, uint64_t ino);
+
+void snapq_get_stats(struct snapq *q, struct snapq_stats *st);
+
+#endif /* SNAPQ_H */
@@ -1,5 +1,6 @@
 #include "super.h"
 #include "kv_store.h"
+#include "inode.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,6 +25,8 @@ int super_load(struct kvbfs_ctx *ctx)
             fprintf(stderr, "Invalid superblock magic\n");
             return -1;
         }
+        /* next_ino 是预留上界：崩溃时未用完的号段被跳过 */
+        inode_alloc_init(ctx);
         return 0;
     }
 
@@ -33,6 +36,7 @@ int super_load(struct kvbfs_ctx *ctx)
     ctx->super.magic = KVBFS_MAGIC;
     ctx->super.version = KVBFS_VERSION;
     ctx->super.next_ino = KVBFS_ROOT_INO + 1;  /* root is ino 1 */
+    inode_alloc_init(ctx);
 
     ret = super_save(ctx);
     if (ret != 0) return ret;
@@ -0,0 +1,378 @@
+#include "usage.h"
+#include "kvbfs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define USAGE_BACKFILL_BATCH  1024
+
+/* Leading "<ino>:" of a key suffix; keys are not NUL-terminated */
+static int parse_ino(const char *s, size_t len, uint64_t *ino)
+{
+    char num[24];
+    size_t n = 0;
+    while (n < len && s[n] != ':') {
+        if (n == sizeof(num) - 1) return -1;
+        num[n] = s[n];
+        n++;
+    }
+    if (n == 0 || n == len) return -1;
+    num[n] = '\0';
+
+    char *end;
+    *ino = strtoull(num, &end, 10);
+    return *end == '\0' ? 0 : -1;
+}
+
+/* ── Records ──────────────────────────────────────────── */
+
+int usage_get(void *db, uint64_t dir, struct kvbfs_usage *u)
+{
+    memset(u, 0, sizeof(*u));
+
+    char key[64];
+    int keylen = kvbfs_key_usage(key, sizeof(key), dir);
+    char *val = NULL;
+    size_t vlen = 0;
+    if (kv_get(db, key, keylen, &val, &vlen) != 0) return -1;
+
+    memcpy(u, val, vlen < sizeof(*u) ? vlen : sizeof(*u));
+    free(val);
+    return 0;
+}
+
+void usage_child(void *db, uint64_t ino, uint32_t mode, uint64_t size,
+                 struct kvbfs_usage *cu)
+{
+    memset(cu, 0, sizeof(*cu));
+    if (S_ISDIR(mode)) {
+        struct kvbfs_usage below;
+        usage_get(db, ino, &below);
+        cu->inodes = below.inodes;
+        cu->bytes = below.bytes;
+    } else {
+        cu->bytes = (int64_t)size;
+    }
+    cu->inodes++;
+}
+
+/* ── Parent cache ─────────────────────────────────────── */
+
+static void cache_clear_locked(struct usage_ctx *uc)
+{
+    struct usage_parent *e, *tmp;
+    HASH_ITER(hh, uc->parents, e, tmp) {
+        HASH_DEL(uc->parents, e);
+        free(e);
+    }
+    uc->count = 0;
+}
+
+static int parent_of(struct usage_ctx *uc, void *db, uint64_t dir,
+                     uint64_t *parent)
+{
+    pthread_mutex_lock(&uc->lock);
+    struct usage_parent *e = NULL;
+    HASH_FIND(hh, uc->parents, &dir, sizeof(uint64_t), e);
+    if (e) *parent = e->parent;
+    uint64_t gen = uc->gen;
+    pthread_mutex_unlock(&uc->lock);
+    if (e) return 0;
+
+    if (path_parent(db, dir, parent) != 0) return -1;
+
+    e = calloc(1, sizeof(*e));
+    if (!e) return 0;
+    e->ino = dir;
+    e->parent = *parent;
+
+    pthread_mutex_lock(&uc->lock);
+    struct usage_parent *old = NULL;
+    HASH_FIND(hh, uc->parents, &dir, sizeof(uint64_t), old);
+    if (old || uc->gen != gen) {
+        free(e);    /* a rename may have raced with the read */
+    } else {
+        if (uc->count >= USAGE_CACHE_MAX)
+            cache_clear_locked(uc);
+        HASH_ADD(hh, uc->parents, ino, sizeof(uint64_t), e);
+        uc->count++;
+    }
+    pthread_mutex_unlock(&uc->lock);
+    return 0;
+}
+
+void usage_forget(struct usage_ctx *uc, uint64_t dir)
+{
+    pthread_mutex_lock(&uc->lock);
+    struct usage_parent *e = NULL;
+    HASH_FIND(hh, uc->parents, &dir, sizeof(uint64_t), e);
+    if (e) {
+        HASH_DEL(uc->parents, e);
+        uc->count--;
+        free(e);
+    }
+    uc->gen++;
+    pthread_mutex_unlock(&uc->lock);
+}
+
+/* ── Charging ─────────────────────────────────────────── */
+
+void usage_charge_begin(struct usage_ctx *uc)
+{
+    pthread_rwlock_rdlock(&uc->tree);
+}
+
+void usage_move_begin(struct usage_ctx *uc)
+{
+    pthread_rwlock_wrlock(&uc->tree);
+}
+
+void usage_charge_end(struct usage_ctx *uc)
+{
+    pthread_rwlock_unlock(&uc->tree);
+}
+
+/* Merge d into dir, then its inode/byte part into every ancestor */
+static int charge(struct usage_ctx *uc, kv_batch_t *batch, void *db,
+                  uint64_t dir, struct kvbfs_usage d)
+{
+    if (d.entries == 0 && d.inodes == 0 && d.bytes == 0) return 0;
+
+    char key[64];
+    int keylen = kvbfs_key_usage(key, sizeof(key), dir);
+    kv_batch_merge(batch, key, keylen, (const char *)&d, sizeof(d));
+
+    d.entries = 0;
+    if (d.inodes == 0 && d.bytes == 0) return 0;
+
+    uint64_t cur = dir;
+    for (int depth = 0; cur != KVBFS_ROOT_INO && depth < PATH_MAX_DEPTH; depth++) {
+        uint64_t parent;
+        if (parent_of(uc, db, cur, &parent) != 0)
+            break;          /* detached subtree: nothing above to charge */
+        keylen = kvbfs_key_usage(key, sizeof(key), parent);
+        kv_batch_merge(batch, key, keylen, (const char *)&d, sizeof(d));
+        cur = parent;
+    }
+    return 0;
+}
+
+int usage_link_batch(struct usage_ctx *uc, kv_batch_t *batch, void *db,
+                     uint64_t parent, const struct kvbfs_usage *cu)
+{
+    struct kvbfs_usage d = { 1, cu->inodes, cu->bytes };
+    return charge(uc, batch, db, parent, d);
+}
+
+int usage_unlink_batch(struct usage_ctx *uc, kv_batch_t *batch, void *db,
+                       uint64_t parent, const struct kvbfs_usage *cu)
+{
+    struct kvbfs_usage d = { -1, -cu->inodes, -cu->bytes };
+    return charge(uc, batch, db, parent, d);
+}
+
+int usage_resize_batch(struct usage_ctx *uc, kv_batch_t *batch, void *db,
+                       uint64_t ino, int64_t delta)
+{
+    if (delta == 0) return 0;
+
+    char prefix[64];
+    int plen = kvbfs_key_parent_prefix(prefix, sizeof(prefix), ino);
+    struct kvbfs_usage d = { 0, 0, delta };
+
+    /* One record per link: "p:<ino>:<parent>:<name>" */
+    kv_iterator_t *iter = kv_iter_prefix(db, prefix, plen);
+    while (kv_iter_valid(iter)) {
+        size_t klen;
+        const char *key = kv_iter_key(iter, &klen);
+        uint64_t parent;
+        if (parse_ino(key + plen, klen - plen, &parent) == 0)
+            charge(uc, batch, db, parent, d);
+        kv_iter_next(iter);
+    }
+    kv_iter_free(iter);
+    return 0;
+}
+
+/* ── Backfill ─────────────────────────────────────────── */
+
+struct bf_dir {
+    uint64_t ino;
+    uint64_t parent;
+    int has_parent;
+    struct kvbfs_usage own;     /* direct children only */
+    struct kvbfs_usage total;
+    UT_hash_handle hh;
+};
+
+static struct bf_dir *bf_get(struct bf_dir **map, uint64_t ino)
+{
+    struct bf_dir *d = NULL;
+    HASH_FIND(hh, *map, &ino, sizeof(uint64_t), d);
+    if (d) return d;
+    d = calloc(1, sizeof(*d));
+    if (!d) return NULL;
+    d->ino = ino;
+    HASH_ADD(hh, *map, ino, sizeof(uint64_t), d);
+    return d;
+}
+
+/* Mode and size of a child; dirents carry the type but not the size */
+static int bf_stat(void *db, uint64_t ino, uint32_t *mode, uint64_t *size)
+{
+    char key[64];
+    int keylen = kvbfs_key_inode(key, sizeof(key), ino);
+    char *val = NULL;
+    size_t vlen = 0;
+    if (kv_get(db, key, keylen, &val, &vlen) != 0) return -1;
+
+    struct kvbfs_inode inode;
+    int ret = -1;
+    if (vlen == sizeof(inode)) {
+        memcpy(&inode, val, sizeof(inode));
+        *mode = inode.mode;
+        *size = inode.size;
+        ret = 0;
+    }
+    free(val);
+    return ret;
+}
+
+static int usage_backfill(void *db)
+{
+    struct bf_dir *map = NULL;
+    int ret = 0;
+
+    struct bf_dir *root = bf_get(&map, KVBFS_ROOT_INO);
+    if (!root) return -1;
+
+    kv_iterator_t *iter = kv_iter_prefix(db, "d:", 2);
+    while (ret == 0 && kv_iter_valid(iter)) {
+        size_t klen, vlen;
+        const char *key = kv_iter_key(iter, &klen);
+        const char *val = kv_iter_value(iter, &vlen);
+        struct kvbfs_dirent de;
+        uint64_t parent;
+
+        if (kvbfs_dirent_decode(val, vlen, &de) == 0 &&
+            parse_ino(key + 2, klen - 2, &parent) == 0) {
+            uint32_t mode = de.type;
+            uint64_t size = 0;
+            if ((!S_ISDIR(mode) && bf_stat(db, de.ino, &mode, &size) != 0) ||
+                mode == 0) {
+                kv_iter_next(iter);
+                continue;   /* dangling dirent: not counted */
+            }
+
+            struct bf_dir *p = bf_get(&map, parent);
+            struct bf_dir *c = S_ISDIR(mode) ? bf_get(&map, de.ino) : NULL;
+            if (!p || (S_ISDIR(mode) && !c)) {
+                ret = -1;
+                break;
+            }
+            p->own.entries++;
+            p->own.inodes++;
+            if (c) {
+                c->parent = parent;
+                c->has_parent = 1;
+            } else {
+                p->own.bytes += (int64_t)size;
+            }
+        }
+        kv_iter_next(iter);
+    }
+    kv_iter_free(iter);
+
+    /* Add each directory's own share to itself and every ancestor */
+    struct bf_dir *d, *tmp;
+    if (ret == 0) {
+        HASH_ITER(hh, map, d, tmp) {
+            d->total.entries = d->own.entries;
+            struct bf_dir *a = d;
+            for (int depth = 0; a && depth < PATH_MAX_DEPTH; depth++) {
+                a->total.inodes += d->own.inodes;
+                a->total.bytes += d->own.bytes;
+                if (a->ino == KVBFS_ROOT_INO || !a->has_parent) break;
+                struct bf_dir *up = NULL;
+                HASH_FIND(hh, map, &a->parent, sizeof(uint64_t), up);
+                a = up;
+            }
+        }
+    }
+
+    /* The root record goes last: its presence marks the backfill done */
+    kv_batch_t *batch = ret == 0 ? kv_batch_new() : NULL;
+    unsigned n = 0;
+    if (ret == 0 && !batch) ret = -1;
+    HASH_ITER(hh, map, d, tmp) {
+        if (ret == 0 && d != root && d->own.entries > 0) {
+            char key[64];
+            int keylen = kvbfs_key_usage(key, sizeof(key), d->ino);
+            kv_batch_put(batch, key, keylen, (const char *)&d->total,
+                         sizeof(d->total));
+            if (++n == USAGE_BACKFILL_BATCH) {
+                ret = kv_batch_commit(db, batch);
+                kv_batch_free(batch);
+                batch = kv_batch_new();
+                n = 0;
+                if (!batch) ret = -1;
+            }
+        }
+        if (d != root) {
+            HASH_DEL(map, d);
+            free(d);
+        }
+    }
+    if (batch) {
+        if (ret == 0 && n > 0)
+            ret = kv_batch_commit(db, batch);
+        kv_batch_free(batch);
+    }
+
+    if (ret == 0) {
+        char key[64];
+        int keylen = kvbfs_key_usage(key, sizeof(key), KVBFS_ROOT_INO);
+        ret = kv_put(db, key, keylen, (const char *)&root->total,
+                     sizeof(root->total));
+        if (root->total.inodes > 0)
+            printf("Usage: counted %ld inodes, %ld bytes\n",
+                   (long)root->total.inodes, (long)root->total.bytes);
+    }
+    HASH_DEL(map, root);
+    free(root);
+    return ret;
+}
+
+/* ── Lifecycle ────────────────────────────────────────── */
+
+int usage_init(struct usage_ctx *uc, void *db)
+{
+    memset(uc, 0, sizeof(*uc));
+    pthread_rwlock_init(&uc->tree, NULL);
+    pthread_mutex_init(&uc->lock, NULL);
+
+    const char *s = getenv("KVBFS_USAGE_REBUILD");
+    if (s && strcmp(s, "0") != 0) {
+        kv_batch_t *batch = kv_batch_new();
+        if (!batch) return -1;
+        kv_batch_delete_prefix(batch, "u:", 2);
+        int ret = kv_batch_commit(db, batch);
+        kv_batch_free(batch);
+        if (ret != 0) return -1;
+    }
+
+    struct kvbfs_usage u;
+    if (usage_get(db, KVBFS_ROOT_INO, &u) == 0) return 0;
+    return usage_backfill(db);
+}
+
+void usage_destroy(struct usage_ctx *uc)
+{
+    pthread_mutex_lock(&uc->lock);
+    cache_clear_locked(uc);
+    pthread_mutex_unlock(&uc->lock);
+    pthread_mutex_destroy(&uc->lock);
+    pthread_rwlock_destroy(&uc->tree);
+}
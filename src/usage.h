@@ -0,0 +1,88 @@
+#ifndef USAGE_H
+#define USAGE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "uthash.h"
+#include "kv_store.h"
+
+/*
+ * Per-directory usage counters.
+ *
+ * Each directory with children has a record "u:<ino>" holding its direct
+ * entry count and the recursive inode count and file bytes below it.  The
+ * counters are never read back on the write path: every namespace change
+ * adds signed deltas to the directory and its ancestors with kv_batch_merge()
+ * in the batch that changes the dirents, so a crash can never split the two.
+ *
+ * File bytes are charged per link at the size last written back by
+ * inode_sync(), which adds the difference to every parent of the file in the
+ * batch that stores the new size.  Sizes of dirty inodes therefore show up
+ * after the next write-back, like the stored size itself.
+ *
+ * Entry counts are exact because the kernel serialises namespace operations
+ * on a directory.  The recursive totals walk the ancestor chain before the
+ * batch commits, so charging callers hold the tree lock shared from the
+ * first charge until the commit, and moves that change a directory's
+ * ancestors (or read a subtree total that others may be charging) hold it
+ * exclusively.  The tree lock nests inside inode locks.  KVBFS_USAGE_REBUILD=1
+ * still recounts at mount.
+ */
+
+#define USAGE_CACHE_MAX     4096
+
+struct kvbfs_usage {
+    int64_t entries;        /* direct children */
+    int64_t inodes;         /* inodes below the directory, one per link */
+    int64_t bytes;          /* file bytes below the directory */
+};
+
+/* Directory → parent, so charging ancestors skips the "p:" seeks */
+struct usage_parent {
+    uint64_t ino;
+    uint64_t parent;
+    UT_hash_handle hh;
+};
+
+struct usage_ctx {
+    pthread_rwlock_t tree;          /* see above */
+    pthread_mutex_t lock;
+    struct usage_parent *parents;
+    unsigned count;
+    uint64_t gen;           /* bumped by usage_forget() */
+};
+
+/* Builds the records from "d:"/"i:" when the root has none yet */
+int  usage_init(struct usage_ctx *uc, void *db);
+void usage_destroy(struct usage_ctx *uc);
+
+/* Counters of dir; a missing record reads as all zero and returns -1 */
+int  usage_get(void *db, uint64_t dir, struct kvbfs_usage *u);
+
+/*
+ * What a child contributes to its parent: itself plus, for a directory,
+ * everything below it.  size is the charged size of a file (ignored for
+ * directories).
+ */
+void usage_child(void *db, uint64_t ino, uint32_t mode, uint64_t size,
+                 struct kvbfs_usage *cu);
+
+/* Charge/uncharge child usage cu to parent and its ancestors */
+int  usage_link_batch(struct usage_ctx *uc, kv_batch_t *batch, void *db,
+                      uint64_t parent, const struct kvbfs_usage *cu);
+int  usage_unlink_batch(struct usage_ctx *uc, kv_batch_t *batch, void *db,
+                        uint64_t parent, const struct kvbfs_usage *cu);
+
+/* A file's charged size changed by delta: charge every link of ino */
+int  usage_resize_batch(struct usage_ctx *uc, kv_batch_t *batch, void *db,
+                        uint64_t ino, int64_t delta);
+
+/* Tree lock: shared around charge + commit, exclusive around a move */
+void usage_charge_begin(struct usage_ctx *uc);
+void usage_move_begin(struct usage_ctx *uc);
+void usage_charge_end(struct usage_ctx *uc);
+
+/* Drop the cached parent of a renamed or removed directory */
+void usage_forget(struct usage_ctx *uc, uint64_t dir);
+
+#endif /* USAGE_H */
@@ -0,0 +1,223 @@
+#include "vcas.h"
+#include "kvbfs.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Writers adding references share it; the sweep takes it exclusively */
+static pthread_rwlock_t vcas_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* ── SHA-256 ──────────────────────────────────────────── */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n)   (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(uint32_t *h, const unsigned char *p)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+               (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+    uint32_t e = h[4], f = h[5], g = h[6], k = h[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = k + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) +
+                      ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) +
+                      ((a & b) ^ (a & c) ^ (b & c));
+        k = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+void vcas_hash(const char *data, size_t len, uint8_t *hash)
+{
+    uint32_t h[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    const unsigned char *p = (const unsigned char *)data;
+    size_t left = len;
+    for (; left >= 64; left -= 64, p += 64)
+        sha256_block(h, p);
+
+    /* Padding: 0x80, zeros, then the bit length big-endian */
+    unsigned char tail[128] = { 0 };
+    memcpy(tail, p, left);
+    tail[left] = 0x80;
+    size_t tlen = left < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t)len * 8;
+    for (int i = 0; i < 8; i++)
+        tail[tlen - 1 - i] = (unsigned char)(bits >> (8 * i));
+    sha256_block(h, tail);
+    if (tlen == 128) sha256_block(h, tail + 64);
+
+    for (int i = 0; i < 8; i++) {
+        hash[4 * i]     = (uint8_t)(h[i] >> 24);
+        hash[4 * i + 1] = (uint8_t)(h[i] >> 16);
+        hash[4 * i + 2] = (uint8_t)(h[i] >> 8);
+        hash[4 * i + 3] = (uint8_t)h[i];
+    }
+}
+
+/* ── References ───────────────────────────────────────── */
+
+void vcas_write_begin(void)
+{
+    pthread_rwlock_rdlock(&vcas_lock);
+}
+
+void vcas_write_end(void)
+{
+    pthread_rwlock_unlock(&vcas_lock);
+}
+
+void vcas_ref(kv_batch_t *batch, const uint8_t *hash, const char *data, size_t len)
+{
+    char key[80];
+    int keylen = kvbfs_key_vcas_blob(key, sizeof(key), hash);
+
+    /* Present blobs stay put until the sweep, which waits for this batch */
+    char probe;
+    size_t plen;
+    if (kv_get_into(g_ctx->db, key, keylen, &probe, 0, &plen) != 0)
+        kv_batch_put(batch, key, keylen, data, len);
+
+    int64_t one = 1;
+    keylen = kvbfs_key_vcas_refs(key, sizeof(key), hash);
+    kv_batch_merge(batch, key, keylen, (const char *)&one, sizeof(one));
+}
+
+void vcas_unref(kv_batch_t *batch, const uint8_t *hash)
+{
+    char key[80];
+    int keylen = kvbfs_key_vcas_refs(key, sizeof(key), hash);
+    int64_t minus = -1;
+    kv_batch_merge(batch, key, keylen, (const char *)&minus, sizeof(minus));
+}
+
+int vcas_get(const uint8_t *hash, char **data, size_t *len)
+{
+    char key[80];
+    int keylen = kvbfs_key_vcas_blob(key, sizeof(key), hash);
+    return kv_get(g_ctx->db, key, keylen, data, len);
+}
+
+size_t vcas_len(const uint8_t *hash)
+{
+    char key[80];
+    int keylen = kvbfs_key_vcas_blob(key, sizeof(key), hash);
+    char probe;
+    size_t len;
+    if (kv_get_into(g_ctx->db, key, keylen, &probe, 0, &len) != 0) return 0;
+    return len;
+}
+
+/* ── Verifier ─────────────────────────────────────────── */
+
+static int hex_decode(const char *s, size_t n, uint8_t *out)
+{
+    for (size_t i = 0; i < n; i++) {
+        unsigned v = 0;
+        for (int j = 0; j < 2; j++) {
+            char c = s[2 * i + j];
+            v <<= 4;
+            if (c >= '0' && c <= '9') v |= (unsigned)(c - '0');
+            else if (c >= 'a' && c <= 'f') v |= (unsigned)(c - 'a' + 10);
+            else return -1;
+        }
+        out[i] = (uint8_t)v;
+    }
+    return 0;
+}
+
+int vcas_verify_step(char *cursor, size_t *cursor_len, struct vcas_pass *pass,
+                     size_t *keys)
+{
+    *keys = 0;
+    kv_batch_t *batch = kv_batch_new();
+    if (!batch) return 0;
+
+    pthread_rwlock_wrlock(&vcas_lock);
+    kv_iterator_t *iter = kv_iter_prefix(g_ctx->db, "vh:", 3);
+    if (!iter) {
+        pthread_rwlock_unlock(&vcas_lock);
+        kv_batch_free(batch);
+        return 0;
+    }
+    if (*cursor_len > 0) {
+        kv_iter_seek(iter, cursor, *cursor_len);
+        size_t klen;
+        const char *k;
+        if (kv_iter_valid(iter) && (k = kv_iter_key(iter, &klen)) &&
+            klen == *cursor_len && memcmp(k, cursor, klen) == 0)
+            kv_iter_next(iter);
+    }
+
+    for (int n = 0; n < VCAS_VERIFY_CHUNK && kv_iter_valid(iter);
+         n++, kv_iter_next(iter)) {
+        size_t klen, vlen;
+        const char *k = kv_iter_key(iter, &klen);
+        const char *v = kv_iter_value(iter, &vlen);
+        uint8_t hash[VCAS_HASH_SIZE], actual[VCAS_HASH_SIZE];
+        if (klen != 3 + 2 * VCAS_HASH_SIZE ||
+            hex_decode(k + 3, VCAS_HASH_SIZE, hash) != 0)
+            continue;
+        memcpy(cursor, k, klen);
+        *cursor_len = klen;
+
+        char rkey[80];
+        int rkeylen = kvbfs_key_vcas_refs(rkey, sizeof(rkey), hash);
+        int64_t refs = 0;
+        size_t rlen;
+        if (kv_get_into(g_ctx->db, rkey, rkeylen, (char *)&refs, sizeof(refs),
+                        &rlen) != 0 || rlen != sizeof(refs))
+            refs = 0;
+        if (refs <= 0) {
+            kv_batch_delete(batch, k, klen);
+            kv_batch_delete(batch, rkey, rkeylen);
+            *keys += 2;
+            pass->swept++;
+            continue;
+        }
+
+        vcas_hash(v, vlen, actual);
+        if (memcmp(hash, actual, VCAS_HASH_SIZE) != 0) {
+            fprintf(stderr, "vcas: blob %.*s does not match its hash\n",
+                    (int)klen, k);
+            pass->corrupt++;
+        }
+        pass->blobs++;
+        pass->stored += vlen;
+        pass->referenced += (uint64_t)refs * vlen;
+    }
+    int more = kv_iter_valid(iter);
+    kv_iter_free(iter);
+
+    if (*keys > 0) kv_batch_commit(g_ctx->db, batch);
+    pthread_rwlock_unlock(&vcas_lock);
+    kv_batch_free(batch);
+    return more;
+}
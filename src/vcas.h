@@ -0,0 +1,89 @@
+#ifndef VCAS_H
+#define VCAS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "kv_store.h"
+
+/*
+ * Content-addressed storage for version blocks.
+ *
+ * A snapshot stores a non-empty block once per distinct content, as
+ * vh:<sha256> -> bytes, and counts its users in vr:<sha256> with the
+ * counter merge operator.  The version record that points at it carries
+ * the hash instead of the data (see version.h), so the same block written
+ * by many files, or a file reverted to content it had before, costs one
+ * copy.  References are added with the record in the snapshot's batch and
+ * dropped with it when a version or file goes; nothing is deleted inline.
+ *
+ * The GC worker verifies the store in the background: it rehashes every
+ * blob, deletes blobs nobody references any more and totals what the
+ * remaining ones save.  Adding a reference to an existing blob and the
+ * verifier's check-then-delete exclude each other through
+ * vcas_write_begin/end, so a blob is never swept under a new reference.
+ */
+
+#define VCAS_HASH_SIZE      32
+#define VCAS_VERIFY_DEFAULT_S   3600    /* verifier pass interval */
+#define VCAS_VERIFY_CHUNK   64          /* blobs per verifier step */
+
+static inline int kvbfs_key_vcas_blob(char *buf, size_t buflen,
+                                      const uint8_t *hash)
+{
+    if (buflen < 4 + 2 * VCAS_HASH_SIZE) return -1;
+    int n = snprintf(buf, buflen, "vh:");
+    for (int i = 0; i < VCAS_HASH_SIZE; i++)
+        n += snprintf(buf + n, buflen - n, "%02x", hash[i]);
+    return n;
+}
+
+static inline int kvbfs_key_vcas_refs(char *buf, size_t buflen,
+                                      const uint8_t *hash)
+{
+    int n = kvbfs_key_vcas_blob(buf, buflen, hash);
+    if (n > 0) buf[1] = 'r';
+    return n;
+}
+
+/* Totals of one verifier pass */
+struct vcas_pass {
+    uint64_t blobs;         /* distinct blocks stored */
+    uint64_t stored;        /* their bytes */
+    uint64_t referenced;    /* bytes the references would take as copies */
+    uint64_t corrupt;       /* blobs whose content no longer hashes to the key */
+    uint64_t swept;         /* unreferenced blobs deleted */
+};
+
+/* SHA-256 of a block's content */
+void vcas_hash(const char *data, size_t len, uint8_t *hash);
+
+/*
+ * Bracket a batch that adds references: from vcas_ref to the commit.
+ * Several writers may hold it at once; only the verifier's sweep waits.
+ */
+void vcas_write_begin(void);
+void vcas_write_end(void);
+
+/* Queue one more reference to data (stored unless already present) */
+void vcas_ref(kv_batch_t *batch, const uint8_t *hash, const char *data, size_t len);
+
+/* Queue dropping one reference; the verifier deletes unreferenced blobs */
+void vcas_unref(kv_batch_t *batch, const uint8_t *hash);
+
+/* Copy of the blob (caller frees *data), or -1 if missing */
+int  vcas_get(const uint8_t *hash, char **data, size_t *len);
+
+/* Stored length of the blob, 0 if missing */
+size_t vcas_len(const uint8_t *hash);
+
+/*
+ * Verify up to VCAS_VERIFY_CHUNK blobs after cursor ("vh:<hash>" key),
+ * adding to pass.  *keys counts the keys deleted.  Returns 1 while blobs
+ * remain.
+ */
+int vcas_verify_step(char *cursor, size_t *cursor_len, struct vcas_pass *pass,
+                     size_t *keys);
+
+#endif /* VCAS_H */
@@ -0,0 +1,420 @@
+#define _GNU_SOURCE
+#include "vdiff.h"
+#include "kvbfs.h"
+#include "inode.h"
+#include "version.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct sbuf {
+    char *p;
+    size_t len, cap;
+    int err;
+};
+
+static void sb_add(struct sbuf *b, const char *s, size_t n)
+{
+    if (b->err) return;
+    if (b->len + n + 1 > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + n + 1) cap *= 2;
+        char *p = realloc(b->p, cap);
+        if (!p) { b->err = 1; return; }
+        b->p = p;
+        b->cap = cap;
+    }
+    memcpy(b->p + b->len, s, n);
+    b->len += n;
+    b->p[b->len] = '\0';
+}
+
+static void sb_printf(struct sbuf *b, const char *fmt, ...)
+{
+    char tmp[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+    if (n > 0) sb_add(b, tmp, (size_t)n < sizeof(tmp) ? (size_t)n : sizeof(tmp) - 1);
+}
+
+/* Block of version ver, or of the live file for VDIFF_LIVE */
+static int read_block(uint64_t ino, uint64_t ver, uint64_t block,
+                      char **data, size_t *len)
+{
+    if (ver != VDIFF_LIVE) return version_read_block(ino, ver, block, data, len);
+    char key[64];
+    int keylen = kvbfs_key_block(key, sizeof(key), ino, block);
+    return kv_get(g_ctx->db, key, keylen, data, len);
+}
+
+/* Bytes [off, end) of a version, clipped to its size; holes read as zeros */
+static char *read_range(uint64_t ino, uint64_t ver, uint64_t size,
+                        uint64_t off, uint64_t end, size_t *len)
+{
+    if (end > size) end = size;
+    *len = off < end ? end - off : 0;
+    char *buf = calloc(1, *len + 1);
+    if (!buf) return NULL;
+
+    for (uint64_t pos = off; pos < end;) {
+        uint64_t blk = pos / KVBFS_BLOCK_SIZE;
+        size_t boff = pos % KVBFS_BLOCK_SIZE;
+        size_t n = KVBFS_BLOCK_SIZE - boff;
+        if (n > end - pos) n = end - pos;
+
+        char *data = NULL;
+        size_t dlen = 0;
+        if (read_block(ino, ver, blk, &data, &dlen) == 0 && dlen > boff)
+            memcpy(buf + (pos - off), data + boff, dlen - boff < n ? dlen - boff : n);
+        free(data);
+        pos += n;
+    }
+    return buf;
+}
+
+/* Start of the line holding off, looking back at most one block */
+static uint64_t line_start(uint64_t ino, uint64_t ver, uint64_t size, uint64_t off)
+{
+    if (off == 0) return 0;
+    uint64_t lo = off > KVBFS_BLOCK_SIZE ? off - KVBFS_BLOCK_SIZE : 0;
+    size_t n;
+    char *buf = read_range(ino, ver, size, lo, off, &n);
+    if (!buf) return off;
+    char *nl = memrchr(buf, '\n', n);
+    uint64_t start = nl ? lo + (uint64_t)(nl - buf) + 1 : lo;
+    free(buf);
+    return start;
+}
+
+/* End of the line holding off - 1, looking ahead at most one block */
+static uint64_t line_end(uint64_t ino, uint64_t ver, uint64_t size, uint64_t off)
+{
+    if (off >= size) return off;
+    size_t n;
+    char *buf = read_range(ino, ver, size, off, off + KVBFS_BLOCK_SIZE, &n);
+    if (!buf) return off;
+    if (off > 0 && off - 1 < size) {
+        /* Already at a line boundary? */
+        size_t m;
+        char *prev = read_range(ino, ver, size, off - 1, off, &m);
+        bool at_start = prev && m == 1 && prev[0] == '\n';
+        free(prev);
+        if (at_start) {
+            free(buf);
+            return off;
+        }
+    }
+    char *nl = memchr(buf, '\n', n);
+    uint64_t end = nl ? off + (uint64_t)(nl - buf) + 1 : off + n;
+    free(buf);
+    return end;
+}
+
+/* Length of the first line of [p, p + n), newline included */
+static size_t line_len(const char *p, size_t n)
+{
+    const char *nl = memchr(p, '\n', n);
+    return nl ? (size_t)(nl - p) + 1 : n;
+}
+
+/* Length of the last line of [p, p + n), newline included */
+static size_t last_line_len(const char *p, size_t n)
+{
+    if (n == 0) return 0;
+    const char *nl = n > 1 ? memrchr(p, '\n', n - 1) : NULL;
+    return nl ? n - (size_t)(nl - p) - 1 : n;
+}
+
+struct lines {
+    const char *p;
+    size_t *off;        /* n + 1 entries: line starts, then the end */
+    size_t n;
+};
+
+static int lines_split(struct lines *l, const char *p, size_t len)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; i += line_len(p + i, len - i)) n++;
+    l->p = p;
+    l->n = n;
+    l->off = malloc((n + 1) * sizeof(size_t));
+    if (!l->off) return -1;
+    n = 0;
+    for (size_t i = 0; i < len; i += line_len(p + i, len - i)) l->off[n++] = i;
+    l->off[n] = len;
+    return 0;
+}
+
+static bool lines_eq(const struct lines *a, size_t i, const struct lines *b, size_t j)
+{
+    size_t la = a->off[i + 1] - a->off[i], lb = b->off[j + 1] - b->off[j];
+    return la == lb && memcmp(a->p + a->off[i], b->p + b->off[j], la) == 0;
+}
+
+/*
+ * Myers diff: mark the lines of a deleted and of b inserted by a shortest
+ * edit script.  Returns -1 past VDIFF_MAX_EDITS edits or out of memory.
+ */
+static int lines_diff(const struct lines *a, const struct lines *b,
+                      bool *del, bool *ins)
+{
+    long n = (long)a->n, m = (long)b->n;
+    long max = n + m < VDIFF_MAX_EDITS ? n + m : VDIFF_MAX_EDITS;
+    long *v = calloc(2 * max + 3, sizeof(long));
+    long **trace = calloc(max + 1, sizeof(long *));
+    if (!v || !trace) {
+        free(v);
+        free(trace);
+        return -1;
+    }
+    long *vk = v + max + 1;     /* vk[k], k in [-max - 1, max + 1] */
+
+    long d, found = -1;
+    for (d = 0; d <= max && found < 0; d++) {
+        for (long k = -d; k <= d; k += 2) {
+            long x = (k == -d || (k != d && vk[k - 1] < vk[k + 1]))
+                     ? vk[k + 1] : vk[k - 1] + 1;
+            long y = x - k;
+            while (x < n && y < m && lines_eq(a, x, b, y)) x++, y++;
+            vk[k] = x;
+            if (x >= n && y >= m) found = d;
+        }
+        trace[d] = malloc((2 * d + 1) * sizeof(long));
+        if (!trace[d]) break;
+        memcpy(trace[d], vk - d, (2 * d + 1) * sizeof(long));
+    }
+
+    int ret = found < 0 || !trace[found] ? -1 : 0;
+    if (ret == 0) {
+        long x = n, y = m;
+        for (d = found; d > 0; d--) {
+            const long *prev = trace[d - 1] + (d - 1);  /* prev[k] */
+            long k = x - y;
+            long pk = (k == -d || (k != d && prev[k - 1] < prev[k + 1]))
+                      ? k + 1 : k - 1;
+            long px = prev[pk], py = px - pk;
+            while (x > px && y > py) x--, y--;
+            if (pk == k + 1) ins[py] = true;
+            else del[px] = true;
+            x = px;
+            y = py;
+        }
+    }
+    for (d = 0; d <= max && trace[d]; d++) free(trace[d]);
+    free(trace);
+    free(v);
+    return ret;
+}
+
+static void emit_lines(struct sbuf *b, char sign, const char *p, size_t n)
+{
+    while (n > 0) {
+        size_t l = line_len(p, n);
+        sb_add(b, &sign, 1);
+        sb_add(b, p, l);
+        if (p[l - 1] != '\n') sb_add(b, "\n\\ No newline at end of file\n", 30);
+        p += l;
+        n -= l;
+    }
+}
+
+static void emit_hunk(struct sbuf *b, uint64_t old_off, const char *old, size_t old_len,
+                      uint64_t new_off, const char *new, size_t new_len)
+{
+    sb_printf(b, "@@ -%lu,%lu +%lu,%lu @@\n",
+              (unsigned long)old_off, (unsigned long)old_len,
+              (unsigned long)new_off, (unsigned long)new_len);
+    emit_lines(b, '-', old, old_len);
+    emit_lines(b, '+', new, new_len);
+}
+
+/* Diff one window that starts at byte off in both versions */
+static void diff_window(struct sbuf *b, uint64_t off,
+                        const char *old, size_t old_len,
+                        const char *new, size_t new_len)
+{
+    /* Drop the lines both sides share at either end */
+    size_t pre = 0;
+    while (pre < old_len && pre < new_len) {
+        size_t l = line_len(old + pre, old_len - pre);
+        if (l != line_len(new + pre, new_len - pre) ||
+            memcmp(old + pre, new + pre, l) != 0 || old[pre + l - 1] != '\n')
+            break;
+        pre += l;
+    }
+    size_t suf = 0;
+    while (pre + suf < old_len && pre + suf < new_len) {
+        size_t l = last_line_len(old + pre, old_len - pre - suf);
+        if (l != last_line_len(new + pre, new_len - pre - suf) ||
+            memcmp(old + old_len - suf - l, new + new_len - suf - l, l) != 0)
+            break;
+        suf += l;
+    }
+    old += pre;
+    new += pre;
+    old_len -= pre + suf;
+    new_len -= pre + suf;
+    off += pre;
+    if (old_len == 0 && new_len == 0) return;
+
+    if (old_len + new_len > VDIFF_MAX_HUNK ||
+        memchr(old, '\0', old_len) || memchr(new, '\0', new_len)) {
+        sb_printf(b, "@@ -%lu,%lu +%lu,%lu @@\n",
+                  (unsigned long)off, (unsigned long)old_len,
+                  (unsigned long)off, (unsigned long)new_len);
+        sb_printf(b, "Binary or large change: %lu bytes -> %lu bytes\n",
+                  (unsigned long)old_len, (unsigned long)new_len);
+        return;
+    }
+
+    struct lines a = { 0 }, c = { 0 };
+    bool *del = NULL, *ins = NULL;
+    if (lines_split(&a, old, old_len) == 0 && lines_split(&c, new, new_len) == 0 &&
+        (del = calloc(a.n + 1, sizeof(bool))) != NULL &&
+        (ins = calloc(c.n + 1, sizeof(bool))) != NULL &&
+        lines_diff(&a, &c, del, ins) == 0) {
+        /* Matched lines pair up in order; each gap between them is a hunk */
+        size_t i = 0, j = 0;
+        while (i < a.n || j < c.n) {
+            if (i < a.n && j < c.n && !del[i] && !ins[j]) {
+                i++, j++;
+                continue;
+            }
+            size_t i0 = i, j0 = j;
+            while (i < a.n && del[i]) i++;
+            while (j < c.n && ins[j]) j++;
+            emit_hunk(b, off + a.off[i0], old + a.off[i0], a.off[i] - a.off[i0],
+                      off + c.off[j0], new + c.off[j0], c.off[j] - c.off[j0]);
+        }
+    } else {
+        /* Too many edits to align: replace the whole window */
+        emit_hunk(b, off, old, old_len, off, new, new_len);
+    }
+    free(del);
+    free(ins);
+    free(a.off);
+    free(c.off);
+}
+
+/* Render the changed blocks of from (from_size bytes) against to; frees blocks */
+static int vdiff_emit(uint64_t ino, uint64_t from, uint64_t from_size,
+                      uint64_t to, uint64_t to_size, uint64_t *blocks, size_t n,
+                      const char *from_label, const char *to_label,
+                      char **out, size_t *len)
+{
+    /* A size change inside a block may leave its fingerprint alone */
+    uint64_t min_size = from_size < to_size ? from_size : to_size;
+    uint64_t tail = min_size / KVBFS_BLOCK_SIZE;
+    if (from_size != to_size && min_size % KVBFS_BLOCK_SIZE != 0) {
+        size_t at = 0;
+        while (at < n && blocks[at] < tail) at++;
+        if (at == n || blocks[at] != tail) {
+            uint64_t *grown = realloc(blocks, (n + 1) * sizeof(uint64_t));
+            if (!grown) {
+                free(blocks);
+                return -1;
+            }
+            blocks = grown;
+            memmove(blocks + at + 1, blocks + at, (n - at) * sizeof(uint64_t));
+            blocks[at] = tail;
+            n++;
+        }
+    }
+
+    struct sbuf b = { 0 };
+    sb_add(&b, "", 0);
+    if (n > 0 || from_size != to_size)
+        sb_printf(&b, "--- %s\n+++ %s\n", from_label, to_label);
+
+    uint64_t max_size = from_size > to_size ? from_size : to_size;
+    size_t i = 0;
+    uint64_t ws = 0, we = 0;
+    bool open = false;
+    while (i <= n) {
+        /* Next run of consecutive changed blocks, widened to whole lines */
+        uint64_t rs = 0, re = 0;
+        if (i < n) {
+            uint64_t first = blocks[i], last = blocks[i];
+            while (i + 1 < n && blocks[i + 1] == last + 1) last = blocks[++i];
+            i++;
+            rs = first * KVBFS_BLOCK_SIZE;
+            re = (last + 1) * KVBFS_BLOCK_SIZE;
+            if (re > max_size) re = max_size;
+            if (rs >= re) continue;
+            rs = line_start(ino, to, to_size, rs);
+            re = line_end(ino, to, to_size, re);
+            if (open && rs <= we) {
+                if (re > we) we = re;
+                continue;
+            }
+        } else {
+            i++;
+        }
+
+        if (open) {
+            size_t ol, nl;
+            char *old = read_range(ino, from, from_size, ws, we, &ol);
+            char *new = read_range(ino, to, to_size, ws, we, &nl);
+            if (old && new) diff_window(&b, ws, old, ol, new, nl);
+            else b.err = 1;
+            free(old);
+            free(new);
+        }
+        ws = rs;
+        we = re;
+        open = i <= n;
+    }
+    free(blocks);
+
+    if (b.err) {
+        free(b.p);
+        return -1;
+    }
+    *out = b.p;
+    *len = b.len;
+    return 0;
+}
+
+int vdiff_render(uint64_t ino, uint64_t from, uint64_t to,
+                 const char *from_label, const char *to_label,
+                 char **out, size_t *len)
+{
+    *out = NULL;
+    *len = 0;
+
+    struct kvbfs_version_meta fm, tm;
+    if (version_get_meta(ino, from, &fm) != 0) return -1;
+
+    /* Live content stays put for the whole render */
+    struct kvbfs_inode_cache *ic = NULL;
+    uint64_t to_size, *blocks;
+    size_t n;
+    if (to == VDIFF_LIVE) {
+        ic = inode_get(ino);
+        if (!ic) return -1;
+        pthread_rwlock_rdlock(&ic->lock);
+        to_size = ic->inode.size;
+        if (ic->deleted || version_diff_live(ic, from, &blocks, &n) != 0) {
+            pthread_rwlock_unlock(&ic->lock);
+            inode_put(ic);
+            return -1;
+        }
+    } else {
+        if (version_get_meta(ino, to, &tm) != 0 ||
+            version_diff_blocks(ino, from, to, &blocks, &n) != 0)
+            return -1;
+        to_size = tm.size;
+    }
+
+    int ret = vdiff_emit(ino, from, fm.size, to, to_size, blocks, n,
+                         from_label, to_label, out, len);
+    if (ic) {
+        pthread_rwlock_unlock(&ic->lock);
+        inode_put(ic);
+    }
+    return ret;
+}
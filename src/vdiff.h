@@ -0,0 +1,41 @@
+#ifndef VDIFF_H
+#define VDIFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Text diff between two versions of a file, served as
+ * .versions/<file>/<a>..<b> (b may be "live").
+ *
+ * version_diff_blocks finds the blocks that differ from fingerprints alone;
+ * only those blocks, plus one neighbouring block on each side to complete
+ * the first and last line, are read.  Each run of changed blocks is then
+ * diffed line by line and every group of changed lines becomes a hunk:
+ *
+ *   --- 3
+ *   +++ 5
+ *   @@ -8192,13 +8192,17 @@
+ *   -old line
+ *   +new line
+ *
+ * Hunk headers give byte offsets and lengths in each version, since line
+ * numbers would need the unchanged data too.  Runs with NUL bytes or longer
+ * than VDIFF_MAX_HUNK list only the range; runs needing more than
+ * VDIFF_MAX_EDITS line edits become one hunk.
+ *
+ * A diff against "live" reads the current blocks under the inode read lock
+ * and records no version.
+ */
+
+#define VDIFF_MAX_HUNK   (64 * 1024)
+#define VDIFF_MAX_EDITS  1024
+
+#define VDIFF_LIVE       UINT64_MAX     /* to: the live file */
+
+/* from/to are internal (0-based) versions; labels go in the header */
+int vdiff_render(uint64_t ino, uint64_t from, uint64_t to,
+                 const char *from_label, const char *to_label,
+                 char **out, size_t *len);
+
+#endif /* VDIFF_H */
@@ -1,162 +1,1411 @@
 #include "version.h"
 #include "kv_store.h"
 #include "inode.h"
+#include "vcas.h"
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-/* Read the version counter for an inode; returns 0 if not set */
-uint64_t version_get_current(uint64_t ino)
+/* Parse the decimal that ends a key after prefix_len bytes */
+static int key_number(const char *key, size_t klen, size_t prefix_len,
+                      uint64_t *out)
 {
-    char key[64];
-    int keylen = kvbfs_key_version_counter(key, sizeof(key), ino);
+    char num[24];
+    size_t n = klen - prefix_len;
+    if (klen <= prefix_len || n >= sizeof(num)) return -1;
+    memcpy(num, key + prefix_len, n);
+    num[n] = '\0';
+
+    char *end;
+    *out = strtoull(num, &end, 10);
+    return *end == '\0' ? 0 : -1;
+}
+
+/* ── Version index ────────────────────────────────────── */
+
+/*
+ * Snapshots (under the inode write lock) and deletions (GC worker) both
+ * rewrite the index; a striped lock keeps their read-modify-write apart.
+ */
+#define VERSION_INDEX_LOCKS 64
+
+static pthread_mutex_t index_locks[VERSION_INDEX_LOCKS];
+static pthread_once_t index_locks_once = PTHREAD_ONCE_INIT;
+
+static void index_locks_init(void)
+{
+    for (int i = 0; i < VERSION_INDEX_LOCKS; i++)
+        pthread_mutex_init(&index_locks[i], NULL);
+}
+
+static pthread_mutex_t *index_lock(uint64_t ino)
+{
+    pthread_once(&index_locks_once, index_locks_init);
+    return &index_locks[ino % VERSION_INDEX_LOCKS];
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+    uint64_t x = ((const struct version_entry *)a)->ver;
+    uint64_t y = ((const struct version_entry *)b)->ver;
+    return x < y ? -1 : x > y;
+}
+
+/* Decode a legacy vm: value; short records predate shared blocks or times */
+static int meta_decode(const char *val, size_t vlen, struct kvbfs_version_meta *meta)
+{
+    if (vlen != sizeof(struct kvbfs_version_meta) &&
+        vlen != VERSION_META_DELTA_SIZE &&
+        vlen != VERSION_META_COPY_SIZE)
+        return -1;
+    memset(meta, 0, sizeof(*meta));
+    memcpy(meta, val, vlen);
+    return 0;
+}
+
+static int index_alloc(struct version_index *vi, size_t n)
+{
+    vi->raw = malloc(sizeof(struct version_index_head) +
+                     n * sizeof(struct version_entry));
+    if (!vi->raw) return -1;
+    vi->e = (struct version_entry *)(vi->raw + sizeof(struct version_index_head));
+    return 0;
+}
+
+/* Build the index of a pre-index database from its vm: keys */
+static int index_load_legacy(uint64_t ino, uint64_t next, struct version_index *vi)
+{
+    vi->next = next;
+    vi->legacy = true;
+    if (index_alloc(vi, 0) != 0) return -1;
+    if (next == 0) return 0;
+
+    char prefix[64];
+    int prefix_len = kvbfs_key_version_meta_prefix(prefix, sizeof(prefix), ino);
+    kv_iterator_t *iter = kv_iter_prefix(g_ctx->db, prefix, prefix_len);
+    if (!iter) return -1;
+
+    size_t cap = 0;
+    int ret = 0;
+    while (kv_iter_valid(iter)) {
+        size_t klen, vlen;
+        const char *k = kv_iter_key(iter, &klen);
+        const char *v = kv_iter_value(iter, &vlen);
+        struct version_entry ent;
+        if (key_number(k, klen, prefix_len, &ent.ver) == 0 &&
+            meta_decode(v, vlen, &ent.meta) == 0) {
+            if (vi->n == cap) {
+                cap = cap ? cap * 2 : 16;
+                struct version_index grown = { 0 };
+                if (index_alloc(&grown, cap) != 0) { ret = -1; break; }
+                memcpy(grown.e, vi->e, vi->n * sizeof(struct version_entry));
+                free(vi->raw);
+                vi->raw = grown.raw;
+                vi->e = grown.e;
+            }
+            vi->e[vi->n++] = ent;
+        }
+        kv_iter_next(iter);
+    }
+    kv_iter_free(iter);
+
+    /* Keys sort as strings: "10" comes before "9" */
+    qsort(vi->e, vi->n, sizeof(struct version_entry), cmp_entry);
+    return ret;
+}
+
+int version_index_load(uint64_t ino, struct version_index *vi)
+{
+    memset(vi, 0, sizeof(*vi));
 
+    char key[64];
+    int keylen = kvbfs_key_version_index(key, sizeof(key), ino);
     char *val = NULL;
     size_t vlen = 0;
-    if (kv_get(g_ctx->db, key, keylen, &val, &vlen) != 0 ||
-        vlen != sizeof(uint64_t)) {
-        free(val);
-        return 0;
-    }
+    if (kv_get(g_ctx->db, key, keylen, &val, &vlen) != 0)
+        return index_alloc(vi, 0);
 
-    uint64_t ver;
-    memcpy(&ver, val, sizeof(uint64_t));
+    int ret = -1;
+    struct version_index_head head;
+    if (vlen == sizeof(uint64_t)) {
+        uint64_t next;
+        memcpy(&next, val, sizeof(next));
+        ret = index_load_legacy(ino, next, vi);
+    } else if (vlen >= sizeof(head)) {
+        memcpy(&head, val, sizeof(head));
+        if (head.magic == VERSION_INDEX_MAGIC &&
+            vlen == sizeof(head) + head.count * sizeof(struct version_entry)) {
+            vi->raw = val;
+            vi->e = (struct version_entry *)(val + sizeof(head));
+            vi->n = head.count;
+            vi->next = head.next;
+            return 0;
+        }
+    }
     free(val);
-    return ver;
+    if (ret != 0) {
+        version_index_free(vi);
+        fprintf(stderr, "version: bad index for inode %lu\n", (unsigned long)ino);
+    }
+    return ret;
+}
+
+void version_index_free(struct version_index *vi)
+{
+    free(vi->raw);
+    memset(vi, 0, sizeof(*vi));
+}
+
+/* Entry of ver in the index, or NULL */
+static struct version_entry *index_find(const struct version_index *vi, uint64_t ver)
+{
+    struct version_entry probe = { .ver = ver };
+    return bsearch(&probe, vi->e, vi->n, sizeof(struct version_entry), cmp_entry);
 }
 
-/* Write the version counter */
-static int version_set_counter(uint64_t ino, uint64_t ver)
+/* Queue the index into batch; a legacy index also drops the vm: keys */
+static void index_save(kv_batch_t *batch, uint64_t ino, struct version_index *vi)
 {
+    struct version_index_head head = {
+        .magic = VERSION_INDEX_MAGIC,
+        .count = (uint32_t)vi->n,
+        .next = vi->next,
+    };
+    memcpy(vi->raw, &head, sizeof(head));
+
     char key[64];
-    int keylen = kvbfs_key_version_counter(key, sizeof(key), ino);
-    return kv_put(g_ctx->db, key, keylen, (const char *)&ver, sizeof(uint64_t));
+    int keylen = kvbfs_key_version_index(key, sizeof(key), ino);
+    kv_batch_put(batch, key, keylen, vi->raw,
+                 sizeof(head) + vi->n * sizeof(struct version_entry));
+    if (vi->legacy) {
+        keylen = kvbfs_key_version_meta_prefix(key, sizeof(key), ino);
+        kv_batch_delete_prefix(batch, key, keylen);
+    }
 }
 
-int version_get_meta(uint64_t ino, uint64_t ver, struct kvbfs_version_meta *meta)
+/* Read the version counter for an inode; returns 0 if not set */
+uint64_t version_get_current(uint64_t ino)
 {
     char key[64];
-    int keylen = kvbfs_key_version_meta(key, sizeof(key), ino, ver);
+    int keylen = kvbfs_key_version_index(key, sizeof(key), ino);
 
-    char *val = NULL;
+    /* The counter leads both the legacy value and the index head */
+    char buf[sizeof(struct version_index_head)];
     size_t vlen = 0;
-    if (kv_get(g_ctx->db, key, keylen, &val, &vlen) != 0 ||
-        vlen != sizeof(struct kvbfs_version_meta)) {
-        free(val);
-        return -1;
+    if (kv_get_into(g_ctx->db, key, keylen, buf, sizeof(buf), &vlen) != 0)
+        return 0;
+
+    uint64_t ver;
+    if (vlen == sizeof(uint64_t)) {
+        memcpy(&ver, buf, sizeof(ver));
+        return ver;
     }
+    struct version_index_head head;
+    if (vlen < sizeof(head)) return 0;
+    memcpy(&head, buf, sizeof(head));
+    return head.magic == VERSION_INDEX_MAGIC ? head.next : 0;
+}
 
-    memcpy(meta, val, sizeof(*meta));
-    free(val);
+int version_get_meta(uint64_t ino, uint64_t ver, struct kvbfs_version_meta *meta)
+{
+    struct version_index vi;
+    if (version_index_load(ino, &vi) != 0) return -1;
+    struct version_entry *e = index_find(&vi, ver);
+    if (e) *meta = e->meta;
+    version_index_free(&vi);
+    return e ? 0 : -1;
+}
+
+/*
+ * Position iter, which covers at least "vx:<ino>:<block>:", at the record
+ * that holds block of version ver.  On success *rec_ver is its version,
+ * *ref whether it is a reference and *v, *vlen its value, valid until iter
+ * moves.
+ */
+static int rec_seek(kv_iterator_t *iter, uint64_t ino, uint64_t ver,
+                    uint64_t block, uint64_t *rec_ver, bool *ref,
+                    const char **v, size_t *vlen)
+{
+    char key[96];
+    int keylen = kvbfs_key_version_rec(key, sizeof(key), ino, block, ver);
+    size_t prefix_len = (size_t)keylen - 16;
+
+    /* A reference key sorts right after the inline key of its version */
+    kv_iter_seek(iter, key, keylen);
+    if (!kv_iter_valid(iter)) return -1;
+    size_t klen;
+    const char *k = kv_iter_key(iter, &klen);
+    if (memcmp(k, key, prefix_len) != 0) return -1;
+    if (klen == (size_t)keylen) *ref = false;
+    else if (klen == (size_t)keylen + 1 && k[keylen] == '#') *ref = true;
+    else return -1;
+
+    *v = kv_iter_value(iter, vlen);
+    if (*ref && *vlen != VCAS_HASH_SIZE) return -1;
+    char hex[17];
+    memcpy(hex, k + prefix_len, 16);
+    hex[16] = '\0';
+    *rec_ver = UINT64_MAX - strtoull(hex, NULL, 16);
+    return 0;
+}
+
+/*
+ * Like version_find, but *data is the record as stored: the block's hash
+ * when *ref is set.
+ */
+static int rec_find(uint64_t ino, uint64_t ver, uint64_t block,
+                    uint64_t *rec_ver, bool *ref, char **data, size_t *len)
+{
+    char prefix[64];
+    int prefix_len = kvbfs_key_version_rec_prefix(prefix, sizeof(prefix), ino, block);
+
+    kv_iterator_t *iter = kv_iter_prefix(g_ctx->db, prefix, prefix_len);
+    if (!iter) return -1;
+
+    const char *v;
+    size_t vlen;
+    int ret = rec_seek(iter, ino, ver, block, rec_ver, ref, &v, &vlen);
+    if (ret == 0 && data) {
+        *data = NULL;
+        *len = vlen;
+        if (vlen > 0) {
+            *data = malloc(vlen);
+            if (*data) memcpy(*data, v, vlen);
+            else ret = -1;
+        }
+    }
+    kv_iter_free(iter);
+    return ret;
+}
+
+/*
+ * Find the record that holds block of version ver: the newest one at or
+ * below ver.  On success *rec_ver is its version and *data and *len a copy of
+ * the block (NULL/0 for a hole record) unless data is NULL.  Returns -1 if
+ * no version up to ver recorded the block.
+ */
+static int version_find(uint64_t ino, uint64_t ver, uint64_t block,
+                        uint64_t *rec_ver, char **data, size_t *len)
+{
+    bool ref;
+    if (rec_find(ino, ver, block, rec_ver, &ref, data, len) != 0) return -1;
+    if (!data || !ref) return 0;
+
+    uint8_t hash[VCAS_HASH_SIZE];
+    memcpy(hash, *data, sizeof(hash));
+    free(*data);
+    *data = NULL;
+    if (vcas_get(hash, data, len) != 0) return -1;
+    return 0;
+}
+
+/* version_read_block for a caller that already has the version's meta */
+static int read_block_meta(uint64_t ino, uint64_t ver,
+                           const struct kvbfs_version_meta *meta,
+                           uint64_t block, char **data, size_t *len)
+{
+    if (meta->format == VERSION_FORMAT_COPY) {
+        char key[96];
+        int keylen = kvbfs_key_version_block(key, sizeof(key), ino, ver, block);
+        return kv_get(g_ctx->db, key, keylen, data, len);
+    }
+
+    uint64_t rec_ver;
+    if (version_find(ino, ver, block, &rec_ver, data, len) != 0) return -1;
+    if (*len == 0) return -1;       /* hole */
     return 0;
 }
 
 int version_read_block(uint64_t ino, uint64_t ver, uint64_t block,
                        char **data, size_t *len)
 {
-    char key[96];
-    int keylen = kvbfs_key_version_block(key, sizeof(key), ino, ver, block);
-    return kv_get(g_ctx->db, key, keylen, data, len);
+    struct kvbfs_version_meta meta;
+    if (version_get_meta(ino, ver, &meta) != 0) return -1;
+    return read_block_meta(ino, ver, &meta, block, data, len);
 }
 
-/* Delete all blocks for a specific version */
-static void version_delete_one(uint64_t ino, uint64_t ver)
+/* Copy block blk's data into the part of [off, off + size) it covers */
+static void fill_block(char *buf, uint64_t off, size_t size, uint64_t blk,
+                       const char *data, size_t dlen)
 {
-    /* Delete metadata */
-    char key[64];
-    int keylen = kvbfs_key_version_meta(key, sizeof(key), ino, ver);
-    kv_delete(g_ctx->db, key, keylen);
+    uint64_t bstart = blk * KVBFS_BLOCK_SIZE;
+    uint64_t from = bstart > off ? bstart : off;
+    uint64_t to = bstart + KVBFS_BLOCK_SIZE;
+    if (to > off + size) to = off + size;
+
+    size_t skip = from - bstart;
+    size_t have = dlen > skip ? dlen - skip : 0;
+    if (have > to - from) have = to - from;
+    if (have) memcpy(buf + (from - off), data + skip, have);
+    memset(buf + (from - off) + have, 0, (to - from) - have);
+}
+
+#define VERSION_READ_BATCH  64
+
+int version_read_range(uint64_t ino, uint64_t ver,
+                       const struct kvbfs_version_meta *meta,
+                       char *buf, size_t size, uint64_t off)
+{
+    if (size == 0) return 0;
+    uint64_t first = off / KVBFS_BLOCK_SIZE;
+    uint64_t last = (off + size - 1) / KVBFS_BLOCK_SIZE;
+
+    if (meta->format == VERSION_FORMAT_COPY) {
+        char kbuf[VERSION_READ_BATCH][96];
+        const char *keys[VERSION_READ_BATCH];
+        size_t klens[VERSION_READ_BATCH];
+        char *vals[VERSION_READ_BATCH];
+        size_t vlens[VERSION_READ_BATCH];
 
-    /* Delete all blocks for this version */
+        for (uint64_t b = first; b <= last; b += VERSION_READ_BATCH) {
+            size_t n = last - b + 1;
+            if (n > VERSION_READ_BATCH) n = VERSION_READ_BATCH;
+            for (size_t i = 0; i < n; i++) {
+                klens[i] = kvbfs_key_version_block(kbuf[i], sizeof(kbuf[i]),
+                                                   ino, ver, b + i);
+                keys[i] = kbuf[i];
+            }
+            if (kv_multi_get(g_ctx->db, n, keys, klens, vals, vlens) != 0)
+                return -1;
+            for (size_t i = 0; i < n; i++) {
+                fill_block(buf, off, size, b + i, vals[i], vals[i] ? vlens[i] : 0);
+                free(vals[i]);
+            }
+        }
+        return 0;
+    }
+
+    /*
+     * One iterator over the file's records, one seek per block; blocks
+     * stored by reference are fetched from the store a batch at a time.
+     */
+    char prefix[64];
+    int prefix_len = snprintf(prefix, sizeof(prefix), "vx:%lu:", (unsigned long)ino);
+    kv_iterator_t *iter = kv_iter_prefix(g_ctx->db, prefix, prefix_len);
+    if (!iter) return -1;
+
+    char kbuf[VERSION_READ_BATCH][80];
+    const char *keys[VERSION_READ_BATCH];
+    size_t klens[VERSION_READ_BATCH];
+    uint64_t blks[VERSION_READ_BATCH];
+    char *vals[VERSION_READ_BATCH];
+    size_t vlens[VERSION_READ_BATCH];
+    size_t n = 0;
+    int ret = 0;
+    for (uint64_t b = first; b <= last && ret == 0; b++) {
+        uint64_t rec_ver;
+        bool ref = false;
+        const char *v = NULL;
+        size_t vlen = 0;
+        if (rec_seek(iter, ino, ver, b, &rec_ver, &ref, &v, &vlen) != 0) {
+            ref = false;
+            vlen = 0;
+        }
+        if (!ref) {
+            fill_block(buf, off, size, b, v, vlen);
+        } else {
+            klens[n] = kvbfs_key_vcas_blob(kbuf[n], sizeof(kbuf[n]),
+                                           (const uint8_t *)v);
+            keys[n] = kbuf[n];
+            blks[n++] = b;
+        }
+        if (n == VERSION_READ_BATCH || (n > 0 && b == last)) {
+            if (kv_multi_get(g_ctx->db, n, keys, klens, vals, vlens) != 0) {
+                ret = -1;
+                break;
+            }
+            for (size_t i = 0; i < n; i++) {
+                if (!vals[i]) ret = -1;     /* a reference without its blob */
+                else fill_block(buf, off, size, blks[i], vals[i], vlens[i]);
+                free(vals[i]);
+            }
+            n = 0;
+        }
+    }
+    kv_iter_free(iter);
+    return ret;
+}
+
+/* ── Fingerprints ─────────────────────────────────────── */
+
+static uint32_t crc32c_table[256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c >> 1) ^ (0x82F63B78U & -(c & 1));
+        crc32c_table[i] = c;
+    }
+}
+
+static uint32_t crc32c(uint32_t crc, const char *buf, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    crc = ~crc;
+    while (len--)
+        crc = (crc >> 8) ^ crc32c_table[(crc ^ *p++) & 0xFF];
+    return ~crc;
+}
+
+uint32_t version_fingerprint(const char *data, size_t len)
+{
+    static const char zeros[KVBFS_BLOCK_SIZE];
+    pthread_once(&crc32c_once, crc32c_init);
+    if (len > KVBFS_BLOCK_SIZE) len = KVBFS_BLOCK_SIZE;
+    uint32_t crc = crc32c(0, data, len);
+    return crc32c(crc, zeros, KVBFS_BLOCK_SIZE - len);
+}
+
+/* ── Change tracking ──────────────────────────────────── */
+
+void version_mark_dirty(kv_batch_t *batch, struct kvbfs_inode_cache *ic,
+                        uint64_t first, uint64_t end)
+{
+    struct version_dirty *vd = ic->vdirty;
+
+    if (!vd) {
+        char key[64];
+        int keylen = kvbfs_key_version_pending(key, sizeof(key), ic->inode.ino);
+
+        /* A marker without a bitmap means earlier changes were not tracked */
+        char probe;
+        size_t plen;
+        bool lost = kv_get_into(g_ctx->db, key, keylen, &probe, 0, &plen) == 0;
+        if (!lost) {
+            if (batch) kv_batch_put(batch, key, keylen, "", 0);
+            else kv_put(g_ctx->db, key, keylen, "", 0);
+        }
+
+        uint64_t nwords = (end + 63) / 64;
+        if (nwords < 4) nwords = 4;
+        if (nwords > VERSION_DIRTY_MAX_WORDS) nwords = VERSION_DIRTY_MAX_WORDS;
+        vd = calloc(1, sizeof(*vd) + nwords * sizeof(uint64_t));
+        if (!vd) return;    /* the marker forces a full compare */
+        vd->nwords = nwords;
+        vd->lost = lost;
+        ic->vdirty = vd;
+    }
+    if (vd->lost || first >= end) return;
+
+    uint64_t need = (end + 63) / 64;
+    if (need > VERSION_DIRTY_MAX_WORDS) {
+        /* Too large to track block by block; the snapshot compares all */
+        vd->lost = true;
+        return;
+    }
+    if (need > vd->nwords) {
+        uint64_t nwords = vd->nwords * 2;
+        if (nwords < need) nwords = need;
+        if (nwords > VERSION_DIRTY_MAX_WORDS) nwords = VERSION_DIRTY_MAX_WORDS;
+        struct version_dirty *grown =
+            realloc(vd, sizeof(*vd) + nwords * sizeof(uint64_t));
+        if (!grown) {
+            vd->lost = true;
+            return;
+        }
+        memset(grown->words + grown->nwords, 0,
+               (nwords - grown->nwords) * sizeof(uint64_t));
+        grown->nwords = nwords;
+        ic->vdirty = vd = grown;
+    }
+
+    for (uint64_t b = first; b < end; b++)
+        vd->words[b / 64] |= 1ULL << (b % 64);
+}
+
+static bool dirty_test(const struct version_dirty *vd, uint64_t block)
+{
+    return block / 64 < vd->nwords &&
+           (vd->words[block / 64] & (1ULL << (block % 64)));
+}
+
+/* ── Version deletion ─────────────────────────────────── */
+
+/* Delete the vb: blocks of a full-copy version; returns their bytes */
+static uint64_t version_delete_copy(uint64_t ino, uint64_t ver, size_t *keys)
+{
     char prefix[64];
     int prefix_len = kvbfs_key_version_block_prefix(prefix, sizeof(prefix), ino, ver);
+    uint64_t bytes = 0;
 
     kv_iterator_t *iter = kv_iter_prefix(g_ctx->db, prefix, prefix_len);
     while (kv_iter_valid(iter)) {
-        size_t klen;
+        size_t klen, vlen;
         const char *k = kv_iter_key(iter, &klen);
+        kv_iter_value(iter, &vlen);
         kv_delete(g_ctx->db, k, klen);
+        bytes += vlen;
+        (*keys)++;
         kv_iter_next(iter);
     }
     kv_iter_free(iter);
+    return bytes;
 }
 
-int version_snapshot(uint64_t ino)
+/* Queue a delta version's records into batch, handing shared ones to next */
+static uint64_t version_delete_delta(kv_batch_t *batch, uint64_t ino, uint64_t ver,
+                                     struct version_entry *next, size_t *keys)
+{
+    char prefix[64];
+    int prefix_len = kvbfs_key_version_block_prefix(prefix, sizeof(prefix), ino, ver);
+    uint64_t moved = 0;
+    uint64_t bytes = 0;
+
+    kv_iterator_t *iter = kv_iter_prefix(g_ctx->db, prefix, prefix_len);
+    while (kv_iter_valid(iter)) {
+        size_t klen, fplen;
+        const char *k = kv_iter_key(iter, &klen);
+        const char *fp = kv_iter_value(iter, &fplen);
+        uint64_t block;
+        if (key_number(k, klen, prefix_len, &block) != 0) {
+            kv_iter_next(iter);
+            continue;
+        }
+
+        char rec[96], ref_key[96];
+        int reclen = kvbfs_key_version_rec(rec, sizeof(rec), ino, block, ver);
+        int ref_keylen = kvbfs_key_version_ref(ref_key, sizeof(ref_key), ino,
+                                               block, ver);
+
+        /* The record moves as stored: a reference keeps its count */
+        uint64_t rec_ver;
+        bool ref = false;
+        char *data = NULL;
+        size_t dlen = 0;
+        if (next && block < next->meta.blocks &&
+            rec_find(ino, next->ver, block, &rec_ver, &ref, &data, &dlen) == 0 &&
+            rec_ver == ver) {
+            char nkey[96];
+            int nkeylen = ref ?
+                kvbfs_key_version_ref(nkey, sizeof(nkey), ino, block, next->ver) :
+                kvbfs_key_version_rec(nkey, sizeof(nkey), ino, block, next->ver);
+            kv_batch_put(batch, nkey, nkeylen, data ? data : "", dlen);
+            nkeylen = kvbfs_key_version_block(nkey, sizeof(nkey), ino, next->ver, block);
+            kv_batch_put(batch, nkey, nkeylen, fp, fplen);
+            moved++;
+            *keys += 2;
+        } else {
+            uint8_t hash[VCAS_HASH_SIZE];
+            size_t rlen;
+            if (kv_get_into(g_ctx->db, ref_key, ref_keylen, (char *)hash,
+                            sizeof(hash), &rlen) == 0 && rlen == sizeof(hash)) {
+                bytes += vcas_len(hash);
+                vcas_unref(batch, hash);
+            } else if (kv_get_into(g_ctx->db, rec, reclen, (char *)hash, 0,
+                                   &rlen) == 0) {
+                bytes += rlen;
+            }
+        }
+        free(data);
+
+        kv_batch_delete(batch, rec, reclen);
+        kv_batch_delete(batch, ref_key, ref_keylen);
+        kv_batch_delete(batch, k, klen);
+        *keys += 3;
+        kv_iter_next(iter);
+    }
+    kv_iter_free(iter);
+
+    if (next) next->meta.changed += moved;
+    return bytes;
+}
+
+uint64_t version_delete(uint64_t ino, uint64_t ver, size_t *keys)
+{
+    size_t nkeys = 0;
+    if (!keys) keys = &nkeys;
+    *keys = 0;
+
+    pthread_mutex_t *lock = index_lock(ino);
+    pthread_mutex_lock(lock);
+
+    struct version_index vi;
+    if (version_index_load(ino, &vi) != 0) {
+        pthread_mutex_unlock(lock);
+        return 0;
+    }
+    kv_batch_t *batch = kv_batch_new();
+    if (!batch) {
+        version_index_free(&vi);
+        pthread_mutex_unlock(lock);
+        return 0;
+    }
+
+    /* The next surviving version inherits what it shares with this one */
+    struct version_entry *e = index_find(&vi, ver);
+    uint64_t bytes;
+    if (!e || e->meta.format == VERSION_FORMAT_COPY) {
+        bytes = version_delete_copy(ino, ver, keys);
+    } else {
+        struct version_entry *next = e + 1 < vi.e + vi.n ? e + 1 : NULL;
+        bytes = version_delete_delta(batch, ino, ver, next, keys);
+    }
+    if (e) {
+        memmove(e, e + 1, (vi.n - (size_t)(e - vi.e) - 1) * sizeof(*e));
+        vi.n--;
+        index_save(batch, ino, &vi);
+        *keys += 1;
+    }
+
+    int ret = kv_batch_commit(g_ctx->db, batch);
+    kv_batch_free(batch);
+    version_index_free(&vi);
+    pthread_mutex_unlock(lock);
+    return ret == 0 ? bytes : 0;
+}
+
+/* ── Snapshot ─────────────────────────────────────────── */
+
+/*
+ * Queue a record of block for version ver unless the previous version
+ * already reads the same content.  Blocks past the previous version's end
+ * are always recorded, so a record is only ever shared by versions that
+ * all cover its block.  Returns 1 if a record was queued.
+ */
+static int snapshot_block(kv_batch_t *batch, uint64_t ino, uint64_t ver,
+                          uint64_t block, uint64_t prev_blocks)
 {
-    /* Get current file metadata */
+    char key[64];
+    int keylen = kvbfs_key_block(key, sizeof(key), ino, block);
+    char cur[KVBFS_BLOCK_SIZE];
+    size_t cur_len = 0;
+    if (kv_get_into(g_ctx->db, key, keylen, cur, sizeof(cur), &cur_len) != 0)
+        cur_len = 0;                /* hole */
+    if (cur_len > sizeof(cur)) cur_len = sizeof(cur);
+
+    uint8_t hash[VCAS_HASH_SIZE];
+    if (cur_len > 0) vcas_hash(cur, cur_len, hash);
+
+    /* A reference compares by hash, an inline record by content */
+    uint64_t rec_ver;
+    bool ref = false;
+    char *old = NULL;
+    size_t old_len = 0;
+    bool found = ver > 0 &&
+        rec_find(ino, ver - 1, block, &rec_ver, &ref, &old, &old_len) == 0;
+    bool same;
+    if (block < prev_blocks && found && ref)
+        same = cur_len > 0 && memcmp(old, hash, sizeof(hash)) == 0;
+    else if (block < prev_blocks)
+        same = found ? (old_len == cur_len &&
+                        (cur_len == 0 || memcmp(old, cur, cur_len) == 0))
+                     : cur_len == 0;
+    else
+        same = !found && cur_len == 0;
+    free(old);
+    if (same) return 0;
+
+    char rec[96];
+    int reclen;
+    if (cur_len > 0) {
+        vcas_ref(batch, hash, cur, cur_len);
+        reclen = kvbfs_key_version_ref(rec, sizeof(rec), ino, block, ver);
+        kv_batch_put(batch, rec, reclen, (const char *)hash, sizeof(hash));
+    } else {
+        reclen = kvbfs_key_version_rec(rec, sizeof(rec), ino, block, ver);
+        kv_batch_put(batch, rec, reclen, cur, 0);
+    }
+    uint32_t fp = version_fingerprint(cur, cur_len);
+    reclen = kvbfs_key_version_block(rec, sizeof(rec), ino, ver, block);
+    kv_batch_put(batch, rec, reclen, (const char *)&fp, sizeof(fp));
+    return 1;
+}
+
+int version_capture(uint64_t ino, uint64_t *captured)
+{
+    if (captured) *captured = UINT64_MAX;
+
     struct kvbfs_inode_cache *ic = inode_get(ino);
     if (!ic) return -1;
 
-    pthread_rwlock_rdlock(&ic->lock);
+    /*
+     * Hold the inode write lock for the capture: the blocks read match the
+     * size and the dirty set taken here, and a concurrent write starts a
+     * fresh dirty set for the next snapshot.
+     */
+    pthread_rwlock_wrlock(&ic->lock);
     uint64_t file_size = ic->inode.size;
     uint64_t file_blocks = ic->inode.blocks;
     struct timespec file_mtime = ic->inode.mtime;
-    pthread_rwlock_unlock(&ic->lock);
 
-    inode_put(ic);
+    /* Skip empty and unlinked files; their changes stay pending */
+    if (file_size == 0 || ic->deleted) {
+        pthread_rwlock_unlock(&ic->lock);
+        inode_put(ic);
+        return 0;
+    }
 
-    /* Skip empty files */
-    if (file_size == 0) return 0;
+    /* Deletions never take the newest version, which is all we read here */
+    struct version_index vi;
+    if (version_index_load(ino, &vi) != 0) {
+        pthread_rwlock_unlock(&ic->lock);
+        inode_put(ic);
+        return -1;
+    }
+    uint64_t ver = vi.next;
+    struct version_entry *last = vi.n > 0 ? &vi.e[vi.n - 1] : NULL;
+    struct kvbfs_version_meta prev;
+    bool delta = last && last->ver == ver - 1 &&
+                 last->meta.format == VERSION_FORMAT_DELTA;
+    if (delta) prev = last->meta;
+    version_index_free(&vi);
 
-    /* Get current version counter */
-    uint64_t ver = version_get_current(ino);
+    char pkey[64];
+    int pkeylen = kvbfs_key_version_pending(pkey, sizeof(pkey), ino);
+    struct version_dirty *vd = ic->vdirty;
+    bool all = !delta || (vd && vd->lost);
+    if (delta && !vd) {
+        char probe;
+        size_t plen;
+        if (kv_get_into(g_ctx->db, pkey, pkeylen, &probe, 0, &plen) != 0) {
+            /* Nothing changed since the previous version */
+            if (captured) *captured = ver - 1;
+            pthread_rwlock_unlock(&ic->lock);
+            inode_put(ic);
+            return 0;
+        }
+        all = true;
+    }
 
-    /* Copy current blocks to versioned keys */
-    for (uint64_t i = 0; i < file_blocks; i++) {
-        char src_key[64];
-        int src_keylen = kvbfs_key_block(src_key, sizeof(src_key), ino, i);
+    kv_batch_t *batch = kv_batch_new();
+    if (!batch) {
+        pthread_rwlock_unlock(&ic->lock);
+        inode_put(ic);
+        return -1;
+    }
 
-        char *block_data = NULL;
-        size_t block_len = 0;
-        if (kv_get(g_ctx->db, src_key, src_keylen, &block_data, &block_len) != 0)
-            continue;
+    /* References taken below must reach the store before a sweep */
+    vcas_write_begin();
+    uint64_t changed = 0;
+    for (uint64_t i = 0; i < file_blocks; i++) {
+        if (!all && !dirty_test(vd, i)) continue;
+        changed += snapshot_block(batch, ino, ver, i, delta ? prev.blocks : 0);
+    }
 
-        char dst_key[96];
-        int dst_keylen = kvbfs_key_version_block(dst_key, sizeof(dst_key), ino, ver, i);
-        kv_put(g_ctx->db, dst_key, dst_keylen, block_data, block_len);
-        free(block_data);
+    int ret = 0;
+    if (delta && changed == 0 && file_size == prev.size) {
+        /* Same content as the previous version: no new version */
+        vcas_write_end();
+        kv_batch_free(batch);
+        kv_delete(g_ctx->db, pkey, pkeylen);
+        free(vd);
+        ic->vdirty = NULL;
+        if (captured) *captured = ver - 1;
+        pthread_rwlock_unlock(&ic->lock);
+        inode_put(ic);
+        return 0;
     }
 
-    /* Store version metadata */
     struct kvbfs_version_meta meta = {
         .size = file_size,
         .blocks = file_blocks,
         .mtime = file_mtime,
+        .changed = changed,
+        .format = VERSION_FORMAT_DELTA,
+        .created = time(NULL),
     };
-    char meta_key[64];
-    int meta_keylen = kvbfs_key_version_meta(meta_key, sizeof(meta_key), ino, ver);
-    kv_put(g_ctx->db, meta_key, meta_keylen,
-           (const char *)&meta, sizeof(meta));
+    kv_batch_delete(batch, pkey, pkeylen);
 
-    /* Increment version counter */
-    version_set_counter(ino, ver + 1);
-
-    /* Prune oldest version if we exceeded the limit */
-    if (ver + 1 > KVBFS_MAX_VERSIONS) {
-        uint64_t oldest = ver + 1 - KVBFS_MAX_VERSIONS;
-        version_delete_one(ino, oldest - 1);
+    /* Append to the index as it is now; the GC may have thinned it */
+    pthread_mutex_t *lock = index_lock(ino);
+    pthread_mutex_lock(lock);
+    struct version_index cur;
+    struct version_index grown = { 0 };
+    if (version_index_load(ino, &cur) == 0 &&
+        index_alloc(&grown, cur.n + 1) == 0) {
+        memcpy(grown.e, cur.e, cur.n * sizeof(struct version_entry));
+        grown.n = cur.n;
+        grown.legacy = cur.legacy;
+        grown.e[grown.n++] = (struct version_entry){ .ver = ver, .meta = meta };
+        grown.next = ver + 1;
+        index_save(batch, ino, &grown);
+        if (kv_batch_commit(g_ctx->db, batch) == 0) {
+            free(vd);
+            ic->vdirty = NULL;
+            if (captured) *captured = ver;
+        } else {
+            ret = -1;           /* dirty set and marker stay for a retry */
+        }
+    } else {
+        ret = -1;
     }
+    pthread_mutex_unlock(lock);
+    vcas_write_end();
+    version_index_free(&grown);
+    version_index_free(&cur);
+    kv_batch_free(batch);
+    pthread_rwlock_unlock(&ic->lock);
+    inode_put(ic);
+    return ret;
+}
 
-    return 0;
+int version_snapshot(uint64_t ino)
+{
+    return version_capture(ino, NULL);
 }
 
 void version_delete_all(uint64_t ino)
 {
-    uint64_t ver = version_get_current(ino);
-    if (ver == 0) return;
+    kv_batch_t *batch = kv_batch_new();
+    if (!batch) return;
+    version_delete_all_batch(batch, ino);
+    kv_batch_commit(g_ctx->db, batch);
+    kv_batch_free(batch);
+}
 
-    /* Delete version counter */
+void version_delete_all_batch(kv_batch_t *batch, uint64_t ino)
+{
     char key[64];
-    int keylen = kvbfs_key_version_counter(key, sizeof(key), ino);
-    kv_delete(g_ctx->db, key, keylen);
+    int keylen = kvbfs_key_version_index(key, sizeof(key), ino);
+    kv_batch_delete(batch, key, keylen);
+    keylen = kvbfs_key_version_pending(key, sizeof(key), ino);
+    kv_batch_delete(batch, key, keylen);
+
+    keylen = kvbfs_key_version_meta_prefix(key, sizeof(key), ino);
+    kv_batch_delete_prefix(batch, key, keylen);
+
+    /* All versions' blocks share the "vb:<ino>:" prefix, records "vx:<ino>:" */
+    keylen = snprintf(key, sizeof(key), "vb:%lu:", (unsigned long)ino);
+    kv_batch_delete_prefix(batch, key, keylen);
+    keylen = snprintf(key, sizeof(key), "vx:%lu:", (unsigned long)ino);
+
+    /* Each reference gives its count back to the store */
+    kv_iterator_t *iter = kv_iter_prefix(g_ctx->db, key, keylen);
+    for (; kv_iter_valid(iter); kv_iter_next(iter)) {
+        size_t klen, vlen;
+        const char *k = kv_iter_key(iter, &klen);
+        const char *v = kv_iter_value(iter, &vlen);
+        if (k[klen - 1] == '#' && vlen == VCAS_HASH_SIZE)
+            vcas_unref(batch, (const uint8_t *)v);
+    }
+    kv_iter_free(iter);
+    kv_batch_delete_prefix(batch, key, keylen);
+}
+
+/* ── Restore ──────────────────────────────────────────── */
+
+static void bit_set(uint64_t *set, uint64_t b)
+{
+    set[b / 64] |= 1ULL << (b % 64);
+}
+
+/*
+ * Blocks below nblocks that may read differently in version lo and in the
+ * versions after it up to hi, as a bitmap.  A block can only change where
+ * a version in (lo, hi] recorded it, or past the smallest size among them;
+ * all marks every block.
+ */
+static uint64_t *changed_set(uint64_t ino, uint64_t lo, uint64_t hi,
+                             uint64_t nblocks, bool all)
+{
+    uint64_t *set = calloc(nblocks / 64 + 1, sizeof(uint64_t));
+    if (!set) return NULL;
+
+    struct version_index vi = { 0 };
+    if (!all && version_index_load(ino, &vi) != 0) all = true;
+
+    uint64_t low = nblocks;
+    for (size_t i = 0; i < vi.n && !all; i++) {
+        const struct version_entry *e = &vi.e[i];
+        if (e->ver <= lo || e->ver > hi) continue;
+        if (e->meta.format == VERSION_FORMAT_COPY) {
+            all = true;
+            break;
+        }
+        if (e->meta.blocks < low) low = e->meta.blocks;
+
+        char prefix[64];
+        int prefix_len = kvbfs_key_version_block_prefix(prefix, sizeof(prefix),
+                                                        ino, e->ver);
+        kv_iterator_t *iter = kv_iter_prefix(g_ctx->db, prefix, prefix_len);
+        while (kv_iter_valid(iter)) {
+            size_t klen;
+            const char *k = kv_iter_key(iter, &klen);
+            uint64_t block;
+            if (key_number(k, klen, prefix_len, &block) == 0 && block < nblocks)
+                bit_set(set, block);
+            kv_iter_next(iter);
+        }
+        kv_iter_free(iter);
+    }
+    version_index_free(&vi);
+
+    if (all) low = 0;
+    for (uint64_t b = low; b < nblocks; b++)
+        bit_set(set, b);
+    return set;
+}
+
+int version_restore(uint64_t ino, uint64_t ver, uint64_t *rewritten)
+{
+    if (rewritten) *rewritten = 0;
+
+    struct kvbfs_version_meta target;
+    if (version_get_meta(ino, ver, &target) != 0) return ENOENT;
+
+    /* The content being replaced becomes a version of its own */
+    uint64_t newest;
+    if (version_capture(ino, &newest) != 0) return EIO;
+
+    struct kvbfs_inode_cache *ic = inode_get(ino);
+    if (!ic) return ENOENT;
+    pthread_rwlock_wrlock(&ic->lock);
+    if (ic->deleted) {
+        pthread_rwlock_unlock(&ic->lock);
+        inode_put(ic);
+        return ENOENT;
+    }
+
+    /* A write slipped in after the capture: the newest version is stale */
+    char pkey[64];
+    int pkeylen = kvbfs_key_version_pending(pkey, sizeof(pkey), ino);
+    char probe;
+    size_t plen;
+    bool all = newest == UINT64_MAX || ic->vdirty ||
+               target.format == VERSION_FORMAT_COPY ||
+               kv_get_into(g_ctx->db, pkey, pkeylen, &probe, 0, &plen) == 0;
+
+    uint64_t *set = changed_set(ino, ver, UINT64_MAX, target.blocks, all);
+    kv_batch_t *batch = set ? kv_batch_new() : NULL;
+    if (!batch) {
+        free(set);
+        pthread_rwlock_unlock(&ic->lock);
+        inode_put(ic);
+        return ENOMEM;
+    }
+
+    struct kvbfs_inode old = ic->inode;
+    if (target.size > old.size)
+        gc_claim(&g_ctx->gc, ino, old.size, target.size);
+
+    uint64_t count = 0;
+    for (uint64_t b = 0; b < target.blocks; b++) {
+        if (!(set[b / 64] & (1ULL << (b % 64)))) continue;
+
+        char *data = NULL;
+        size_t len = 0;
+        uint64_t rec_ver;
+        bool found = target.format == VERSION_FORMAT_COPY ?
+            version_read_block(ino, ver, b, &data, &len) == 0 :
+            version_find(ino, ver, b, &rec_ver, &data, &len) == 0 && len > 0;
+
+        char key[64];
+        int keylen = kvbfs_key_block(key, sizeof(key), ino, b);
+        if (found) kv_batch_put(batch, key, keylen, data, len);
+        else kv_batch_delete(batch, key, keylen);
+        free(data);
+        version_mark_dirty(batch, ic, b, b + 1);
+        count++;
+    }
+    version_mark_dirty(batch, ic, 0, 0);
+    free(set);
+
+    /*
+     * Blocks past the restored end go to GC as a truncation after the
+     * commit; the ow: record in the batch covers a crash in between.
+     */
+    bool shrink = target.size < old.size;
+    bool wb_added = false;
+    if (shrink && !ic->wb_intent) {
+        char key[64];
+        int keylen = kvbfs_key_orphan_wb(key, sizeof(key), ino);
+        kv_batch_put(batch, key, keylen, NULL, 0);
+        wb_added = true;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    ic->inode.size = target.size;
+    ic->inode.blocks = target.blocks;
+    ic->inode.mtime = now;
+    ic->inode.ctime = now;
+    inode_save_batch(batch, &ic->inode);
+
+    int ret = 0;
+    if (kv_batch_commit(g_ctx->db, batch) == 0) {
+        if (wb_added) ic->wb_intent = true;
+        if (shrink) gc_truncate(&g_ctx->gc, ino, old.size, target.size);
+        if (rewritten) *rewritten = count;
+    } else {
+        ic->inode = old;
+        ret = EIO;
+    }
+    kv_batch_free(batch);
+    pthread_rwlock_unlock(&ic->lock);
+
+    /* Charges the size change to the directory usage, drops ow: */
+    if (ret == 0) inode_sync(ic);
+    inode_put(ic);
+    return ret;
+}
+
+/* ── Diff ─────────────────────────────────────────────── */
 
-    /* Delete all version metadata and blocks */
-    uint64_t start = 0;
-    if (ver > KVBFS_MAX_VERSIONS) {
-        start = ver - KVBFS_MAX_VERSIONS;
+/*
+ * Which record holds block of version ver (*rec_ver, UINT64_MAX for none)
+ * and its fingerprint.  Records written before fingerprints were kept are
+ * read and hashed.
+ */
+static int block_fingerprint(uint64_t ino, uint64_t ver,
+                             const struct kvbfs_version_meta *meta,
+                             uint64_t block, uint64_t *rec_ver, uint32_t *fp)
+{
+    char key[96];
+    int keylen;
+    if (meta->format == VERSION_FORMAT_DELTA) {
+        if (version_find(ino, ver, block, rec_ver, NULL, NULL) != 0) {
+            *rec_ver = UINT64_MAX;
+            *fp = version_fingerprint(NULL, 0);
+            return 0;
+        }
+        keylen = kvbfs_key_version_block(key, sizeof(key), ino, *rec_ver, block);
+        size_t vlen;
+        if (kv_get_into(g_ctx->db, key, keylen, (char *)fp, sizeof(*fp),
+                        &vlen) == 0 && vlen == sizeof(*fp))
+            return 0;
+    } else {
+        *rec_ver = ver;
     }
-    for (uint64_t v = start; v < ver; v++) {
-        version_delete_one(ino, v);
+
+    char *data = NULL;
+    size_t len = 0;
+    if (read_block_meta(ino, ver, meta, block, &data, &len) != 0)
+        len = 0;
+    *fp = version_fingerprint(data, len);
+    free(data);
+    return 0;
+}
+
+int version_diff_blocks(uint64_t ino, uint64_t from, uint64_t to,
+                        uint64_t **blocks, size_t *n)
+{
+    *blocks = NULL;
+    *n = 0;
+
+    uint64_t lo = from < to ? from : to, hi = from < to ? to : from;
+    struct kvbfs_version_meta lo_meta, hi_meta;
+    if (version_get_meta(ino, lo, &lo_meta) != 0 ||
+        version_get_meta(ino, hi, &hi_meta) != 0)
+        return -1;
+
+    uint64_t nblocks = lo_meta.blocks > hi_meta.blocks ? lo_meta.blocks
+                                                       : hi_meta.blocks;
+    bool all = lo_meta.format == VERSION_FORMAT_COPY ||
+               hi_meta.format == VERSION_FORMAT_COPY;
+    uint64_t *set = changed_set(ino, lo, hi, nblocks, all);
+    if (!set) return -1;
+
+    size_t cap = 0;
+    int ret = 0;
+    for (uint64_t b = 0; b < nblocks; b++) {
+        if (!(set[b / 64] & (1ULL << (b % 64)))) continue;
+
+        /* Same record, or an edit that was reverted: same content */
+        if (b < lo_meta.blocks && b < hi_meta.blocks) {
+            uint64_t lo_rec, hi_rec;
+            uint32_t lo_fp, hi_fp;
+            block_fingerprint(ino, lo, &lo_meta, b, &lo_rec, &lo_fp);
+            block_fingerprint(ino, hi, &hi_meta, b, &hi_rec, &hi_fp);
+            if (lo_rec == hi_rec || lo_fp == hi_fp) continue;
+        }
+
+        if (*n == cap) {
+            cap = cap ? cap * 2 : 64;
+            uint64_t *grown = realloc(*blocks, cap * sizeof(uint64_t));
+            if (!grown) { ret = -1; break; }
+            *blocks = grown;
+        }
+        (*blocks)[(*n)++] = b;
     }
+    free(set);
+    if (ret != 0) {
+        free(*blocks);
+        *blocks = NULL;
+        *n = 0;
+    }
+    return ret;
+}
+
+int version_diff_live(struct kvbfs_inode_cache *ic, uint64_t from,
+                      uint64_t **blocks, size_t *n)
+{
+    *blocks = NULL;
+    *n = 0;
+
+    uint64_t ino = ic->inode.ino;
+    struct kvbfs_version_meta meta;
+    if (version_get_meta(ino, from, &meta) != 0) return -1;
+
+    /*
+     * Candidates: blocks recorded by later versions, plus the dirty set since
+     * the newest one.  A marker without a bitmap means untracked changes.
+     */
+    char pkey[64];
+    int pkeylen = kvbfs_key_version_pending(pkey, sizeof(pkey), ino);
+    char probe;
+    size_t plen;
+    struct version_dirty *vd = ic->vdirty;
+    bool all = meta.format == VERSION_FORMAT_COPY || (vd && vd->lost) ||
+               (!vd && kv_get_into(g_ctx->db, pkey, pkeylen, &probe, 0, &plen) == 0);
+
+    uint64_t live_blocks = ic->inode.blocks;
+    uint64_t nblocks = meta.blocks > live_blocks ? meta.blocks : live_blocks;
+    uint64_t *set = changed_set(ino, from, UINT64_MAX, nblocks, all);
+    if (!set) return -1;
+    for (uint64_t b = 0; vd && !all && b < nblocks; b++)
+        if (dirty_test(vd, b)) bit_set(set, b);
+    for (uint64_t b = meta.blocks < live_blocks ? meta.blocks : live_blocks;
+         b < nblocks; b++)
+        bit_set(set, b);
+
+    size_t cap = 0;
+    int ret = 0;
+    for (uint64_t b = 0; b < nblocks; b++) {
+        if (!(set[b / 64] & (1ULL << (b % 64)))) continue;
+
+        if (b < meta.blocks && b < live_blocks) {
+            uint64_t rec;
+            uint32_t fp;
+            block_fingerprint(ino, from, &meta, b, &rec, &fp);
+
+            char key[64];
+            int keylen = kvbfs_key_block(key, sizeof(key), ino, b);
+            char cur[KVBFS_BLOCK_SIZE];
+            size_t cur_len = 0;
+            if (kv_get_into(g_ctx->db, key, keylen, cur, sizeof(cur), &cur_len) != 0)
+                cur_len = 0;                /* hole */
+            if (cur_len > sizeof(cur)) cur_len = sizeof(cur);
+            if (version_fingerprint(cur, cur_len) == fp) continue;
+        }
+
+        if (*n == cap) {
+            cap = cap ? cap * 2 : 64;
+            uint64_t *grown = realloc(*blocks, cap * sizeof(uint64_t));
+            if (!grown) { ret = -1; break; }
+            *blocks = grown;
+        }
+        (*blocks)[(*n)++] = b;
+    }
+    free(set);
+    if (ret != 0) {
+        free(*blocks);
+        *blocks = NULL;
+        *n = 0;
+    }
+    return ret;
+}
+
+/* ── Retention ────────────────────────────────────────── */
+
+int version_list(uint64_t ino, uint64_t **vers, size_t *n)
+{
+    *vers = NULL;
+    *n = 0;
+
+    struct version_index vi;
+    if (version_index_load(ino, &vi) != 0) return -1;
+    if (vi.n > 0) {
+        *vers = malloc(vi.n * sizeof(uint64_t));
+        if (!*vers) {
+            version_index_free(&vi);
+            return -1;
+        }
+        for (size_t i = 0; i < vi.n; i++) (*vers)[i] = vi.e[i].ver;
+        *n = vi.n;
+    }
+    version_index_free(&vi);
+    return 0;
+}
+
+void version_policy_default(struct version_policy *pol)
+{
+    pol->keep_all = 600;
+    pol->hourly = 86400;
+    pol->daily = 30 * 86400;
+    pol->max_count = KVBFS_MAX_VERSIONS;
+    pol->max_bytes = 0;
+
+    const char *s = getenv("KVBFS_VERSION_RETENTION");
+    if (s && version_policy_parse(s, strlen(s), pol) != 0)
+        fprintf(stderr, "Warning: bad KVBFS_VERSION_RETENTION \"%s\"\n", s);
+}
+
+int version_policy_parse(const char *s, size_t len, struct version_policy *pol)
+{
+    char buf[256];
+    if (len >= sizeof(buf)) return -1;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+
+    struct version_policy p = *pol;
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ",", &save); tok;
+         tok = strtok_r(NULL, ",", &save)) {
+        while (*tok == ' ') tok++;
+        char *eq = strchr(tok, '=');
+        if (!eq) return -1;
+        *eq = '\0';
+
+        char *end;
+        uint64_t v = strtoull(eq + 1, &end, 10);
+        if (end == eq + 1) return -1;
+        bool bytes = strcmp(tok, "bytes") == 0;
+        uint64_t unit = 1;
+        switch (*end) {
+        case 's': unit = 1; break;
+        case 'm': unit = 60; break;
+        case 'h': unit = 3600; break;
+        case 'd': unit = 86400; break;
+        case 'K': unit = 1ULL << 10; break;
+        case 'M': unit = 1ULL << 20; break;
+        case 'G': unit = 1ULL << 30; break;
+        case 'T': unit = 1ULL << 40; break;
+        default: unit = 0; break;
+        }
+        if (unit != 0) {
+            /* Time suffixes are lower case, size suffixes upper case */
+            if (bytes != (*end >= 'A' && *end <= 'Z')) return -1;
+            /* count is a plain number of versions */
+            if (strcmp(tok, "count") == 0) return -1;
+            end++;
+        } else {
+            unit = 1;
+        }
+        while (*end == ' ' || *end == '\n') end++;
+        if (*end != '\0') return -1;
+        v *= unit;
+
+        if (strcmp(tok, "all") == 0) p.keep_all = v;
+        else if (strcmp(tok, "hourly") == 0) p.hourly = v;
+        else if (strcmp(tok, "daily") == 0) p.daily = v;
+        else if (strcmp(tok, "count") == 0) p.max_count = v;
+        else if (bytes) p.max_bytes = v;
+        else return -1;
+    }
+    *pol = p;
+    return 0;
+}
+
+void version_policy_resolve(uint64_t ino, struct version_policy *pol)
+{
+    *pol = g_ctx->gc.retention;
+
+    uint64_t cur = ino;
+    for (int depth = 0; depth < PATH_MAX_DEPTH; depth++) {
+        struct kvbfs_inode_cache *ic = inode_get(cur);
+        if (ic) {
+            char *val = NULL;
+            size_t vlen = 0;
+            int found = xattr_get(ic, VERSION_RETENTION_XATTR, &val, &vlen) == 0;
+            inode_put(ic);
+            if (found) {
+                version_policy_parse(val, vlen, pol);
+                free(val);
+                return;
+            }
+        }
+        if (cur == KVBFS_ROOT_INO || path_parent(g_ctx->db, cur, &cur) != 0)
+            return;
+    }
+}
+
+enum { TIER_DROP, TIER_RECENT, TIER_OLD };
+
+static int64_t version_time(const struct kvbfs_version_meta *meta)
+{
+    return meta->created ? meta->created : (int64_t)meta->mtime.tv_sec;
+}
+
+/* Bytes of block records the version owns */
+static uint64_t version_bytes(const struct kvbfs_version_meta *meta)
+{
+    uint64_t n = meta->format == VERSION_FORMAT_COPY ? meta->blocks : meta->changed;
+    return n * KVBFS_BLOCK_SIZE;
+}
+
+int version_thin_plan(uint64_t ino, const struct version_policy *pol,
+                      int64_t now, uint64_t **drop, size_t *n_drop)
+{
+    *drop = NULL;
+    *n_drop = 0;
+
+    struct version_index vi;
+    if (version_index_load(ino, &vi) != 0) return -1;
+    size_t n = vi.n;
+    if (n <= 1) {
+        version_index_free(&vi);
+        return 0;
+    }
+
+    uint64_t *vers = malloc(n * sizeof(uint64_t));
+    uint8_t *tier = malloc(n);
+    uint64_t *bytes = malloc(n * sizeof(uint64_t));
+    if (!vers || !tier || !bytes) {
+        free(vers);
+        free(tier);
+        free(bytes);
+        version_index_free(&vi);
+        return -1;
+    }
+
+    /* Newest first, so the first version seen in an hour or day is kept */
+    int64_t last_hour = INT64_MIN, last_day = INT64_MIN;
+    size_t kept = 0;
+    uint64_t total = 0;
+    for (size_t i = n; i-- > 0;) {
+        const struct kvbfs_version_meta *meta = &vi.e[i].meta;
+        vers[i] = vi.e[i].ver;
+        bytes[i] = version_bytes(meta);
+
+        int64_t t = version_time(meta);
+        uint64_t age = now > t ? (uint64_t)(now - t) : 0;
+        if (i == n - 1 || age < pol->keep_all) {
+            tier[i] = TIER_RECENT;
+        } else if (age < pol->hourly) {
+            tier[i] = t / 3600 == last_hour ? TIER_DROP : TIER_OLD;
+            last_hour = t / 3600;
+        } else if (pol->daily == 0 || age < pol->daily) {
+            tier[i] = t / 86400 == last_day ? TIER_DROP : TIER_OLD;
+            last_day = t / 86400;
+        } else {
+            tier[i] = TIER_DROP;
+        }
+        if (tier[i] != TIER_DROP) {
+            kept++;
+            total += bytes[i];
+        }
+    }
+
+    /* Over a cap: thin the recent tier before older history */
+    for (int pass = TIER_RECENT; pass <= TIER_OLD; pass++) {
+        for (size_t i = 0; i + 1 < n; i++) {
+            if ((pol->max_count == 0 || kept <= pol->max_count) &&
+                (pol->max_bytes == 0 || total <= pol->max_bytes))
+                break;
+            if (tier[i] != pass) continue;
+            tier[i] = TIER_DROP;
+            kept--;
+            total -= bytes[i];
+        }
+    }
+
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++)
+        if (tier[i] == TIER_DROP) vers[m++] = vers[i];
+    free(tier);
+    free(bytes);
+    version_index_free(&vi);
+    if (m == 0) {
+        free(vers);
+        return 0;
+    }
+    *drop = vers;
+    *n_drop = m;
+    return 0;
 }
@@ -2,22 +2,119 @@
 #define VERSION_H
 
 #include "kvbfs.h"
+#include "kv_store.h"
 
-#define KVBFS_MAX_VERSIONS 64
+#include <stddef.h>
+
+#define KVBFS_MAX_VERSIONS 128        /* default cap on versions per file */
+
+/*
+ * Versions share unchanged blocks.  A snapshot writes a record
+ * vx:<ino>:<blk>:<~ver> only for blocks that differ from what the previous
+ * version holds; block blk of version v is the newest record with a version
+ * <= v (the inverted version makes that the first key at or after ~v).  An
+ * empty record is a hole.  vb:<ino>:<ver>:<blk> lists the records a version
+ * owns, so deleting a version hands each one to the next version when that
+ * version still reads it, and drops it otherwise.  Its value is the CRC32C
+ * fingerprint of the record's block (empty in older databases), which lets
+ * a diff skip blocks that were rewritten with the same content.
+ *
+ * A non-empty block is normally recorded by reference: the record key ends
+ * in '#' and its value is the SHA-256 of the block, whose bytes live once
+ * in the content-addressed store (vcas.h) however many versions and files
+ * hold them.  Records without the suffix carry the data inline (holes, and
+ * blocks snapshotted before the store existed).
+ *
+ * Versions written before this layout (VERSION_FORMAT_COPY) keep full block
+ * copies in their vb: keys and are read as before.
+ */
+#define VERSION_FORMAT_COPY     0   /* full copies in vb: keys */
+#define VERSION_FORMAT_DELTA    1   /* shared vx: records, vb: is the index */
 
 /* Version metadata stored per snapshot */
 struct kvbfs_version_meta {
     uint64_t size;          /* file size at snapshot time */
     uint64_t blocks;        /* block count at snapshot time */
     struct timespec mtime;  /* modification time at snapshot */
+    uint64_t changed;       /* block records owned by this version */
+    uint32_t format;        /* VERSION_FORMAT_* */
+    uint32_t reserved;
+    int64_t created;        /* snapshot time (seconds), 0 = use mtime */
+};
+
+/*
+ * All of a file's version metadata lives in one record, vc:<ino>, ordered by
+ * version: a head followed by count entries.  Listing versions is one read,
+ * and a snapshot or deletion rewrites the record in the batch that changes
+ * the versions.  Databases from before the index hold an 8-byte counter in
+ * vc:<ino> and a vm:<ino>:<ver> key per version; they are read as before and
+ * folded into the index by the next change.
+ */
+#define VERSION_INDEX_MAGIC     0x31584956U     /* "VIX1" */
+
+struct version_index_head {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t next;          /* number of the next version */
+};
+
+struct version_entry {
+    uint64_t ver;
+    struct kvbfs_version_meta meta;
+};
+
+/* A loaded index; e points into the raw record */
+struct version_index {
+    uint64_t next;
+    size_t n;
+    struct version_entry *e;
+    bool legacy;            /* built from vm: keys */
+    char *raw;
+};
+
+/* Size of a VERSION_FORMAT_COPY meta record */
+#define VERSION_META_COPY_SIZE  offsetof(struct kvbfs_version_meta, changed)
+/* Size of a delta meta record written before snapshot times were kept */
+#define VERSION_META_DELTA_SIZE offsetof(struct kvbfs_version_meta, created)
+
+/*
+ * Retention.  A version younger than keep_all is kept; up to the age hourly
+ * only the newest version of each hour is kept, then up to daily the newest
+ * of each day, and older versions go (daily == 0 keeps one per day forever).
+ * If the survivors still exceed max_count or max_bytes (0 = no cap), the
+ * recent tier is thinned oldest first before any hourly or daily version,
+ * so an edit loop cannot wipe out older history.  The newest version is
+ * never deleted: the next snapshot is a delta against it.
+ *
+ * The mount default comes from KVBFS_VERSION_RETENTION; a file or its
+ * nearest ancestor directory can override it with the xattr below.  Both use
+ * "all=10m,hourly=1d,daily=30d,count=128,bytes=1G" (any subset; s/m/h/d and
+ * K/M/G suffixes).  The GC worker enforces it in the background; struct
+ * version_policy lives in gc.h.
+ */
+#define VERSION_RETENTION_XATTR "user.agentfs.retention"
+
+/*
+ * Blocks changed since the last snapshot, hung off the inode cache entry.
+ * The first change also writes a vd:<ino> marker, so a snapshot that finds
+ * the marker but no bitmap (entry evicted, crash) compares every block.
+ * Changes past VERSION_DIRTY_MAX_WORDS are not tracked and set lost.
+ */
+#define VERSION_DIRTY_MAX_WORDS 16384   /* 1M blocks (4 GiB), 128 KiB per inode */
+
+struct version_dirty {
+    uint64_t nwords;
+    bool lost;              /* some changes went untracked: compare all */
+    uint64_t words[];
 };
 
 /* KV key helpers for version storage */
-static inline int kvbfs_key_version_counter(char *buf, size_t buflen, uint64_t ino)
+static inline int kvbfs_key_version_index(char *buf, size_t buflen, uint64_t ino)
 {
     return snprintf(buf, buflen, "vc:%lu", (unsigned long)ino);
 }
 
+/* Legacy per-version meta key */
 static inline int kvbfs_key_version_meta(char *buf, size_t buflen,
                                           uint64_t ino, uint64_t ver)
 {
@@ -32,6 +129,35 @@ static inline int kvbfs_key_version_block(char *buf, size_t buflen,
                     (unsigned long)ino, (unsigned long)ver, (unsigned long)block);
 }
 
+static inline int kvbfs_key_version_rec(char *buf, size_t buflen,
+                                         uint64_t ino, uint64_t block, uint64_t ver)
+{
+    return snprintf(buf, buflen, "vx:%lu:%lu:%016lx",
+                    (unsigned long)ino, (unsigned long)block,
+                    (unsigned long)(UINT64_MAX - ver));
+}
+
+/* The record key of a block stored by reference */
+static inline int kvbfs_key_version_ref(char *buf, size_t buflen,
+                                        uint64_t ino, uint64_t block, uint64_t ver)
+{
+    return snprintf(buf, buflen, "vx:%lu:%lu:%016lx#",
+                    (unsigned long)ino, (unsigned long)block,
+                    (unsigned long)(UINT64_MAX - ver));
+}
+
+static inline int kvbfs_key_version_rec_prefix(char *buf, size_t buflen,
+                                                uint64_t ino, uint64_t block)
+{
+    return snprintf(buf, buflen, "vx:%lu:%lu:",
+                    (unsigned long)ino, (unsigned long)block);
+}
+
+static inline int kvbfs_key_version_pending(char *buf, size_t buflen, uint64_t ino)
+{
+    return snprintf(buf, buflen, "vd:%lu", (unsigned long)ino);
+}
+
 static inline int kvbfs_key_version_meta_prefix(char *buf, size_t buflen, uint64_t ino)
 {
     return snprintf(buf, buflen, "vm:%lu:", (unsigned long)ino);
@@ -44,19 +170,108 @@ static inline int kvbfs_key_version_block_prefix(char *buf, size_t buflen,
                     (unsigned long)ino, (unsigned long)ver);
 }
 
-/* Take a snapshot of the current file content */
+/*
+ * Record that blocks [first, end) of ic changed; caller holds ic->lock for
+ * writing.  The pending marker goes into batch, or is written directly when
+ * batch is NULL.  An empty range only notes that the size changed.
+ */
+void version_mark_dirty(kv_batch_t *batch, struct kvbfs_inode_cache *ic,
+                        uint64_t first, uint64_t end);
+
+/* Mount default from KVBFS_VERSION_RETENTION */
+void version_policy_default(struct version_policy *pol);
+
+/* Apply "key=value,..." to pol; returns -1 (pol unchanged) on a bad value */
+int  version_policy_parse(const char *s, size_t len, struct version_policy *pol);
+
+/* Policy for ino: its own xattr, else the nearest ancestor's, else default */
+void version_policy_resolve(uint64_t ino, struct version_policy *pol);
+
+/*
+ * Versions of ino that pol drops at time now, oldest first; caller frees
+ * *drop.  Returns -1 on allocation failure.
+ */
+int  version_thin_plan(uint64_t ino, const struct version_policy *pol,
+                       int64_t now, uint64_t **drop, size_t *n_drop);
+
+/*
+ * Delete one version, handing shared records to the next surviving one.
+ * Returns the bytes reclaimed; *keys counts the keys written or deleted.
+ */
+uint64_t version_delete(uint64_t ino, uint64_t ver, size_t *keys);
+
+/* Existing version numbers of ino in ascending order; caller frees *vers */
+int  version_list(uint64_t ino, uint64_t **vers, size_t *n);
+
+/* Load the version index of ino (empty if none); free with version_index_free */
+int  version_index_load(uint64_t ino, struct version_index *vi);
+void version_index_free(struct version_index *vi);
+
+/*
+ * Make the live file read as version ver, in one batch with its new size and
+ * mtime.  The current content is captured first, so the restore can itself
+ * be undone.  Only blocks that differ are rewritten: those recorded by
+ * versions after ver, plus any past the smallest size since; undoing an edit
+ * costs the edit, not the file.  Returns 0 or an errno; *rewritten counts
+ * the blocks written.
+ */
+int version_restore(uint64_t ino, uint64_t ver, uint64_t *rewritten);
+
+/*
+ * Read [off, off + size) of version ver, whose metadata is meta, into buf;
+ * holes and blocks past the data read as zeros.  The caller clamps the
+ * range to meta->size.  Full copies come from one multi-get per batch of
+ * blocks, shared records from one iterator.  Returns -1 on a KV error.
+ */
+int version_read_range(uint64_t ino, uint64_t ver,
+                       const struct kvbfs_version_meta *meta,
+                       char *buf, size_t size, uint64_t off);
+
+/* CRC32C of a block's content, zero-padded to KVBFS_BLOCK_SIZE (NULL = hole) */
+uint32_t version_fingerprint(const char *data, size_t len);
+
+/*
+ * Blocks that read differently in versions from and to, ascending; caller
+ * frees *blocks.  Only blocks recorded by the versions in between are
+ * compared, by fingerprint; nothing else is read.  Blocks past the end of
+ * either version count as changed.
+ */
+int version_diff_blocks(uint64_t ino, uint64_t from, uint64_t to,
+                        uint64_t **blocks, size_t *n);
+
+/*
+ * version_diff_blocks between version from and the live file, without
+ * recording a version.  The caller holds ic->lock.  Candidates are the
+ * blocks recorded after from plus the dirty set since the newest version;
+ * each is compared by fingerprint against the current b: block.
+ */
+int version_diff_live(struct kvbfs_inode_cache *ic, uint64_t from,
+                      uint64_t **blocks, size_t *n);
+
+/* Take a snapshot of the changes since the previous one; no-op if unchanged */
 int version_snapshot(uint64_t ino);
 
+/*
+ * version_snapshot that also reports the version holding the captured
+ * content: the new one, or the previous one if nothing changed.
+ * *captured is UINT64_MAX when there is none (empty or unlinked file).
+ */
+int version_capture(uint64_t ino, uint64_t *captured);
+
 /* Delete all version data for an inode */
 void version_delete_all(uint64_t ino);
 
+/* Queue range deletes of all version data for an inode into batch */
+void version_delete_all_batch(kv_batch_t *batch, uint64_t ino);
+
 /* Get current version number (0 if no versions) */
 uint64_t version_get_current(uint64_t ino);
 
 /* Get version metadata; returns 0 on success */
 int version_get_meta(uint64_t ino, uint64_t ver, struct kvbfs_version_meta *meta);
 
-/* Read a block from a specific version; caller must free *data */
+/* Read a block from a specific version; caller must free *data.
+   Returns -1 for a hole */
 int version_read_block(uint64_t ino, uint64_t ver, uint64_t block,
                        char **data, size_t *len);
 
@@ -3,104 +3,228 @@
 #include <string.h>
 #include <stdio.h>
 
-void vtree_init(struct vtree_ctx *vt)
+#define VTREE_SHARD_MASK    (VTREE_SHARDS - 1)
+
+/* Shard of a vino: the low bits of its offset from AGENTFS_VDIR_BASE */
+static struct vtree_shard *shard_of_vino(struct vtree_ctx *vt, uint64_t vino)
 {
-    vt->by_ino    = NULL;
-    vt->by_parent = NULL;
-    vt->next_vino = AGENTFS_VDIR_BASE;
-    pthread_mutex_init(&vt->lock, NULL);
+    return &vt->shards[(vino - AGENTFS_VDIR_BASE) & VTREE_SHARD_MASK];
 }
 
-void vtree_destroy(struct vtree_ctx *vt)
+/* Key: the parent vino's bytes followed by the name, not terminated */
+static size_t make_key(char **buf, char *stack, size_t stack_len,
+                       uint64_t parent_vino, const char *name)
 {
-    pthread_mutex_lock(&vt->lock);
+    size_t nlen = strlen(name);
+    size_t len = sizeof(parent_vino) + nlen;
+    *buf = len <= stack_len ? stack : malloc(len);
+    if (!*buf) return 0;
+    memcpy(*buf, &parent_vino, sizeof(parent_vino));
+    memcpy(*buf + sizeof(parent_vino), name, nlen);
+    return len;
+}
 
-    struct vtree_node *n, *ntmp;
-    HASH_ITER(hh, vt->by_ino, n, ntmp) {
-        HASH_DEL(vt->by_ino, n);
-        free(n);
+static unsigned key_shard(const char *key, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;       /* FNV-1a */
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)key[i];
+        h *= 1099511628211ULL;
     }
-    struct vtree_lookup_entry *le, *ltmp;
-    HASH_ITER(hh, vt->by_parent, le, ltmp) {
-        HASH_DEL(vt->by_parent, le);
-        free(le);
+    return (unsigned)(h ^ (h >> 32)) & VTREE_SHARD_MASK;
+}
+
+uint64_t vtree_stat_ino(const struct vtree_node *vn)
+{
+    uint64_t f[5] = { (uint64_t)vn->is_version_file, vn->real_ino,
+                      vn->version, vn->version2, vn->snap };
+    uint64_t h = 14695981039346656037ULL;       /* FNV-1a */
+    const unsigned char *p = (const unsigned char *)f;
+    for (size_t i = 0; i < sizeof(f); i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
     }
+    return VTREE_STAT_BASE | (h >> 4);
+}
 
-    pthread_mutex_unlock(&vt->lock);
-    pthread_mutex_destroy(&vt->lock);
+void vtree_init(struct vtree_ctx *vt)
+{
+    for (int i = 0; i < VTREE_SHARDS; i++) {
+        struct vtree_shard *sh = &vt->shards[i];
+        sh->by_ino  = NULL;
+        sh->by_name = NULL;
+        pthread_rwlock_init(&sh->lock, NULL);
+        slab_init(&sh->nodes, sizeof(struct vtree_node));
+    }
+    vt->next_vino = 0;
+    vt->live      = 0;
+    vt->forgotten = 0;
+}
+
+void vtree_destroy(struct vtree_ctx *vt)
+{
+    for (int i = 0; i < VTREE_SHARDS; i++) {
+        struct vtree_shard *sh = &vt->shards[i];
+        pthread_rwlock_wrlock(&sh->lock);
+
+        /* Nodes the kernel still held at unmount */
+        struct vtree_node *n, *tmp;
+        HASH_ITER(hh, sh->by_ino, n, tmp) {
+            HASH_DELETE(hh, sh->by_ino, n);
+            if (n->key) HASH_DELETE(hh_name, sh->by_name, n);
+            free(n->key);
+        }
+        slab_destroy(&sh->nodes);
+
+        pthread_rwlock_unlock(&sh->lock);
+        pthread_rwlock_destroy(&sh->lock);
+    }
 }
 
 uint64_t vtree_lookup_child(struct vtree_ctx *vt, uint64_t parent_vino,
                             const char *name)
 {
-    char key[80];
-    snprintf(key, sizeof(key), "%llu:%s",
-             (unsigned long long)parent_vino, name);
-
-    pthread_mutex_lock(&vt->lock);
-    struct vtree_lookup_entry *le;
-    HASH_FIND_STR(vt->by_parent, key, le);
-    uint64_t result = le ? le->vino : 0;
-    pthread_mutex_unlock(&vt->lock);
+    char stack[128], *key;
+    size_t len = make_key(&key, stack, sizeof(stack), parent_vino, name);
+    if (!len) return 0;
+
+    struct vtree_shard *sh = &vt->shards[key_shard(key, len)];
+    pthread_rwlock_rdlock(&sh->lock);
+    struct vtree_node *n;
+    HASH_FIND(hh_name, sh->by_name, key, len, n);
+    uint64_t result = n ? n->vino : 0;
+    pthread_rwlock_unlock(&sh->lock);
+
+    if (key != stack) free(key);
     return result;
 }
 
-struct vtree_node *vtree_get(struct vtree_ctx *vt, uint64_t vino)
+struct vtree_node *vtree_get(struct vtree_ctx *vt, uint64_t vino,
+                             struct vtree_node *out)
 {
-    pthread_mutex_lock(&vt->lock);
+    if (!vtree_is_vnode(vino)) return NULL;
+
+    struct vtree_shard *sh = shard_of_vino(vt, vino);
+    pthread_rwlock_rdlock(&sh->lock);
     struct vtree_node *n;
-    HASH_FIND(hh, vt->by_ino, &vino, sizeof(uint64_t), n);
-    pthread_mutex_unlock(&vt->lock);
-    return n;
+    HASH_FIND(hh, sh->by_ino, &vino, sizeof(uint64_t), n);
+    if (n) {
+        *out = *n;
+        out->key = NULL;
+    }
+    pthread_rwlock_unlock(&sh->lock);
+    return n ? out : NULL;
 }
 
 static uint64_t vtree_alloc(struct vtree_ctx *vt, uint64_t parent_vino,
                             const char *name, uint64_t real_ino,
-                            int is_version_file, uint64_t version)
+                            int is_version_file, uint64_t version,
+                            uint64_t version2, uint64_t snap)
 {
-    char key[80];
-    snprintf(key, sizeof(key), "%llu:%s",
-             (unsigned long long)parent_vino, name);
-
-    pthread_mutex_lock(&vt->lock);
-
-    /* Idempotent: return existing if already allocated */
-    struct vtree_lookup_entry *existing;
-    HASH_FIND_STR(vt->by_parent, key, existing);
-    if (existing) {
-        uint64_t vino = existing->vino;
-        pthread_mutex_unlock(&vt->lock);
+    char stack[128], *key;
+    size_t len = make_key(&key, stack, sizeof(stack), parent_vino, name);
+    if (!len) return 0;
+
+    unsigned idx = key_shard(key, len);
+    struct vtree_shard *sh = &vt->shards[idx];
+    pthread_rwlock_wrlock(&sh->lock);
+
+    /* Idempotent: another reference to the existing node */
+    struct vtree_node *n;
+    HASH_FIND(hh_name, sh->by_name, key, len, n);
+    if (n && n->real_ino == real_ino && n->is_version_file == is_version_file &&
+        n->version == version && n->version2 == version2 && n->snap == snap) {
+        n->nlookup++;
+        uint64_t vino = n->vino;
+        pthread_rwlock_unlock(&sh->lock);
+        if (key != stack) free(key);
         return vino;
     }
+    if (n) {
+        /*
+         * The name now means another file (removed and recreated): the old
+         * node keeps its vino, and the content the kernel cached under it,
+         * until forgotten, but is no longer found by name.
+         */
+        HASH_DELETE(hh_name, sh->by_name, n);
+        free(n->key);
+        n->key = NULL;
+    }
 
-    uint64_t vino = vt->next_vino++;
+    n = slab_zalloc(&sh->nodes);
+    char *owned = key != stack ? key : malloc(len);
+    if (!n || !owned) {
+        if (n) slab_free(&sh->nodes, n);
+        pthread_rwlock_unlock(&sh->lock);
+        free(key != stack ? key : owned);
+        return 0;
+    }
+    if (owned != key) memcpy(owned, key, len);
 
-    struct vtree_node *n = calloc(1, sizeof(*n));
-    if (!n) { pthread_mutex_unlock(&vt->lock); return 0; }
-    n->vino            = vino;
+    uint64_t seq = __atomic_fetch_add(&vt->next_vino, 1, __ATOMIC_RELAXED);
+    n->vino            = AGENTFS_VDIR_BASE + (seq * VTREE_SHARDS + idx);
     n->real_ino        = real_ino;
     n->is_version_file = is_version_file;
     n->version         = version;
-    HASH_ADD(hh, vt->by_ino, vino, sizeof(uint64_t), n);
-
-    struct vtree_lookup_entry *le = calloc(1, sizeof(*le));
-    if (!le) { pthread_mutex_unlock(&vt->lock); return vino; }
-    strncpy(le->key, key, sizeof(le->key) - 1);
-    le->vino = vino;
-    HASH_ADD_STR(vt->by_parent, key, le);
-
-    pthread_mutex_unlock(&vt->lock);
+    n->version2        = version2;
+    n->snap            = snap;
+    n->nlookup         = 1;
+    n->key             = owned;
+    n->keylen          = len;
+    HASH_ADD(hh, sh->by_ino, vino, sizeof(uint64_t), n);
+    HASH_ADD_KEYPTR(hh_name, sh->by_name, n->key, n->keylen, n);
+    uint64_t vino = n->vino;
+
+    pthread_rwlock_unlock(&sh->lock);
+    __atomic_add_fetch(&vt->live, 1, __ATOMIC_RELAXED);
     return vino;
 }
 
 uint64_t vtree_alloc_dir(struct vtree_ctx *vt, uint64_t parent_vino,
                          const char *name, uint64_t real_ino)
 {
-    return vtree_alloc(vt, parent_vino, name, real_ino, 0, 0);
+    return vtree_alloc(vt, parent_vino, name, real_ino, 0, 0, 0, 0);
 }
 
 uint64_t vtree_alloc_vfile(struct vtree_ctx *vt, uint64_t parent_vino,
                            const char *name, uint64_t real_ino, uint64_t version)
 {
-    return vtree_alloc(vt, parent_vino, name, real_ino, 1, version);
+    return vtree_alloc(vt, parent_vino, name, real_ino, 1, version, 0, 0);
+}
+
+uint64_t vtree_alloc_diff(struct vtree_ctx *vt, uint64_t parent_vino,
+                          const char *name, uint64_t real_ino,
+                          uint64_t from, uint64_t to)
+{
+    return vtree_alloc(vt, parent_vino, name, real_ino, 2, from, to, 0);
+}
+
+uint64_t vtree_alloc_snap(struct vtree_ctx *vt, uint64_t parent_vino,
+                          const char *name, uint64_t real_ino, uint64_t snap)
+{
+    return vtree_alloc(vt, parent_vino, name, real_ino, 3, 0, 0, snap);
+}
+
+void vtree_forget(struct vtree_ctx *vt, uint64_t vino, uint64_t nlookup)
+{
+    if (!vtree_is_vnode(vino)) return;
+
+    struct vtree_shard *sh = shard_of_vino(vt, vino);
+    pthread_rwlock_wrlock(&sh->lock);
+    struct vtree_node *n;
+    HASH_FIND(hh, sh->by_ino, &vino, sizeof(uint64_t), n);
+    if (n && n->nlookup > nlookup) n->nlookup -= nlookup;
+    else if (n) n->nlookup = 0;
+    if (!n || n->nlookup > 0) {
+        pthread_rwlock_unlock(&sh->lock);
+        return;
+    }
+    HASH_DELETE(hh, sh->by_ino, n);
+    if (n->key) HASH_DELETE(hh_name, sh->by_name, n);
+    free(n->key);
+    slab_free(&sh->nodes, n);
+    pthread_rwlock_unlock(&sh->lock);
+
+    __atomic_sub_fetch(&vt->live, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&vt->forgotten, 1, __ATOMIC_RELAXED);
 }
@@ -4,54 +4,97 @@
 #include <pthread.h>
 #include <stdint.h>
 #include "uthash.h"
+#include "slab.h"
 
 /* Virtual inode constants */
 #define AGENTFS_VERSIONS_INO   0xFFFFFFFFFFFFFDULL
 #define AGENTFS_VERSIONS_NAME  ".versions"
 #define AGENTFS_VDIR_BASE      0xC000000000000001ULL
 
+/*
+ * The tree is a cache of what the kernel holds.  A node is created by the
+ * lookup that hands its vino to the kernel, counts the kernel's references
+ * like a real inode, and is freed when FUSE forget drops the count to zero;
+ * readdir allocates nothing.  A
+ * find over a large /.versions tree therefore costs what the kernel's inode
+ * cache keeps, not one node per name ever listed.
+ *
+ * Nodes live in VTREE_SHARDS shards chosen by a hash of (parent vino, name).
+ * The low bits of a vino record its shard, so both the lookup by name and
+ * the lookup by vino take a single shard lock, read-locked when nothing
+ * changes.  Names are kept whole: lookups compare the full key.
+ */
+#define VTREE_SHARDS        64          /* power of two */
+#define VTREE_STAT_BASE     0xD000000000000000ULL   /* st_ino range of nodes */
+
 /* A node in the virtual directory tree.
  * - is_version_file=0: mirrors a real directory or file (version-list dir)
  * - is_version_file=1: a specific version of real_ino, readable via version_read_block
+ * - is_version_file=2: diff from version to version2 (VTREE_LIVE = the live file)
+ * - is_version_file=3: real_ino as it is in filesystem snapshot snap, any type
  */
 struct vtree_node {
     uint64_t vino;            /* virtual inode number (hash key) */
     uint64_t real_ino;        /* real inode this mirrors */
     int      is_version_file; /* 1=leaf version file, 0=directory */
-    uint64_t version;         /* version number (is_version_file=1 only) */
-    UT_hash_handle hh;
+    uint64_t version;         /* version number (is_version_file>=1) */
+    uint64_t version2;        /* diff target (is_version_file=2 only) */
+    uint64_t snap;            /* fssnap id (is_version_file=3 only) */
+    uint64_t nlookup;         /* kernel references (shard lock) */
+    char    *key;             /* parent vino, then the name; NULL once renamed away */
+    size_t   keylen;
+    UT_hash_handle hh;        /* shard table by vino */
+    UT_hash_handle hh_name;   /* shard table by key */
 };
 
-/* Reverse lookup entry: (parent_vino, child_name) -> vino */
-struct vtree_lookup_entry {
-    char     key[80];         /* "%llu:%s" of parent_vino:name */
-    uint64_t vino;
-    UT_hash_handle hh;
+#define VTREE_LIVE  UINT64_MAX
+
+struct vtree_shard {
+    pthread_rwlock_t   lock;
+    struct vtree_node *by_ino;
+    struct vtree_node *by_name;
+    struct slab        nodes;     /* vtree_node storage */
 };
 
 /* Per-session virtual tree state */
 struct vtree_ctx {
-    struct vtree_node         *by_ino;    /* hash by vino */
-    struct vtree_lookup_entry *by_parent; /* hash by (parent_vino:name) */
-    uint64_t                   next_vino; /* allocation counter */
-    pthread_mutex_t            lock;
+    struct vtree_shard shards[VTREE_SHARDS];
+    uint64_t           next_vino; /* allocation counter (atomic) */
+    uint64_t           live;      /* nodes held (atomic) */
+    uint64_t           forgotten; /* nodes freed by forget (atomic) */
 };
 
+struct fssnap;
+
 /* Per-open handle for version files (stored in fi->fh) */
 struct version_fh {
     uint64_t real_ino;
     uint64_t version;
+    char    *diff;            /* rendered diff (diff nodes only) */
+    size_t   diff_len;
+    struct fssnap *snap;      /* referenced snapshot (snapshot nodes only) */
+    uint64_t size;            /* file size in the snapshot */
 };
 
 void     vtree_init(struct vtree_ctx *vt);
 void     vtree_destroy(struct vtree_ctx *vt);
 
-/* Return vino for (parent_vino, name), or 0 if not cached */
+/* Return vino for (parent_vino, name), or 0 if no node exists; takes no reference */
 uint64_t vtree_lookup_child(struct vtree_ctx *vt, uint64_t parent_vino,
                             const char *name);
 
-/* Return node for vino, or NULL */
-struct vtree_node *vtree_get(struct vtree_ctx *vt, uint64_t vino);
+/*
+ * Copy the node for vino into *out and return out, or NULL.  The copy stays
+ * valid after a concurrent forget; key is not usable.
+ */
+struct vtree_node *vtree_get(struct vtree_ctx *vt, uint64_t vino,
+                             struct vtree_node *out);
+
+/*
+ * The allocators return the vino for (parent_vino, name), creating the node
+ * if needed, and take one kernel reference: call them only for an entry
+ * reply, and vtree_forget(vino, 1) if the reply is not sent.  0 = no memory.
+ */
 
 /* Allocate a virtual directory node (idempotent: returns existing if present) */
 uint64_t vtree_alloc_dir(struct vtree_ctx *vt, uint64_t parent_vino,
@@ -61,6 +104,26 @@ uint64_t vtree_alloc_dir(struct vtree_ctx *vt, uint64_t parent_vino,
 uint64_t vtree_alloc_vfile(struct vtree_ctx *vt, uint64_t parent_vino,
                            const char *name, uint64_t real_ino, uint64_t version);
 
+/* Allocate a diff node between two versions (idempotent) */
+uint64_t vtree_alloc_diff(struct vtree_ctx *vt, uint64_t parent_vino,
+                          const char *name, uint64_t real_ino,
+                          uint64_t from, uint64_t to);
+
+/* Allocate a node for real_ino inside filesystem snapshot snap (idempotent) */
+uint64_t vtree_alloc_snap(struct vtree_ctx *vt, uint64_t parent_vino,
+                          const char *name, uint64_t real_ino, uint64_t snap);
+
+/*
+ * st_ino of a node, and the d_ino readdir reports for it: a hash of what the
+ * node shows (kind, real_ino, versions, snap), not its vino, so a listed
+ * name needs no node and keeps its number across forget and lookup.  Only
+ * those fields of vn are read.
+ */
+uint64_t vtree_stat_ino(const struct vtree_node *vn);
+
+/* Drop nlookup kernel references; the node is freed at zero */
+void     vtree_forget(struct vtree_ctx *vt, uint64_t vino, uint64_t nlookup);
+
 /* Return 1 if ino belongs to the dynamic virtual tree range */
 static inline int vtree_is_vnode(uint64_t ino)
 {
@@ -0,0 +1,326 @@
+#include "warmup.h"
+#include "kvbfs.h"
+#include "inode.h"
+#include "kv_store.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define WARMUP_SCAN_TASKS   18      /* "i:1".."i:9", then "d:1".."d:9" */
+#define WARMUP_GENS         64      /* >= KVBFS_ICACHE_SHARDS, DCACHE_SHARDS */
+
+struct warmup_run {
+    struct warmup_ctx *wc;
+    uint64_t *hot;
+    size_t n_hot;
+    unsigned n_tasks;
+    unsigned next;          /* atomic: next task to claim */
+    uint64_t icache_limit;
+    uint64_t dcache_limit;
+};
+
+static int stopping(const struct warmup_ctx *wc)
+{
+    return __atomic_load_n(&wc->stop, __ATOMIC_ACQUIRE);
+}
+
+static int icache_full(const struct warmup_run *r)
+{
+    uint64_t entries, evictions, writes;
+    inode_cache_stats(&entries, &evictions, &writes);
+    return entries >= r->icache_limit;
+}
+
+static int dcache_full(const struct warmup_run *r)
+{
+    struct dcache_stats st;
+    dcache_get_stats(&g_ctx->dcache, &st);
+    return st.entries >= r->dcache_limit;
+}
+
+/* Leading "<ino>:" of a key suffix; keys are not NUL-terminated */
+static int parse_ino(const char *s, size_t len, uint64_t *ino, size_t *used)
+{
+    char num[24];
+    size_t n = 0;
+    while (n < len && s[n] != ':') {
+        if (n == sizeof(num) - 1) return -1;
+        num[n] = s[n];
+        n++;
+    }
+    if (n == 0) return -1;
+    num[n] = '\0';
+
+    char *end;
+    *ino = strtoull(num, &end, 10);
+    *used = n;
+    return *end == '\0' ? 0 : -1;
+}
+
+/* ── Filling ──────────────────────────────────────────── */
+
+/* "i:<ino>" → inode cache; returns whether the entry was added */
+static int fill_inode(const char *val, size_t vlen, const uint64_t *gens)
+{
+    struct kvbfs_inode inode;
+    if (vlen != sizeof(inode)) return 0;
+    memcpy(&inode, val, sizeof(inode));
+    return inode_preload(&inode, gens);
+}
+
+/* "d:<parent>:<name>" → dentry cache */
+static int fill_dirent(const char *key, size_t klen, const char *val,
+                       size_t vlen, const uint64_t *gens)
+{
+    struct kvbfs_dirent de;
+    uint64_t parent;
+    size_t used;
+    if (klen < 2 || kvbfs_dirent_decode(val, vlen, &de) != 0 ||
+        parse_ino(key + 2, klen - 2, &parent, &used) != 0)
+        return 0;
+
+    size_t off = 2 + used + 1;
+    if (off >= klen || klen - off > 255) return 0;
+    char name[256];
+    memcpy(name, key + off, klen - off);
+    name[klen - off] = '\0';
+    return dcache_preload(&g_ctx->dcache, parent, name, de.ino, gens);
+}
+
+static void snapshot(int dirents, uint64_t *gens)
+{
+    if (dirents)
+        dcache_gens(&g_ctx->dcache, gens);
+    else
+        inode_cache_gens(gens);
+}
+
+/* Sequential scan of one key range into the inode or dentry cache */
+static void scan(struct warmup_run *r, const char *prefix, size_t plen,
+                 int dirents)
+{
+    uint64_t gens[WARMUP_GENS];
+    uint64_t added = 0;
+    unsigned n = 0;
+
+    snapshot(dirents, gens);
+    kv_iterator_t *iter = kv_iter_prefix(g_ctx->db, prefix, plen);
+    while (kv_iter_valid(iter) && !stopping(r->wc)) {
+        size_t klen, vlen;
+        const char *key = kv_iter_key(iter, &klen);
+        const char *val = kv_iter_value(iter, &vlen);
+        added += dirents ? fill_dirent(key, klen, val, vlen, gens)
+                         : fill_inode(val, vlen, gens);
+
+        if (++n % WARMUP_REFRESH == 0) {
+            if (dirents ? dcache_full(r) : icache_full(r)) break;
+
+            /* Newer generations, and an iterator that sees newer data */
+            char cur[KVBFS_KEY_MAX];
+            if (klen > sizeof(cur)) break;
+            memcpy(cur, key, klen);
+            kv_iter_free(iter);
+            snapshot(dirents, gens);
+            iter = kv_iter_prefix(g_ctx->db, prefix, plen);
+            kv_iter_seek(iter, cur, klen);
+            if (!kv_iter_valid(iter)) break;
+            size_t nlen;
+            const char *now = kv_iter_key(iter, &nlen);
+            if (nlen != klen || memcmp(now, cur, klen) != 0)
+                continue;   /* current key is gone: resume at its successor */
+        }
+        kv_iter_next(iter);
+    }
+    kv_iter_free(iter);
+
+    __atomic_add_fetch(dirents ? &r->wc->dentries : &r->wc->inodes, added,
+                       __ATOMIC_RELAXED);
+}
+
+/* One kv_multi_get of hot inodes, then the dirents of hot directories */
+static void warm_hot(struct warmup_run *r, size_t first)
+{
+    size_t n = r->n_hot - first;
+    if (n > WARMUP_MGET) n = WARMUP_MGET;
+
+    char kbuf[WARMUP_MGET][32];
+    const char *keys[WARMUP_MGET];
+    size_t klens[WARMUP_MGET];
+    char *vals[WARMUP_MGET];
+    size_t vlens[WARMUP_MGET];
+    for (size_t i = 0; i < n; i++) {
+        klens[i] = kvbfs_key_inode(kbuf[i], sizeof(kbuf[i]), r->hot[first + i]);
+        keys[i] = kbuf[i];
+    }
+
+    uint64_t gens[WARMUP_GENS];
+    inode_cache_gens(gens);
+    kv_multi_get(g_ctx->db, n, keys, klens, vals, vlens);
+
+    uint64_t dirs[WARMUP_MGET];
+    size_t n_dirs = 0;
+    uint64_t added = 0;
+    for (size_t i = 0; i < n; i++) {
+        struct kvbfs_inode inode;
+        if (vals[i] && vlens[i] == sizeof(inode)) {
+            memcpy(&inode, vals[i], sizeof(inode));
+            added += inode_preload(&inode, gens);
+            if (S_ISDIR(inode.mode)) dirs[n_dirs++] = inode.ino;
+        }
+        free(vals[i]);
+    }
+    __atomic_add_fetch(&r->wc->inodes, added, __ATOMIC_RELAXED);
+
+    for (size_t i = 0; i < n_dirs && !stopping(r->wc); i++) {
+        char prefix[64];
+        int plen = kvbfs_key_dirent_prefix(prefix, sizeof(prefix), dirs[i]);
+        scan(r, prefix, plen, 1);
+    }
+}
+
+static void run_task(struct warmup_run *r, unsigned task)
+{
+    unsigned hot_tasks = r->n_tasks - WARMUP_SCAN_TASKS;
+    if (task < hot_tasks) {
+        warm_hot(r, (size_t)task * WARMUP_MGET);
+        return;
+    }
+
+    task -= hot_tasks;
+    int dirents = task >= 9;
+    char prefix[3] = { dirents ? 'd' : 'i', ':', (char)('1' + task % 9) };
+    if (dirents ? dcache_full(r) : icache_full(r)) return;
+    scan(r, prefix, sizeof(prefix), dirents);
+}
+
+static void *worker_main(void *arg)
+{
+    struct warmup_run *r = arg;
+    while (!stopping(r->wc)) {
+        unsigned task = __atomic_fetch_add(&r->next, 1, __ATOMIC_RELAXED);
+        if (task >= r->n_tasks) break;
+        run_task(r, task);
+    }
+    return NULL;
+}
+
+/* ── Run ──────────────────────────────────────────────── */
+
+static void warmup_run(struct warmup_ctx *wc)
+{
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    __atomic_store_n(&wc->state, WARMUP_RUNNING, __ATOMIC_RELEASE);
+
+    struct warmup_run r;
+    memset(&r, 0, sizeof(r));
+    r.wc = wc;
+    r.icache_limit = (uint64_t)g_ctx->icache_shard_max * KVBFS_ICACHE_SHARDS;
+    r.dcache_limit = (uint64_t)g_ctx->dcache.shard_max * DCACHE_SHARDS;
+
+    char *val = NULL;
+    size_t vlen = 0;
+    if (kv_get(g_ctx->db, KVBFS_KEY_HOTSET, strlen(KVBFS_KEY_HOTSET),
+               &val, &vlen) == 0 && vlen % sizeof(uint64_t) == 0) {
+        r.hot = (uint64_t *)val;
+        r.n_hot = vlen / sizeof(uint64_t);
+        if (r.n_hot > WARMUP_HOT_MAX) r.n_hot = WARMUP_HOT_MAX;
+        val = NULL;
+    }
+    free(val);
+    wc->hot = r.n_hot;
+    r.n_tasks = (unsigned)((r.n_hot + WARMUP_MGET - 1) / WARMUP_MGET) +
+                WARMUP_SCAN_TASKS;
+
+    /* The calling thread is one of the workers */
+    pthread_t tids[WARMUP_THREADS_MAX];
+    unsigned started = 0;
+    for (unsigned i = 1; i < wc->threads; i++) {
+        if (pthread_create(&tids[started], NULL, worker_main, &r) != 0) break;
+        started++;
+    }
+    worker_main(&r);
+    for (unsigned i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+    free(r.hot);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    wc->elapsed_us = (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000 +
+                     (t1.tv_nsec - t0.tv_nsec) / 1000;
+    __atomic_store_n(&wc->state, WARMUP_DONE, __ATOMIC_RELEASE);
+    printf("Warmup: %lu inodes, %lu dentries in %.1f ms (%u threads, %lu hot)\n",
+           (unsigned long)__atomic_load_n(&wc->inodes, __ATOMIC_RELAXED),
+           (unsigned long)__atomic_load_n(&wc->dentries, __ATOMIC_RELAXED),
+           wc->elapsed_us / 1000.0, started + 1, (unsigned long)wc->hot);
+}
+
+static void *warmup_main(void *arg)
+{
+    warmup_run(arg);
+    return NULL;
+}
+
+/* ── Lifecycle ────────────────────────────────────────── */
+
+void warmup_init(struct warmup_ctx *wc)
+{
+    memset(wc, 0, sizeof(*wc));
+
+    const char *s = getenv("KVBFS_WARMUP");
+    if (!s || strcmp(s, "0") == 0)
+        wc->mode = WARMUP_OFF;
+    else if (strcmp(s, "bg") == 0 || strcmp(s, "background") == 0)
+        wc->mode = WARMUP_BACKGROUND;
+    else
+        wc->mode = WARMUP_SYNC;
+
+    wc->threads = WARMUP_THREADS_DEFAULT;
+    s = getenv("KVBFS_WARMUP_THREADS");
+    if (s) wc->threads = strtoul(s, NULL, 10);
+    if (wc->threads == 0) wc->threads = 1;
+    if (wc->threads > WARMUP_THREADS_MAX) wc->threads = WARMUP_THREADS_MAX;
+}
+
+int warmup_start(struct warmup_ctx *wc)
+{
+    if (wc->mode == WARMUP_OFF || wc->running ||
+        __atomic_load_n(&wc->state, __ATOMIC_ACQUIRE) != WARMUP_IDLE)
+        return 0;
+
+    wc->stop = 0;
+    if (wc->mode == WARMUP_SYNC) {
+        warmup_run(wc);
+        return 0;
+    }
+    if (pthread_create(&wc->thread, NULL, warmup_main, wc) != 0) {
+        fprintf(stderr, "Warmup: failed to create thread\n");
+        return -1;
+    }
+    wc->running = 1;
+    return 0;
+}
+
+void warmup_stop(struct warmup_ctx *wc)
+{
+    if (!wc->running) return;
+    __atomic_store_n(&wc->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(wc->thread, NULL);
+    wc->running = 0;
+}
+
+int warmup_save_hotset(void *db)
+{
+    uint64_t *inos = malloc(WARMUP_HOT_MAX * sizeof(uint64_t));
+    if (!inos) return -1;
+
+    size_t n = inode_hot_list(inos, WARMUP_HOT_MAX);
+    int ret = n > 0 ?
+        kv_put(db, KVBFS_KEY_HOTSET, strlen(KVBFS_KEY_HOTSET),
+               (const char *)inos, n * sizeof(uint64_t)) :
+        kv_delete(db, KVBFS_KEY_HOTSET, strlen(KVBFS_KEY_HOTSET));
+    free(inos);
+    return ret;
+}
@@ -0,0 +1,71 @@
+#ifndef WARMUP_H
+#define WARMUP_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+ * Mount-time cache warmup.
+ *
+ * After a restart every inode and dirent is faulted in one lookup at a time,
+ * so the first find/ls -R/search over a workspace is slow.  With
+ * KVBFS_WARMUP set, FUSE init fills the inode and dentry caches before
+ * (KVBFS_WARMUP=1) or while (KVBFS_WARMUP=bg) serving requests.
+ *
+ * The inodes cached at the last clean unmount are saved under "hot" and
+ * loaded first with kv_multi_get, together with the dirents of the hot
+ * directories.  The rest of the budget is filled by sequential scans of the
+ * "i:" and "d:" ranges, split by leading digit across KVBFS_WARMUP_THREADS
+ * workers.  The budget is the caches themselves: warmup never evicts, and a
+ * scan stops once its cache is full.
+ *
+ * Warmed entries must not resurrect stale data in background mode.  Workers
+ * snapshot the shard generations before each read; an entry is dropped if
+ * anything left its inode cache shard or was invalidated in its dentry cache
+ * shard since (see inode_preload and dcache_preload).
+ */
+
+#define WARMUP_THREADS_DEFAULT  4
+#define WARMUP_THREADS_MAX      32
+#define WARMUP_HOT_MAX          65536   /* inode numbers saved at unmount */
+#define WARMUP_MGET             64      /* keys per kv_multi_get */
+#define WARMUP_REFRESH          4096    /* scan entries per generation snapshot */
+
+enum warmup_mode {
+    WARMUP_OFF = 0,
+    WARMUP_SYNC,            /* finish before FUSE init returns */
+    WARMUP_BACKGROUND,
+};
+
+enum warmup_state {
+    WARMUP_IDLE = 0,
+    WARMUP_RUNNING,
+    WARMUP_DONE,
+};
+
+struct warmup_ctx {
+    int mode;
+    unsigned threads;
+
+    pthread_t thread;       /* coordinator in background mode */
+    int running;
+    int stop;               /* atomic */
+
+    int state;              /* atomic, enum warmup_state */
+    uint64_t inodes;        /* atomic: entries added to the caches */
+    uint64_t dentries;
+    uint64_t hot;           /* inode numbers in the saved hot set */
+    uint64_t elapsed_us;
+};
+
+/* Reads KVBFS_WARMUP and KVBFS_WARMUP_THREADS */
+void warmup_init(struct warmup_ctx *wc);
+
+/* Runs or starts the warmup according to the mode; needs g_ctx */
+int  warmup_start(struct warmup_ctx *wc);
+void warmup_stop(struct warmup_ctx *wc);
+
+/* Save the inode numbers currently cached as the next mount's hot set */
+int  warmup_save_hotset(void *db);
+
+#endif /* WARMUP_H */
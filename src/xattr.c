@@ -0,0 +1,461 @@
+#include "xattr.h"
+#include "kvbfs.h"
+#include "kv_store.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/xattr.h>
+
+#define XATTR_F_SPILLED     0x1
+
+/* Packed record: a sequence of header + name + inline value */
+struct xattr_rec {
+    uint16_t name_len;
+    uint16_t flags;
+    uint32_t value_len;
+};
+
+/* ── Sets ─────────────────────────────────────────────── */
+
+static void entry_clear(struct xattr_entry *e)
+{
+    free(e->name);
+    free(e->value);
+}
+
+void xattr_set_free(struct xattr_set *xs)
+{
+    if (!xs) return;
+    for (unsigned i = 0; i < xs->count; i++)
+        entry_clear(&xs->v[i]);
+    free(xs->v);
+    free(xs);
+}
+
+static int entry_find(const struct xattr_set *xs, const char *name)
+{
+    if (!xs) return -1;
+    for (unsigned i = 0; i < xs->count; i++)
+        if (strcmp(xs->v[i].name, name) == 0) return (int)i;
+    return -1;
+}
+
+/* Copy xs without entry skip and with room for one more */
+static struct xattr_set *set_copy(const struct xattr_set *xs, int skip)
+{
+    struct xattr_set *out = calloc(1, sizeof(*out));
+    if (!out) return NULL;
+    unsigned n = xs ? xs->count : 0;
+    out->v = calloc(n + 1, sizeof(*out->v));
+    if (!out->v) {
+        free(out);
+        return NULL;
+    }
+
+    for (unsigned i = 0; i < n; i++) {
+        if ((int)i == skip) continue;
+        const struct xattr_entry *src = &xs->v[i];
+        struct xattr_entry *dst = &out->v[out->count];
+        dst->name = strdup(src->name);
+        dst->value_len = src->value_len;
+        if (src->value) {
+            dst->value = malloc(src->value_len ? src->value_len : 1);
+            if (dst->value) memcpy(dst->value, src->value, src->value_len);
+        }
+        out->count++;
+        if (!dst->name || (src->value && !dst->value)) {
+            xattr_set_free(out);
+            return NULL;
+        }
+    }
+    return out;
+}
+
+/* ── Encoding ─────────────────────────────────────────── */
+
+static char *set_encode(const struct xattr_set *xs, size_t *len)
+{
+    size_t total = 0;
+    for (unsigned i = 0; i < xs->count; i++) {
+        total += sizeof(struct xattr_rec) + strlen(xs->v[i].name);
+        if (xs->v[i].value) total += xs->v[i].value_len;
+    }
+
+    char *buf = malloc(total ? total : 1);
+    if (!buf) return NULL;
+
+    size_t off = 0;
+    for (unsigned i = 0; i < xs->count; i++) {
+        const struct xattr_entry *e = &xs->v[i];
+        struct xattr_rec rec = {
+            .name_len = (uint16_t)strlen(e->name),
+            .flags = e->value ? 0 : XATTR_F_SPILLED,
+            .value_len = e->value_len,
+        };
+        memcpy(buf + off, &rec, sizeof(rec));
+        off += sizeof(rec);
+        memcpy(buf + off, e->name, rec.name_len);
+        off += rec.name_len;
+        if (e->value) {
+            memcpy(buf + off, e->value, e->value_len);
+            off += e->value_len;
+        }
+    }
+    *len = total;
+    return buf;
+}
+
+static struct xattr_set *set_decode(const char *buf, size_t len)
+{
+    struct xattr_set *xs = calloc(1, sizeof(*xs));
+    if (!xs) return NULL;
+    unsigned cap = 0;
+
+    size_t off = 0;
+    while (off < len) {
+        struct xattr_rec rec;
+        if (len - off < sizeof(rec)) goto bad;
+        memcpy(&rec, buf + off, sizeof(rec));
+        off += sizeof(rec);
+
+        size_t vlen = (rec.flags & XATTR_F_SPILLED) ? 0 : rec.value_len;
+        if (len - off < rec.name_len + vlen) goto bad;
+
+        if (xs->count == cap) {
+            cap = cap ? cap * 2 : 4;
+            struct xattr_entry *v = realloc(xs->v, cap * sizeof(*v));
+            if (!v) goto bad;
+            xs->v = v;
+        }
+        struct xattr_entry *e = &xs->v[xs->count];
+        memset(e, 0, sizeof(*e));
+        xs->count++;
+
+        e->name = strndup(buf + off, rec.name_len);
+        off += rec.name_len;
+        e->value_len = rec.value_len;
+        if (!(rec.flags & XATTR_F_SPILLED)) {
+            e->value = malloc(vlen ? vlen : 1);
+            if (e->value) memcpy(e->value, buf + off, vlen);
+            off += vlen;
+        }
+        if (!e->name || (!(rec.flags & XATTR_F_SPILLED) && !e->value)) goto bad;
+    }
+    return xs;
+
+bad:
+    xattr_set_free(xs);
+    return NULL;
+}
+
+/* Stored set of ino; *xs is NULL when the inode has no attributes */
+static int set_load(void *db, uint64_t ino, struct xattr_set **xs)
+{
+    *xs = NULL;
+
+    char key[64];
+    int keylen = kvbfs_key_xattr_packed(key, sizeof(key), ino);
+    char *val = NULL;
+    size_t vlen = 0;
+    if (kv_get(db, key, keylen, &val, &vlen) != 0) return 0;
+
+    *xs = set_decode(val, vlen);
+    free(val);
+    return *xs ? 0 : -1;
+}
+
+/* Record the new set (deleting the record when it is empty) */
+static void set_store_batch(kv_batch_t *batch, uint64_t ino,
+                            const struct xattr_set *xs, int *err)
+{
+    char key[64];
+    int keylen = kvbfs_key_xattr_packed(key, sizeof(key), ino);
+
+    if (xs->count == 0) {
+        kv_batch_delete(batch, key, keylen);
+        return;
+    }
+    size_t len;
+    char *buf = set_encode(xs, &len);
+    if (!buf) {
+        *err = ENOMEM;
+        return;
+    }
+    kv_batch_put(batch, key, keylen, buf, len);
+    free(buf);
+}
+
+/* ── Cache ────────────────────────────────────────────── */
+
+/* Load the set into the cache entry; caller holds the write lock */
+static int cache_fill_locked(struct kvbfs_inode_cache *ic)
+{
+    if (ic->xattrs_cached) return 0;
+    if (set_load(g_ctx->db, ic->inode.ino, &ic->xattrs) != 0) return EIO;
+    ic->xattrs_cached = true;
+    return 0;
+}
+
+static int cache_fill(struct kvbfs_inode_cache *ic)
+{
+    pthread_rwlock_rdlock(&ic->lock);
+    bool cached = ic->xattrs_cached;
+    pthread_rwlock_unlock(&ic->lock);
+    if (cached) return 0;
+
+    pthread_rwlock_wrlock(&ic->lock);
+    int err = cache_fill_locked(ic);
+    pthread_rwlock_unlock(&ic->lock);
+    return err;
+}
+
+/* ── Operations ───────────────────────────────────────── */
+
+int xattr_get(struct kvbfs_inode_cache *ic, const char *name,
+              char **value, size_t *len)
+{
+    int err = cache_fill(ic);
+    if (err) return err;
+
+    pthread_rwlock_rdlock(&ic->lock);
+    int i = entry_find(ic->xattrs, name);
+    if (i < 0) {
+        err = ENODATA;
+    } else if (ic->xattrs->v[i].value) {
+        const struct xattr_entry *e = &ic->xattrs->v[i];
+        *value = malloc(e->value_len ? e->value_len : 1);
+        if (*value) {
+            memcpy(*value, e->value, e->value_len);
+            *len = e->value_len;
+        } else {
+            err = ENOMEM;
+        }
+    } else {
+        char key[KVBFS_KEY_MAX];
+        int keylen = kvbfs_key_xattr(key, sizeof(key), ic->inode.ino, name);
+        if (keylen < 0 || kv_get(g_ctx->db, key, keylen, value, len) != 0)
+            err = EIO;
+    }
+    pthread_rwlock_unlock(&ic->lock);
+    return err;
+}
+
+int xattr_list(struct kvbfs_inode_cache *ic, char **buf, size_t *len)
+{
+    *buf = NULL;
+    *len = 0;
+    int err = cache_fill(ic);
+    if (err) return err;
+
+    pthread_rwlock_rdlock(&ic->lock);
+    const struct xattr_set *xs = ic->xattrs;
+    size_t total = 0;
+    for (unsigned i = 0; xs && i < xs->count; i++)
+        total += strlen(xs->v[i].name) + 1;
+
+    if (total > 0) {
+        *buf = malloc(total);
+        if (*buf) {
+            size_t off = 0;
+            for (unsigned i = 0; i < xs->count; i++) {
+                size_t n = strlen(xs->v[i].name) + 1;
+                memcpy(*buf + off, xs->v[i].name, n);
+                off += n;
+            }
+            *len = total;
+        } else {
+            err = ENOMEM;
+        }
+    }
+    pthread_rwlock_unlock(&ic->lock);
+    return err;
+}
+
+/* Commit batch and swap in the new set; caller holds the write lock */
+static int commit_locked(struct kvbfs_inode_cache *ic, kv_batch_t *batch,
+                         struct xattr_set *next, int err)
+{
+    if (!err && kv_batch_commit(g_ctx->db, batch) != 0)
+        err = EIO;
+    kv_batch_free(batch);
+
+    if (err) {
+        xattr_set_free(next);
+        return err;
+    }
+    xattr_set_free(ic->xattrs);
+    if (next->count == 0) {
+        xattr_set_free(next);
+        next = NULL;        /* cached "no attributes" */
+    }
+    ic->xattrs = next;
+    return 0;
+}
+
+int xattr_set(struct kvbfs_inode_cache *ic, const char *name,
+              const char *value, size_t size, int flags)
+{
+    size_t name_len = strlen(name);
+    if (name_len == 0 || name_len > XATTR_NAME_MAX) return ERANGE;
+    if (size > UINT32_MAX) return E2BIG;
+
+    pthread_rwlock_wrlock(&ic->lock);
+    int err = cache_fill_locked(ic);
+    int i = entry_find(ic->xattrs, name);
+    if (!err && (flags & XATTR_CREATE) && i >= 0) err = EEXIST;
+    if (!err && (flags & XATTR_REPLACE) && i < 0) err = ENODATA;
+    if (err) {
+        pthread_rwlock_unlock(&ic->lock);
+        return err;
+    }
+
+    bool was_spilled = i >= 0 && !ic->xattrs->v[i].value;
+    bool spill = size > XATTR_INLINE_MAX;
+
+    struct xattr_set *next = set_copy(ic->xattrs, i);
+    kv_batch_t *batch = next ? kv_batch_new() : NULL;
+    if (!batch) {
+        xattr_set_free(next);
+        pthread_rwlock_unlock(&ic->lock);
+        return ENOMEM;
+    }
+
+    struct xattr_entry *e = &next->v[next->count++];
+    e->name = strdup(name);
+    e->value_len = (uint32_t)size;
+    if (!spill) {
+        e->value = malloc(size ? size : 1);
+        if (e->value) memcpy(e->value, value, size);
+    }
+    if (!e->name || (!spill && !e->value)) err = ENOMEM;
+
+    char key[KVBFS_KEY_MAX];
+    int keylen = kvbfs_key_xattr(key, sizeof(key), ic->inode.ino, name);
+    if (keylen < 0) err = ERANGE;
+    if (!err && spill)
+        kv_batch_put(batch, key, keylen, value, size);
+    else if (!err && was_spilled)
+        kv_batch_delete(batch, key, keylen);
+    if (!err)
+        set_store_batch(batch, ic->inode.ino, next, &err);
+
+    err = commit_locked(ic, batch, next, err);
+    pthread_rwlock_unlock(&ic->lock);
+    return err;
+}
+
+int xattr_remove(struct kvbfs_inode_cache *ic, const char *name)
+{
+    pthread_rwlock_wrlock(&ic->lock);
+    int err = cache_fill_locked(ic);
+    int i = err ? -1 : entry_find(ic->xattrs, name);
+    if (!err && i < 0) err = ENODATA;
+    if (err) {
+        pthread_rwlock_unlock(&ic->lock);
+        return err;
+    }
+
+    bool was_spilled = !ic->xattrs->v[i].value;
+    struct xattr_set *next = set_copy(ic->xattrs, i);
+    kv_batch_t *batch = next ? kv_batch_new() : NULL;
+    if (!batch) {
+        xattr_set_free(next);
+        pthread_rwlock_unlock(&ic->lock);
+        return ENOMEM;
+    }
+
+    if (was_spilled) {
+        char key[KVBFS_KEY_MAX];
+        int keylen = kvbfs_key_xattr(key, sizeof(key), ic->inode.ino, name);
+        if (keylen >= 0) kv_batch_delete(batch, key, keylen);
+    }
+    set_store_batch(batch, ic->inode.ino, next, &err);
+
+    err = commit_locked(ic, batch, next, err);
+    pthread_rwlock_unlock(&ic->lock);
+    return err;
+}
+
+/* ── Migration ────────────────────────────────────────── */
+
+/* Fold one "x:<ino>:<name>" record into the packed record of ino */
+static int migrate_one(void *db, const char *key, size_t klen,
+                       const char *val, size_t vlen)
+{
+    char num[24];
+    size_t n = 0;
+    while (2 + n < klen && key[2 + n] != ':' && n < sizeof(num) - 1) {
+        num[n] = key[2 + n];
+        n++;
+    }
+    if (n == 0 || 2 + n >= klen || key[2 + n] != ':') return 0;
+    num[n] = '\0';
+    uint64_t ino = strtoull(num, NULL, 10);
+
+    char name[XATTR_NAME_MAX + 1];
+    size_t name_len = klen - 3 - n;
+    if (name_len == 0 || name_len > XATTR_NAME_MAX) return 0;
+    memcpy(name, key + 3 + n, name_len);
+    name[name_len] = '\0';
+
+    struct xattr_set *xs;
+    if (set_load(db, ino, &xs) != 0) return -1;
+    int i = entry_find(xs, name);
+    if (i >= 0 && !xs->v[i].value) {
+        xattr_set_free(xs);
+        return 0;           /* large value already listed */
+    }
+
+    struct xattr_set *next = set_copy(xs, i);
+    xattr_set_free(xs);
+    kv_batch_t *batch = next ? kv_batch_new() : NULL;
+    if (!batch) {
+        xattr_set_free(next);
+        return -1;
+    }
+
+    int err = 0;
+    struct xattr_entry *e = &next->v[next->count++];
+    e->name = strdup(name);
+    e->value_len = (uint32_t)vlen;
+    if (vlen <= XATTR_INLINE_MAX) {
+        e->value = malloc(vlen ? vlen : 1);
+        if (e->value) memcpy(e->value, val, vlen);
+        kv_batch_delete(batch, key, klen);
+        if (!e->value) err = ENOMEM;
+    }
+    if (!e->name) err = ENOMEM;
+    if (!err) set_store_batch(batch, ino, next, &err);
+    if (!err && kv_batch_commit(db, batch) != 0) err = EIO;
+
+    kv_batch_free(batch);
+    xattr_set_free(next);
+    return err ? -1 : 1;
+}
+
+int xattr_migrate(void *db)
+{
+    unsigned moved = 0;
+    int ret = 0;
+
+    kv_iterator_t *iter = kv_iter_prefix(db, "x:", 2);
+    while (kv_iter_valid(iter)) {
+        size_t klen, vlen;
+        const char *key = kv_iter_key(iter, &klen);
+        const char *val = kv_iter_value(iter, &vlen);
+        int r = migrate_one(db, key, klen, val, vlen);
+        if (r < 0) {
+            ret = -1;
+            break;
+        }
+        moved += r;
+        kv_iter_next(iter);
+    }
+    kv_iter_free(iter);
+
+    if (moved > 0)
+        printf("Xattr: packed %u attribute(s)\n", moved);
+    return ret;
+}
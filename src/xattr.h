@@ -0,0 +1,55 @@
+#ifndef XATTR_H
+#define XATTR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Extended attributes.
+ *
+ * All attributes of an inode live in one packed record "xa:<ino>", so
+ * listxattr and getxattr cost a single KV read per inode.  Values larger
+ * than XATTR_INLINE_MAX keep their own "x:<ino>:<name>" key; the packed
+ * record still lists the name so listing never touches them.
+ *
+ * The decoded set hangs off the inode cache entry and is guarded by the
+ * inode lock.  An inode without attributes caches a NULL set, which answers
+ * the security.* probes the kernel sends before writes without a KV read.
+ * Updates build a new set, commit it, and only then replace the cached one.
+ */
+
+#define XATTR_INLINE_MAX    4096
+#define XATTR_NAME_MAX      255
+
+struct kvbfs_inode_cache;
+
+struct xattr_entry {
+    char *name;
+    char *value;            /* NULL when the value has its own key */
+    uint32_t value_len;
+};
+
+struct xattr_set {
+    struct xattr_entry *v;
+    unsigned count;
+};
+
+void xattr_set_free(struct xattr_set *xs);
+
+/*
+ * Operations on a referenced inode; they take the inode lock themselves.
+ * Return 0 or an errno (ENODATA, EEXIST, ERANGE, ENOMEM, EIO).
+ */
+int xattr_get(struct kvbfs_inode_cache *ic, const char *name,
+              char **value, size_t *len);
+/* NUL-separated name list, malloc'd; *len is 0 (and *buf NULL) when empty */
+int xattr_list(struct kvbfs_inode_cache *ic, char **buf, size_t *len);
+/* flags: XATTR_CREATE / XATTR_REPLACE */
+int xattr_set(struct kvbfs_inode_cache *ic, const char *name,
+              const char *value, size_t size, int flags);
+int xattr_remove(struct kvbfs_inode_cache *ic, const char *name);
+
+/* Folds per-key records from older databases into packed records */
+int xattr_migrate(void *db);
+
+#endif /* XATTR_H */
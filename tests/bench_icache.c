@@ -0,0 +1,166 @@
+/*
+ * inode 缓存并发基准：模拟 FUSE 多线程下 getattr / lookup 的热路径
+ * (dentry 缓存 → inode_get → 读锁复制属性 → inode_put)，
+ * 线程数从 1 增加到 32，输出每秒操作数。
+ *
+ * 用法: bench_icache [秒/轮 (默认 1)] [文件数 (默认 10000)]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "../src/kvbfs.h"
+#include "../src/context.h"
+#include "../src/inode.h"
+#include "../src/kv_store.h"
+
+struct kvbfs_ctx *g_ctx = NULL;
+
+#define BENCH_DB_PATH   "/tmp/bench_icache_db"
+#define MAX_THREADS     32
+
+static uint64_t *g_inos;
+static char (*g_names)[32];
+static int g_nfiles;
+static volatile int g_stop;
+
+struct worker {
+    pthread_t thread;
+    unsigned seed;
+    int lookup;             /* 0 = getattr, 1 = lookup */
+    uint64_t ops;
+};
+
+static int bench_getattr(uint64_t ino, struct stat *st)
+{
+    struct kvbfs_inode_cache *ic = inode_get(ino);
+    if (!ic) return -1;
+
+    pthread_rwlock_rdlock(&ic->lock);
+    memset(st, 0, sizeof(*st));
+    st->st_ino = ic->inode.ino;
+    st->st_mode = ic->inode.mode;
+    st->st_size = ic->inode.size;
+    pthread_rwlock_unlock(&ic->lock);
+
+    inode_put(ic);
+    return 0;
+}
+
+/* 与 kvbfs_lookup 相同的路径：先查 dentry 缓存，未命中再读 KV */
+static int bench_lookup(const char *name, struct stat *st)
+{
+    uint64_t ino, gen;
+    if (dcache_lookup(&g_ctx->dcache, KVBFS_ROOT_INO, name, &ino, &gen) != 0) {
+        char key[KVBFS_KEY_MAX];
+        int keylen = kvbfs_key_dirent(key, sizeof(key), KVBFS_ROOT_INO, name);
+        char *val = NULL;
+        size_t vlen = 0;
+        struct kvbfs_dirent de = {0};
+        if (kv_get(g_ctx->db, key, keylen, &val, &vlen) == 0)
+            kvbfs_dirent_decode(val, vlen, &de);
+        free(val);
+        ino = de.ino;
+        dcache_insert(&g_ctx->dcache, KVBFS_ROOT_INO, name, ino, gen);
+    }
+    if (ino == 0) return -1;
+    return bench_getattr(ino, st);
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct stat st;
+
+    while (!g_stop) {
+        for (int i = 0; i < 256; i++) {
+            int k = rand_r(&w->seed) % g_nfiles;
+            if (w->lookup)
+                bench_lookup(g_names[k], &st);
+            else
+                bench_getattr(g_inos[k], &st);
+        }
+        w->ops += 256;
+    }
+    return NULL;
+}
+
+static double run_round(int nthreads, int lookup, double seconds)
+{
+    struct worker w[MAX_THREADS];
+    g_stop = 0;
+
+    for (int i = 0; i < nthreads; i++) {
+        w[i].seed = 12345u + i;
+        w[i].lookup = lookup;
+        w[i].ops = 0;
+        pthread_create(&w[i].thread, NULL, worker_main, &w[i]);
+    }
+
+    struct timespec ts = {
+        .tv_sec = (time_t)seconds,
+        .tv_nsec = (long)((seconds - (time_t)seconds) * 1e9),
+    };
+    nanosleep(&ts, NULL);
+    g_stop = 1;
+
+    uint64_t total = 0;
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(w[i].thread, NULL);
+        total += w[i].ops;
+    }
+    return total / seconds;
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    g_nfiles = argc > 2 ? atoi(argv[2]) : 10000;
+    if (seconds <= 0 || g_nfiles <= 0) {
+        fprintf(stderr, "usage: %s [seconds] [files]\n", argv[0]);
+        return 1;
+    }
+
+    char cmd[256];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", BENCH_DB_PATH);
+    system(cmd);
+
+    g_ctx = ctx_init(BENCH_DB_PATH);
+    if (!g_ctx) return 1;
+
+    /* 准备文件：inode + 根目录项 */
+    g_inos = calloc(g_nfiles, sizeof(*g_inos));
+    g_names = calloc(g_nfiles, sizeof(*g_names));
+    if (!g_inos || !g_names) return 1;
+
+    for (int i = 0; i < g_nfiles; i++) {
+        struct kvbfs_inode_cache *ic = inode_create(S_IFREG | 0644);
+        if (!ic) return 1;
+        g_inos[i] = ic->inode.ino;
+        inode_put(ic);
+
+        snprintf(g_names[i], sizeof(g_names[i]), "file%d", i);
+        char key[KVBFS_KEY_MAX];
+        int keylen = kvbfs_key_dirent(key, sizeof(key), KVBFS_ROOT_INO, g_names[i]);
+        struct kvbfs_dirent de = { .ino = g_inos[i], .type = S_IFREG };
+        kv_put(g_ctx->db, key, keylen, (const char *)&de, sizeof(de));
+    }
+
+    printf("%d files, %.1fs per round, %d cache shards\n\n",
+           g_nfiles, seconds, KVBFS_ICACHE_SHARDS);
+    printf("%8s %16s %16s\n", "threads", "getattr ops/s", "lookup ops/s");
+    for (int t = 1; t <= MAX_THREADS; t *= 2) {
+        double g = run_round(t, 0, seconds);
+        double l = run_round(t, 1, seconds);
+        printf("%8d %16.0f %16.0f\n", t, g, l);
+    }
+
+    free(g_inos);
+    free(g_names);
+    ctx_destroy(g_ctx);
+    g_ctx = NULL;
+    return 0;
+}
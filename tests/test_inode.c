@@ -2,13 +2,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include <pthread.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <sys/xattr.h>
 
 #include "../src/kvbfs.h"
 #include "../src/inode.h"
 #include "../src/kv_store.h"
 #include "../src/super.h"
+#include "../src/version.h"
+#include "../src/vdiff.h"
+#include "../src/vcas.h"
 
 /* 测试程序中定义全局上下文（主程序中在 main.c 定义） */
 struct kvbfs_ctx *g_ctx = NULL;
@@ -40,9 +46,8 @@ static void setup(void)
     g_ctx->db = kv_open(TEST_DB_PATH);
     assert(g_ctx->db);
 
-    pthread_mutex_init(&g_ctx->icache_lock, NULL);
     pthread_mutex_init(&g_ctx->alloc_lock, NULL);
-    g_ctx->icache = NULL;
+    inode_cache_init(g_ctx);
 
     /* Init superblock */
     assert(super_load(g_ctx) == 0);
@@ -53,7 +58,7 @@ static void teardown(void)
     inode_cache_clear();
 
     if (g_ctx->db) kv_close(g_ctx->db);
-    pthread_mutex_destroy(&g_ctx->icache_lock);
+    inode_cache_destroy(g_ctx);
     pthread_mutex_destroy(&g_ctx->alloc_lock);
     free(g_ctx);
     g_ctx = NULL;
@@ -311,6 +316,1241 @@ static void test_concurrent_delete(void)
     #undef NUM_THREADS2
 }
 
+/* Path resolution via the p: reverse index, including legacy backfill */
+static void test_path_resolve(void)
+{
+    setup();
+
+    /* Legacy dirents without p: records: /a (dir 100) → /a/b (file 101) */
+    uint64_t a = 100, b = 101;
+    char key[KVBFS_KEY_MAX];
+    int keylen = kvbfs_key_dirent(key, sizeof(key), KVBFS_ROOT_INO, "a");
+    assert(kv_put(g_ctx->db, key, keylen, (const char *)&a, sizeof(a)) == 0);
+    keylen = kvbfs_key_dirent(key, sizeof(key), a, "b");
+    assert(kv_put(g_ctx->db, key, keylen, (const char *)&b, sizeof(b)) == 0);
+
+    /* A backfill cut short after its first batch is finished, not trusted */
+    kv_batch_t *batch = kv_batch_new();
+    assert(path_link_batch(batch, a, KVBFS_ROOT_INO, "a") == 0);
+    assert(kv_batch_commit(g_ctx->db, batch) == 0);
+    kv_batch_free(batch);
+
+    assert(path_init(&g_ctx->paths, g_ctx->db) == 0);
+
+    char path[256];
+    assert(path_resolve(&g_ctx->paths, g_ctx->db, b, path, sizeof(path)) == 0);
+    assert(strcmp(path, "/a/b") == 0);
+
+    /* Hard link in a second directory; first link still resolves */
+    batch = kv_batch_new();
+    assert(path_link_batch(batch, b, KVBFS_ROOT_INO, "c") == 0);
+    assert(kv_batch_commit(g_ctx->db, batch) == 0);
+    kv_batch_free(batch);
+
+    /* Drop the original link: cached path must not be reused */
+    batch = kv_batch_new();
+    assert(path_unlink_batch(batch, b, a, "b") == 0);
+    assert(kv_batch_commit(g_ctx->db, batch) == 0);
+    kv_batch_free(batch);
+    path_forget(&g_ctx->paths, b);
+
+    assert(path_resolve(&g_ctx->paths, g_ctx->db, b, path, sizeof(path)) == 0);
+    assert(strcmp(path, "/c") == 0);
+
+    /* Unknown inode falls back to "ino:<n>" */
+    assert(path_resolve(&g_ctx->paths, g_ctx->db, 999, path, sizeof(path)) == -1);
+    assert(strcmp(path, "ino:999") == 0);
+
+    path_destroy(&g_ctx->paths);
+    teardown();
+}
+
+/* Dentry cache: negative entries, stale fills, LRU bound */
+static void test_dcache(void)
+{
+    struct dcache dc;
+    setenv("KVBFS_DCACHE_SIZE", "32", 1);   /* 2 entries per shard */
+    dcache_init(&dc);
+    unsetenv("KVBFS_DCACHE_SIZE");
+
+    uint64_t ino, gen;
+    assert(dcache_lookup(&dc, 1, "missing", &ino, &gen) == DCACHE_MISS);
+    dcache_insert(&dc, 1, "missing", 0, gen);
+    assert(dcache_lookup(&dc, 1, "missing", &ino, &gen) == 0 && ino == 0);
+
+    /* A fill that raced with an invalidation is dropped */
+    assert(dcache_lookup(&dc, 1, "f", &ino, &gen) == DCACHE_MISS);
+    dcache_invalidate(&dc, 1, "f");
+    dcache_insert(&dc, 1, "f", 0, gen);
+    assert(dcache_lookup(&dc, 1, "f", &ino, &gen) == DCACHE_MISS);
+    dcache_insert(&dc, 1, "f", 42, gen);
+    assert(dcache_lookup(&dc, 1, "f", &ino, &gen) == 0 && ino == 42);
+
+    /* Invalidation removes the negative entry */
+    dcache_invalidate(&dc, 1, "missing");
+    assert(dcache_lookup(&dc, 1, "missing", &ino, &gen) == DCACHE_MISS);
+
+    /* Size stays bounded */
+    for (int i = 0; i < 1000; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "n%d", i);
+        dcache_lookup(&dc, 2, name, &ino, &gen);
+        dcache_insert(&dc, 2, name, i + 1, gen);
+    }
+    struct dcache_stats st;
+    dcache_get_stats(&dc, &st);
+    assert(st.entries <= 32);
+    assert(st.evictions > 0);
+    assert(st.hits == 1 && st.negative_hits == 1);
+
+    dcache_destroy(&dc);
+}
+
+/* Unreferenced inodes are evicted under the budget and reload intact */
+static void test_cache_eviction(void)
+{
+    setenv("KVBFS_ICACHE_MB", "0", 1);      /* one idle entry per shard */
+    setup();
+    unsetenv("KVBFS_ICACHE_MB");
+
+    uint64_t inos[500];
+    struct kvbfs_inode_cache *pinned = inode_create(S_IFREG | 0644);
+    assert(pinned);
+
+    for (int i = 0; i < 500; i++) {
+        struct kvbfs_inode_cache *ic = inode_create(S_IFREG | 0600);
+        assert(ic);
+        inos[i] = ic->inode.ino;
+        pthread_rwlock_wrlock(&ic->lock);
+        ic->inode.size = 1000 + i;
+        pthread_rwlock_unlock(&ic->lock);
+        assert(inode_sync(ic) == 0);
+        inode_put(ic);
+    }
+
+    uint64_t entries, evictions, writes;
+    inode_cache_stats(&entries, &evictions, &writes);
+    assert(entries <= KVBFS_ICACHE_SHARDS + 1);
+    assert(evictions > 0);
+
+    /* Referenced entries are never evicted */
+    struct kvbfs_inode_cache *again = inode_get(pinned->inode.ino);
+    assert(again == pinned);
+    inode_put(again);
+
+    for (int i = 0; i < 500; i++) {
+        struct kvbfs_inode_cache *ic = inode_get(inos[i]);
+        assert(ic);
+        assert(ic->inode.size == (uint64_t)(1000 + i));
+        inode_put(ic);
+    }
+
+    /* forget on an uncached or unknown inode is harmless */
+    inode_lookup_inc(inos[0]);
+    inode_forget(inos[0], 5);
+    inode_forget(999999, 1);
+
+    inode_put(pinned);
+    teardown();
+}
+
+/* Dirty inodes are written back once, together with the ow: record */
+static void test_writeback(void)
+{
+    setup();
+
+    struct kvbfs_inode_cache *ic = inode_create(S_IFREG | 0644);
+    assert(ic);
+    uint64_t ino = ic->inode.ino;
+
+    char key[64];
+    int keylen = kvbfs_key_orphan_wb(key, sizeof(key), ino);
+    char *val = NULL;
+    size_t vlen = 0;
+
+    /* First growth past the stored size adds the intent record, once */
+    kv_batch_t *batch = kv_batch_new();
+    assert(batch);
+    pthread_rwlock_wrlock(&ic->lock);
+    assert(inode_writeback_batch(batch, ic, 8192));
+    assert(!inode_writeback_batch(batch, ic, 16384));
+    pthread_rwlock_unlock(&ic->lock);
+    assert(kv_batch_commit(g_ctx->db, batch) == 0);
+    kv_batch_free(batch);
+    assert(kv_get(g_ctx->db, key, keylen, &val, &vlen) == 0);
+    free(val);
+
+    uint64_t e0, ev0, w0;
+    inode_cache_stats(&e0, &ev0, &w0);
+
+    for (int i = 1; i <= 4; i++) {
+        pthread_rwlock_wrlock(&ic->lock);
+        ic->inode.size = 4096 * i;
+        inode_mark_dirty(ic);
+        pthread_rwlock_unlock(&ic->lock);
+    }
+    inode_put(ic);
+
+    /* Nothing reaches the store until the flush */
+    struct kvbfs_inode stored;
+    assert(inode_load(ino, &stored) == 0);
+    assert(stored.size == 0);
+
+    assert(inode_sync_all() == 0);
+    assert(inode_load(ino, &stored) == 0);
+    assert(stored.size == 16384);
+    val = NULL;
+    assert(kv_get(g_ctx->db, key, keylen, &val, &vlen) != 0);
+
+    uint64_t e1, ev1, w1;
+    inode_cache_stats(&e1, &ev1, &w1);
+    assert(w1 - w0 == 1);
+
+    /* Clean inodes are skipped */
+    assert(inode_sync_all() == 0);
+    inode_cache_stats(&e1, &ev1, &w1);
+    assert(w1 - w0 == 1);
+
+    teardown();
+}
+
+/* Inode numbers come from per-thread batches under a persisted high-water mark */
+#define ALLOC_THREADS   8
+#define ALLOC_PER       1000
+
+static void *thread_alloc(void *arg)
+{
+    uint64_t *out = arg;
+    for (int i = 0; i < ALLOC_PER; i++)
+        out[i] = inode_alloc();
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t stored_next_ino(void)
+{
+    char *val = NULL;
+    size_t vlen = 0;
+    struct kvbfs_super sb;
+    assert(kv_get(g_ctx->db, KVBFS_KEY_SUPER, strlen(KVBFS_KEY_SUPER),
+                  &val, &vlen) == 0);
+    assert(vlen == sizeof(sb));
+    memcpy(&sb, val, sizeof(sb));
+    free(val);
+    return sb.next_ino;
+}
+
+static void test_ino_alloc(void)
+{
+    setup();
+
+    /* One superblock write covers a whole chunk */
+    uint64_t first = inode_alloc();
+    uint64_t mark = stored_next_ino();
+    assert(mark > first);
+    for (int i = 0; i < 100; i++) assert(inode_alloc() < mark);
+    assert(stored_next_ino() == mark);
+
+    static uint64_t got[ALLOC_THREADS * ALLOC_PER];
+    pthread_t threads[ALLOC_THREADS];
+    for (int i = 0; i < ALLOC_THREADS; i++)
+        assert(pthread_create(&threads[i], NULL, thread_alloc,
+                              &got[i * ALLOC_PER]) == 0);
+    for (int i = 0; i < ALLOC_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    qsort(got, ALLOC_THREADS * ALLOC_PER, sizeof(uint64_t), cmp_u64);
+    for (int i = 1; i < ALLOC_THREADS * ALLOC_PER; i++)
+        assert(got[i] != got[i - 1]);
+    assert(got[0] > first);
+
+    /* After a crash the stored mark is above everything handed out */
+    uint64_t max = got[ALLOC_THREADS * ALLOC_PER - 1];
+    assert(stored_next_ino() > max);
+    assert(super_load(g_ctx) == 0);
+    assert(inode_alloc() > max);
+
+    teardown();
+}
+
+#undef ALLOC_THREADS
+#undef ALLOC_PER
+
+/* Directory counters follow links, unlinks and write-back, and match a recount */
+static void link_child(uint64_t parent, const char *name, uint64_t child,
+                       uint32_t mode, uint64_t size)
+{
+    char key[KVBFS_KEY_MAX];
+    int keylen = kvbfs_key_dirent(key, sizeof(key), parent, name);
+    struct kvbfs_dirent de = { .ino = child, .type = mode & S_IFMT };
+    struct kvbfs_usage cu;
+    usage_child(g_ctx->db, child, mode, size, &cu);
+
+    kv_batch_t *batch = kv_batch_new();
+    assert(batch);
+    kv_batch_put(batch, key, keylen, (const char *)&de, sizeof(de));
+    assert(path_link_batch(batch, child, parent, name) == 0);
+    assert(usage_link_batch(&g_ctx->usage, batch, g_ctx->db, parent, &cu) == 0);
+    assert(kv_batch_commit(g_ctx->db, batch) == 0);
+    kv_batch_free(batch);
+}
+
+static void assert_usage(uint64_t dir, int64_t entries, int64_t inodes,
+                         int64_t bytes)
+{
+    struct kvbfs_usage u;
+    usage_get(g_ctx->db, dir, &u);
+    assert(u.entries == entries);
+    assert(u.inodes == inodes);
+    assert(u.bytes == bytes);
+}
+
+static void test_usage(void)
+{
+    setup();
+    assert(usage_init(&g_ctx->usage, g_ctx->db) == 0);
+    assert_usage(KVBFS_ROOT_INO, 0, 0, 0);
+
+    struct kvbfs_inode_cache *dir = inode_create(S_IFDIR | 0755);
+    struct kvbfs_inode_cache *file = inode_create(S_IFREG | 0644);
+    assert(dir && file);
+    uint64_t d = dir->inode.ino, f = file->inode.ino;
+    link_child(KVBFS_ROOT_INO, "dir", d, S_IFDIR, 0);
+    link_child(d, "file", f, S_IFREG, 0);
+    assert_usage(d, 1, 1, 0);
+    assert_usage(KVBFS_ROOT_INO, 1, 2, 0);
+
+    /* Growth is charged to every ancestor when the size is written back */
+    pthread_rwlock_wrlock(&file->lock);
+    file->inode.size = 5000;
+    inode_mark_dirty(file);
+    pthread_rwlock_unlock(&file->lock);
+    assert_usage(d, 1, 1, 0);
+    assert(inode_sync(file) == 0);
+    assert_usage(d, 1, 1, 5000);
+    assert_usage(KVBFS_ROOT_INO, 1, 2, 5000);
+
+    /* A second link is charged separately */
+    link_child(KVBFS_ROOT_INO, "hard", f, S_IFREG, file->synced_size);
+    assert_usage(KVBFS_ROOT_INO, 2, 3, 10000);
+
+    /* Recounting from the dirents gives the same totals */
+    kv_batch_t *batch = kv_batch_new();
+    assert(batch);
+    kv_batch_delete_prefix(batch, "u:", 2);
+    assert(kv_batch_commit(g_ctx->db, batch) == 0);
+    kv_batch_free(batch);
+    usage_destroy(&g_ctx->usage);
+    assert(usage_init(&g_ctx->usage, g_ctx->db) == 0);
+    assert_usage(d, 1, 1, 5000);
+    assert_usage(KVBFS_ROOT_INO, 2, 3, 10000);
+
+    /* Removing the directory takes its whole subtree off the root */
+    struct kvbfs_usage cu;
+    usage_child(g_ctx->db, d, S_IFDIR, 0, &cu);
+    batch = kv_batch_new();
+    assert(batch);
+    usage_unlink_batch(&g_ctx->usage, batch, g_ctx->db, KVBFS_ROOT_INO, &cu);
+    assert(kv_batch_commit(g_ctx->db, batch) == 0);
+    kv_batch_free(batch);
+    assert_usage(KVBFS_ROOT_INO, 1, 1, 5000);
+
+    inode_put(file);
+    inode_put(dir);
+    usage_destroy(&g_ctx->usage);
+    teardown();
+}
+
+static int count_prefix(const char *prefix, size_t plen)
+{
+    int n = 0;
+    kv_iterator_t *iter = kv_iter_prefix(g_ctx->db, prefix, plen);
+    for (; kv_iter_valid(iter); kv_iter_next(iter)) n++;
+    kv_iter_free(iter);
+    return n;
+}
+
+/* Xattrs share one packed record, large values spill, old keys get folded in */
+static void test_xattr(void)
+{
+    setup();
+    struct kvbfs_inode_cache *ic = inode_create(S_IFREG | 0644);
+    assert(ic);
+    uint64_t ino = ic->inode.ino;
+    char *val = NULL, *list = NULL;
+    size_t len = 0;
+
+    /* Nothing set: negative answers come from the cached empty set */
+    assert(xattr_get(ic, "user.a", &val, &len) == ENODATA);
+    assert(ic->xattrs_cached && ic->xattrs == NULL);
+    assert(xattr_list(ic, &list, &len) == 0 && len == 0 && !list);
+
+    assert(xattr_set(ic, "user.a", "one", 3, 0) == 0);
+    assert(xattr_set(ic, "user.a", "x", 1, XATTR_CREATE) == EEXIST);
+    assert(xattr_set(ic, "user.b", "x", 1, XATTR_REPLACE) == ENODATA);
+    assert(xattr_set(ic, "user.b", "two", 3, 0) == 0);
+
+    char big[XATTR_INLINE_MAX + 100];
+    memset(big, 'z', sizeof(big));
+    assert(xattr_set(ic, "user.big", big, sizeof(big), 0) == 0);
+
+    /* Drop the cache so everything below is read back from the store */
+    inode_put(ic);
+    inode_cache_clear();
+    ic = inode_get(ino);
+    assert(ic && !ic->xattrs_cached);
+
+    assert(xattr_get(ic, "user.a", &val, &len) == 0);
+    assert(len == 3 && memcmp(val, "one", 3) == 0);
+    free(val);
+    assert(xattr_get(ic, "user.big", &val, &len) == 0);
+    assert(len == sizeof(big) && memcmp(val, big, len) == 0);
+    free(val);
+    assert(xattr_list(ic, &list, &len) == 0);
+    assert(len == sizeof("user.a") + sizeof("user.b") + sizeof("user.big"));
+    free(list);
+
+    /* Only the spilled value keeps its own key */
+    char prefix[64];
+    int plen = kvbfs_key_xattr_prefix(prefix, sizeof(prefix), ino);
+    assert(count_prefix(prefix, plen) == 1);
+    assert(xattr_remove(ic, "user.big") == 0);
+    assert(count_prefix(prefix, plen) == 0);
+    assert(xattr_remove(ic, "user.big") == ENODATA);
+
+    /* A per-key record from an older database is packed on migration */
+    char key[KVBFS_KEY_MAX];
+    int keylen = kvbfs_key_xattr(key, sizeof(key), ino, "user.old");
+    assert(kv_put(g_ctx->db, key, keylen, "legacy", 6) == 0);
+    assert(xattr_migrate(g_ctx->db) == 0);
+    assert(count_prefix(prefix, plen) == 0);
+    inode_put(ic);
+    inode_cache_clear();
+    ic = inode_get(ino);
+    assert(ic);
+    assert(xattr_get(ic, "user.old", &val, &len) == 0);
+    assert(len == 6 && memcmp(val, "legacy", 6) == 0);
+    free(val);
+
+    inode_put(ic);
+    teardown();
+}
+
+/* Warmup fills unreferenced entries, never evicts, and drops stale reads */
+static void test_preload(void)
+{
+    setup();
+    struct kvbfs_inode_cache *ic = inode_create(S_IFREG | 0644);
+    assert(ic);
+    struct kvbfs_inode a = ic->inode;
+    inode_put(ic);
+    ic = inode_create(S_IFREG | 0644);
+    assert(ic);
+    struct kvbfs_inode b = ic->inode;
+    inode_put(ic);
+    inode_cache_clear();
+
+    uint64_t gens[KVBFS_ICACHE_SHARDS];
+    inode_cache_gens(gens);
+    assert(inode_preload(&a, gens) == 1);
+    assert(inode_preload(&a, gens) == 0);      /* already cached */
+    struct kvbfs_inode got;
+    assert(inode_peek(a.ino, &got) == 0 && got.ino == a.ino);
+
+    /* An inode deleted after the read must not come back */
+    inode_cache_gens(gens);
+    inode_mark_deleted(b.ino);
+    assert(inode_preload(&b, gens) == 0);
+    assert(inode_peek(b.ino, &got) != 0);
+
+    /* A full shard keeps its entries */
+    size_t saved = g_ctx->icache_shard_max;
+    g_ctx->icache_shard_max = 1;
+    struct kvbfs_inode c = a;
+    c.ino = a.ino + KVBFS_ICACHE_SHARDS;       /* same shard as a */
+    inode_cache_gens(gens);
+    assert(inode_preload(&c, gens) == 0);
+    assert(inode_peek(a.ino, &got) == 0);
+    g_ctx->icache_shard_max = saved;
+
+    /* The hot list reports what is cached */
+    uint64_t hot[8];
+    assert(inode_hot_list(hot, 8) == 1 && hot[0] == a.ino);
+    teardown();
+}
+
+/* Slabs recycle freed objects, request buffers grow and are reused */
+static void test_slab(void)
+{
+    struct slab sl;
+    slab_init(&sl, 24);
+    void *objs[SLAB_CHUNK_OBJS + 1];
+    for (int i = 0; i <= SLAB_CHUNK_OBJS; i++) {
+        objs[i] = slab_zalloc(&sl);
+        assert(objs[i]);
+        assert(((uintptr_t)objs[i] % sizeof(void *)) == 0);
+        memset(objs[i], 0xab, 24);
+    }
+    assert(sl.n_chunks == 2 && sl.n_live == SLAB_CHUNK_OBJS + 1);
+
+    /* A freed object is handed out again, zeroed */
+    slab_free(&sl, objs[3]);
+    char *again = slab_zalloc(&sl);
+    assert(again == objs[3]);
+    for (int i = 0; i < 24; i++) assert(again[i] == 0);
+    for (int i = 0; i <= SLAB_CHUNK_OBJS; i++) slab_free(&sl, objs[i]);
+    assert(sl.n_live == 0 && sl.n_free == 2 * SLAB_CHUNK_OBJS);
+    slab_destroy(&sl);
+
+    char *rb = reqbuf_get(100);
+    assert(rb && reqbuf_get(4096) == rb);
+    assert(reqbuf_bytes() >= REQBUF_INITIAL);
+    char *big = reqbuf_get(3 * REQBUF_INITIAL);
+    assert(big);
+    memset(big, 0, 3 * REQBUF_INITIAL);
+    assert(reqbuf_get(REQBUF_INITIAL) == big);
+
+    /* Inode cache entries come from the shard slabs */
+    setup();
+    uint64_t live0, live, idle, chunks;
+    inode_cache_slab_stats(&live0, &idle, &chunks);
+    struct kvbfs_inode_cache *ic = inode_create(S_IFREG | 0644);
+    assert(ic);
+    inode_cache_slab_stats(&live, &idle, &chunks);
+    assert(live == live0 + 1 && chunks >= 1);
+    inode_put(ic);
+    inode_cache_clear();
+    inode_cache_slab_stats(&live, &idle, &chunks);
+    assert(live == 0 && idle == chunks * SLAB_CHUNK_OBJS);
+    teardown();
+}
+
+/* I/O pool: exclusive tasks keep submission order, shared tasks stay bounded */
+static int io_log[400];
+static int io_log_len;
+static int io_active[4];
+static int io_max_active[4];
+static pthread_mutex_t io_test_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void io_test_run(struct io_task *t)
+{
+    pthread_mutex_lock(&io_test_lock);
+    int a = ++io_active[t->ino];
+    if (a > io_max_active[t->ino]) io_max_active[t->ino] = a;
+    /* Exclusive tasks never overlap anything on the same inode */
+    assert(!t->exclusive || a == 1);
+    if (t->exclusive) io_log[io_log_len++] = (int)t->off;
+    pthread_mutex_unlock(&io_test_lock);
+
+    usleep(100);
+
+    pthread_mutex_lock(&io_test_lock);
+    io_active[t->ino]--;
+    pthread_mutex_unlock(&io_test_lock);
+}
+
+static int io_feed;
+
+/* Keep the pool busy on inode 0 until io_feed drops */
+static void *io_feed_run(void *arg)
+{
+    struct iopool *p = arg;
+    while (__atomic_load_n(&io_feed, __ATOMIC_ACQUIRE)) {
+        struct io_task *t = iopool_task(p);
+        assert(t);
+        iopool_submit(p, t);
+        usleep(20);
+    }
+    return NULL;
+}
+
+static void test_iopool(void)
+{
+    setenv("KVBFS_IO_THREADS", "8", 1);
+    setenv("KVBFS_IO_INODE_INFLIGHT", "2", 1);
+    struct iopool p;
+    iopool_init(&p);
+    unsetenv("KVBFS_IO_THREADS");
+    unsetenv("KVBFS_IO_INODE_INFLIGHT");
+    assert(iopool_start(&p, io_test_run) == 0 && iopool_running(&p));
+
+    /* Inode 1 alternates shared and exclusive tasks, inode 2 is all shared */
+    int n_excl = 0;
+    for (int i = 0; i < 600; i++) {
+        struct io_task *t = iopool_task(&p);
+        assert(t);
+        t->ino = (i % 3 == 2) ? 2 : 1;
+        t->exclusive = (t->ino == 1 && i % 2 == 0);
+        t->off = t->exclusive ? n_excl++ : -1;
+        iopool_submit(&p, t);
+    }
+
+    /* Waiting on the whole pool covers earlier tasks, not later arrivals */
+    struct iopool_stats st;
+    pthread_t feeder;
+    __atomic_store_n(&io_feed, 1, __ATOMIC_RELEASE);
+    assert(pthread_create(&feeder, NULL, io_feed_run, &p) == 0);
+    iopool_wait(&p, 0);
+    iopool_get_stats(&p, &st);
+    assert(st.completed >= 600);
+    __atomic_store_n(&io_feed, 0, __ATOMIC_RELEASE);
+    pthread_join(feeder, NULL);
+    uint64_t fed = st.submitted;
+
+    iopool_stop(&p);
+    assert(!iopool_running(&p));
+
+    iopool_get_stats(&p, &st);
+    assert(st.submitted >= fed && st.completed == st.submitted && st.queued == 0);
+    assert(st.deferred > 0);
+    assert(io_log_len == n_excl);
+    for (int i = 0; i < io_log_len; i++) assert(io_log[i] == i);
+    assert(io_max_active[1] <= 2 && io_max_active[2] <= 2);
+
+    /* A stopped pool runs tasks inline */
+    struct io_task *t = iopool_task(&p);
+    t->ino = 3;
+    iopool_submit(&p, t);
+    assert(io_max_active[3] == 1 && io_active[3] == 0);
+    iopool_destroy(&p);
+}
+
+/* Fill block blk of ic with c the way a write does, tracking it for versions */
+static void version_write_block(struct kvbfs_inode_cache *ic, uint64_t blk, char c)
+{
+    char data[KVBFS_BLOCK_SIZE];
+    memset(data, c, sizeof(data));
+    char key[64];
+    int keylen = kvbfs_key_block(key, sizeof(key), ic->inode.ino, blk);
+
+    pthread_rwlock_wrlock(&ic->lock);
+    kv_batch_t *batch = kv_batch_new();
+    kv_batch_put(batch, key, keylen, data, sizeof(data));
+    version_mark_dirty(batch, ic, blk, blk + 1);
+    assert(kv_batch_commit(g_ctx->db, batch) == 0);
+    kv_batch_free(batch);
+    if ((blk + 1) * KVBFS_BLOCK_SIZE > ic->inode.size) {
+        ic->inode.size = (blk + 1) * KVBFS_BLOCK_SIZE;
+        ic->inode.blocks = blk + 1;
+    }
+    pthread_rwlock_unlock(&ic->lock);
+    inode_sync(ic);
+}
+
+static char version_block_byte(uint64_t ino, uint64_t ver, uint64_t blk)
+{
+    char *data = NULL;
+    size_t len = 0;
+    if (version_read_block(ino, ver, blk, &data, &len) != 0) return 0;
+    assert(len == KVBFS_BLOCK_SIZE);
+    char c = data[0];
+    free(data);
+    return c;
+}
+
+/* Snapshots record only changed blocks and share the rest across versions */
+static void test_version_cow(void)
+{
+    setup();
+    struct kvbfs_inode_cache *ic = inode_create(S_IFREG | 0644);
+    assert(ic);
+    uint64_t ino = ic->inode.ino;
+    char prefix[64];
+    int plen = snprintf(prefix, sizeof(prefix), "vx:%lu:", (unsigned long)ino);
+    struct kvbfs_version_meta meta;
+
+    for (int i = 0; i < 8; i++) version_write_block(ic, i, 'a' + i);
+    assert(version_snapshot(ino) == 0);
+    assert(version_get_meta(ino, 0, &meta) == 0);
+    assert(meta.format == VERSION_FORMAT_DELTA && meta.changed == 8);
+
+    /* One changed block costs one record */
+    version_write_block(ic, 3, 'X');
+    assert(version_snapshot(ino) == 0);
+    assert(version_get_meta(ino, 1, &meta) == 0 && meta.changed == 1);
+    assert(count_prefix(prefix, plen) == 9);
+    assert(version_block_byte(ino, 0, 3) == 'd');
+    assert(version_block_byte(ino, 1, 3) == 'X');
+    assert(version_block_byte(ino, 1, 7) == 'h');
+
+    /* A range read spans shared records, partial blocks and full copies */
+    static char range[3 * KVBFS_BLOCK_SIZE];
+    uint64_t roff = 2 * KVBFS_BLOCK_SIZE + 5;
+    assert(version_get_meta(ino, 1, &meta) == 0);
+    assert(version_read_range(ino, 1, &meta, range, sizeof(range), roff) == 0);
+    assert(range[0] == 'c' && range[KVBFS_BLOCK_SIZE - 6] == 'c');
+    assert(range[KVBFS_BLOCK_SIZE - 5] == 'X' && range[sizeof(range) - 1] == 'f');
+    struct kvbfs_version_meta copy = { .format = VERSION_FORMAT_COPY };
+    char key[96];
+    int keylen = kvbfs_key_version_block(key, sizeof(key), ino, 99, 1);
+    assert(kv_put(g_ctx->db, key, keylen, "tail", 4) == 0);
+    memset(range, 1, sizeof(range));
+    assert(version_read_range(ino, 99, &copy, range, 8, KVBFS_BLOCK_SIZE - 2) == 0);
+    assert(range[0] == 0 && range[1] == 0 && memcmp(range + 2, "tail", 4) == 0);
+    assert(range[6] == 0 && range[7] == 0);
+    assert(kv_delete(g_ctx->db, key, keylen) == 0);
+
+    /* Nothing changed, or the same bytes rewritten: no new version */
+    assert(version_snapshot(ino) == 0);
+    version_write_block(ic, 5, 'f');
+    assert(version_snapshot(ino) == 0);
+    assert(version_get_current(ino) == 2);
+
+    /* Tracking lost with the cache entry: the marker forces a full compare */
+    version_write_block(ic, 6, 'Y');
+    inode_put(ic);
+    inode_cache_clear();
+    assert(version_snapshot(ino) == 0);
+    assert(version_get_meta(ino, 2, &meta) == 0 && meta.changed == 1);
+    assert(version_block_byte(ino, 2, 6) == 'Y');
+    ic = inode_get(ino);
+    assert(ic);
+
+    /* Deleting a version hands shared records to the next surviving one */
+    for (int i = 0; i < 4; i++) {
+        version_write_block(ic, 0, i % 2 ? 'p' : 'q');
+        assert(version_snapshot(ino) == 0);
+    }
+    size_t keys = 0;
+    assert(version_delete(ino, 0, &keys) == KVBFS_BLOCK_SIZE && keys > 0);
+    assert(version_delete(ino, 1, &keys) == KVBFS_BLOCK_SIZE);
+    assert(version_get_meta(ino, 1, &meta) != 0);
+    assert(version_block_byte(ino, 2, 7) == 'h');
+    assert(version_block_byte(ino, 2, 3) == 'X');
+    assert(version_block_byte(ino, 2, 6) == 'Y');
+    assert(version_block_byte(ino, 6, 0) == 'p');
+    assert(count_prefix(prefix, plen) == 8 + 4);
+
+    version_delete_all(ino);
+    assert(count_prefix(prefix, plen) == 0);
+    assert(version_get_current(ino) == 0);
+
+    inode_put(ic);
+    teardown();
+}
+
+/* Retention keeps the newest version per hour and day, caps thin recent first */
+static void test_version_retention(void)
+{
+    setup();
+    struct version_policy pol;
+    version_policy_default(&pol);
+    assert(pol.max_count == KVBFS_MAX_VERSIONS);
+    assert(version_policy_parse("all=10m,hourly=2h,daily=0,bytes=1M", 34, &pol) == 0);
+    assert(pol.keep_all == 600 && pol.hourly == 7200 && pol.daily == 0);
+    assert(pol.max_bytes == 1 << 20 && pol.max_count == KVBFS_MAX_VERSIONS);
+    assert(version_policy_parse("count=5h", 8, &pol) != 0);
+    assert(version_policy_parse("count=5s", 8, &pol) != 0);
+    assert(version_policy_parse("bytes=1m", 8, &pol) != 0);
+    assert(version_policy_parse("weekly=1d", 9, &pol) != 0);
+    assert(pol.max_bytes == 1 << 20);
+
+    struct kvbfs_inode_cache *ic = inode_create(S_IFREG | 0644);
+    assert(ic);
+    uint64_t ino = ic->inode.ino;
+    for (int i = 0; i < 11; i++) {
+        version_write_block(ic, 0, 'a' + i);
+        assert(version_snapshot(ino) == 0);
+    }
+    uint64_t *vers;
+    size_t n;
+    assert(version_list(ino, &vers, &n) == 0 && n == 11);
+    for (size_t i = 0; i < n; i++) assert(vers[i] == i);
+    free(vers);
+
+    /* Noon of some day; v0-v4 are past the daily tier */
+    const int64_t now = 1000 * 86400 + 12 * 3600;
+    const int64_t created[11] = {
+        now - 10 * 86400 - 4, now - 10 * 86400 - 3, now - 10 * 86400 - 2,
+        now - 10 * 86400 - 1, now - 10 * 86400,
+        now - 3 * 86400 - 7200, now - 3 * 86400 - 3600,     /* same day */
+        now - 5 * 3600, now - 5 * 3600 + 600,               /* same hour */
+        now - 100, now - 50,                                /* recent */
+    };
+    char key[64];
+    int keylen = kvbfs_key_version_index(key, sizeof(key), ino);
+    char *raw;
+    size_t rawlen;
+    assert(kv_get(g_ctx->db, key, keylen, &raw, &rawlen) == 0);
+    assert(rawlen == sizeof(struct version_index_head) + 11 * sizeof(struct version_entry));
+    struct version_entry *ents = (struct version_entry *)(raw + sizeof(struct version_index_head));
+    for (uint64_t v = 0; v < 11; v++) ents[v].meta.created = created[v];
+    assert(kv_put(g_ctx->db, key, keylen, raw, rawlen) == 0);
+    free(raw);
+
+    pol = (struct version_policy){ 600, 86400, 7 * 86400, 0, 0 };
+    uint64_t *drop;
+    assert(version_thin_plan(ino, &pol, now, &drop, &n) == 0);
+    const uint64_t tiers[] = { 0, 1, 2, 3, 4, 5, 7 };
+    assert(n == 7 && memcmp(drop, tiers, sizeof(tiers)) == 0);
+    free(drop);
+
+    /* Over the count cap the recent tier goes first, never the newest */
+    pol.max_count = 3;
+    assert(version_thin_plan(ino, &pol, now, &drop, &n) == 0);
+    const uint64_t capped[] = { 0, 1, 2, 3, 4, 5, 7, 9 };
+    assert(n == 8 && memcmp(drop, capped, sizeof(capped)) == 0);
+
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < n; i++)
+        bytes += version_delete(ino, drop[i], NULL);
+    free(drop);
+    assert(bytes == 8 * KVBFS_BLOCK_SIZE);
+    assert(version_list(ino, &vers, &n) == 0 && n == 3);
+    assert(vers[0] == 6 && vers[1] == 8 && vers[2] == 10);
+    free(vers);
+    assert(version_block_byte(ino, 6, 0) == 'g');
+    assert(version_block_byte(ino, 8, 0) == 'i');
+    assert(version_block_byte(ino, 10, 0) == 'k');
+
+    /* A byte cap of one block leaves only the newest */
+    pol.max_count = 0;
+    pol.max_bytes = KVBFS_BLOCK_SIZE;
+    assert(version_thin_plan(ino, &pol, now, &drop, &n) == 0);
+    assert(n == 2 && drop[0] == 6 && drop[1] == 8);
+    free(drop);
+
+    inode_put(ic);
+    teardown();
+}
+
+/* The packed index lists versions numerically and absorbs legacy vm: keys */
+static void test_version_index(void)
+{
+    setup();
+    struct kvbfs_inode_cache *ic = inode_create(S_IFREG | 0644);
+    assert(ic);
+    uint64_t ino = ic->inode.ino;
+    for (int i = 0; i < 12; i++) {
+        version_write_block(ic, 0, 'a' + i);
+        assert(version_snapshot(ino) == 0);
+    }
+    char prefix[64];
+    int plen = kvbfs_key_version_meta_prefix(prefix, sizeof(prefix), ino);
+    assert(count_prefix(prefix, plen) == 0);
+
+    struct version_index vi;
+    assert(version_index_load(ino, &vi) == 0);
+    assert(vi.n == 12 && vi.next == 12 && !vi.legacy);
+    for (size_t i = 0; i < vi.n; i++) assert(vi.e[i].ver == i);
+    version_index_free(&vi);
+
+    assert(version_delete(ino, 3, NULL) == KVBFS_BLOCK_SIZE);
+    assert(version_index_load(ino, &vi) == 0);
+    assert(vi.n == 11 && vi.e[3].ver == 4 && vi.next == 12);
+    version_index_free(&vi);
+    struct kvbfs_version_meta meta;
+    assert(version_get_meta(ino, 3, &meta) != 0);
+    assert(version_get_meta(ino, 11, &meta) == 0 && meta.changed == 1);
+
+    /* A database from before the index: counter plus one vm: key each */
+    uint64_t old_ino = ino + 1000;
+    char key[64];
+    int keylen = kvbfs_key_version_index(key, sizeof(key), old_ino);
+    uint64_t next = 11;
+    assert(kv_put(g_ctx->db, key, keylen, (const char *)&next, sizeof(next)) == 0);
+    const uint64_t old_vers[] = { 10, 2, 0 };
+    for (int i = 0; i < 3; i++) {
+        struct kvbfs_version_meta m = { .size = 1, .blocks = 1,
+                                        .format = VERSION_FORMAT_DELTA };
+        keylen = kvbfs_key_version_meta(key, sizeof(key), old_ino, old_vers[i]);
+        assert(kv_put(g_ctx->db, key, keylen, (const char *)&m,
+                      VERSION_META_DELTA_SIZE) == 0);
+    }
+    assert(version_get_current(old_ino) == 11);
+    assert(version_index_load(old_ino, &vi) == 0);
+    assert(vi.legacy && vi.n == 3);
+    assert(vi.e[0].ver == 0 && vi.e[1].ver == 2 && vi.e[2].ver == 10);
+    version_index_free(&vi);
+
+    /* The next change writes the index and drops the vm: keys */
+    version_delete(old_ino, 2, NULL);
+    plen = kvbfs_key_version_meta_prefix(prefix, sizeof(prefix), old_ino);
+    assert(count_prefix(prefix, plen) == 0);
+    assert(version_index_load(old_ino, &vi) == 0);
+    assert(!vi.legacy && vi.n == 2 && vi.e[1].ver == 10 && vi.next == 11);
+    version_index_free(&vi);
+    assert(version_get_current(old_ino) == 11);
+
+    inode_put(ic);
+    teardown();
+}
+
+/* Diffs compare fingerprints, skip reverted edits and show only changed lines */
+static void test_version_diff(void)
+{
+    setup();
+    char zero[KVBFS_BLOCK_SIZE] = { 0 };
+    assert(version_fingerprint(NULL, 0) == version_fingerprint(zero, sizeof(zero)));
+    assert(version_fingerprint("a", 1) != version_fingerprint("b", 1));
+
+    struct kvbfs_inode_cache *ic = inode_create(S_IFREG | 0644);
+    assert(ic);
+    uint64_t ino = ic->inode.ino;
+    for (int i = 0; i < 4; i++) version_write_block(ic, i, 'a' + i);
+    assert(version_snapshot(ino) == 0);                 /* v0 */
+    version_write_block(ic, 2, 'X');
+    assert(version_snapshot(ino) == 0);                 /* v1 */
+    version_write_block(ic, 2, 'c');
+    version_write_block(ic, 1, 'Y');
+    assert(version_snapshot(ino) == 0);                 /* v2 */
+
+    uint64_t *blocks;
+    size_t n;
+    assert(version_diff_blocks(ino, 0, 1, &blocks, &n) == 0);
+    assert(n == 1 && blocks[0] == 2);
+    free(blocks);
+    /* Block 2 went back to 'c': only block 1 differs from v0 */
+    assert(version_diff_blocks(ino, 2, 0, &blocks, &n) == 0);
+    assert(n == 1 && blocks[0] == 1);
+    free(blocks);
+    version_write_block(ic, 4, 'e');
+    assert(version_snapshot(ino) == 0);                 /* v3 grows */
+    assert(version_diff_blocks(ino, 2, 3, &blocks, &n) == 0);
+    assert(n == 1 && blocks[0] == 4);
+    free(blocks);
+
+    /* Line diff of a text file: one changed line in the second block */
+    struct kvbfs_inode_cache *tc = inode_create(S_IFREG | 0644);
+    assert(tc);
+    uint64_t tino = tc->inode.ino;
+    char *text = malloc(2 * KVBFS_BLOCK_SIZE);
+    assert(text);
+    for (size_t i = 0; i < 2 * KVBFS_BLOCK_SIZE; i++)
+        text[i] = i % 16 == 15 ? '\n' : 'a' + (i / 16) % 26;
+    char key[64];
+    for (uint64_t blk = 0; blk < 2; blk++) {
+        int keylen = kvbfs_key_block(key, sizeof(key), tino, blk);
+        assert(kv_put(g_ctx->db, key, keylen, text + blk * KVBFS_BLOCK_SIZE,
+                      KVBFS_BLOCK_SIZE) == 0);
+    }
+    pthread_rwlock_wrlock(&tc->lock);
+    version_mark_dirty(NULL, tc, 0, 2);
+    tc->inode.size = 2 * KVBFS_BLOCK_SIZE;
+    tc->inode.blocks = 2;
+    pthread_rwlock_unlock(&tc->lock);
+    inode_sync(tc);
+    assert(version_snapshot(tino) == 0);
+
+    uint64_t line = KVBFS_BLOCK_SIZE + 16 * 3;         /* 4th line of block 1 */
+    memcpy(text + line, "CHANGED\n", 8);
+    int keylen = kvbfs_key_block(key, sizeof(key), tino, 1);
+    assert(kv_put(g_ctx->db, key, keylen, text + KVBFS_BLOCK_SIZE,
+                  KVBFS_BLOCK_SIZE) == 0);
+    pthread_rwlock_wrlock(&tc->lock);
+    version_mark_dirty(NULL, tc, 1, 2);
+    pthread_rwlock_unlock(&tc->lock);
+    assert(version_snapshot(tino) == 0);
+
+    char *out;
+    size_t len;
+    assert(vdiff_render(tino, 0, 1, "1", "2", &out, &len) == 0);
+    char expect[256];
+    char old_line[17];
+    for (int i = 0; i < 15; i++) old_line[i] = 'a' + ((KVBFS_BLOCK_SIZE / 16 + 3) % 26);
+    old_line[15] = '\n';
+    old_line[16] = '\0';
+    snprintf(expect, sizeof(expect),
+             "--- 1\n+++ 2\n@@ -%lu,16 +%lu,16 @@\n-%s+CHANGED\n+%.8s",
+             (unsigned long)line, (unsigned long)line, old_line, text + line + 8);
+    assert(len == strlen(expect) && strcmp(out, expect) == 0);
+    free(out);
+
+    /* Identical versions render nothing */
+    assert(vdiff_render(tino, 1, 1, "2", "2", &out, &len) == 0);
+    assert(len == 0);
+    free(out);
+
+    /* A diff against the live file sees the edit but records no version */
+    uint64_t cur = version_get_current(tino);
+    assert(vdiff_render(tino, 1, VDIFF_LIVE, "2", "live", &out, &len) == 0);
+    assert(len == 0);
+    free(out);
+    memcpy(text + line, "LIVE!!!\n", 8);
+    assert(kv_put(g_ctx->db, key, keylen, text + KVBFS_BLOCK_SIZE,
+                  KVBFS_BLOCK_SIZE) == 0);
+    pthread_rwlock_wrlock(&tc->lock);
+    version_mark_dirty(NULL, tc, 1, 2);
+    pthread_rwlock_unlock(&tc->lock);
+    assert(vdiff_render(tino, 1, VDIFF_LIVE, "2", "live", &out, &len) == 0);
+    assert(len > 0 && strstr(out, "-CHANGED\n+LIVE!!!\n") != NULL);
+    free(out);
+    assert(version_get_current(tino) == cur);
+
+    /* A write far past the bitmap cap gives up tracking instead of growing */
+    pthread_rwlock_wrlock(&tc->lock);
+    version_mark_dirty(NULL, tc, 0, 1);
+    assert(tc->vdirty && !tc->vdirty->lost);
+    uint64_t far = (uint64_t)VERSION_DIRTY_MAX_WORDS * 64;
+    version_mark_dirty(NULL, tc, far, far + 1);
+    assert(tc->vdirty->lost && tc->vdirty->nwords <= VERSION_DIRTY_MAX_WORDS);
+    pthread_rwlock_unlock(&tc->lock);
+
+    free(text);
+    inode_put(tc);
+    inode_put(ic);
+    teardown();
+}
+
+static int64_t vcas_refs(const uint8_t *hash)
+{
+    char key[80];
+    int keylen = kvbfs_key_vcas_refs(key, sizeof(key), hash);
+    int64_t refs = 0;
+    size_t len;
+    if (kv_get_into(g_ctx->db, key, keylen, (char *)&refs, sizeof(refs), &len) != 0)
+        return 0;
+    return refs;
+}
+
+static void vcas_verify_all(struct vcas_pass *pass)
+{
+    char cursor[80];
+    size_t cursor_len = 0, keys;
+    memset(pass, 0, sizeof(*pass));
+    while (vcas_verify_step(cursor, &cursor_len, pass, &keys)) {}
+}
+
+/* Identical blocks share one stored copy; the verifier sweeps and checks it */
+static void test_vcas(void)
+{
+    setup();
+    struct kvbfs_inode_cache *a = inode_create(S_IFREG | 0644);
+    struct kvbfs_inode_cache *b = inode_create(S_IFREG | 0644);
+    assert(a && b);
+    version_write_block(a, 0, 'z');
+    version_write_block(b, 0, 'z');
+    version_write_block(b, 1, 'y');
+    assert(version_snapshot(a->inode.ino) == 0);
+    assert(version_snapshot(b->inode.ino) == 0);
+
+    /* Two files, one copy of the shared block */
+    static char blk[KVBFS_BLOCK_SIZE];
+    uint8_t hz[VCAS_HASH_SIZE], hy[VCAS_HASH_SIZE];
+    memset(blk, 'z', sizeof(blk));
+    vcas_hash(blk, sizeof(blk), hz);
+    memset(blk, 'y', sizeof(blk));
+    vcas_hash(blk, sizeof(blk), hy);
+    assert(count_prefix("vh:", 3) == 2);
+    assert(vcas_refs(hz) == 2 && vcas_refs(hy) == 1);
+    assert(version_block_byte(a->inode.ino, 0, 0) == 'z');
+    assert(version_block_byte(b->inode.ino, 0, 1) == 'y');
+
+    struct vcas_pass pass;
+    vcas_verify_all(&pass);
+    assert(pass.blobs == 2 && pass.corrupt == 0 && pass.swept == 0);
+    assert(pass.stored == 2 * KVBFS_BLOCK_SIZE);
+    assert(pass.referenced == 3 * KVBFS_BLOCK_SIZE);
+
+    /* SHA-256 of "abc" */
+    uint8_t h[VCAS_HASH_SIZE];
+    vcas_hash("abc", 3, h);
+    assert(h[0] == 0xba && h[1] == 0x78 && h[30] == 0x15 && h[31] == 0xad);
+
+    /* A damaged blob is reported; the other file still reads its copy */
+    char key[80];
+    int keylen = kvbfs_key_vcas_blob(key, sizeof(key), hy);
+    memset(blk, 'Y', sizeof(blk));
+    assert(kv_put(g_ctx->db, key, keylen, blk, sizeof(blk)) == 0);
+    vcas_verify_all(&pass);
+    assert(pass.blobs == 2 && pass.corrupt == 1);
+
+    /* Dropping the references leaves blobs for the sweep, not inline */
+    version_delete_all(b->inode.ino);
+    assert(vcas_refs(hz) == 1 && vcas_refs(hy) == 0);
+    assert(version_block_byte(a->inode.ino, 0, 0) == 'z');
+    vcas_verify_all(&pass);
+    assert(pass.swept == 1 && pass.blobs == 1);
+    assert(count_prefix("vh:", 3) == 1 && count_prefix("vr:", 3) == 1);
+    version_delete_all(a->inode.ino);
+    vcas_verify_all(&pass);
+    assert(pass.swept == 1 && count_prefix("vh:", 3) == 0);
+
+    inode_put(a);
+    inode_put(b);
+    teardown();
+}
+
+/* Filesystem snapshots: checkpoints stay put while the live store changes */
+static void test_fssnap(void)
+{
+    setup();
+    system("rm -rf " TEST_DB_PATH ".snapshots");
+    struct fssnap_ctx fs;
+    assert(fssnap_init(&fs, g_ctx->db, TEST_DB_PATH) == 0);
+
+    char key[64];
+    int keylen = kvbfs_key_block(key, sizeof(key), 7, 0);
+    assert(kv_put(g_ctx->db, key, keylen, "old", 3) == 0);
+    uint64_t id;
+    assert(fssnap_create(&fs, "a", &id) == 0);
+    assert(fssnap_create(&fs, "a", NULL) == EEXIST);
+    assert(kv_put(g_ctx->db, key, keylen, "new", 3) == 0);
+
+    struct fssnap *s = fssnap_find(&fs, "a");
+    assert(s && s->id == id && fssnap_get(&fs, id) == s);
+    char buf[8];
+    size_t len;
+    assert(kv_get_into(s->db, key, keylen, buf, sizeof(buf), &len) == 0);
+    assert(len == 3 && memcmp(buf, "old", 3) == 0);
+
+    /* Deleting hides the name at once; the files go with the last reader */
+    char path[256];
+    snprintf(path, sizeof(path), "%s.snapshots/%llu", TEST_DB_PATH,
+             (unsigned long long)s->rec.seq);
+    assert(fssnap_delete(&fs, "a") == 0);
+    assert(fssnap_delete(&fs, "a") == ENOENT);
+    assert(!fssnap_find(&fs, "a") && !fssnap_get(&fs, id));
+    struct stat st;
+    fssnap_put(&fs, s);
+    assert(stat(path, &st) == 0);
+    fssnap_put(&fs, s);
+    assert(stat(path, &st) != 0);
+
+    /* Records survive a remount; a checkpoint without one is removed */
+    assert(fssnap_create(&fs, "b", NULL) == 0);
+    fssnap_destroy(&fs);
+    snprintf(path, sizeof(path), "%s.snapshots/99", TEST_DB_PATH);
+    assert(mkdir(path, 0755) == 0);
+    assert(fssnap_init(&fs, g_ctx->db, TEST_DB_PATH) == 0);
+    assert(stat(path, &st) != 0);
+    s = fssnap_find(&fs, "b");
+    assert(s && s->rec.seq == 1);
+    assert(kv_get_into(s->db, key, keylen, buf, sizeof(buf), &len) == 0);
+    assert(len == 3 && memcmp(buf, "new", 3) == 0);
+    fssnap_put(&fs, s);
+    assert(fssnap_create(&fs, "c", NULL) == 0);
+    s = fssnap_find(&fs, "c");
+    assert(s && s->rec.seq == 100);
+    fssnap_put(&fs, s);
+
+    fssnap_destroy(&fs);
+    system("rm -rf " TEST_DB_PATH ".snapshots");
+    teardown();
+}
+
+/* Virtual tree: nodes live while the kernel holds them, names are kept whole */
+static void *thread_vtree(void *arg)
+{
+    struct vtree_ctx *vt = arg;
+    char name[16];
+    for (int i = 0; i < 2000; i++) {
+        snprintf(name, sizeof(name), "n%d", i % 32);
+        uint64_t vino = vtree_alloc_vfile(vt, AGENTFS_VERSIONS_INO, name, 5, 0);
+        assert(vino && vtree_lookup_child(vt, AGENTFS_VERSIONS_INO, name) == vino);
+        vtree_forget(vt, vino, 1);
+    }
+    return NULL;
+}
+
+static void test_vtree(void)
+{
+    struct vtree_ctx vt;
+    vtree_init(&vt);
+
+    /* Names sharing a long prefix get distinct nodes */
+    char a[200], b[200];
+    memset(a, 'p', 150);
+    a[150] = '\0';
+    strcpy(b, a);
+    strcat(a, "a");
+    strcat(b, "b");
+    uint64_t va = vtree_alloc_dir(&vt, AGENTFS_VERSIONS_INO, a, 10);
+    uint64_t vb = vtree_alloc_dir(&vt, AGENTFS_VERSIONS_INO, b, 11);
+    assert(vtree_is_vnode(va) && vtree_is_vnode(vb) && va != vb);
+    struct vtree_node n;
+    assert(vtree_get(&vt, va, &n) && n.real_ino == 10);
+    assert(vtree_get(&vt, vb, &n) && n.real_ino == 11);
+
+    /* Each allocation is a reference; forget frees at zero */
+    assert(vtree_alloc_dir(&vt, AGENTFS_VERSIONS_INO, a, 10) == va);
+    assert(vt.live == 2);
+    vtree_forget(&vt, va, 1);
+    assert(vtree_lookup_child(&vt, AGENTFS_VERSIONS_INO, a) == va);
+    vtree_forget(&vt, va, 1);
+    assert(!vtree_get(&vt, va, &n));
+    assert(vtree_lookup_child(&vt, AGENTFS_VERSIONS_INO, a) == 0);
+    assert(vt.live == 1 && vt.forgotten == 1);
+    vtree_forget(&vt, va, 1);
+    uint64_t va2 = vtree_alloc_vfile(&vt, vb, "1", 11, 0);
+    assert(va2 != va && vtree_get(&vt, va2, &n) && n.is_version_file == 1);
+
+    /* st_ino follows what the node shows, so readdir can report it unallocated */
+    struct vtree_node id = {.is_version_file = 1, .real_ino = 11, .version = 0};
+    uint64_t si = vtree_stat_ino(&n);
+    assert(si == vtree_stat_ino(&id) && !vtree_is_vnode(si));
+    id.version = 1;
+    assert(vtree_stat_ino(&id) != si);
+    assert(vtree_get(&vt, vb, &n) && vtree_stat_ino(&n) != si);
+
+    /* Concurrent lookups and forgets of the same names */
+    pthread_t threads[8];
+    for (int i = 0; i < 8; i++)
+        assert(pthread_create(&threads[i], NULL, thread_vtree, &vt) == 0);
+    for (int i = 0; i < 8; i++)
+        pthread_join(threads[i], NULL);
+    assert(vt.live == 2);
+
+    vtree_destroy(&vt);
+}
+
+/* Snapshot queue: closes coalesce per inode, waiters run pending jobs early */
+static int snap_runs[8];
+
+static void snap_test_run(uint64_t ino)
+{
+    __atomic_add_fetch(&snap_runs[ino], 1, __ATOMIC_RELAXED);
+}
+
+static void test_snapq(void)
+{
+    setenv("KVBFS_VERSION_DELAY_MS", "60000", 1);
+    struct snapq q;
+    snapq_init(&q);
+    unsetenv("KVBFS_VERSION_DELAY_MS");
+    assert(q.delay_ms == 60000);
+
+    /* Not started: each close runs its job inline */
+    q.run = snap_test_run;
+    snapq_submit(&q, 1);
+    assert(snap_runs[1] == 1);
+    assert(snapq_start(&q, snap_test_run) == 0);
+
+    /* Repeated closes fold into one job that waits out the delay */
+    for (int i = 0; i < 5; i++) snapq_submit(&q, 2);
+    snapq_submit(&q, 3);
+    snapq_submit(&q, 4);
+    usleep(20000);
+    struct snapq_stats st;
+    snapq_get_stats(&q, &st);
+    assert(st.pending == 3 && st.coalesced == 4 && snap_runs[2] == 0);
+
+    /* Waiting on one inode runs only its job, without the delay */
+    time_t t0 = time(NULL);
+    snapq_wait(&q, 2);
+    assert(snap_runs[2] == 1 && snap_runs[3] == 0);
+    snapq_wait(&q, 2);
+    assert(snap_runs[2] == 1);
+
+    /* Waiting on everything covers the jobs queued before the call */
+    snapq_wait(&q, 0);
+    assert(snap_runs[3] == 1 && snap_runs[4] == 1);
+    assert(time(NULL) - t0 < 30);
+
+    /* Stopping runs what is still queued */
+    snapq_submit(&q, 5);
+    snapq_stop(&q);
+    assert(snap_runs[5] == 1);
+    snapq_get_stats(&q, &st);
+    assert(st.pending == 0 && st.submitted == 8 && st.completed == 4);
+    snapq_destroy(&q);
+}
+
 int main(void)
 {
     printf("Testing inode management...\n");
@@ -321,6 +1561,24 @@ int main(void)
     RUN_TEST(test_delete_with_active_refs);
     RUN_TEST(test_concurrent_get_put);
     RUN_TEST(test_concurrent_delete);
+    RUN_TEST(test_path_resolve);
+    RUN_TEST(test_dcache);
+    RUN_TEST(test_cache_eviction);
+    RUN_TEST(test_writeback);
+    RUN_TEST(test_ino_alloc);
+    RUN_TEST(test_usage);
+    RUN_TEST(test_xattr);
+    RUN_TEST(test_preload);
+    RUN_TEST(test_slab);
+    RUN_TEST(test_iopool);
+    RUN_TEST(test_version_cow);
+    RUN_TEST(test_version_retention);
+    RUN_TEST(test_version_index);
+    RUN_TEST(test_version_diff);
+    RUN_TEST(test_vcas);
+    RUN_TEST(test_fssnap);
+    RUN_TEST(test_vtree);
+    RUN_TEST(test_snapq);
 
     printf("\n%d/%d tests passed!\n", tests_passed, tests_run);
     return tests_passed == tests_run ? 0 : 1;
@@ -24,6 +24,10 @@ pass() { ((PASS++)); echo -e "  ${GREEN}PASS${NC}: $1"; }
 fail() { ((FAIL++)); echo -e "  ${RED}FAIL${NC}: $1${2:+ ($2)}"; }
 skip() { ((SKIP++)); echo -e "  ${YELLOW}SKIP${NC}: $1"; }
 
+# Snapshots are taken in the background and coalesced; reading the version
+# runs the pending one, so each call ends a version
+settle() { python3 -c "import os, sys; os.getxattr(sys.argv[1], 'agentfs.version')" "$1"; }
+
 cleanup() {
     echo ""
     echo "=== Cleanup ==="
@@ -598,6 +602,7 @@ fi
 # ============================================================
 echo "--- Test 37: Version increments on subsequent writes ---"
 echo "version2" > "$MNT/ver_file.txt" 2>/dev/null
+settle "$MNT/ver_file.txt"
 echo "version3" > "$MNT/ver_file.txt" 2>/dev/null
 VER_RESULT=$(python3 -c "
 import os
@@ -832,6 +837,7 @@ fi
 # ============================================================
 echo "--- Test 53: .versions/<file>/ lists version numbers ---"
 echo "version one content" > "$MNT/ver_test.txt"
+settle "$MNT/ver_test.txt"
 echo "version two content" > "$MNT/ver_test.txt"
 sleep 0.3
 VER_LIST=$(ls "$MNT/.versions/ver_test.txt/" 2>/dev/null)
@@ -881,6 +887,989 @@ else
     fail ".versions write protection" "write succeeded unexpectedly"
 fi
 
+# ============================================================
+echo "--- Test 58: truncate then extend reads zeros (background GC) ---"
+python3 -c "open('$MNT/gc_trunc.bin','wb').write(b'x' * 40960)" 2>/dev/null
+truncate -s 5000 "$MNT/gc_trunc.bin" 2>/dev/null
+truncate -s 40960 "$MNT/gc_trunc.bin" 2>/dev/null
+GC_OK=$(python3 -c "
+d = open('$MNT/gc_trunc.bin','rb').read()
+print('yes' if len(d) == 40960 and d[:5000] == b'x' * 5000 and d[5000:] == bytes(35904) else 'no')
+" 2>/dev/null)
+if [ "$GC_OK" = "yes" ]; then
+    pass "no stale data after truncate + extend"
+else
+    fail "truncate + extend" "stale data visible"
+fi
+rm -f "$MNT/gc_trunc.bin" 2>/dev/null
+
+# ============================================================
+echo "--- Test 59: unlink of large versioned file, name reusable ---"
+dd if=/dev/urandom of="$MNT/gc_big.bin" bs=1M count=4 2>/dev/null
+dd if=/dev/urandom of="$MNT/gc_big.bin" bs=1M count=4 2>/dev/null
+if rm "$MNT/gc_big.bin" 2>/dev/null && [ ! -e "$MNT/gc_big.bin" ]; then
+    echo "fresh" > "$MNT/gc_big.bin"
+    CONTENT=$(cat "$MNT/gc_big.bin" 2>/dev/null)
+    if [ "$CONTENT" = "fresh" ]; then
+        pass "unlink + recreate"
+    else
+        fail "unlink + recreate" "got: $CONTENT"
+    fi
+else
+    fail "unlink large file"
+fi
+rm -f "$MNT/gc_big.bin" 2>/dev/null
+
+# ============================================================
+echo "--- Test 60: CFS_IOC_RMTREE removes a directory tree ---"
+mkdir -p "$MNT/rmtree_dir/a/b" "$MNT/rmtree_dir/c"
+for i in $(seq 1 20); do echo "$i" > "$MNT/rmtree_dir/a/f$i"; done
+echo deep > "$MNT/rmtree_dir/a/b/deep.txt"
+RT_OK=$(python3 -c "
+import fcntl, os, struct
+fd = os.open('$MNT', os.O_RDONLY | os.O_DIRECTORY)
+cmd = (1 << 30) | (256 << 16) | (ord('C') << 8) | 3
+fcntl.ioctl(fd, cmd, struct.pack('256s', b'rmtree_dir'))
+os.close(fd)
+print('yes' if not os.path.exists('$MNT/rmtree_dir') else 'no')
+" 2>/dev/null)
+if [ "$RT_OK" = "yes" ]; then
+    pass "rmtree detaches subtree"
+else
+    fail "rmtree" "directory still present"
+fi
+
+# ============================================================
+echo "--- Test 61: rmtree name is reusable, non-dir rejected ---"
+mkdir "$MNT/rmtree_dir" 2>/dev/null && echo new > "$MNT/rmtree_dir/f"
+echo x > "$MNT/rmtree_file"
+RT_ERR=$(python3 -c "
+import errno, fcntl, os, struct
+fd = os.open('$MNT', os.O_RDONLY | os.O_DIRECTORY)
+cmd = (1 << 30) | (256 << 16) | (ord('C') << 8) | 3
+try:
+    fcntl.ioctl(fd, cmd, struct.pack('256s', b'rmtree_file'))
+    print('none')
+except OSError as e:
+    print(errno.errorcode.get(e.errno, e.errno))
+os.close(fd)
+" 2>/dev/null)
+CONTENT=$(cat "$MNT/rmtree_dir/f" 2>/dev/null)
+if [ "$RT_ERR" = "ENOTDIR" ] && [ "$CONTENT" = "new" ]; then
+    pass "rmtree error handling + name reuse"
+else
+    fail "rmtree reuse" "err=$RT_ERR content=$CONTENT"
+fi
+rm -rf "$MNT/rmtree_dir" "$MNT/rmtree_file" 2>/dev/null
+
+# ============================================================
+echo "--- Test 62: large directory lists every entry once ---"
+mkdir -p "$MNT/bigdir"
+for i in $(seq 1 500); do : > "$MNT/bigdir/f$i"; done
+COUNT=$(ls -f "$MNT/bigdir" 2>/dev/null | grep -v '^\.\.\?$' | sort -u | wc -l)
+if [ "$COUNT" -eq 500 ]; then
+    pass "500 entries listed"
+else
+    fail "large readdir" "got $COUNT entries"
+fi
+
+# ============================================================
+echo "--- Test 63: readdir reports file types (ls -l / find -type) ---"
+mkdir -p "$MNT/bigdir/sub1" "$MNT/bigdir/sub2"
+ln -s f1 "$MNT/bigdir/lnk" 2>/dev/null
+NDIR=$(find "$MNT/bigdir" -mindepth 1 -maxdepth 1 -type d 2>/dev/null | wc -l)
+NLNK=$(find "$MNT/bigdir" -mindepth 1 -maxdepth 1 -type l 2>/dev/null | wc -l)
+LSL=$(ls -l "$MNT/bigdir" 2>/dev/null | grep -c '^d')
+if [ "$NDIR" -eq 2 ] && [ "$NLNK" -eq 1 ] && [ "$LSL" -eq 2 ]; then
+    pass "types from readdir(plus)"
+else
+    fail "readdir types" "dirs=$NDIR links=$NLNK ls_dirs=$LSL"
+fi
+rm -rf "$MNT/bigdir" 2>/dev/null
+
+# ============================================================
+echo "--- Test 64: readdir survives inserts during listing ---"
+mkdir -p "$MNT/curdir"
+for i in $(seq 1 300); do : > "$MNT/curdir/f$i"; done
+CUR=$(python3 -c "
+import os
+seen = []
+with os.scandir('$MNT/curdir') as it:
+    for i, e in enumerate(it):
+        seen.append(e.name)
+        if i % 20 == 0:
+            open('$MNT/curdir/a%d' % i, 'w').close()
+            open('$MNT/curdir/z%d' % i, 'w').close()
+orig = [n for n in seen if n.startswith('f')]
+print('ok' if len(orig) == 300 and len(set(orig)) == 300 else 'bad %d/%d' % (len(orig), len(set(orig))))
+" 2>/dev/null)
+if [ "$CUR" = "ok" ]; then
+    pass "every original entry listed exactly once"
+else
+    fail "readdir with inserts" "$CUR"
+fi
+
+# ============================================================
+echo "--- Test 65: telldir/seekdir resumes at the same entry ---"
+SEEK=$(python3 -c "
+import ctypes, ctypes.util
+libc = ctypes.CDLL(ctypes.util.find_library('c'))
+class Dirent(ctypes.Structure):
+    _fields_ = [('d_ino', ctypes.c_ulong), ('d_off', ctypes.c_long),
+                ('d_reclen', ctypes.c_ushort), ('d_type', ctypes.c_ubyte),
+                ('d_name', ctypes.c_char * 256)]
+libc.opendir.restype = ctypes.c_void_p
+libc.readdir.restype = ctypes.POINTER(Dirent)
+libc.readdir.argtypes = [ctypes.c_void_p]
+libc.telldir.restype = ctypes.c_long
+libc.telldir.argtypes = [ctypes.c_void_p]
+libc.seekdir.argtypes = [ctypes.c_void_p, ctypes.c_long]
+libc.closedir.argtypes = [ctypes.c_void_p]
+d = libc.opendir(b'$MNT/curdir')
+for _ in range(150):
+    libc.readdir(d)
+pos = libc.telldir(d)
+want = libc.readdir(d).contents.d_name
+for _ in range(100):
+    libc.readdir(d)
+open('$MNT/curdir/b_new', 'w').close()
+libc.seekdir(d, pos)
+got = libc.readdir(d).contents.d_name
+libc.closedir(d)
+print('ok' if got == want else 'bad %r %r' % (want, got))
+" 2>/dev/null)
+if [ "$SEEK" = "ok" ]; then
+    pass "seekdir returns to the saved entry"
+else
+    fail "seekdir" "$SEEK"
+fi
+rm -rf "$MNT/curdir" 2>/dev/null
+
+# ============================================================
+echo "--- Test 66: missing names become visible once created ---"
+mkdir -p "$MNT/negdir"
+stat "$MNT/negdir/late" >/dev/null 2>&1
+stat "$MNT/negdir/late" >/dev/null 2>&1
+echo hi > "$MNT/negdir/late"
+mkdir "$MNT/negdir/later" 2>/dev/null
+if [ "$(cat "$MNT/negdir/late" 2>/dev/null)" = "hi" ] && [ -d "$MNT/negdir/later" ]; then
+    pass "negative entries invalidated by create/mkdir"
+else
+    fail "negative dentry" "late/later not visible"
+fi
+
+# ============================================================
+echo "--- Test 67: agentfs.stats reports dentry cache counters ---"
+rm -f "$MNT/negdir/late"
+STATS=$(python3 -c "
+import json, os
+d = json.loads(os.getxattr('$MNT', 'agentfs.stats'))['dcache']
+ok = all(k in d for k in ('hits', 'negative_hits', 'misses', 'hit_rate'))
+print('ok' if ok and d['misses'] > 0 else d)
+" 2>/dev/null)
+if [ "$STATS" = "ok" ] && [ ! -e "$MNT/negdir/late" ]; then
+    pass "dcache stats"
+else
+    fail "agentfs.stats" "$STATS"
+fi
+rm -rf "$MNT/negdir" 2>/dev/null
+
+# ============================================================
+echo "--- Test 68: inode cache stays within its budget ---"
+mkdir -p "$MNT/many"
+for i in $(seq 1 1000); do echo "$i" > "$MNT/many/f$i"; done
+find "$MNT/many" -type f | xargs stat >/dev/null 2>&1
+ICACHE=$(python3 -c "
+import json, os
+d = json.loads(os.getxattr('$MNT', 'agentfs.stats'))['icache']
+print('ok' if 0 < d['entries'] <= d['limit'] else d)
+" 2>/dev/null)
+if [ "$ICACHE" = "ok" ] && [ "$(cat "$MNT/many/f777" 2>/dev/null)" = "777" ]; then
+    pass "icache bounded"
+else
+    fail "icache budget" "$ICACHE"
+fi
+
+# ============================================================
+echo "--- Test 69: inode metadata survives remount ---"
+echo "persist me" > "$MNT/many/sized"
+chmod 600 "$MNT/many/sized"
+fusermount3 -u "$MNT" 2>/dev/null
+wait "$KVBFS_PID" 2>/dev/null
+"$KVBFS" "$MNT" -f -s &
+KVBFS_PID=$!
+for _ in $(seq 1 10); do mountpoint -q "$MNT" 2>/dev/null && break; sleep 1; done
+SIZE=$(stat -c %s "$MNT/many/sized" 2>/dev/null)
+MODE=$(stat -c %a "$MNT/many/sized" 2>/dev/null)
+if [ "$SIZE" = "11" ] && [ "$MODE" = "600" ] && [ "$(cat "$MNT/many/f500" 2>/dev/null)" = "500" ]; then
+    pass "size/mode persisted across remount"
+else
+    fail "remount" "size=$SIZE mode=$MODE"
+fi
+rm -rf "$MNT/many" 2>/dev/null
+
+# ============================================================
+echo "--- Test 70: streaming writes defer inode write-back ---"
+INODE_WRITES='import json, os; print(json.loads(os.getxattr("'"$MNT"'", "agentfs.stats"))["icache"]["inode_writes"])'
+W0=$(python3 -c "$INODE_WRITES" 2>/dev/null)
+dd if=/dev/zero of="$MNT/stream.bin" bs=4096 count=256 2>/dev/null
+W1=$(python3 -c "$INODE_WRITES" 2>/dev/null)
+SIZE=$(stat -c %s "$MNT/stream.bin" 2>/dev/null)
+if [ -n "$W0" ] && [ -n "$W1" ] && [ $((W1 - W0)) -lt 16 ] && [ "$SIZE" = "1048576" ]; then
+    pass "256 writes cost $((W1 - W0)) inode writes"
+else
+    fail "write-back" "inode writes $W0 -> $W1, size=$SIZE"
+fi
+rm -f "$MNT/stream.bin"
+
+# ============================================================
+echo "--- Test 71: fsync'd data survives a crash ---"
+python3 -c "
+import os
+fd = os.open('$MNT/crash.bin', os.O_CREAT | os.O_WRONLY, 0o644)
+os.write(fd, b'z' * 8192)
+os.fsync(fd)
+os.write(fd, b'z' * 4096)
+" 2>/dev/null
+kill -9 "$KVBFS_PID" 2>/dev/null
+wait "$KVBFS_PID" 2>/dev/null
+fusermount3 -u "$MNT" 2>/dev/null
+"$KVBFS" "$MNT" -f -s &
+KVBFS_PID=$!
+for _ in $(seq 1 10); do mountpoint -q "$MNT" 2>/dev/null && break; sleep 1; done
+CRASH=$(python3 -c "
+d = open('$MNT/crash.bin', 'rb').read()
+print('ok' if len(d) in (8192, 12288) and d == b'z' * len(d) else len(d))
+" 2>/dev/null)
+if [ "$CRASH" = "ok" ]; then
+    pass "size and data consistent after kill -9"
+else
+    fail "crash recovery" "$CRASH"
+fi
+rm -f "$MNT/crash.bin"
+
+# ============================================================
+echo "--- Test 72: concurrent creates get unique inode numbers ---"
+mkdir -p "$MNT/inos"
+WRITERS=""
+for t in 1 2 3 4; do
+    (for i in $(seq 1 250); do : > "$MNT/inos/t${t}_$i"; done) &
+    WRITERS="$WRITERS $!"
+done
+wait $WRITERS
+TOTAL=$(stat -c %i "$MNT"/inos/* 2>/dev/null | wc -l)
+DUPS=$(stat -c %i "$MNT"/inos/* 2>/dev/null | sort | uniq -d | wc -l)
+if [ "$TOTAL" = "1000" ] && [ "$DUPS" = "0" ]; then
+    pass "1000 files, no duplicate inode numbers"
+else
+    fail "inode numbers" "total=$TOTAL dups=$DUPS"
+fi
+
+# ============================================================
+echo "--- Test 73: inode numbers stay unique after a crash ---"
+stat -c %i "$MNT"/inos/* 2>/dev/null | sort > /tmp/kvbfs_inos_before
+kill -9 "$KVBFS_PID" 2>/dev/null
+wait "$KVBFS_PID" 2>/dev/null
+fusermount3 -u "$MNT" 2>/dev/null
+"$KVBFS" "$MNT" -f -s &
+KVBFS_PID=$!
+for _ in $(seq 1 10); do mountpoint -q "$MNT" 2>/dev/null && break; sleep 1; done
+for i in $(seq 1 50); do : > "$MNT/inos/after_$i"; done
+REUSED=$(stat -c %i "$MNT"/inos/after_* 2>/dev/null | sort | comm -12 - /tmp/kvbfs_inos_before | wc -l)
+AFTER=$(ls "$MNT/inos" 2>/dev/null | wc -l)
+if [ "$REUSED" = "0" ] && [ "$AFTER" = "1050" ]; then
+    pass "no inode number reused after kill -9"
+else
+    fail "inode reuse" "reused=$REUSED entries=$AFTER"
+fi
+rm -rf "$MNT/inos" /tmp/kvbfs_inos_before 2>/dev/null
+
+# ============================================================
+echo "--- Test 74: agentfs.du tracks recursive usage ---"
+mkdir -p "$MNT/du/sub"
+head -c 5000 /dev/zero > "$MNT/du/sub/a"
+head -c 3000 /dev/zero > "$MNT/du/b"
+ln "$MNT/du/b" "$MNT/du/sub/b2"
+mv "$MNT/du/sub/a" "$MNT/du/a"
+rm -f "$MNT/du/b"
+DU=$(python3 -c "
+import json, os
+d = json.loads(os.getxattr('$MNT/du', 'agentfs.du'))
+s = json.loads(os.getxattr('$MNT/du/sub', 'agentfs.du'))
+print(d['entries'], d['inodes'], d['bytes'], s['entries'], s['bytes'])
+" 2>/dev/null)
+if [ "$DU" = "2 3 8000 1 3000" ]; then
+    pass "entries, inodes and bytes follow create/link/rename/unlink"
+else
+    fail "agentfs.du" "$DU"
+fi
+
+# ============================================================
+echo "--- Test 75: statfs reports used space and inodes ---"
+U0=$(stat -f -c '%b %f %c %d' "$MNT" 2>/dev/null)
+head -c 1048576 /dev/zero > "$MNT/du/big"
+U1=$(stat -f -c '%b %f %c %d' "$MNT" 2>/dev/null)
+STATFS=$(python3 -c "
+b0, f0, c0, d0 = map(int, '$U0'.split())
+b1, f1, c1, d1 = map(int, '$U1'.split())
+print('ok' if (b1 - f1) - (b0 - f0) == 256 and (c1 - d1) - (c0 - d0) == 1 else '$U0 / $U1')
+" 2>/dev/null)
+if [ "$STATFS" = "ok" ]; then
+    pass "1 MiB file adds 256 blocks and one inode"
+else
+    fail "statfs" "$STATFS"
+fi
+rm -rf "$MNT/du" 2>/dev/null
+
+# ============================================================
+echo "--- Test 76: small and large xattrs survive a remount ---"
+echo "packed" > "$MNT/xa_packed.txt"
+python3 -c "
+import os
+f = '$MNT/xa_packed.txt'
+os.setxattr(f, 'user.small', b'v' * 100)
+os.setxattr(f, 'user.large', b'L' * 10000)
+" 2>/dev/null
+fusermount3 -u "$MNT" 2>/dev/null
+wait "$KVBFS_PID" 2>/dev/null
+"$KVBFS" "$MNT" -f -s &
+KVBFS_PID=$!
+for _ in $(seq 1 10); do mountpoint -q "$MNT" 2>/dev/null && break; sleep 1; done
+XA_RESULT=$(python3 -c "
+import os
+f = '$MNT/xa_packed.txt'
+ok = (os.getxattr(f, 'user.small') == b'v' * 100 and
+      os.getxattr(f, 'user.large') == b'L' * 10000 and
+      sorted(os.listxattr(f)) == ['user.large', 'user.small'])
+print('PASS' if ok else 'FAIL:' + str(os.listxattr(f)))
+" 2>&1)
+if [ "$XA_RESULT" = "PASS" ]; then
+    pass "packed and spilled xattrs read back after remount"
+else
+    fail "xattr remount" "$XA_RESULT"
+fi
+
+# ============================================================
+echo "--- Test 77: many xattrs on one file ---"
+XA_RESULT=$(python3 -c "
+import os, errno
+f = '$MNT/xa_packed.txt'
+for i in range(200):
+    os.setxattr(f, 'user.k%d' % i, str(i).encode())
+ok = all(os.getxattr(f, 'user.k%d' % i) == str(i).encode() for i in range(200))
+ok = ok and len(os.listxattr(f)) == 202
+for a in os.listxattr(f):
+    os.removexattr(f, a)
+try:
+    os.getxattr(f, 'user.k0')
+    ok = False
+except OSError as e:
+    ok = ok and e.errno == errno.ENODATA
+print('PASS' if ok and os.listxattr(f) == [] else 'FAIL')
+" 2>&1)
+if [ "$XA_RESULT" = "PASS" ]; then
+    pass "200 attributes set, listed and removed"
+else
+    fail "many xattrs" "$XA_RESULT"
+fi
+rm -f "$MNT/xa_packed.txt" 2>/dev/null
+
+# ============================================================
+echo "--- Test 78: warmup preloads caches at mount ---"
+mkdir -p "$MNT/warm"
+for i in $(seq 1 200); do : > "$MNT/warm/f$i"; done
+fusermount3 -u "$MNT" 2>/dev/null
+wait "$KVBFS_PID" 2>/dev/null
+KVBFS_WARMUP=1 "$KVBFS" "$MNT" -f -s &
+KVBFS_PID=$!
+for _ in $(seq 1 10); do mountpoint -q "$MNT" 2>/dev/null && break; sleep 1; done
+WARM=$(python3 -c "
+import json, os
+s = json.loads(os.getxattr('$MNT', 'agentfs.stats'))
+w = s['warmup']
+print(w['state'], w['inodes'] >= 200, w['dentries'] >= 200, w['hot'] > 0)
+" 2>/dev/null)
+if [ "$WARM" = "done True True True" ]; then
+    pass "inodes, dentries and the saved hot set loaded before serving"
+else
+    fail "sync warmup" "$WARM"
+fi
+
+# ============================================================
+echo "--- Test 79: warmed lookups skip the KV store ---"
+MISSES=$(python3 -c "
+import json, os
+before = json.loads(os.getxattr('$MNT', 'agentfs.stats'))['dcache']['misses']
+for i in range(1, 201):
+    os.stat('$MNT/warm/f%d' % i)
+after = json.loads(os.getxattr('$MNT', 'agentfs.stats'))['dcache']['misses']
+print(after - before)
+" 2>/dev/null)
+if [ "$MISSES" = "0" ]; then
+    pass "200 first lookups after remount hit the dentry cache"
+else
+    fail "warm lookups" "misses=$MISSES"
+fi
+rm -rf "$MNT/warm" 2>/dev/null
+
+# ============================================================
+echo "--- Test 80: reads at unaligned offsets across holes ---"
+RESULT=$(python3 -c "
+import os, random
+p = '$MNT/rdbuf.bin'
+data = bytearray(os.urandom(300000))
+with open(p, 'wb') as f:
+    f.write(data[:5000])
+    f.seek(200000)
+    f.write(data[200000:300000])
+data[5000:200000] = bytes(195000)
+random.seed(7)
+ok = True
+with open(p, 'rb', buffering=0) as f:
+    for _ in range(200):
+        off = random.randrange(0, 310000)
+        n = random.choice([1, 100, 4096, 5000, 65536, 131072])
+        f.seek(off)
+        if f.read(n) != bytes(data[off:off + n]):
+            ok = False
+print('ok' if ok else 'mismatch')
+" 2>&1)
+if [ "$RESULT" = "ok" ]; then
+    pass "200 random reads match, holes and partial blocks read as zeros"
+else
+    fail "unaligned reads" "$RESULT"
+fi
+rm -f "$MNT/rdbuf.bin"
+
+# ============================================================
+echo "--- Test 81: large listings reuse request buffers ---"
+mkdir -p "$MNT/many"
+for i in $(seq 1 2000); do : > "$MNT/many/f$i"; done
+RESULT=$(python3 -c "
+import json, os
+names = os.listdir('$MNT/many')
+a = json.loads(os.getxattr('$MNT', 'agentfs.stats'))['alloc']
+print(len(names), len(set(names)), a['icache_live'] > 0, a['reqbuf_bytes'] > 0)
+" 2>&1)
+if [ "$RESULT" = "2000 2000 True True" ]; then
+    pass "2000 entries listed once each; slab and buffer counters reported"
+else
+    fail "large readdir" "$RESULT"
+fi
+rm -rf "$MNT/many" 2>/dev/null
+
+# ============================================================
+echo "--- Test 82: one FUSE thread keeps many KV requests in flight ---"
+mkdir -p "$MNT/par"
+RESULT=$(python3 -c "
+import hashlib, json, os, threading
+sums = {}
+def work(i):
+    data = os.urandom(1 << 20)
+    p = '$MNT/par/f%d' % i
+    with open(p, 'wb') as f:
+        for off in range(0, len(data), 65536):
+            f.write(data[off:off + 65536])
+    with open(p, 'rb') as f:
+        sums[i] = hashlib.md5(f.read()).digest() == hashlib.md5(data).digest()
+ts = [threading.Thread(target=work, args=(i,)) for i in range(16)]
+for t in ts: t.start()
+for t in ts: t.join()
+io = json.loads(os.getxattr('$MNT', 'agentfs.stats'))['io']
+print(all(sums.values()) and len(sums) == 16, io['threads'] > 0, io['peak'] > 1)
+" 2>&1)
+if [ "$RESULT" = "True True True" ]; then
+    pass "16 parallel writers read back intact with requests queued concurrently"
+else
+    fail "parallel I/O" "$RESULT"
+fi
+rm -rf "$MNT/par" 2>/dev/null
+
+# ============================================================
+echo "--- Test 83: reads see earlier writes to the same file ---"
+RESULT=$(python3 -c "
+import os, threading
+p = '$MNT/order.bin'
+open(p, 'wb').close()
+bad = []
+def work(t):
+    fd = os.open(p, os.O_RDWR)
+    for i in range(200):
+        off = (t * 200 + i) * 4096
+        rec = (b'%d:%d;' % (t, i)).ljust(4096, b'.')
+        os.pwrite(fd, rec, off)
+        if os.pread(fd, 4096, off) != rec:
+            bad.append((t, i))
+    os.close(fd)
+ts = [threading.Thread(target=work, args=(t,)) for t in range(8)]
+for t in ts: t.start()
+for t in ts: t.join()
+print(len(bad), os.path.getsize(p))
+" 2>&1)
+if [ "$RESULT" = "0 6553600" ]; then
+    pass "1600 interleaved write/read pairs observe their own writes"
+else
+    fail "write/read ordering" "$RESULT"
+fi
+rm -f "$MNT/order.bin"
+
+# ============================================================
+echo "--- Test 84: appending to a large file records only the changed blocks ---"
+RESULT=$(python3 -c "
+import hashlib, json, os
+p = '$MNT/cow.log'
+base = os.urandom(8 << 20)
+with open(p, 'wb') as f: f.write(base)
+os.getxattr(p, 'agentfs.version')
+for i in range(10):
+    with open(p, 'ab') as f: f.write(b'line %d\\n' % i)
+    os.getxattr(p, 'agentfs.version')
+vs = json.loads(os.getxattr(p, 'agentfs.versions'))
+with open(p, 'rb') as f: cur = f.read()
+with open('$MNT/.versions/cow.log/1', 'rb') as f: first = f.read()
+with open('$MNT/.versions/cow.log/%d' % len(vs), 'rb') as f: last = f.read()
+print(len(vs), vs[0]['changed'], max(v['changed'] for v in vs[1:]),
+      hashlib.md5(first).digest() == hashlib.md5(base).digest(), last == cur)
+" 2>&1)
+if [ "$RESULT" = "11 2048 1 True True" ]; then
+    pass "10 appends to an 8 MiB file record one block each; versions intact"
+else
+    fail "copy-on-write versions" "$RESULT"
+fi
+
+# ============================================================
+echo "--- Test 85: unchanged content adds no version; holes read as zeros ---"
+RESULT=$(python3 -c "
+import os
+p = '$MNT/cow.log'
+n = int(os.getxattr(p, 'agentfs.version'))
+with open(p, 'r+b') as f:
+    head = f.read(4096)
+    f.seek(0)
+    f.write(head)
+same = int(os.getxattr(p, 'agentfs.version')) == n
+os.truncate(p, 4096)
+with open(p, 'r+b') as f:
+    f.seek(3 * 4096)
+    f.write(b'tail')
+v = int(os.getxattr(p, 'agentfs.version'))
+with open('$MNT/.versions/cow.log/%d' % v, 'rb') as f: snap = f.read()
+print(same, v == n + 1, len(snap), snap[4096:3 * 4096] == bytes(8192), snap[-4:])
+" 2>&1)
+if [ "$RESULT" = "True True 12292 True b'tail'" ]; then
+    pass "rewriting identical bytes keeps the version count; regrown hole is zero"
+else
+    fail "unchanged skip / holes" "$RESULT"
+fi
+rm -f "$MNT/cow.log"
+
+# ============================================================
+echo "--- Test 86: rewrites within the snapshot delay make one version ---"
+RESULT=$(python3 -c "
+import json, os
+p = '$MNT/debounce.txt'
+for i in range(5):
+    with open(p, 'w') as f: f.write('edit %d' % i)
+v = int(os.getxattr(p, 'agentfs.version'))
+with open('$MNT/.versions/debounce.txt/%d' % v) as f: last = f.read()
+st = json.loads(os.getxattr('$MNT', 'agentfs.stats'))['snapshots']
+print(v, last, st['coalesced'] >= 4)
+" 2>&1)
+if [ "$RESULT" = "1 edit 4 True" ]; then
+    pass "5 closes coalesce into one background snapshot of the last content"
+else
+    fail "snapshot coalescing" "$RESULT"
+fi
+rm -f "$MNT/debounce.txt"
+
+# ============================================================
+echo "--- Test 87: CFS_IOC_VERSION_WAIT on a directory runs queued snapshots ---"
+RESULT=$(python3 -c "
+import fcntl, json, os
+for n in ('wait_a.txt', 'wait_b.txt'):
+    with open('$MNT/' + n, 'w') as f: f.write(n)
+fd = os.open('$MNT', os.O_RDONLY | os.O_DIRECTORY)
+fcntl.ioctl(fd, (ord('C') << 8) | 4)
+os.close(fd)
+st = json.loads(os.getxattr('$MNT', 'agentfs.stats'))['snapshots']
+print(st['pending'], os.getxattr('$MNT/wait_a.txt', 'agentfs.version'),
+      os.getxattr('$MNT/wait_b.txt', 'agentfs.version'))
+" 2>&1)
+if [ "$RESULT" = "0 b'1' b'1'" ]; then
+    pass "version wait ioctl leaves no pending snapshots"
+else
+    fail "version wait ioctl" "$RESULT"
+fi
+rm -f "$MNT/wait_a.txt" "$MNT/wait_b.txt"
+
+# ============================================================
+echo "--- Test 88: a directory retention cap thins its files in the background ---"
+RESULT=$(python3 -c "
+import json, os, time
+d = '$MNT/keep3'
+os.mkdir(d)
+os.setxattr(d, 'user.agentfs.retention', b'count=3')
+p = d + '/f.txt'
+for i in range(6):
+    with open(p, 'w') as f: f.write('rev %d' % i)
+    os.getxattr(p, 'agentfs.version')
+for _ in range(100):
+    vs = json.loads(os.getxattr(p, 'agentfs.versions'))
+    if len(vs) == 3: break
+    time.sleep(0.05)
+last = vs[-1]['ver']
+with open('$MNT/.versions/keep3/f.txt/%d' % (last + 1)) as f: newest = f.read()
+st = json.loads(os.getxattr('$MNT', 'agentfs.stats'))['retention']
+print(len(vs), newest, st['thinned'] >= 3, st['reclaimed_bytes'] > 0)
+" 2>&1)
+if [ "$RESULT" = "3 rev 5 True True" ]; then
+    pass "count=3 on the parent keeps the 3 newest versions; reclaimed bytes reported"
+else
+    fail "retention cap" "$RESULT"
+fi
+
+# ============================================================
+echo "--- Test 89: retention xattr is validated; a file overrides its directory ---"
+RESULT=$(python3 -c "
+import errno, json, os, time
+p = '$MNT/keep3/f.txt'
+try:
+    os.setxattr(p, 'user.agentfs.retention', b'count=2h')
+    bad = 'accepted'
+except OSError as e:
+    bad = errno.errorcode[e.errno]
+os.setxattr(p, 'user.agentfs.retention', b'count=5')
+for i in range(4):
+    with open(p, 'w') as f: f.write('more %d' % i)
+    os.getxattr(p, 'agentfs.version')
+time.sleep(0.5)
+print(bad, len(json.loads(os.getxattr(p, 'agentfs.versions'))))
+" 2>&1)
+if [ "$RESULT" = "EINVAL 5" ]; then
+    pass "bad policy rejected with EINVAL; file policy count=5 wins over count=3"
+else
+    fail "retention override" "$RESULT"
+fi
+rm -rf "$MNT/keep3"
+
+# ============================================================
+echo "--- Test 90: CFS_IOC_VERSION_RESTORE rewrites only the edited blocks ---"
+RESULT=$(python3 -c "
+import fcntl, os, struct
+RESTORE = (3 << 30) | (16 << 16) | (ord('C') << 8) | 5
+p = '$MNT/undo.bin'
+base = bytes(range(256)) * 8192
+with open(p, 'wb') as f: f.write(base)
+os.getxattr(p, 'agentfs.version')
+with open(p, 'r+b') as f:
+    f.seek(12345)
+    f.write(b'oops')
+    f.seek(0, 2)
+    f.write(b'appended')
+fd = os.open(p, os.O_RDONLY)
+out = fcntl.ioctl(fd, RESTORE, struct.pack('QQ', 1, 0))
+os.close(fd)
+with open(p, 'rb') as f: now = f.read()
+print(struct.unpack('QQ', out)[1], now == base, os.getxattr(p, 'agentfs.version'))
+" 2>&1)
+if [ "$RESULT" = "1 True b'3'" ]; then
+    pass "2 MiB file restored to version 1 by rewriting 1 block; restore is a new version"
+else
+    fail "version restore" "$RESULT"
+fi
+
+# ============================================================
+echo "--- Test 91: a restore can be undone; bad targets are rejected ---"
+RESULT=$(python3 -c "
+import errno, fcntl, os, struct
+RESTORE = (3 << 30) | (16 << 16) | (ord('C') << 8) | 5
+p = '$MNT/undo.bin'
+fd = os.open(p, os.O_RDONLY)
+fcntl.ioctl(fd, RESTORE, struct.pack('QQ', 2, 0))
+with open(p, 'rb') as f: data = f.read()
+errs = []
+for target, v in ((fd, 99), (os.open('$MNT', os.O_RDONLY | os.O_DIRECTORY), 1)):
+    try:
+        fcntl.ioctl(target, RESTORE, struct.pack('QQ', v, 0))
+        errs.append('ok')
+    except OSError as e:
+        errs.append(errno.errorcode[e.errno])
+os.close(fd)
+print(data[12345:12349], data[-8:], len(data), *errs)
+" 2>&1)
+if [ "$RESULT" = "b'oops' b'appended' 2097160 ENOENT EISDIR" ]; then
+    pass "restoring the pre-restore version brings the edit back; ENOENT / EISDIR"
+else
+    fail "restore undo / errors" "$RESULT"
+fi
+rm -f "$MNT/undo.bin"
+
+# ============================================================
+echo "--- Test 92: .versions/<file>/<a>..<b> shows only the changed lines ---"
+RESULT=$(python3 -c "
+import os
+p = '$MNT/diff.txt'
+with open(p, 'w') as f: f.write(''.join('line %04d\\n' % i for i in range(2000)))
+os.getxattr(p, 'agentfs.version')
+with open(p, 'r+') as f:
+    f.seek(10 * 1500)
+    f.write('LINE 1500')
+os.getxattr(p, 'agentfs.version')
+with open('$MNT/.versions/diff.txt/1..2') as f: print(f.read(), end='')
+" 2>&1)
+EXPECT=$(printf -- '--- 1\n+++ 2\n@@ -15000,10 +15000,10 @@\n-line 1500\n+LINE 1500')
+if [ "$RESULT" = "$EXPECT" ]; then
+    pass "one-line edit in a 20 KB file diffs to a single hunk"
+else
+    fail "version diff" "$RESULT"
+fi
+
+# ============================================================
+echo "--- Test 93: <a>..live diffs against the current content ---"
+RESULT=$(python3 -c "
+import errno, os
+p = '$MNT/diff.txt'
+with open(p, 'a') as f: f.write('tail\\n')
+d = '$MNT/.versions/diff.txt/'
+before = sorted(os.listdir(d))
+with open(d + '2..live') as f: live = f.read()
+kept = sorted(os.listdir(d)) == before
+with open(d + '2..2') as f: same = f.read()
+try:
+    open(d + '1..9')
+    bad = 'ok'
+except OSError as e:
+    bad = errno.errorcode[e.errno]
+print(live.splitlines()[2:], kept, repr(same), bad)
+" 2>&1)
+if [ "$RESULT" = "['@@ -20000,0 +20000,5 @@', '+tail'] True '' ENOENT" ]; then
+    pass "live diff shows the append without a new version; same version is empty; unknown version ENOENT"
+else
+    fail "live version diff" "$RESULT"
+fi
+rm -f "$MNT/diff.txt"
+
+# ============================================================
+echo "--- Test 94: .versions lists versions in numeric order ---"
+RESULT=$(python3 -c "
+import json, os
+p = '$MNT/many.txt'
+for i in range(12):
+    with open(p, 'w') as f: f.write('v%d' % i)
+    os.getxattr(p, 'agentfs.version')
+names = os.listdir('$MNT/.versions/many.txt')
+vers = [v['ver'] for v in json.loads(os.getxattr(p, 'agentfs.versions'))]
+print(names == [str(i) for i in range(1, 13)], vers == list(range(12)))
+" 2>&1)
+if [ "$RESULT" = "True True" ]; then
+    pass "readdir and agentfs.versions give 1..12 in order (10 after 9)"
+else
+    fail "numeric version order" "$RESULT"
+fi
+
+# ============================================================
+echo "--- Test 95: the version index survives a remount ---"
+fusermount3 -u "$MNT" 2>/dev/null
+wait "$KVBFS_PID" 2>/dev/null
+"$KVBFS" "$MNT" -f -s &
+KVBFS_PID=$!
+for _ in $(seq 1 10); do mountpoint -q "$MNT" 2>/dev/null && break; sleep 1; done
+RESULT=$(python3 -c "
+import os
+d = '$MNT/.versions/many.txt/'
+names = os.listdir(d)
+with open(d + '10') as f: v10 = f.read()
+with open('$MNT/many.txt', 'w') as f: f.write('v12')
+print(len(names), v10, os.getxattr('$MNT/many.txt', 'agentfs.version'))
+" 2>&1)
+if [ "$RESULT" = "12 v9 b'13'" ]; then
+    pass "12 versions read back after remount; the next snapshot is 13"
+else
+    fail "version index remount" "$RESULT"
+fi
+rm -f "$MNT/many.txt"
+
+# ============================================================
+echo "--- Test 96: /.snapshots/<name> keeps the tree as it was ---"
+mkdir -p "$MNT/snapdir"
+echo "before" > "$MNT/snapdir/a.txt"
+ln -s snapdir/a.txt "$MNT/snaplink"
+mkdir "$MNT/.snapshots/s1"
+echo "after" > "$MNT/snapdir/a.txt"
+rm -f "$MNT/snaplink"
+touch "$MNT/snapdir/new.txt"
+RESULT="$(cat "$MNT/.snapshots/s1/snapdir/a.txt")|$(ls "$MNT/.snapshots/s1/snapdir")"
+RESULT="$RESULT|$(readlink "$MNT/.snapshots/s1/snaplink")|$(cat "$MNT/snapdir/a.txt")"
+if [ "$RESULT" = "before|a.txt|snapdir/a.txt|after" ]; then
+    pass "snapshot shows old content, old entries and the removed symlink"
+else
+    fail "snapshot content" "$RESULT"
+fi
+
+# ============================================================
+echo "--- Test 97: snapshots are read-only and go away with rmdir ---"
+ERRS=""
+echo x > "$MNT/.snapshots/s1/snapdir/a.txt" 2>/dev/null || ERRS="${ERRS}w"
+touch "$MNT/.snapshots/s1/snapdir/b.txt" 2>/dev/null || ERRS="${ERRS}c"
+rm -f "$MNT/.snapshots/s1/snapdir/a.txt" 2>/dev/null || ERRS="${ERRS}u"
+mkdir "$MNT/.snapshots/s1" 2>/dev/null || ERRS="${ERRS}e"
+rmdir "$MNT/.snapshots/s1"
+if [ "$ERRS" = "wcue" ] && [ ! -e "$MNT/.snapshots/s1" ] && [ -z "$(ls "$MNT/.snapshots")" ]; then
+    pass "writes, creates, unlinks and a duplicate name fail; rmdir removes it"
+else
+    fail "snapshot read-only/rmdir" "errs=$ERRS ls=$(ls "$MNT/.snapshots" 2>&1)"
+fi
+rm -rf "$MNT/snapdir"
+
+# ============================================================
+echo "--- Test 98: listing /.versions allocates no virtual nodes ---"
+mkdir -p "$MNT/vwide"
+for i in $(seq 1 200); do echo "$i" > "$MNT/vwide/f$i"; done
+RESULT=$(python3 -c "
+import json, os
+def nodes(): return json.loads(os.getxattr('$MNT', 'agentfs.stats'))['vtree']['nodes']
+os.stat('$MNT/.versions/vwide')
+before = nodes()
+for _ in range(3): names = os.listdir('$MNT/.versions/vwide')
+grown = nodes() - before
+d = '$MNT/.versions/vwide/f7'
+same = all(e.inode() == os.stat(e.path).st_ino
+           for e in list(os.scandir('$MNT/.versions/vwide'))[:20] + list(os.scandir(d)))
+print(len(names), grown, same)
+" 2>&1)
+if [ "$RESULT" = "200 0 True" ]; then
+    pass "200 names listed three times without a node per name; d_ino matches st_ino"
+else
+    fail "vtree readdir allocation" "$RESULT"
+fi
+rm -rf "$MNT/vwide"
+
+# ============================================================
+echo "--- Test 99: long names with a common prefix keep their own versions ---"
+LONG=$(printf 'n%.0s' $(seq 1 120))
+echo "first" > "$MNT/${LONG}A"
+echo "second" > "$MNT/${LONG}B"
+RESULT="$(cat "$MNT/.versions/${LONG}A/1")|$(cat "$MNT/.versions/${LONG}B/1")"
+if [ "$RESULT" = "first|second" ]; then
+    pass "names sharing a 120-char prefix resolve to different files"
+else
+    fail "vtree long names" "$RESULT"
+fi
+rm -f "$MNT/${LONG}A" "$MNT/${LONG}B"
+
+# ============================================================
+echo "--- Test 100: a multi-block version reads back whole and at offsets ---"
+RESULT=$(python3 -c "
+import os
+p = '$MNT/vbig.bin'
+old = os.urandom(300000)
+with open(p, 'wb') as f: f.write(old)
+os.getxattr(p, 'agentfs.version')
+with open(p, 'r+b') as f:
+    f.seek(70000)
+    f.write(b'x' * 9000)
+v = '$MNT/.versions/vbig.bin/1'
+with open(v, 'rb') as f: a = f.read()
+with open(v, 'rb') as f:
+    f.seek(4095)
+    b = f.read(20000)
+with open(v, 'rb') as f: c = f.read()
+print(a == old, b == old[4095:24095], c == old)
+" 2>&1)
+if [ "$RESULT" = "True True True" ]; then
+    pass "300 KB version matches when read whole, at an offset and again"
+else
+    fail "version range read" "$RESULT"
+fi
+rm -f "$MNT/vbig.bin"
+
+# ============================================================
+echo "--- Test 101: a recreated file shows its own versions ---"
+echo "gone" > "$MNT/vre.txt"
+cat "$MNT/.versions/vre.txt/1" > /dev/null
+rm -f "$MNT/vre.txt"
+echo "fresh" > "$MNT/vre.txt"
+RESULT="$(cat "$MNT/.versions/vre.txt/1")|$(ls "$MNT/.versions/vre.txt" | wc -l)"
+if [ "$RESULT" = "fresh|1" ]; then
+    pass "the same name after rm resolves to the new file's history"
+else
+    fail "recreated file versions" "$RESULT"
+fi
+rm -f "$MNT/vre.txt"
+
+# ============================================================
+echo "--- Test 102: identical blocks across files are stored once ---"
+DEDUP='import json, os, sys, time
+for _ in range(100):
+    d = json.loads(os.getxattr("'"$MNT"'", "agentfs.stats"))["dedup"]
+    if d["passes"] > 0: break
+    time.sleep(0.1)
+print(d["passes"], d["stored_bytes"], d["referenced_bytes"])'
+fusermount3 -u "$MNT" 2>/dev/null
+wait "$KVBFS_PID" 2>/dev/null
+"$KVBFS" "$MNT" -f -s &
+KVBFS_PID=$!
+for _ in $(seq 1 10); do mountpoint -q "$MNT" 2>/dev/null && break; sleep 1; done
+read -r _ STORED0 REFD0 <<< "$(python3 -c "$DEDUP")"
+python3 -c "
+import os
+data = os.urandom(65536)
+for i in range(10):
+    p = '$MNT/dup%d.bin' % i
+    with open(p, 'wb') as f: f.write(data)
+    os.getxattr(p, 'agentfs.version')
+"
+fusermount3 -u "$MNT" 2>/dev/null
+wait "$KVBFS_PID" 2>/dev/null
+"$KVBFS" "$MNT" -f -s &
+KVBFS_PID=$!
+for _ in $(seq 1 10); do mountpoint -q "$MNT" 2>/dev/null && break; sleep 1; done
+read -r PASSES STORED1 REFD1 <<< "$(python3 -c "$DEDUP")"
+if [ "${PASSES:-0}" -gt 0 ] && [ $((REFD1 - REFD0)) -ge 655360 ] && \
+   [ $((STORED1 - STORED0)) -le 69632 ]; then
+    pass "10 copies of 64 KB add $((STORED1 - STORED0)) stored bytes"
+else
+    fail "version dedup" "passes=$PASSES stored $STORED0->$STORED1 referenced $REFD0->$REFD1"
+fi
+
+# ============================================================
+echo "--- Test 103: removing one copy keeps the others' versions ---"
+rm -f "$MNT"/dup[1-9].bin
+sleep 1
+RESULT=$(python3 -c "
+with open('$MNT/dup0.bin', 'rb') as f: cur = f.read()
+with open('$MNT/.versions/dup0.bin/1', 'rb') as f: old = f.read()
+print(len(old), old == cur)
+" 2>&1)
+if [ "$RESULT" = "65536 True" ]; then
+    pass "the remaining copy's version reads back after 9 copies are removed"
+else
+    fail "dedup after unlink" "$RESULT"
+fi
+rm -f "$MNT/dup0.bin"
+
+# ============================================================
+echo "--- Test 104: readdir keeps going when listed entries are removed ---"
+mkdir -p "$MNT/rmdir_iter"
+for i in $(seq 1 2000); do : > "$MNT/rmdir_iter/entry_with_a_longer_name_$i"; done
+RESULT=$(python3 -c "
+import os
+seen = []
+with os.scandir('$MNT/rmdir_iter') as it:
+    for i, e in enumerate(it):
+        seen.append(e.name)
+        if i == 100:
+            for n in seen:
+                os.unlink('$MNT/rmdir_iter/' + n)
+print('ok' if len(seen) == 2000 and len(set(seen)) == 2000 else 'bad %d/%d' % (len(seen), len(set(seen))))
+" 2>&1)
+if [ "$RESULT" = "ok" ]; then
+    pass "every entry listed once after unlinking the current one"
+else
+    fail "readdir with unlinks" "$RESULT"
+fi
+rm -rf "$MNT/rmdir_iter" 2>/dev/null
+
 # ============================================================
 echo ""
 echo "========================================="